@@ -0,0 +1,87 @@
+/*=============================================================================
+	CAChannelMatrixBenchmarks.cpp
+
+	The cost of CAChannelMatrix per kernel, for (isa, shape): a dense 64x64
+	mix, a 64x64 permutation that only routes, and a 128 to 8 downmix that
+	sums sixteen inputs into each output, in 512-frame blocks. per_frame is
+	the time per frame of all the outputs together. Kernels the CPU lacks
+	are skipped.
+=============================================================================*/
+
+#include "CAChannelMatrix.h"
+
+#include <benchmark/benchmark.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace {
+
+const UInt32 kBlockFrames = 512;
+
+enum Shape { kShape_Dense, kShape_Routing, kShape_Downmix };
+
+void BM_ChannelMatrix(benchmark::State &state)
+{
+	const CAChannelMatrixKernels *kernels = CAGetChannelMatrixKernels(CASampleConversionISA(state.range(0)));
+	if (!kernels) {
+		state.SkipWithError("kernel not available");
+		return;
+	}
+	const Shape shape = Shape(state.range(1));
+	const UInt32 nInputs = (shape == kShape_Downmix) ? 128 : 64;
+	const UInt32 nOutputs = (shape == kShape_Downmix) ? 8 : 64;
+	state.SetLabel(kernels->mName);
+
+	CAChannelMatrix matrix;
+	matrix.Initialize(nInputs, nOutputs, kernels);
+	matrix.Clear();
+	for (UInt32 m = 0; m < nOutputs; ++m) {
+		for (UInt32 n = 0; n < nInputs; ++n) {
+			if (shape == kShape_Dense)
+				matrix.SetGain(m, n, Float32(rand()) / RAND_MAX - 0.5f);
+			else if (shape == kShape_Downmix && n % nOutputs == m)
+				matrix.SetGain(m, n, 1.0f / (nInputs / nOutputs));
+		}
+		if (shape == kShape_Routing)
+			matrix.SetGain(m, (m * 7 + 3) % nInputs, 1.0f);
+	}
+
+	std::vector<Float32> inStorage(nInputs * kBlockFrames), outStorage(nOutputs * kBlockFrames);
+	for (size_t i = 0; i < inStorage.size(); ++i)
+		inStorage[i] = Float32(rand()) / RAND_MAX - 0.5f;
+	AudioBufferList *in = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nInputs);
+	AudioBufferList *out = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nOutputs);
+	in->mNumberBuffers = nInputs;
+	out->mNumberBuffers = nOutputs;
+	for (UInt32 n = 0; n < nInputs; ++n) {
+		in->mBuffers[n].mNumberChannels = 1;
+		in->mBuffers[n].mData = &inStorage[n * kBlockFrames];
+	}
+	for (UInt32 m = 0; m < nOutputs; ++m) {
+		out->mBuffers[m].mNumberChannels = 1;
+		out->mBuffers[m].mData = &outStorage[m * kBlockFrames];
+	}
+
+	for (auto _ : state) {
+		matrix.Process(in, out, kBlockFrames);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * kBlockFrames);
+	state.counters["per_frame"] = benchmark::Counter(kBlockFrames, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+
+	free(in);
+	free(out);
+}
+
+void ChannelMatrixArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "isa", "shape" });
+	b->ArgsProduct({
+		{ kCASampleConversionISA_Scalar, kCASampleConversionISA_SSE2, kCASampleConversionISA_AVX2, kCASampleConversionISA_NEON },
+		{ kShape_Dense, kShape_Routing, kShape_Downmix } });
+}
+
+} // namespace
+
+BENCHMARK(BM_ChannelMatrix)->Apply(ChannelMatrixArgs);
@@ -0,0 +1,153 @@
+/*=============================================================================
+	CADSPChainBenchmarks.cpp
+
+	The cost of each CADSPChain processor, and of all four in a chain, on
+	256-frame blocks of 2, 8 and 64 channels: per_frame_channel is the time
+	per frame of each channel. Each block is copied in from the same noise
+	first, so that the limiter has peaks to take down every time; the none
+	row is that copy alone. The equalizer has four bands and the best
+	kernel, the gain a steady 0.5, the limiter a threshold under the peaks,
+	and the delay 10 ms with feedback.
+
+	BM_Equalizer times the biquad kernels themselves, for (isa, bands,
+	channels), skipping those the CPU lacks.
+=============================================================================*/
+
+#include "CADSPProcessors.h"
+
+#include <benchmark/benchmark.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+const UInt32 kBlockFrames = 256;
+const Float64 kSampleRate = 48000.0;
+
+enum Processor { kProcessor_None, kProcessor_Equalizer, kProcessor_Gain, kProcessor_Limiter, kProcessor_Delay, kProcessor_Chain };
+
+const char *const kProcessorNames[] = { "none", "equalizer", "gain", "limiter", "delay", "chain" };
+
+class Channels {
+public:
+	Channels(UInt32 nChannels, UInt32 nFrames) : mNoise(nChannels * nFrames), mStorage(nChannels * nFrames)
+	{
+		for (size_t i = 0; i < mNoise.size(); ++i)
+			mNoise[i] = Float32(rand()) / RAND_MAX - 0.5f;
+		mList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nChannels);
+		mList->mNumberBuffers = nChannels;
+		for (UInt32 ch = 0; ch < nChannels; ++ch) {
+			mList->mBuffers[ch].mNumberChannels = 1;
+			mList->mBuffers[ch].mDataByteSize = nFrames * sizeof(Float32);
+			mList->mBuffers[ch].mData = &mStorage[ch * nFrames];
+		}
+	}
+	~Channels() { free(mList); }
+
+	AudioBufferList *	List() { return mList; }
+	void				Refill() { memcpy(mStorage.data(), mNoise.data(), mStorage.size() * sizeof(Float32)); }
+
+private:
+	std::vector<Float32>	mNoise;
+	std::vector<Float32>	mStorage;
+	AudioBufferList *		mList;
+};
+
+CADSPEqualizer *NewEqualizer(UInt32 nBands, const CABiquadKernels *kernels = NULL)
+{
+	static const CADSPEqualizerBand kBands[] = {
+		{ kCADSPFilter_HighPass, 30, 0.707, 0 },
+		{ kCADSPFilter_LowShelf, 120, 0.707, 3 },
+		{ kCADSPFilter_Peaking, 1000, 1.5, -4 },
+		{ kCADSPFilter_HighShelf, 9000, 0.707, 2 },
+		{ kCADSPFilter_Peaking, 250, 2, 2 },
+		{ kCADSPFilter_Peaking, 3000, 3, -2 },
+		{ kCADSPFilter_Peaking, 6000, 4, 1 },
+		{ kCADSPFilter_LowPass, 18000, 0.707, 0 },
+	};
+	CADSPEqualizer *eq = new CADSPEqualizer(kernels);
+	eq->SetBands(kBands, nBands);
+	return eq;
+}
+
+void BM_Processor(benchmark::State &state)
+{
+	const Processor processor = Processor(state.range(0));
+	const UInt32 nChannels = UInt32(state.range(1));
+	state.SetLabel(kProcessorNames[processor]);
+
+	CADSPChain chain;
+	if (processor == kProcessor_Equalizer || processor == kProcessor_Chain)
+		chain.Add(NewEqualizer(4));
+	if (processor == kProcessor_Gain || processor == kProcessor_Chain)
+		chain.Add(new CADSPGain(0.5f));
+	if (processor == kProcessor_Limiter || processor == kProcessor_Chain)
+		chain.Add(new CADSPLimiter(0.2f, 0.05));
+	if (processor == kProcessor_Delay || processor == kProcessor_Chain) {
+		CADSPDelay *delay = new CADSPDelay(0.1, 0.01);
+		delay->SetFeedback(0.3f);
+		delay->SetMix(0.5f);
+		chain.Add(delay);
+	}
+	chain.Prepare(nChannels, kSampleRate);
+	Channels channels(nChannels, kBlockFrames);
+
+	for (auto _ : state) {
+		channels.Refill();
+		chain.Process(channels.List(), kBlockFrames);
+		benchmark::ClobberMemory();
+	}
+	state.counters["per_frame_channel"] = benchmark::Counter(kBlockFrames * nChannels,
+															 benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+void ProcessorArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "processor", "channels" });
+	b->ArgsProduct({
+		{ kProcessor_None, kProcessor_Equalizer, kProcessor_Gain, kProcessor_Limiter, kProcessor_Delay, kProcessor_Chain },
+		{ 2, 8, 64 } });
+}
+
+// The kernel alone, without the chain around it, on a block that's filtered over and over: the
+// filters are stable and the denormals are flushed, so it stays noise.
+void BM_Equalizer(benchmark::State &state)
+{
+	const CABiquadKernels *kernels = CAGetBiquadKernels(CASampleConversionISA(state.range(0)));
+	if (!kernels) {
+		state.SkipWithError("kernel not available");
+		return;
+	}
+	const UInt32 nBands = UInt32(state.range(1));
+	const UInt32 nChannels = UInt32(state.range(2));
+	state.SetLabel(kernels->mName);
+
+	CADSPChain chain;
+	chain.Add(NewEqualizer(nBands, kernels));
+	chain.Prepare(nChannels, kSampleRate);
+	Channels channels(nChannels, kBlockFrames);
+	channels.Refill();
+
+	for (auto _ : state) {
+		chain.Process(channels.List(), kBlockFrames);
+		benchmark::ClobberMemory();
+	}
+	state.counters["per_frame_channel"] = benchmark::Counter(kBlockFrames * nChannels,
+															 benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+void EqualizerArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "isa", "bands", "channels" });
+	b->ArgsProduct({
+		{ kCASampleConversionISA_Scalar, kCASampleConversionISA_SSE2, kCASampleConversionISA_AVX2, kCASampleConversionISA_NEON },
+		{ 1, 4, 8 },
+		{ 2, 8, 64 } });
+}
+
+} // namespace
+
+BENCHMARK(BM_Processor)->Apply(ProcessorArgs);
+BENCHMARK(BM_Equalizer)->Apply(EqualizerArgs);
@@ -0,0 +1,43 @@
+/*=============================================================================
+	CAPlayThroughMetricsBenchmarks.cpp
+
+	What CAPlayThroughMetrics adds to an output callback: a CallbackTimer,
+	a CountFetch and a SetOutputState, as CAPlayThroughEngine::OutputProc
+	does them, with a reader thread taking snapshots or not.
+=============================================================================*/
+
+#include "CAPlayThroughMetrics.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+void BM_OutputCallback(benchmark::State &state)
+{
+	static CAPlayThroughMetrics metrics;
+	Float64 fill = 0;
+	for (auto _ : state) {
+		if (state.thread_index() == 0) {
+			CAPlayThroughMetrics::CallbackTimer timer(metrics, CAPlayThroughMetrics::kOutput);
+			metrics.CountFetch(kCARingBufferError_OK);
+			metrics.SetOutputState(fill, 1.0, 0.5, 1024);
+			fill += 1;
+		} else {
+			CAPlayThroughMetrics::Snapshot snapshot;
+			metrics.GetSnapshot(snapshot);
+			benchmark::DoNotOptimize(snapshot);
+		}
+	}
+}
+
+// the clock reads on their own, for comparison
+void BM_Now(benchmark::State &state)
+{
+	for (auto _ : state)
+		benchmark::DoNotOptimize(CAPlayThroughMetrics::Now());
+}
+
+} // namespace
+
+BENCHMARK(BM_OutputCallback)->Threads(1)->Threads(2);
+BENCHMARK(BM_Now);
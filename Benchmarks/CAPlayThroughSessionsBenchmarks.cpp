@@ -0,0 +1,64 @@
+/*=============================================================================
+	CAPlayThroughSessionsBenchmarks.cpp
+
+	What a play-through session costs as the routes in a process grow from
+	1 to 256: sessions between 16 simulated input and 16 output devices,
+	stereo at 48 kHz with 256-frame buffers and a little drift, each run
+	for 100 ms of simulated time in turn, offline, through the varispeed
+	stand-in or the engine's resampler. cpu_per_session is the CPU time one
+	session takes per second of audio, so a flat line is linear scaling;
+	where it rises, the sessions' working sets have outgrown the caches.
+=============================================================================*/
+
+#include "CASimulatedSessions.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+const UInt32 kDevices = 16;
+const Float64 kSliceSeconds = 0.1;
+
+void BM_Sessions(benchmark::State &state)
+{
+	const UInt32 nSessions = UInt32(state.range(0));
+	const bool varispeed = state.range(1) != 0;
+
+	CASimulatedSessionFactory factory;
+	factory.SetVarispeed(varispeed);
+	for (UInt32 i = 0; i < kDevices; ++i) {
+		CASimulatedDeviceConfig config = CASimulatedBackend::DefaultDeviceConfig();
+		config.mBufferSizeFrames = 256;
+		config.mDriftPPM = (i % 2) ? 100 : -100;
+		factory.AddDevice(1 + i, config);
+		factory.AddDevice(101 + i, config);
+	}
+
+	// every input to every output, spread so that the devices are shared as evenly as they can be
+	CAPlayThroughSessionManager manager(factory);
+	for (UInt32 i = 0; i < nSessions; ++i) {
+		CAPlayThroughRoute route = { 1 + i % kDevices, 101 + (i + i / kDevices) % kDevices };
+		if (manager.AddRoute(route)) {
+			state.SkipWithError("couldn't add a route");
+			return;
+		}
+	}
+	// past the ring filling up and the drift controller settling
+	manager.ForEachSession([](const CAPlayThroughRoute &, CAPlayThroughSessionManager::Session &session) {
+		static_cast<CASimulatedSessionFactory::Session &>(session).Run(1.0);
+	});
+
+	for (auto _ : state) {
+		manager.ForEachSession([](const CAPlayThroughRoute &, CAPlayThroughSessionManager::Session &session) {
+			static_cast<CASimulatedSessionFactory::Session &>(session).Run(kSliceSeconds);
+		});
+	}
+	state.counters["open_devices"] = factory.GetOpenDevices();
+	state.counters["cpu_per_session"] = benchmark::Counter(nSessions * kSliceSeconds,
+														   benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+} // namespace
+
+BENCHMARK(BM_Sessions)->ArgNames({ "sessions", "varispeed" })->ArgsProduct({ benchmark::CreateRange(1, 256, 2), { 1, 0 } })
+	->Unit(benchmark::kMillisecond);
@@ -0,0 +1,113 @@
+/*=============================================================================
+	CARealtimeWorkerPoolBenchmarks.cpp
+
+	One output callback's heavy work, a dense 64x64 channel matrix and a
+	64-channel sinc resample of a 256-frame buffer, on a CARealtimeWorkerPool
+	with 0 to 7 workers. per_frame is the wall time per frame; critical_path
+	is the longest any one participant spent on its tasks, in nanoseconds per
+	block, and the difference between the two is what waking, stealing and
+	joining cost. Against a buffer's period, 5.3 ms at 48 kHz, misses counts
+	the blocks that overran it. Without workers the work runs inline, as it
+	does without a pool, and there are no blocks to report.
+=============================================================================*/
+
+#include "CAChannelMatrix.h"
+#include "CARealtimeWorkerPool.h"
+#include "CAResampler.h"
+
+#include <benchmark/benchmark.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace {
+
+const UInt32 kChannels = 64;
+const UInt32 kBlockFrames = 256;
+const Float64 kSampleRate = 48000.0;
+
+class Channels {
+public:
+	Channels(UInt32 nChannels, UInt32 nFrames) : mStorage(nChannels * nFrames)
+	{
+		for (size_t i = 0; i < mStorage.size(); ++i)
+			mStorage[i] = Float32(rand()) / RAND_MAX - 0.5f;
+		mList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nChannels);
+		mList->mNumberBuffers = nChannels;
+		for (UInt32 ch = 0; ch < nChannels; ++ch) {
+			mList->mBuffers[ch].mNumberChannels = 1;
+			mList->mBuffers[ch].mDataByteSize = nFrames * sizeof(Float32);
+			mList->mBuffers[ch].mData = &mStorage[ch * nFrames];
+		}
+	}
+	~Channels() { free(mList); }
+
+	AudioBufferList *	List() { return mList; }
+
+private:
+	std::vector<Float32>	mStorage;
+	AudioBufferList *		mList;
+};
+
+void Report(benchmark::State &state, CARealtimeWorkerPool &pool, UInt64 criticalPath, UInt64 blocks)
+{
+	CARealtimeWorkerPoolStats stats;
+	pool.GetStats(stats);
+	state.counters["per_frame"] = benchmark::Counter(kBlockFrames, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+	state.counters["critical_path"] = blocks ? Float64(criticalPath) / blocks : 0.0;
+	state.counters["misses"] = Float64(stats.mDeadlineMisses);
+	state.SetLabel(pool.GetConcurrency() == 1 ? "inline" : stats.mRealtime ? "real-time" : "ordinary priority");
+}
+
+void BM_PooledMatrix(benchmark::State &state)
+{
+	CARealtimeWorkerPool pool;
+	pool.Initialize(UInt32(state.range(0)), kBlockFrames / kSampleRate);
+	CAChannelMatrix matrix;
+	matrix.Initialize(kChannels, kChannels);
+	for (UInt32 m = 0; m < kChannels; ++m)
+		for (UInt32 n = 0; n < kChannels; ++n)
+			matrix.SetGain(m, n, Float32(rand()) / RAND_MAX - 0.5f);
+	Channels in(kChannels, kBlockFrames), out(kChannels, kBlockFrames);
+
+	UInt64 criticalPath = 0, blocks = 0;
+	for (auto _ : state) {
+		matrix.Process(in.List(), out.List(), kBlockFrames, false, &pool);
+		benchmark::ClobberMemory();
+		CARealtimeWorkerPoolBlock block;
+		if (pool.GetLastBlock(block)) {
+			criticalPath += block.mCriticalPathNanos;
+			++blocks;
+		}
+	}
+	Report(state, pool, criticalPath, blocks);
+}
+
+void BM_PooledResampler(benchmark::State &state)
+{
+	CARealtimeWorkerPool pool;
+	pool.Initialize(UInt32(state.range(0)), kBlockFrames / kSampleRate);
+	CAResampler resampler;
+	resampler.Initialize(kChannels, kBlockFrames, 1.01, kCAResamplerQuality_High);
+	const Float64 ratio = 1.0001;
+	const UInt32 nInput = resampler.GetMaxInputFrames();
+	Channels in(kChannels, nInput), out(kChannels, kBlockFrames);
+
+	UInt64 criticalPath = 0, blocks = 0;
+	for (auto _ : state) {
+		UInt32 needed = resampler.InputFramesNeeded(kBlockFrames, ratio);
+		resampler.Process(in.List(), needed, out.List(), kBlockFrames, ratio, &pool);
+		benchmark::ClobberMemory();
+		CARealtimeWorkerPoolBlock block;
+		if (pool.GetLastBlock(block)) {
+			criticalPath += block.mCriticalPathNanos;
+			++blocks;
+		}
+	}
+	Report(state, pool, criticalPath, blocks);
+}
+
+} // namespace
+
+BENCHMARK(BM_PooledMatrix)->ArgName("workers")->Arg(0)->Arg(1)->Arg(3)->Arg(7)->UseRealTime();
+BENCHMARK(BM_PooledResampler)->ArgName("workers")->Arg(0)->Arg(1)->Arg(3)->Arg(7)->UseRealTime();
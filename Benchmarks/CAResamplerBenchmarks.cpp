@@ -0,0 +1,76 @@
+/*=============================================================================
+	CAResamplerBenchmarks.cpp
+
+	The cost of CAResampler per quality and kernel, for (isa, quality,
+	channels): 512-frame blocks at 44.1 to 48 kHz with the ratio moving a
+	little on every block, as the drift controller moves it. per_frame is the
+	time per output frame of all the channels together. Kernels the CPU lacks are
+	skipped.
+=============================================================================*/
+
+#include "CAResampler.h"
+
+#include <benchmark/benchmark.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace {
+
+const UInt32 kBlockFrames = 512;
+
+void BM_Resample(benchmark::State &state)
+{
+	const CAResamplerKernels *kernels = CAGetResamplerKernels(CASampleConversionISA(state.range(0)));
+	if (!kernels) {
+		state.SkipWithError("kernel not available");
+		return;
+	}
+	const CAResamplerQuality quality = CAResamplerQuality(state.range(1));
+	const int nChannels = int(state.range(2));
+	state.SetLabel(kernels->mName);
+
+	const Float64 kRatio = 44100.0 / 48000.0;
+	CAResampler resampler;
+	resampler.Initialize(nChannels, kBlockFrames, kRatio * 1.005, quality, kernels);
+
+	const UInt32 nInputFrames = resampler.GetMaxInputFrames();
+	std::vector<Float32> inStorage(nChannels * nInputFrames), outStorage(nChannels * kBlockFrames);
+	for (size_t i = 0; i < inStorage.size(); ++i)
+		inStorage[i] = Float32(rand()) / RAND_MAX - 0.5f;
+	size_t listSize = offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nChannels;
+	AudioBufferList *in = (AudioBufferList *)calloc(1, listSize);
+	AudioBufferList *out = (AudioBufferList *)calloc(1, listSize);
+	in->mNumberBuffers = out->mNumberBuffers = nChannels;
+	for (int ch = 0; ch < nChannels; ++ch) {
+		in->mBuffers[ch].mNumberChannels = out->mBuffers[ch].mNumberChannels = 1;
+		in->mBuffers[ch].mData = &inStorage[ch * nInputFrames];
+		out->mBuffers[ch].mData = &outStorage[ch * kBlockFrames];
+	}
+
+	UInt32 block = 0;
+	for (auto _ : state) {
+		Float64 ratio = kRatio * (1.0 + 0.001 * ((++block & 1) ? 1 : -1));
+		UInt32 nIn = resampler.InputFramesNeeded(kBlockFrames, ratio);
+		resampler.Process(in, nIn, out, kBlockFrames, ratio);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * kBlockFrames);
+	state.counters["per_frame"] = benchmark::Counter(kBlockFrames, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+
+	free(in);
+	free(out);
+}
+
+void ResamplerArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "isa", "quality", "channels" });
+	b->ArgsProduct({
+		{ kCASampleConversionISA_Scalar, kCASampleConversionISA_SSE2, kCASampleConversionISA_AVX2, kCASampleConversionISA_NEON },
+		{ kCAResamplerQuality_Cubic, kCAResamplerQuality_Low, kCAResamplerQuality_Medium, kCAResamplerQuality_High },
+		{ 1, 2, 8 } });
+}
+
+} // namespace
+
+BENCHMARK(BM_Resample)->Apply(ResamplerArgs);
@@ -0,0 +1,252 @@
+/*=============================================================================
+	CARingBufferBenchmarks.cpp
+
+	Per-frame cost of CARingBuffer::Store and Fetch.
+
+	Every benchmark takes (channels, frames per call, wrap, interleaved,
+	mirrored). The ring is sized to exactly one block so that the phase of the
+	sample times alone decides whether StoreABL/FetchABL split at the end of
+	the buffer: with wrap == 0 every call is a single contiguous copy per
+	buffer, with wrap == 1 every call is split in two. The difference between
+	the two is the cost of the split path. interleaved == 1 allocates the ring
+	with CARingBuffer::kInterleaved and moves a single interleaved buffer.
+	
+	mirrored == 1 allocates with CARingBuffer::kAllocateMirrored, which never
+	splits. Its capacity is rounded up to whole pages, so at small block sizes
+	it is bigger than one block: wrap == 1 then still makes every Fetch
+	straddle the end of the ring, but only the first Store of a run. BM_Fetch
+	is the like-for-like comparison with the split path.
+	
+	BM_StoreFetchPlacement runs a large ring (20 blocks, as CAPlayThrough
+	sizes it) with each of the memory placement options and counts the page
+	faults taken by Allocate and by the timed loop. The loop should take none.
+	
+	BM_MixSources takes (sources, channels, frames, fused) and sums that many
+	rings, each with its own gains, into one bus, each fetch split at the
+	wrap. fused == 1 uses FetchMix; fused == 0 is Fetch into a scratch list
+	and a second pass mixing it into the bus, with the same kernels.
+=============================================================================*/
+
+#include "CARingBuffer.h"
+
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <vector>
+
+namespace {
+
+// A Float32 AudioBufferList that owns its memory.
+class BenchABL {
+public:
+	BenchABL(int nChannels, UInt32 nFrames, CARingBuffer::Layout layout) : mStorage(nChannels * nFrames, 0.25f)
+	{
+		int nBuffers = (layout == CARingBuffer::kInterleaved) ? 1 : nChannels;
+		mList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nBuffers);
+		mList->mNumberBuffers = nBuffers;
+		for (int i = 0; i < nBuffers; ++i) {
+			mList->mBuffers[i].mNumberChannels = nChannels / nBuffers;
+			mList->mBuffers[i].mDataByteSize = nFrames * sizeof(Float32) * mList->mBuffers[i].mNumberChannels;
+			mList->mBuffers[i].mData = &mStorage[i * nFrames];
+		}
+	}
+	~BenchABL() { free(mList); }
+
+	AudioBufferList *	List() { return mList; }
+
+private:
+	std::vector<Float32>	mStorage;
+	AudioBufferList *		mList;
+};
+
+void SetFrameCounters(benchmark::State &state, int nChannels, UInt32 nFrames)
+{
+	state.SetItemsProcessed(state.iterations() * nFrames);
+	state.SetBytesProcessed(state.iterations() * nFrames * nChannels * sizeof(Float32));
+	state.counters["ns/frame"] = benchmark::Counter(nFrames * 1e-9, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+void BM_Store(benchmark::State &state)
+{
+	const int nChannels = state.range(0);
+	const UInt32 nFrames = state.range(1);
+	const bool wrap = state.range(2);
+	const CARingBuffer::Layout layout = state.range(3) ? CARingBuffer::kInterleaved : CARingBuffer::kDeinterleaved;
+	const UInt32 options = state.range(4) ? CARingBuffer::kAllocateMirrored : 0;
+
+	CARingBuffer ring;
+	ring.Allocate(nChannels, sizeof(Float32), nFrames, layout, options);
+	if (options && !ring.IsMirrored()) {
+		state.SkipWithError("mirrored allocation is not available");
+		return;
+	}
+	BenchABL src(nChannels, nFrames, layout);
+
+	CARingBuffer::SampleTime t = wrap ? ring.GetCapacityFrames() - nFrames / 2 : 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(ring.Store(src.List(), nFrames, t));
+		t += nFrames;
+	}
+	SetFrameCounters(state, nChannels, nFrames);
+}
+
+void BM_Fetch(benchmark::State &state)
+{
+	const int nChannels = state.range(0);
+	const UInt32 nFrames = state.range(1);
+	const bool wrap = state.range(2);
+	const CARingBuffer::Layout layout = state.range(3) ? CARingBuffer::kInterleaved : CARingBuffer::kDeinterleaved;
+	const UInt32 options = state.range(4) ? CARingBuffer::kAllocateMirrored : 0;
+
+	CARingBuffer ring;
+	ring.Allocate(nChannels, sizeof(Float32), nFrames, layout, options);
+	if (options && !ring.IsMirrored()) {
+		state.SkipWithError("mirrored allocation is not available");
+		return;
+	}
+	BenchABL src(nChannels, nFrames, layout), dest(nChannels, nFrames, layout);
+
+	CARingBuffer::SampleTime t = wrap ? ring.GetCapacityFrames() - nFrames / 2 : 0;
+	ring.Store(src.List(), nFrames, t);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(ring.Fetch(dest.List(), nFrames, t));
+		benchmark::ClobberMemory();
+	}
+	SetFrameCounters(state, nChannels, nFrames);
+}
+
+// one input callback followed by one output callback, as in CAPlayThrough
+void BM_StoreFetch(benchmark::State &state)
+{
+	const int nChannels = state.range(0);
+	const UInt32 nFrames = state.range(1);
+	const bool wrap = state.range(2);
+	const CARingBuffer::Layout layout = state.range(3) ? CARingBuffer::kInterleaved : CARingBuffer::kDeinterleaved;
+	const UInt32 options = state.range(4) ? CARingBuffer::kAllocateMirrored : 0;
+
+	CARingBuffer ring;
+	ring.Allocate(nChannels, sizeof(Float32), nFrames, layout, options);
+	if (options && !ring.IsMirrored()) {
+		state.SkipWithError("mirrored allocation is not available");
+		return;
+	}
+	BenchABL src(nChannels, nFrames, layout), dest(nChannels, nFrames, layout);
+
+	CARingBuffer::SampleTime t = wrap ? ring.GetCapacityFrames() - nFrames / 2 : 0;
+	for (auto _ : state) {
+		ring.Store(src.List(), nFrames, t);
+		benchmark::DoNotOptimize(ring.Fetch(dest.List(), nFrames, t));
+		benchmark::ClobberMemory();
+		t += nFrames;
+	}
+	SetFrameCounters(state, nChannels, nFrames);
+}
+
+// page faults taken so far by the calling thread (by the process where threads aren't counted separately)
+long PageFaults()
+{
+	struct rusage usage;
+#if defined(RUSAGE_THREAD)
+	getrusage(RUSAGE_THREAD, &usage);
+#else
+	getrusage(RUSAGE_SELF, &usage);
+#endif
+	return usage.ru_minflt + usage.ru_majflt;
+}
+
+void BM_StoreFetchPlacement(benchmark::State &state)
+{
+	const int nChannels = state.range(0);
+	const UInt32 nFrames = state.range(1);
+	const UInt32 options = state.range(2);
+	const int numaNode = state.range(3);
+
+	BenchABL src(nChannels, nFrames, CARingBuffer::kDeinterleaved), dest(nChannels, nFrames, CARingBuffer::kDeinterleaved);
+
+	CARingBuffer ring;
+	long faults = PageFaults();
+	ring.Allocate(nChannels, sizeof(Float32), nFrames * 20, CARingBuffer::kDeinterleaved, options, numaNode);
+	long allocateFaults = PageFaults() - faults;
+
+	CARingBuffer::SampleTime t = 0;
+	faults = PageFaults();
+	for (auto _ : state) {
+		ring.Store(src.List(), nFrames, t);
+		benchmark::DoNotOptimize(ring.Fetch(dest.List(), nFrames, t));
+		benchmark::ClobberMemory();
+		t += nFrames;
+	}
+	long loopFaults = PageFaults() - faults;
+
+	SetFrameCounters(state, nChannels, nFrames);
+	state.counters["allocate_faults"] = allocateFaults;
+	state.counters["loop_faults"] = loopFaults;
+	state.counters["huge"] = (ring.GetAllocationOptions() & CARingBuffer::kAllocateHugePages) != 0;
+	state.counters["locked"] = (ring.GetAllocationOptions() & CARingBuffer::kAllocateLocked) != 0;
+	state.counters["numa_node"] = ring.GetNUMANode();
+}
+
+void BM_MixSources(benchmark::State &state)
+{
+	const int nSources = state.range(0);
+	const int nChannels = state.range(1);
+	const UInt32 nFrames = state.range(2);
+	const bool fused = state.range(3);
+
+	std::vector<CARingBuffer> rings(nSources);
+	std::vector<Float32> gains(nSources * nChannels);
+	BenchABL src(nChannels, nFrames, CARingBuffer::kDeinterleaved), scratch(nChannels, nFrames, CARingBuffer::kDeinterleaved);
+	BenchABL bus(nChannels, nFrames, CARingBuffer::kDeinterleaved);
+	CARingBuffer::SampleTime t = 0;
+	for (int s = 0; s < nSources; ++s) {
+		rings[s].Allocate(nChannels, sizeof(Float32), nFrames);
+		t = rings[s].GetCapacityFrames() - nFrames / 2;
+		rings[s].Store(src.List(), nFrames, t);
+		for (int ch = 0; ch < nChannels; ++ch)
+			gains[s * nChannels + ch] = 1.0f / (s + ch + 2);
+	}
+	const CASampleConverter &kernels = CAGetBestSampleConverter();
+
+	for (auto _ : state) {
+		for (int s = 0; s < nSources; ++s) {
+			if (fused) {
+				rings[s].FetchMix(bus.List(), nFrames, t, &gains[s * nChannels]);
+			} else {
+				rings[s].Fetch(scratch.List(), nFrames, t);
+				for (int ch = 0; ch < nChannels; ++ch)
+					kernels.mMix((const Float32 *)scratch.List()->mBuffers[ch].mData, (Float32 *)bus.List()->mBuffers[ch].mData,
+								 gains[s * nChannels + ch], nFrames);
+			}
+		}
+		benchmark::ClobberMemory();
+	}
+	SetFrameCounters(state, nChannels * nSources, nFrames);
+}
+
+void MixSourcesArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "sources", "channels", "frames", "fused" });
+	b->ArgsProduct({ { 1, 8, 32 }, { 2, 8 }, { 256, 1024 }, { 0, 1 } });
+}
+
+void PlacementArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "channels", "frames", "options", "numa" });
+	b->ArgsProduct({ { 128 }, { 512 },
+		{ 0, CARingBuffer::kAllocateHugePages, CARingBuffer::kAllocateLocked, CARingBuffer::kAllocateHugePages | CARingBuffer::kAllocateLocked },
+		{ -1, 0 } });
+}
+
+void RingBufferArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "channels", "frames", "wrap", "interleaved", "mirrored" });
+	b->ArgsProduct({ { 1, 2, 8, 16, 32, 64 }, { 32, 64, 128, 256, 512, 1024, 4096 }, { 0, 1 }, { 0, 1 }, { 0, 1 } });
+}
+
+} // namespace
+
+BENCHMARK(BM_Store)->Apply(RingBufferArgs);
+BENCHMARK(BM_Fetch)->Apply(RingBufferArgs);
+BENCHMARK(BM_StoreFetch)->Apply(RingBufferArgs);
+BENCHMARK(BM_StoreFetchPlacement)->Apply(PlacementArgs);
+BENCHMARK(BM_MixSources)->Apply(MixSourcesArgs);
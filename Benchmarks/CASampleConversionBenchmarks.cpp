@@ -0,0 +1,74 @@
+/*=============================================================================
+	CASampleConversionBenchmarks.cpp
+
+	Throughput of each sample conversion kernel, in GB/s of Float32 moved,
+	for (isa, format, samples). isa and format are the CASampleConversionISA
+	and CASampleFormat enum values; kernels the CPU lacks are skipped.
+=============================================================================*/
+
+#include "CASampleConversion.h"
+
+#include <benchmark/benchmark.h>
+#include <vector>
+
+namespace {
+
+void SetCounters(benchmark::State &state, UInt32 nSamples)
+{
+	state.SetItemsProcessed(state.iterations() * nSamples);
+	state.SetBytesProcessed(state.iterations() * nSamples * sizeof(Float32));
+}
+
+void BM_FromFloat32(benchmark::State &state)
+{
+	const CASampleConverter *converter = CAGetSampleConverter(CASampleConversionISA(state.range(0)));
+	if (!converter) {
+		state.SkipWithError("kernel not available");
+		return;
+	}
+	const CASampleFormat format = CASampleFormat(state.range(1));
+	const UInt32 nSamples = state.range(2);
+	state.SetLabel(converter->mName);
+
+	std::vector<Float32> src(nSamples, 0.25f);
+	std::vector<Byte> dest(nSamples * CASampleFormatBytes(format));
+	for (auto _ : state) {
+		converter->mFromFloat32[format](&src[0], &dest[0], nSamples);
+		benchmark::ClobberMemory();
+	}
+	SetCounters(state, nSamples);
+}
+
+void BM_ToFloat32(benchmark::State &state)
+{
+	const CASampleConverter *converter = CAGetSampleConverter(CASampleConversionISA(state.range(0)));
+	if (!converter) {
+		state.SkipWithError("kernel not available");
+		return;
+	}
+	const CASampleFormat format = CASampleFormat(state.range(1));
+	const UInt32 nSamples = state.range(2);
+	state.SetLabel(converter->mName);
+
+	std::vector<Byte> src(nSamples * CASampleFormatBytes(format), 0x11);
+	std::vector<Float32> dest(nSamples);
+	for (auto _ : state) {
+		converter->mToFloat32[format](&src[0], &dest[0], nSamples);
+		benchmark::ClobberMemory();
+	}
+	SetCounters(state, nSamples);
+}
+
+void ConversionArgs(benchmark::internal::Benchmark *b)
+{
+	b->ArgNames({ "isa", "format", "samples" });
+	b->ArgsProduct({
+		{ kCASampleConversionISA_Scalar, kCASampleConversionISA_SSE2, kCASampleConversionISA_AVX2, kCASampleConversionISA_NEON },
+		{ kCASampleFormat_Int16, kCASampleFormat_Int24, kCASampleFormat_Int32 },
+		{ 64, 512, 4096, 65536 } });
+}
+
+} // namespace
+
+BENCHMARK(BM_FromFloat32)->Apply(ConversionArgs);
+BENCHMARK(BM_ToFloat32)->Apply(ConversionArgs);
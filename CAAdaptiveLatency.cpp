@@ -0,0 +1,73 @@
+/*=============================================================================
+	CAAdaptiveLatency.cpp
+
+=============================================================================*/
+
+#include "CAAdaptiveLatency.h"
+
+#include <algorithm>
+
+const Float64 CAAdaptiveLatency::kDefaultWindow = 10.0;
+const Float64 CAAdaptiveLatency::kDefaultMinMargin = 0.0005;
+const Float64 CAAdaptiveLatency::kDefaultMaxStep = 0.0005;
+const Float64 CAAdaptiveLatency::kDefaultBackoff = 0.002;
+
+CAAdaptiveLatency::CAAdaptiveLatency() :
+	mWindow(kDefaultWindow),
+	mMinMargin(kDefaultMinMargin),
+	mMaxStep(kDefaultMaxStep),
+	mBackoff(kDefaultBackoff),
+	mTarget(0),
+	mMaxTarget(0),
+	mBackoffs(0),
+	mLastMinHeadroom(0),
+	mLastJitter(0)
+{
+	StartWindow();
+}
+
+void	CAAdaptiveLatency::Reset(Float64 target, Float64 maxTarget)
+{
+	mMaxTarget = maxTarget;
+	mTarget = std::min(target, maxTarget);
+	mBackoffs = 0;
+	mLastMinHeadroom = 0;
+	mLastJitter = 0;
+	StartWindow();
+}
+
+void	CAAdaptiveLatency::StartWindow()
+{
+	mElapsed = 0;
+	mMinHeadroom = 1e30;
+	mMinInterval = 1e30;
+	mMaxInterval = 0;
+}
+
+Float64	CAAdaptiveLatency::Update(Float64 headroom, Float64 interval, bool underrun)
+{
+	if (underrun) {
+		// what it fell short by, and the backoff on top
+		mTarget = std::min(mTarget + std::max(-headroom, 0.0) + mBackoff, mMaxTarget);
+		mLastMinHeadroom = headroom;
+		++mBackoffs;
+		StartWindow();
+		return mTarget;
+	}
+
+	mElapsed += interval;
+	mMinHeadroom = std::min(mMinHeadroom, headroom);
+	mMinInterval = std::min(mMinInterval, interval);
+	mMaxInterval = std::max(mMaxInterval, interval);
+	if (mElapsed < mWindow)
+		return mTarget;
+
+	mLastMinHeadroom = mMinHeadroom;
+	// a callback late by j lengthens one interval by j and shortens the next by as much
+	mLastJitter = (mMaxInterval - mMinInterval) / 2;
+	Float64 spare = mMinHeadroom - std::max(mMinMargin, mLastJitter);
+	if (spare > 0.0)
+		mTarget -= std::min(spare / 2, mMaxStep);
+	StartWindow();
+	return mTarget;
+}
@@ -0,0 +1,92 @@
+/*=============================================================================
+	CAAdaptiveLatency.h
+
+	Learns the smallest latency target a play-through can run at without
+	glitching, from the headroom it actually has.
+
+	The headroom is how far the end of what the output reads falls short of
+	the end of what the input has stored, measured at each output callback.
+	Its minimum over a window is what the target could have been lower by
+	without an underrun. At the end of every window without an underrun the
+	target comes down by half of that, less a margin, and by no more than a
+	step, so that it creeps down over many windows rather than jumping to
+	the lowest value it has seen. The margin is at least the callback jitter
+	measured over the window, half the spread of the output callbacks'
+	intervals, since the worst alignment of late callbacks may not have come round yet.
+
+	An underrun puts the target straight back up by what it fell short by
+	and the backoff, and the window starts again.
+
+	Everything is in seconds. It does not change the latency itself; the
+	caller steers the latency onto GetTarget, as CAPlayThroughEngine does
+	with its CADriftController.
+=============================================================================*/
+
+#ifndef __CAAdaptiveLatency_h__
+#define __CAAdaptiveLatency_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+class CAAdaptiveLatency {
+public:
+	CAAdaptiveLatency();
+
+	void		SetWindow(Float64 seconds) { mWindow = seconds; }
+					// how long the headroom must have been there before the target comes down
+	Float64		GetWindow() const { return mWindow; }
+	void		SetMinMargin(Float64 seconds) { mMinMargin = seconds; }
+					// headroom always left, however little jitter there is
+	Float64		GetMinMargin() const { return mMinMargin; }
+	void		SetMaxStep(Float64 seconds) { mMaxStep = seconds; }
+					// the most the target comes down by at the end of a window
+	Float64		GetMaxStep() const { return mMaxStep; }
+	void		SetBackoff(Float64 seconds) { mBackoff = seconds; }
+					// what an underrun puts on the target, besides the shortfall
+	Float64		GetBackoff() const { return mBackoff; }
+
+	void		Reset(Float64 target, Float64 maxTarget);
+					// starts again from target, never to go above maxTarget
+	Float64		Update(Float64 headroom, Float64 interval, bool underrun);
+					// headroom: at this callback, as it would be with the latency exactly on the
+					// target (negative for an underrun). interval: since the last callback.
+					// Returns the target.
+	Float64		GetTarget() const { return mTarget; }
+
+	Float64		GetMinHeadroom() const { return mLastMinHeadroom; }
+					// over the last window to finish, or since the last underrun
+	Float64		GetJitter() const { return mLastJitter; }
+					// callback jitter over the last window to finish
+	UInt64		GetBackoffs() const { return mBackoffs; }
+
+	static const Float64	kDefaultWindow;
+	static const Float64	kDefaultMinMargin;
+	static const Float64	kDefaultMaxStep;
+	static const Float64	kDefaultBackoff;
+
+private:
+	void		StartWindow();
+
+	Float64		mWindow;
+	Float64		mMinMargin;
+	Float64		mMaxStep;
+	Float64		mBackoff;
+
+	Float64		mTarget;
+	Float64		mMaxTarget;
+	UInt64		mBackoffs;
+
+	// the window so far
+	Float64		mElapsed;
+	Float64		mMinHeadroom;
+	Float64		mMinInterval;
+	Float64		mMaxInterval;
+
+	Float64		mLastMinHeadroom;
+	Float64		mLastJitter;
+};
+
+#endif // __CAAdaptiveLatency_h__
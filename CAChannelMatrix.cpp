@@ -0,0 +1,311 @@
+/*=============================================================================
+	CAChannelMatrix.cpp
+
+=============================================================================*/
+
+#include "CAChannelMatrix.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define CACM_X86 1
+	#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+	#define CACM_NEON 1
+	#include <arm_neon.h>
+#endif
+
+namespace {
+
+#pragma mark -- Scalar --
+
+void Mix_Scalar(const Float32 *const *inputs, const Float32 *gains, UInt32 nInputs, Float32 *output, UInt32 nFrames)
+{
+	for (UInt32 i = 0; i < nFrames; ++i)
+		output[i] = gains[0] * inputs[0][i];
+	for (UInt32 n = 1; n < nInputs; ++n) {
+		const Float32 *x = inputs[n];
+		Float32 g = gains[n];
+		for (UInt32 i = 0; i < nFrames; ++i)
+			output[i] += g * x[i];
+	}
+}
+
+const CAChannelMatrixKernels kScalarKernels = { "Scalar", Mix_Scalar };
+
+// The vector kernels below go through the frames a block at a time, a few vectors wide, and
+// accumulate each block over every input before storing it, so that output is written once and
+// never read. The frames from first on, fewer than a vector, are left to this.
+inline void MixTail(const Float32 *const *inputs, const Float32 *gains, UInt32 nInputs, Float32 *output, UInt32 first,
+					UInt32 nFrames)
+{
+	for (UInt32 i = first; i < nFrames; ++i) {
+		Float32 sum = 0.0f;
+		for (UInt32 n = 0; n < nInputs; ++n)
+			sum += gains[n] * inputs[n][i];
+		output[i] = sum;
+	}
+}
+
+#if CACM_X86
+#pragma mark -- SSE2 --
+
+void Mix_SSE2(const Float32 *const *inputs, const Float32 *gains, UInt32 nInputs, Float32 *output, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 16 <= nFrames; i += 16) {
+		__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+		for (UInt32 n = 0; n < nInputs; ++n) {
+			const Float32 *x = inputs[n] + i;
+			__m128 g = _mm_set1_ps(gains[n]);
+			s0 = _mm_add_ps(s0, _mm_mul_ps(g, _mm_loadu_ps(x)));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(g, _mm_loadu_ps(x + 4)));
+			s2 = _mm_add_ps(s2, _mm_mul_ps(g, _mm_loadu_ps(x + 8)));
+			s3 = _mm_add_ps(s3, _mm_mul_ps(g, _mm_loadu_ps(x + 12)));
+		}
+		_mm_storeu_ps(output + i, s0);
+		_mm_storeu_ps(output + i + 4, s1);
+		_mm_storeu_ps(output + i + 8, s2);
+		_mm_storeu_ps(output + i + 12, s3);
+	}
+	for (; i + 4 <= nFrames; i += 4) {
+		__m128 s = _mm_setzero_ps();
+		for (UInt32 n = 0; n < nInputs; ++n)
+			s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(gains[n]), _mm_loadu_ps(inputs[n] + i)));
+		_mm_storeu_ps(output + i, s);
+	}
+	MixTail(inputs, gains, nInputs, output, i, nFrames);
+}
+
+const CAChannelMatrixKernels kSSE2Kernels = { "SSE2", Mix_SSE2 };
+
+#pragma mark -- AVX2 --
+
+#define CACM_AVX2 __attribute__((target("avx2,fma")))
+
+CACM_AVX2 void Mix_AVX2(const Float32 *const *inputs, const Float32 *gains, UInt32 nInputs, Float32 *output, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 32 <= nFrames; i += 32) {
+		__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+		for (UInt32 n = 0; n < nInputs; ++n) {
+			const Float32 *x = inputs[n] + i;
+			__m256 g = _mm256_set1_ps(gains[n]);
+			s0 = _mm256_fmadd_ps(g, _mm256_loadu_ps(x), s0);
+			s1 = _mm256_fmadd_ps(g, _mm256_loadu_ps(x + 8), s1);
+			s2 = _mm256_fmadd_ps(g, _mm256_loadu_ps(x + 16), s2);
+			s3 = _mm256_fmadd_ps(g, _mm256_loadu_ps(x + 24), s3);
+		}
+		_mm256_storeu_ps(output + i, s0);
+		_mm256_storeu_ps(output + i + 8, s1);
+		_mm256_storeu_ps(output + i + 16, s2);
+		_mm256_storeu_ps(output + i + 24, s3);
+	}
+	for (; i + 8 <= nFrames; i += 8) {
+		__m256 s = _mm256_setzero_ps();
+		for (UInt32 n = 0; n < nInputs; ++n)
+			s = _mm256_fmadd_ps(_mm256_set1_ps(gains[n]), _mm256_loadu_ps(inputs[n] + i), s);
+		_mm256_storeu_ps(output + i, s);
+	}
+	MixTail(inputs, gains, nInputs, output, i, nFrames);
+}
+
+const CAChannelMatrixKernels kAVX2Kernels = { "AVX2", Mix_AVX2 };
+#endif // CACM_X86
+
+#if CACM_NEON
+#pragma mark -- NEON --
+
+void Mix_NEON(const Float32 *const *inputs, const Float32 *gains, UInt32 nInputs, Float32 *output, UInt32 nFrames)
+{
+	UInt32 i = 0;
+	for (; i + 16 <= nFrames; i += 16) {
+		float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f), s2 = vdupq_n_f32(0.0f), s3 = vdupq_n_f32(0.0f);
+		for (UInt32 n = 0; n < nInputs; ++n) {
+			const Float32 *x = inputs[n] + i;
+			float32x4_t g = vdupq_n_f32(gains[n]);
+			s0 = vfmaq_f32(s0, g, vld1q_f32(x));
+			s1 = vfmaq_f32(s1, g, vld1q_f32(x + 4));
+			s2 = vfmaq_f32(s2, g, vld1q_f32(x + 8));
+			s3 = vfmaq_f32(s3, g, vld1q_f32(x + 12));
+		}
+		vst1q_f32(output + i, s0);
+		vst1q_f32(output + i + 4, s1);
+		vst1q_f32(output + i + 8, s2);
+		vst1q_f32(output + i + 12, s3);
+	}
+	for (; i + 4 <= nFrames; i += 4) {
+		float32x4_t s = vdupq_n_f32(0.0f);
+		for (UInt32 n = 0; n < nInputs; ++n)
+			s = vfmaq_f32(s, vdupq_n_f32(gains[n]), vld1q_f32(inputs[n] + i));
+		vst1q_f32(output + i, s);
+	}
+	MixTail(inputs, gains, nInputs, output, i, nFrames);
+}
+
+const CAChannelMatrixKernels kNEONKernels = { "NEON", Mix_NEON };
+#endif // CACM_NEON
+
+} // namespace
+
+const CAChannelMatrixKernels *	CAGetChannelMatrixKernels(CASampleConversionISA isa)
+{
+	switch (isa) {
+		case kCASampleConversionISA_Scalar:
+			return &kScalarKernels;
+#if CACM_X86
+		case kCASampleConversionISA_SSE2:
+			return __builtin_cpu_supports("sse2") ? &kSSE2Kernels : NULL;
+		case kCASampleConversionISA_AVX2:
+			return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? &kAVX2Kernels : NULL;
+#endif
+#if CACM_NEON
+		case kCASampleConversionISA_NEON:
+			return &kNEONKernels;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+static const CAChannelMatrixKernels *ChooseBestChannelMatrixKernels()
+{
+	const CAChannelMatrixKernels *best = NULL;
+	for (int isa = kCASampleConversionISA_Count - 1; isa >= 0 && best == NULL; --isa)
+		best = CAGetChannelMatrixKernels(CASampleConversionISA(isa));
+	return best;
+}
+
+const CAChannelMatrixKernels &	CAGetBestChannelMatrixKernels()
+{
+	static const CAChannelMatrixKernels *best = ChooseBestChannelMatrixKernels();
+	return *best;
+}
+
+#pragma mark -- CAChannelMatrix --
+
+CAChannelMatrix::CAChannelMatrix() :
+	mInputs(0),
+	mOutputs(0),
+	mKernels(NULL),
+	mTerms(0),
+	mIdentity(true),
+	mRouting(true)
+{
+}
+
+void	CAChannelMatrix::Initialize(UInt32 nInputs, UInt32 nOutputs, const CAChannelMatrixKernels *kernels)
+{
+	mInputs = nInputs;
+	mOutputs = nOutputs;
+	mKernels = kernels ? kernels : &CAGetBestChannelMatrixKernels();
+	mGains.assign(nInputs * nOutputs, 0.0f);
+	mFirstTerm.assign(nOutputs, 0);
+	mTermCount.assign(nOutputs, 0);
+	mTermInputs.assign(nInputs * nOutputs, 0);
+	mTermGains.assign(nInputs * nOutputs, 0.0f);
+	mTermData.assign(nInputs * nOutputs, NULL);
+	SetDiagonal();
+}
+
+void	CAChannelMatrix::SetGain(UInt32 output, UInt32 input, Float32 gain)
+{
+	if (output >= mOutputs || input >= mInputs)
+		return;
+	mGains[output * mInputs + input] = gain;
+	Plan();
+}
+
+void	CAChannelMatrix::SetDiagonal()
+{
+	std::fill(mGains.begin(), mGains.end(), 0.0f);
+	for (UInt32 i = 0; i < std::min(mInputs, mOutputs); ++i)
+		mGains[i * mInputs + i] = 1.0f;
+	Plan();
+}
+
+void	CAChannelMatrix::Clear()
+{
+	std::fill(mGains.begin(), mGains.end(), 0.0f);
+	Plan();
+}
+
+// gathers each output's non-zero gains, row by row
+void	CAChannelMatrix::Plan()
+{
+	mTerms = 0;
+	mIdentity = (mInputs == mOutputs);
+	mRouting = true;
+	for (UInt32 m = 0; m < mOutputs; ++m) {
+		mFirstTerm[m] = mTerms;
+		const Float32 *row = &mGains[m * mInputs];
+		for (UInt32 n = 0; n < mInputs; ++n) {
+			if (row[n] == 0.0f)
+				continue;
+			mTermInputs[mTerms] = n;
+			mTermGains[mTerms] = row[n];
+			++mTerms;
+		}
+		mTermCount[m] = mTerms - mFirstTerm[m];
+
+		bool copies = mTermCount[m] == 1 && mTermGains[mFirstTerm[m]] == 1.0f;
+		mRouting = mRouting && (copies || mTermCount[m] == 0);
+		mIdentity = mIdentity && copies && mTermInputs[mFirstTerm[m]] == m;
+	}
+}
+
+// Each output has its own terms' pointers in mTermData, so that groups of them can be mixed at once.
+void	CAChannelMatrix::ProcessOutputs(const AudioBufferList *input, AudioBufferList *output, UInt32 nFrames,
+										bool byReference, UInt32 first, UInt32 end)
+{
+	UInt32 nBytes = nFrames * sizeof(Float32);
+	for (UInt32 m = first; m < end; ++m) {
+		AudioBuffer &out = output->mBuffers[m];
+		const UInt32 *terms = &mTermInputs[mFirstTerm[m]];
+		const Float32 *gains = &mTermGains[mFirstTerm[m]];
+		UInt32 nTerms = mTermCount[m];
+		out.mDataByteSize = nBytes;
+
+		if (nTerms == 0) {
+			memset(out.mData, 0, nBytes);
+		} else if (nTerms == 1 && gains[0] == 1.0f) {
+			void *in = input->mBuffers[terms[0]].mData;
+			if (byReference)
+				out.mData = in;
+			else
+				memcpy(out.mData, in, nBytes);
+		} else {
+			const Float32 **data = &mTermData[mFirstTerm[m]];
+			for (UInt32 k = 0; k < nTerms; ++k)
+				data[k] = (const Float32 *)input->mBuffers[terms[k]].mData;
+			mKernels->mMix(data, gains, nTerms, (Float32 *)out.mData, nFrames);
+		}
+	}
+}
+
+void	CAChannelMatrix::ProcessTask(void *context, UInt32 task)
+{
+	Block &block = *(Block *)context;
+	UInt32 outputs = block.mMatrix->mOutputs;
+	block.mMatrix->ProcessOutputs(block.mInput, block.mOutput, block.mFrames, block.mByReference,
+								  outputs * task / block.mTasks, outputs * (task + 1) / block.mTasks);
+}
+
+CAChannelMatrixError	CAChannelMatrix::Process(const AudioBufferList *input, AudioBufferList *output, UInt32 nFrames,
+												 bool byReference, CARealtimeWorkerPool *pool)
+{
+	if (input->mNumberBuffers != mInputs || output->mNumberBuffers != mOutputs)
+		return kCAChannelMatrixError_Channels;
+
+	// only the mixed outputs are worth a worker
+	UInt32 nTasks = (pool && !mRouting) ? pool->GetTasks(mOutputs) : 1;
+	if (nTasks <= 1) {
+		ProcessOutputs(input, output, nFrames, byReference, 0, mOutputs);
+	} else {
+		Block block = { this, input, output, nFrames, byReference, nTasks };
+		pool->Run(nTasks, ProcessTask, &block);
+	}
+	return kCAChannelMatrixError_OK;
+}
@@ -0,0 +1,116 @@
+/*=============================================================================
+	CAChannelMatrix.h
+
+	A gain matrix from N deinterleaved Float32 input channels to M output
+	channels: output m is the sum over n of gain(m, n) times input n. It
+	routes any input to any output, mixes down and up, and by default passes
+	input n to output n as far as both go, which is what taking the smaller
+	of the two channel counts used to do.
+
+	Setting a gain replans the matrix on the calling thread. Each output
+	keeps only its non-zero terms, so a sparse matrix costs what its terms
+	do: an output with none is zeroed, one that is a single input at unity
+	is copied, or with Process's byReference pointed at the input's buffer
+	instead, and the rest are mixed by a kernel that keeps a block of frames
+	in registers while it multiply-accumulates across the inputs. An
+	identity matrix does nothing at all, and a caller can skip it. Given a
+	CARealtimeWorkerPool, Process splits the outputs into groups and mixes
+	them on the pool's workers as well as the calling thread.
+
+	The kernels are chosen as CASampleConversion's are: the fastest the CPU
+	supports, or a given CASampleConversionISA for testing.
+=============================================================================*/
+
+#ifndef __CAChannelMatrix_h__
+#define __CAChannelMatrix_h__
+
+#include "CARealtimeWorkerPool.h"
+#include "CASampleConversion.h"
+
+#include <vector>
+
+enum {
+	kCAChannelMatrixError_OK = 0,
+	kCAChannelMatrixError_Channels = 1		// a buffer list without one mono buffer per channel of the matrix
+};
+
+typedef SInt32 CAChannelMatrixError;
+
+typedef void (*CAChannelMixProc)(const Float32 *const *inputs, const Float32 *gains, UInt32 nInputs, Float32 *output,
+								 UInt32 nFrames);
+	// output[i] = the sum over n of gains[n] * inputs[n][i]; nInputs is at least 1
+
+struct CAChannelMatrixKernels {
+	const char *		mName;
+	CAChannelMixProc	mMix;
+};
+
+const CAChannelMatrixKernels *	CAGetChannelMatrixKernels(CASampleConversionISA isa);
+									// NULL if the kernels for isa were not built or the CPU lacks them
+const CAChannelMatrixKernels &	CAGetBestChannelMatrixKernels();
+
+class CAChannelMatrix {
+public:
+	CAChannelMatrix();
+
+	void				Initialize(UInt32 nInputs, UInt32 nOutputs, const CAChannelMatrixKernels *kernels = NULL);
+							// allocates; not for the IO thread. Input n goes to output n at unity, as
+							// far as both go, and everything else is 0.
+	UInt32				GetNumberInputs() const { return mInputs; }
+	UInt32				GetNumberOutputs() const { return mOutputs; }
+
+	void				SetGain(UInt32 output, UInt32 input, Float32 gain);
+	Float32				GetGain(UInt32 output, UInt32 input) const { return mGains[output * mInputs + input]; }
+	void				SetDiagonal();
+							// back to how Initialize leaves it
+	void				Clear();
+							// every gain 0. Neither this, SetDiagonal nor SetGain allocates, but none
+							// may run during Process.
+
+	bool				IsIdentity() const { return mIdentity; }
+							// as many outputs as inputs, each its own input at unity
+	bool				IsRouting() const { return mRouting; }
+							// every output silent or a single input at unity: only copies, no arithmetic
+	UInt32				GetTerms() const { return mTerms; }
+							// non-zero gains
+
+	CAChannelMatrixError Process(const AudioBufferList *input, AudioBufferList *output, UInt32 nFrames,
+								 bool byReference = false, CARealtimeWorkerPool *pool = NULL);
+							// Deinterleaved Float32, a buffer per channel, and input and output distinct.
+							// byReference points an output that only copies an input at the input's buffer
+							// instead, for a caller that owns output's buffer pointers; the rest are
+							// written through whatever output points at. With a pool, the outputs are
+							// mixed a group at a time across its workers.
+
+private:
+	struct Block {
+		CAChannelMatrix *		mMatrix;
+		const AudioBufferList *	mInput;
+		AudioBufferList *		mOutput;
+		UInt32					mFrames;
+		bool					mByReference;
+		UInt32					mTasks;
+	};
+
+	void				Plan();
+	void				ProcessOutputs(const AudioBufferList *input, AudioBufferList *output, UInt32 nFrames,
+									   bool byReference, UInt32 first, UInt32 end);
+	static void			ProcessTask(void *context, UInt32 task);
+
+	UInt32					mInputs;
+	UInt32					mOutputs;
+	const CAChannelMatrixKernels *mKernels;
+	std::vector<Float32>	mGains;				// mOutputs rows of mInputs
+
+	// the plan: each output's terms, in mTermInputs and mTermGains from mFirstTerm, mTermCount of them
+	std::vector<UInt32>		mFirstTerm;
+	std::vector<UInt32>		mTermCount;
+	std::vector<UInt32>		mTermInputs;		// room for every gain; the plan uses the first mTerms
+	std::vector<Float32>	mTermGains;
+	UInt32					mTerms;
+	std::vector<const Float32 *> mTermData;		// Process's input pointers for each output's terms, from mFirstTerm
+	bool					mIdentity;
+	bool					mRouting;
+};
+
+#endif // __CAChannelMatrix_h__
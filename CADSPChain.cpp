@@ -0,0 +1,156 @@
+/*=============================================================================
+	CADSPChain.cpp
+
+=============================================================================*/
+
+#include "CADSPChain.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <xmmintrin.h>
+#endif
+
+namespace {
+
+// Sets flush-to-zero, and denormals-are-zero where there is such a thing, for as long as it
+// lasts, and puts back what was there.
+class DenormalsFlushed {
+public:
+#if defined(__x86_64__) || defined(__i386__)
+	DenormalsFlushed() : mSaved(_mm_getcsr()) { _mm_setcsr(mSaved | 0x8040); }	// FTZ | DAZ
+	~DenormalsFlushed() { _mm_setcsr(mSaved); }
+private:
+	unsigned int	mSaved;
+#elif defined(__aarch64__)
+	DenormalsFlushed()
+	{
+		asm volatile("mrs %0, fpcr" : "=r"(mSaved));
+		asm volatile("msr fpcr, %0" : : "r"(mSaved | (1 << 24)));	// FZ
+	}
+	~DenormalsFlushed() { asm volatile("msr fpcr, %0" : : "r"(mSaved)); }
+private:
+	UInt64			mSaved;
+#endif
+};
+
+} // namespace
+
+CADSPChain::CADSPChain() :
+	mCount(0),
+	mChannels(0),
+	mSampleRate(0),
+	mRunningSampleRate(0)
+{
+	mOrder.mCount = 0;
+}
+
+CADSPChain::~CADSPChain()
+{
+	RemoveAll();
+}
+
+CADSPChainError	CADSPChain::Add(CADSPProcessor *processor)
+{
+	if (mCount == kMaxProcessors)
+		return kCADSPChainError_Full;
+	if (mChannels)
+		processor->Prepare(mChannels, mSampleRate);
+	processor->mControlLock = &mControlLock;
+	processor->mRunningSampleRate = mRunningSampleRate;
+	mProcessors[mCount] = processor;
+	mOrder.mIndices[mOrder.mCount++] = UInt8(mCount++);
+	return kCADSPChainError_OK;
+}
+
+void	CADSPChain::RemoveAll()
+{
+	for (UInt32 i = 0; i < mCount; ++i)
+		delete mProcessors[i];
+	mCount = 0;
+	mOrder.mCount = 0;
+	mOrders.Clear();
+}
+
+void	CADSPChain::Prepare(UInt32 nChannels, Float64 sampleRate)
+{
+	mChannels = nChannels;
+	mSampleRate = mRunningSampleRate = sampleRate;
+	mChannelData.assign(nChannels, NULL);
+	mRates.Clear();
+	for (UInt32 i = 0; i < mCount; ++i) {
+		mProcessors[i]->Prepare(nChannels, sampleRate);
+		mProcessors[i]->mRunningSampleRate = sampleRate;
+	}
+}
+
+void	CADSPChain::SetSampleRate(Float64 sampleRate)
+{
+	std::lock_guard<std::mutex> lock(mControlLock);
+	Redesign(sampleRate);
+	mRates.Post(sampleRate);
+}
+
+void	CADSPChain::SetPendingSampleRate(Float64 sampleRate)
+{
+	std::lock_guard<std::mutex> lock(mControlLock);
+	Redesign(sampleRate);
+}
+
+void	CADSPChain::Redesign(Float64 sampleRate)
+{
+	mSampleRate = sampleRate;
+	for (UInt32 i = 0; i < mCount; ++i)
+		mProcessors[i]->SetSampleRate(sampleRate);
+}
+
+// over any rate SetSampleRate posted before, which would otherwise come after this one
+void	CADSPChain::TakeUpSampleRate(Float64 sampleRate)
+{
+	Float64 posted;
+	mRates.Take(posted);
+	mRunningSampleRate = sampleRate;
+}
+
+CADSPChainError	CADSPChain::SetOrder(const UInt32 *indices, UInt32 count)
+{
+	if (count > kMaxProcessors)
+		return kCADSPChainError_Full;
+	Order order;
+	order.mCount = count;
+	for (UInt32 i = 0; i < count; ++i) {
+		if (indices[i] >= mCount)
+			return kCADSPChainError_NoSuchProcessor;
+		order.mIndices[i] = UInt8(indices[i]);
+	}
+	std::lock_guard<std::mutex> lock(mControlLock);
+	mOrders.Post(order);
+	return kCADSPChainError_OK;
+}
+
+void	CADSPChain::Reset()
+{
+	for (UInt32 i = 0; i < mCount; ++i)
+		mProcessors[i]->Reset();
+}
+
+CADSPChainError	CADSPChain::Process(AudioBufferList *ioData, UInt32 nFrames)
+{
+	mOrders.Take(mOrder);
+	mRates.Take(mRunningSampleRate);
+	if (mOrder.mCount == 0 || nFrames == 0)
+		return kCADSPChainError_OK;
+	if (ioData->mNumberBuffers != mChannels)
+		return kCADSPChainError_Channels;
+	for (UInt32 ch = 0; ch < mChannels; ++ch) {
+		if (ioData->mBuffers[ch].mNumberChannels != 1)
+			return kCADSPChainError_Channels;
+		mChannelData[ch] = (Float32 *)ioData->mBuffers[ch].mData;
+	}
+
+	DenormalsFlushed flushed;
+	for (UInt32 i = 0; i < mOrder.mCount; ++i) {
+		CADSPProcessor *processor = mProcessors[mOrder.mIndices[i]];
+		processor->mRunningSampleRate = mRunningSampleRate;
+		processor->Process(mChannelData.data(), nFrames);
+	}
+	return kCADSPChainError_OK;
+}
@@ -0,0 +1,195 @@
+/*=============================================================================
+	CADSPChain.h
+
+	A chain of processors that OutputProc runs on the output's channels, in
+	place, between the fetch from the ring (and the channel matrix) and the
+	varispeed or the resampler. CADSPProcessors.h has an equalizer, a gain,
+	a limiter and a delay.
+
+	Everything a processor needs is allocated up front: the chain holds up
+	to kMaxProcessors, added while the play-through is stopped, and Prepare
+	sizes their state for the channel count and sample rate. After that the
+	IO thread never allocates, locks or waits. The processors take any
+	number of frames per call, with the same result however a signal is
+	cut into blocks.
+
+	A control thread changes a running chain without locks. Each processor
+	designs its coefficients on the thread that sets its parameters and
+	posts them to a CAMailbox, and Process takes the latest at the start of
+	the next block; SetOrder does the same for which processors run, and in
+	what order. A mailbox takes one writer at a time, and the writers can
+	be on different threads: the UI's setters, and the engine's Reconfigure
+	on a device notification calling SetSampleRate. So the chain shares a
+	control lock with the processors added to it, which SetOrder,
+	SetSampleRate and every setter hold while they post. Only the control
+	threads ever take it; Process never does. While it runs, Process
+	flushes denormals to zero, so that filters and feedback decaying
+	towards silence don't slow down.
+
+	Each design goes out with the sample rate it was made for, and Process
+	takes it up only once the chain runs at that rate. SetSampleRate moves
+	the chain to the new rate at its next block. SetPendingSampleRate
+	leaves it where it is, on the coefficients it has, until the IO thread
+	calls TakeUpSampleRate: the engine's changeover to a new pipeline, so
+	that the old one's last blocks are processed at the old rate.
+=============================================================================*/
+
+#ifndef __CADSPChain_h__
+#define __CADSPChain_h__
+
+#include "CAMailbox.h"
+
+#include <mutex>
+#include <vector>
+
+enum {
+	kCADSPChainError_OK = 0,
+	kCADSPChainError_Full = 1,				// kMaxProcessors already, or a processor's own limit
+	kCADSPChainError_NoSuchProcessor = 2,
+	kCADSPChainError_Channels = 3			// a buffer list without one mono buffer per channel of the chain
+};
+
+typedef SInt32 CADSPChainError;
+
+// A processor's designs, from the control thread to Process, each with the sample rate it was
+// made for. The latest posted wins, as with a CAMailbox, but Take holds one back until it's asked
+// for that rate.
+template <typename T>
+class CADSPUpdates {
+public:
+	CADSPUpdates() : mHeld(false) { }
+
+	void		Post(const T &value, Float64 sampleRate)
+					// from the writer
+	{
+		Update update = { value, sampleRate };
+		mMailbox.Post(update);
+	}
+
+	bool		Take(T &value, Float64 sampleRate)
+					// from the reader: the latest value posted, if it hasn't been taken and was made for sampleRate
+	{
+		if (mMailbox.Take(mNext))
+			mHeld = true;
+		if (!mHeld || mNext.mSampleRate != sampleRate)
+			return false;
+		mHeld = false;
+		value = mNext.mValue;
+		return true;
+	}
+
+	void		Clear()
+					// forget anything posted; call while neither side is using it
+	{
+		mMailbox.Clear();
+		mHeld = false;
+	}
+
+private:
+	struct Update {
+		T			mValue;
+		Float64		mSampleRate;
+	};
+
+	CAMailbox<Update>	mMailbox;
+	Update				mNext;		// the reader's, as is mHeld
+	bool				mHeld;
+};
+
+class CADSPProcessor {
+public:
+	CADSPProcessor() : mControlLock(NULL), mRunningSampleRate(0) { }
+	virtual ~CADSPProcessor() { }
+
+	virtual const char *	GetName() const = 0;
+	virtual void			Prepare(UInt32 nChannels, Float64 sampleRate) = 0;
+								// allocates for nChannels, designs for sampleRate and resets, with the
+								// parameters set so far in effect at once; while stopped
+	virtual void			SetSampleRate(Float64 sampleRate) = 0;
+								// from the control thread: redesigns for the new rate, as a setter does, for
+								// Process to take up once it runs at that rate. A chain calls it with the
+								// control lock held, so it mustn't take it.
+	virtual void			Reset() = 0;
+								// forgets the signal so far; from the IO thread, or while stopped
+	virtual void			Process(Float32 *const *channels, UInt32 nFrames) = 0;
+								// one buffer per channel, in place, any number of frames; real-time safe
+
+protected:
+	Float64					GetRunningSampleRate() const { return mRunningSampleRate; }
+								// for Process: the rate the chain runs at, which CADSPUpdates::Take wants
+
+	// for the setters to hold while they design and post: the chain's control lock once the
+	// processor is in one, and nothing before
+	class ControlLock {
+	public:
+		ControlLock(const CADSPProcessor &processor) : mLock(processor.mControlLock) { if (mLock) mLock->lock(); }
+		~ControlLock() { if (mLock) mLock->unlock(); }
+	private:
+		std::mutex *	mLock;
+	};
+
+private:
+	friend class CADSPChain;
+	std::mutex *			mControlLock;
+	Float64					mRunningSampleRate;		// the IO thread's, set by the chain
+};
+
+class CADSPChain {
+public:
+	static const UInt32 kMaxProcessors = 16;
+
+	CADSPChain();
+	~CADSPChain();
+
+	CADSPChainError		Add(CADSPProcessor *processor);
+							// takes ownership and appends it to the order, prepared if the chain is; while
+							// stopped. With kCADSPChainError_Full the caller keeps it.
+	void				RemoveAll();
+							// deletes them all; while stopped
+	UInt32				GetNumberProcessors() const { return mCount; }
+	CADSPProcessor *	GetProcessor(UInt32 index) const { return index < mCount ? mProcessors[index] : NULL; }
+
+	void				Prepare(UInt32 nChannels, Float64 sampleRate);
+							// prepares every processor, and those added later; while stopped
+	void				SetSampleRate(Float64 sampleRate);
+							// from a control thread: redesigns every processor, and runs at the new rate
+							// from the next block on
+	void				SetPendingSampleRate(Float64 sampleRate);
+							// from a control thread: redesigns every processor, but runs on at the old rate
+							// until TakeUpSampleRate
+	void				TakeUpSampleRate(Float64 sampleRate);
+							// from the IO thread: runs at sampleRate from the next Process on; real-time safe
+	UInt32				GetNumberChannels() const { return mChannels; }
+
+	CADSPChainError		SetOrder(const UInt32 *indices, UInt32 count);
+							// from the control thread: the processors that run from the next block on,
+							// by index, in order; those left out are skipped and keep their state
+	void				Reset();
+							// every processor's; from the IO thread, or while stopped
+
+	CADSPChainError		Process(AudioBufferList *ioData, UInt32 nFrames);
+							// deinterleaved Float32, a buffer per channel, in place; real-time safe. Does
+							// nothing, and doesn't look at ioData, with nothing to run.
+
+private:
+	struct Order {
+		UInt32		mCount;
+		UInt8		mIndices[kMaxProcessors];
+	};
+
+	void				Redesign(Float64 sampleRate);
+							// with the control lock held
+
+	CADSPProcessor *		mProcessors[kMaxProcessors];
+	UInt32					mCount;
+	UInt32					mChannels;
+	Float64					mSampleRate;
+	std::vector<Float32 *>	mChannelData;		// Process's buffers, for the processors
+	std::mutex				mControlLock;		// the posters', never the IO thread's
+	CAMailbox<Order>		mOrders;
+	CAMailbox<Float64>		mRates;				// SetSampleRate's
+	Order					mOrder;				// the IO thread's, as is the rate
+	Float64					mRunningSampleRate;
+};
+
+#endif // __CADSPChain_h__
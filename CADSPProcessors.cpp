@@ -0,0 +1,798 @@
+/*=============================================================================
+	CADSPProcessors.cpp
+
+=============================================================================*/
+
+#include "CADSPProcessors.h"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define CADSP_X86 1
+	#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+	#define CADSP_NEON 1
+	#include <arm_neon.h>
+#endif
+
+namespace {
+
+// the sections a vector kernel keeps the coefficients of at once; more go through in batches
+const UInt32 kBatchSections = 8;
+
+#pragma mark -- Scalar --
+
+// Channels [first, end), a section at a time over the whole block, which gives what taking each
+// frame through every section would. The vector kernels do the same arithmetic, in the same
+// order, on several channels at once.
+void BiquadChannels(Float32 *const *channels, UInt32 first, UInt32 end, UInt32 nChannels, UInt32 nFrames,
+					const CABiquadCoefficients *sections, UInt32 nSections, Float32 *state)
+{
+	for (UInt32 ch = first; ch < end; ++ch) {
+		Float32 *x = channels[ch];
+		for (UInt32 s = 0; s < nSections; ++s) {
+			const CABiquadCoefficients &c = sections[s];
+			Float32 *z = &state[2 * s * nChannels + ch];
+			Float32 z1 = z[0], z2 = z[nChannels];
+			for (UInt32 i = 0; i < nFrames; ++i) {
+				Float32 in = x[i];
+				Float32 y = c.mB0 * in + z1;
+				z1 = c.mB1 * in - c.mA1 * y + z2;
+				z2 = c.mB2 * in - c.mA2 * y;
+				x[i] = y;
+			}
+			z[0] = z1;
+			z[nChannels] = z2;
+		}
+	}
+}
+
+void Biquad_Scalar(Float32 *const *channels, UInt32 nChannels, UInt32 nFrames, const CABiquadCoefficients *sections,
+				   UInt32 nSections, Float32 *state)
+{
+	BiquadChannels(channels, 0, nChannels, nChannels, nFrames, sections, nSections, state);
+}
+
+const CABiquadKernels kScalarKernels = { "Scalar", Biquad_Scalar };
+
+#if CADSP_X86
+#pragma mark -- SSE2 --
+
+struct Sections4 {
+	__m128		mB0, mB1, mB2, mA1, mA2;
+};
+
+inline __m128 Cascade_SSE2(__m128 x, const Sections4 *c, __m128 *z, UInt32 nSections)
+{
+	for (UInt32 s = 0; s < nSections; ++s) {
+		__m128 y = _mm_add_ps(_mm_mul_ps(c[s].mB0, x), z[2 * s]);
+		z[2 * s] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(c[s].mB1, x), _mm_mul_ps(c[s].mA1, y)), z[2 * s + 1]);
+		z[2 * s + 1] = _mm_sub_ps(_mm_mul_ps(c[s].mB2, x), _mm_mul_ps(c[s].mA2, y));
+		x = y;
+	}
+	return x;
+}
+
+// Four channels at a time from first, in a vector a frame: four frames of each are loaded and
+// transposed, and the frames over a multiple of four are gathered one by one. Returns the first
+// channel of the fewer than four left over.
+UInt32 BiquadGroups_SSE2(Float32 *const *channels, UInt32 first, UInt32 end, UInt32 nChannels, UInt32 nFrames,
+						 const CABiquadCoefficients *sections, UInt32 nSections, Float32 *state)
+{
+	UInt32 ch = first;
+	for (; ch + 4 <= end; ch += 4) {
+		Float32 *c0 = channels[ch], *c1 = channels[ch + 1], *c2 = channels[ch + 2], *c3 = channels[ch + 3];
+		for (UInt32 s0 = 0; s0 < nSections; s0 += kBatchSections) {
+			UInt32 n = std::min(kBatchSections, nSections - s0);
+			Sections4 c[kBatchSections];
+			__m128 z[2 * kBatchSections];
+			for (UInt32 s = 0; s < n; ++s) {
+				const CABiquadCoefficients &k = sections[s0 + s];
+				c[s].mB0 = _mm_set1_ps(k.mB0);
+				c[s].mB1 = _mm_set1_ps(k.mB1);
+				c[s].mB2 = _mm_set1_ps(k.mB2);
+				c[s].mA1 = _mm_set1_ps(k.mA1);
+				c[s].mA2 = _mm_set1_ps(k.mA2);
+				z[2 * s] = _mm_loadu_ps(&state[2 * (s0 + s) * nChannels + ch]);
+				z[2 * s + 1] = _mm_loadu_ps(&state[(2 * (s0 + s) + 1) * nChannels + ch]);
+			}
+
+			UInt32 i = 0;
+			for (; i + 4 <= nFrames; i += 4) {
+				__m128 x0 = _mm_loadu_ps(c0 + i), x1 = _mm_loadu_ps(c1 + i), x2 = _mm_loadu_ps(c2 + i), x3 = _mm_loadu_ps(c3 + i);
+				_MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+				x0 = Cascade_SSE2(x0, c, z, n);
+				x1 = Cascade_SSE2(x1, c, z, n);
+				x2 = Cascade_SSE2(x2, c, z, n);
+				x3 = Cascade_SSE2(x3, c, z, n);
+				_MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+				_mm_storeu_ps(c0 + i, x0);
+				_mm_storeu_ps(c1 + i, x1);
+				_mm_storeu_ps(c2 + i, x2);
+				_mm_storeu_ps(c3 + i, x3);
+			}
+			for (; i < nFrames; ++i) {
+				Float32 y[4];
+				_mm_storeu_ps(y, Cascade_SSE2(_mm_setr_ps(c0[i], c1[i], c2[i], c3[i]), c, z, n));
+				c0[i] = y[0];
+				c1[i] = y[1];
+				c2[i] = y[2];
+				c3[i] = y[3];
+			}
+
+			for (UInt32 s = 0; s < n; ++s) {
+				_mm_storeu_ps(&state[2 * (s0 + s) * nChannels + ch], z[2 * s]);
+				_mm_storeu_ps(&state[(2 * (s0 + s) + 1) * nChannels + ch], z[2 * s + 1]);
+			}
+		}
+	}
+	return ch;
+}
+
+void Biquad_SSE2(Float32 *const *channels, UInt32 nChannels, UInt32 nFrames, const CABiquadCoefficients *sections,
+				 UInt32 nSections, Float32 *state)
+{
+	UInt32 ch = BiquadGroups_SSE2(channels, 0, nChannels, nChannels, nFrames, sections, nSections, state);
+	BiquadChannels(channels, ch, nChannels, nChannels, nFrames, sections, nSections, state);
+}
+
+const CABiquadKernels kSSE2Kernels = { "SSE2", Biquad_SSE2 };
+
+#pragma mark -- AVX2 --
+
+// not fma: the same unfused arithmetic as the scalar kernel
+#define CADSP_AVX2 __attribute__((target("avx2")))
+
+struct Sections8 {
+	__m256		mB0, mB1, mB2, mA1, mA2;
+};
+
+CADSP_AVX2 inline __m256 Cascade_AVX2(__m256 x, const Sections8 *c, __m256 *z, UInt32 nSections)
+{
+	for (UInt32 s = 0; s < nSections; ++s) {
+		__m256 y = _mm256_add_ps(_mm256_mul_ps(c[s].mB0, x), z[2 * s]);
+		z[2 * s] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(c[s].mB1, x), _mm256_mul_ps(c[s].mA1, y)), z[2 * s + 1]);
+		z[2 * s + 1] = _mm256_sub_ps(_mm256_mul_ps(c[s].mB2, x), _mm256_mul_ps(c[s].mA2, y));
+		x = y;
+	}
+	return x;
+}
+
+// Eight channels at a time: each half of a vector is four of them, transposed as the SSE2
+// kernel does.
+CADSP_AVX2 UInt32 BiquadGroups_AVX2(Float32 *const *channels, UInt32 first, UInt32 end, UInt32 nChannels, UInt32 nFrames,
+									const CABiquadCoefficients *sections, UInt32 nSections, Float32 *state)
+{
+	UInt32 ch = first;
+	for (; ch + 8 <= end; ch += 8) {
+		Float32 *const *c8 = channels + ch;
+		for (UInt32 s0 = 0; s0 < nSections; s0 += kBatchSections) {
+			UInt32 n = std::min(kBatchSections, nSections - s0);
+			Sections8 c[kBatchSections];
+			__m256 z[2 * kBatchSections];
+			for (UInt32 s = 0; s < n; ++s) {
+				const CABiquadCoefficients &k = sections[s0 + s];
+				c[s].mB0 = _mm256_set1_ps(k.mB0);
+				c[s].mB1 = _mm256_set1_ps(k.mB1);
+				c[s].mB2 = _mm256_set1_ps(k.mB2);
+				c[s].mA1 = _mm256_set1_ps(k.mA1);
+				c[s].mA2 = _mm256_set1_ps(k.mA2);
+				z[2 * s] = _mm256_loadu_ps(&state[2 * (s0 + s) * nChannels + ch]);
+				z[2 * s + 1] = _mm256_loadu_ps(&state[(2 * (s0 + s) + 1) * nChannels + ch]);
+			}
+
+			UInt32 i = 0;
+			for (; i + 4 <= nFrames; i += 4) {
+				__m128 l0 = _mm_loadu_ps(c8[0] + i), l1 = _mm_loadu_ps(c8[1] + i), l2 = _mm_loadu_ps(c8[2] + i), l3 = _mm_loadu_ps(c8[3] + i);
+				__m128 h0 = _mm_loadu_ps(c8[4] + i), h1 = _mm_loadu_ps(c8[5] + i), h2 = _mm_loadu_ps(c8[6] + i), h3 = _mm_loadu_ps(c8[7] + i);
+				_MM_TRANSPOSE4_PS(l0, l1, l2, l3);
+				_MM_TRANSPOSE4_PS(h0, h1, h2, h3);
+				__m256 x0 = Cascade_AVX2(_mm256_insertf128_ps(_mm256_castps128_ps256(l0), h0, 1), c, z, n);
+				__m256 x1 = Cascade_AVX2(_mm256_insertf128_ps(_mm256_castps128_ps256(l1), h1, 1), c, z, n);
+				__m256 x2 = Cascade_AVX2(_mm256_insertf128_ps(_mm256_castps128_ps256(l2), h2, 1), c, z, n);
+				__m256 x3 = Cascade_AVX2(_mm256_insertf128_ps(_mm256_castps128_ps256(l3), h3, 1), c, z, n);
+				l0 = _mm256_castps256_ps128(x0);
+				l1 = _mm256_castps256_ps128(x1);
+				l2 = _mm256_castps256_ps128(x2);
+				l3 = _mm256_castps256_ps128(x3);
+				h0 = _mm256_extractf128_ps(x0, 1);
+				h1 = _mm256_extractf128_ps(x1, 1);
+				h2 = _mm256_extractf128_ps(x2, 1);
+				h3 = _mm256_extractf128_ps(x3, 1);
+				_MM_TRANSPOSE4_PS(l0, l1, l2, l3);
+				_MM_TRANSPOSE4_PS(h0, h1, h2, h3);
+				_mm_storeu_ps(c8[0] + i, l0);
+				_mm_storeu_ps(c8[1] + i, l1);
+				_mm_storeu_ps(c8[2] + i, l2);
+				_mm_storeu_ps(c8[3] + i, l3);
+				_mm_storeu_ps(c8[4] + i, h0);
+				_mm_storeu_ps(c8[5] + i, h1);
+				_mm_storeu_ps(c8[6] + i, h2);
+				_mm_storeu_ps(c8[7] + i, h3);
+			}
+			for (; i < nFrames; ++i) {
+				Float32 y[8];
+				__m256 x = _mm256_setr_ps(c8[0][i], c8[1][i], c8[2][i], c8[3][i], c8[4][i], c8[5][i], c8[6][i], c8[7][i]);
+				_mm256_storeu_ps(y, Cascade_AVX2(x, c, z, n));
+				for (UInt32 k = 0; k < 8; ++k)
+					c8[k][i] = y[k];
+			}
+
+			for (UInt32 s = 0; s < n; ++s) {
+				_mm256_storeu_ps(&state[2 * (s0 + s) * nChannels + ch], z[2 * s]);
+				_mm256_storeu_ps(&state[(2 * (s0 + s) + 1) * nChannels + ch], z[2 * s + 1]);
+			}
+		}
+	}
+	_mm256_zeroupper();		// ahead of the SSE2 and scalar code for what's left
+	return ch;
+}
+
+CADSP_AVX2 void Biquad_AVX2(Float32 *const *channels, UInt32 nChannels, UInt32 nFrames, const CABiquadCoefficients *sections,
+							UInt32 nSections, Float32 *state)
+{
+	UInt32 ch = BiquadGroups_AVX2(channels, 0, nChannels, nChannels, nFrames, sections, nSections, state);
+	ch = BiquadGroups_SSE2(channels, ch, nChannels, nChannels, nFrames, sections, nSections, state);
+	BiquadChannels(channels, ch, nChannels, nChannels, nFrames, sections, nSections, state);
+}
+
+const CABiquadKernels kAVX2Kernels = { "AVX2", Biquad_AVX2 };
+#endif // CADSP_X86
+
+#if CADSP_NEON
+#pragma mark -- NEON --
+
+struct Sections4 {
+	float32x4_t	mB0, mB1, mB2, mA1, mA2;
+};
+
+inline float32x4_t Cascade_NEON(float32x4_t x, const Sections4 *c, float32x4_t *z, UInt32 nSections)
+{
+	for (UInt32 s = 0; s < nSections; ++s) {
+		float32x4_t y = vaddq_f32(vmulq_f32(c[s].mB0, x), z[2 * s]);
+		z[2 * s] = vaddq_f32(vsubq_f32(vmulq_f32(c[s].mB1, x), vmulq_f32(c[s].mA1, y)), z[2 * s + 1]);
+		z[2 * s + 1] = vsubq_f32(vmulq_f32(c[s].mB2, x), vmulq_f32(c[s].mA2, y));
+		x = y;
+	}
+	return x;
+}
+
+inline void Transpose4_NEON(float32x4_t &r0, float32x4_t &r1, float32x4_t &r2, float32x4_t &r3)
+{
+	float32x4x2_t t01 = vtrnq_f32(r0, r1), t23 = vtrnq_f32(r2, r3);
+	r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+	r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+	r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+	r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+
+void Biquad_NEON(Float32 *const *channels, UInt32 nChannels, UInt32 nFrames, const CABiquadCoefficients *sections,
+				 UInt32 nSections, Float32 *state)
+{
+	UInt32 ch = 0;
+	for (; ch + 4 <= nChannels; ch += 4) {
+		Float32 *c0 = channels[ch], *c1 = channels[ch + 1], *c2 = channels[ch + 2], *c3 = channels[ch + 3];
+		for (UInt32 s0 = 0; s0 < nSections; s0 += kBatchSections) {
+			UInt32 n = std::min(kBatchSections, nSections - s0);
+			Sections4 c[kBatchSections];
+			float32x4_t z[2 * kBatchSections];
+			for (UInt32 s = 0; s < n; ++s) {
+				const CABiquadCoefficients &k = sections[s0 + s];
+				c[s].mB0 = vdupq_n_f32(k.mB0);
+				c[s].mB1 = vdupq_n_f32(k.mB1);
+				c[s].mB2 = vdupq_n_f32(k.mB2);
+				c[s].mA1 = vdupq_n_f32(k.mA1);
+				c[s].mA2 = vdupq_n_f32(k.mA2);
+				z[2 * s] = vld1q_f32(&state[2 * (s0 + s) * nChannels + ch]);
+				z[2 * s + 1] = vld1q_f32(&state[(2 * (s0 + s) + 1) * nChannels + ch]);
+			}
+
+			UInt32 i = 0;
+			for (; i + 4 <= nFrames; i += 4) {
+				float32x4_t x0 = vld1q_f32(c0 + i), x1 = vld1q_f32(c1 + i), x2 = vld1q_f32(c2 + i), x3 = vld1q_f32(c3 + i);
+				Transpose4_NEON(x0, x1, x2, x3);
+				x0 = Cascade_NEON(x0, c, z, n);
+				x1 = Cascade_NEON(x1, c, z, n);
+				x2 = Cascade_NEON(x2, c, z, n);
+				x3 = Cascade_NEON(x3, c, z, n);
+				Transpose4_NEON(x0, x1, x2, x3);
+				vst1q_f32(c0 + i, x0);
+				vst1q_f32(c1 + i, x1);
+				vst1q_f32(c2 + i, x2);
+				vst1q_f32(c3 + i, x3);
+			}
+			for (; i < nFrames; ++i) {
+				Float32 y[4] = { c0[i], c1[i], c2[i], c3[i] };
+				vst1q_f32(y, Cascade_NEON(vld1q_f32(y), c, z, n));
+				c0[i] = y[0];
+				c1[i] = y[1];
+				c2[i] = y[2];
+				c3[i] = y[3];
+			}
+
+			for (UInt32 s = 0; s < n; ++s) {
+				vst1q_f32(&state[2 * (s0 + s) * nChannels + ch], z[2 * s]);
+				vst1q_f32(&state[(2 * (s0 + s) + 1) * nChannels + ch], z[2 * s + 1]);
+			}
+		}
+	}
+	BiquadChannels(channels, ch, nChannels, nChannels, nFrames, sections, nSections, state);
+}
+
+const CABiquadKernels kNEONKernels = { "NEON", Biquad_NEON };
+#endif // CADSP_NEON
+
+} // namespace
+
+const CABiquadKernels *	CAGetBiquadKernels(CASampleConversionISA isa)
+{
+	switch (isa) {
+		case kCASampleConversionISA_Scalar:
+			return &kScalarKernels;
+#if CADSP_X86
+		case kCASampleConversionISA_SSE2:
+			return __builtin_cpu_supports("sse2") ? &kSSE2Kernels : NULL;
+		case kCASampleConversionISA_AVX2:
+			return __builtin_cpu_supports("avx2") ? &kAVX2Kernels : NULL;
+#endif
+#if CADSP_NEON
+		case kCASampleConversionISA_NEON:
+			return &kNEONKernels;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+static const CABiquadKernels *ChooseBestBiquadKernels()
+{
+	const CABiquadKernels *best = NULL;
+	for (int isa = kCASampleConversionISA_Count - 1; isa >= 0 && best == NULL; --isa)
+		best = CAGetBiquadKernels(CASampleConversionISA(isa));
+	return best;
+}
+
+const CABiquadKernels &	CAGetBestBiquadKernels()
+{
+	static const CABiquadKernels *best = ChooseBestBiquadKernels();
+	return *best;
+}
+
+#pragma mark -- CADSPEqualizer --
+
+CADSPEqualizer::CADSPEqualizer(const CABiquadKernels *kernels) :
+	mKernels(kernels ? kernels : &CAGetBestBiquadKernels()),
+	mNumberBands(0),
+	mSampleRate(0),
+	mChannels(0)
+{
+	mSections.mCount = 0;
+}
+
+CADSPChainError	CADSPEqualizer::SetBands(const CADSPEqualizerBand *bands, UInt32 nBands)
+{
+	if (nBands > kMaxBands)
+		return kCADSPChainError_Full;
+	ControlLock lock(*this);
+	std::copy(bands, bands + nBands, mBands);
+	mNumberBands = nBands;
+	if (mSampleRate > 0) {
+		Sections sections;
+		Design(sections);
+		mUpdates.Post(sections, mSampleRate);
+	}
+	return kCADSPChainError_OK;
+}
+
+// The Audio EQ Cookbook's, in double precision, with a0 divided out. The shelves' Q is its alpha's,
+// as the peaking filter's is.
+CABiquadCoefficients	CADSPEqualizer::Design(const CADSPEqualizerBand &band, Float64 sampleRate)
+{
+	Float64 frequency = std::min(std::max(band.mFrequency, 1.0), 0.49 * sampleRate);
+	Float64 w0 = 2.0 * M_PI * frequency / sampleRate;
+	Float64 cosw = cos(w0);
+	Float64 alpha = sin(w0) / (2.0 * std::max(band.mQ, 0.01));
+	Float64 A = pow(10.0, band.mGainDB / 40.0);
+	Float64 shelf = 2.0 * sqrt(A) * alpha;
+	Float64 b0, b1, b2, a0, a1, a2;
+	switch (band.mType) {
+		case kCADSPFilter_Peaking:
+			b0 = 1.0 + alpha * A;
+			b1 = -2.0 * cosw;
+			b2 = 1.0 - alpha * A;
+			a0 = 1.0 + alpha / A;
+			a1 = -2.0 * cosw;
+			a2 = 1.0 - alpha / A;
+			break;
+		case kCADSPFilter_LowShelf:
+			b0 = A * ((A + 1.0) - (A - 1.0) * cosw + shelf);
+			b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cosw);
+			b2 = A * ((A + 1.0) - (A - 1.0) * cosw - shelf);
+			a0 = (A + 1.0) + (A - 1.0) * cosw + shelf;
+			a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cosw);
+			a2 = (A + 1.0) + (A - 1.0) * cosw - shelf;
+			break;
+		case kCADSPFilter_HighShelf:
+			b0 = A * ((A + 1.0) + (A - 1.0) * cosw + shelf);
+			b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cosw);
+			b2 = A * ((A + 1.0) + (A - 1.0) * cosw - shelf);
+			a0 = (A + 1.0) - (A - 1.0) * cosw + shelf;
+			a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cosw);
+			a2 = (A + 1.0) - (A - 1.0) * cosw - shelf;
+			break;
+		case kCADSPFilter_LowPass:
+			b0 = (1.0 - cosw) / 2.0;
+			b1 = 1.0 - cosw;
+			b2 = (1.0 - cosw) / 2.0;
+			a0 = 1.0 + alpha;
+			a1 = -2.0 * cosw;
+			a2 = 1.0 - alpha;
+			break;
+		case kCADSPFilter_HighPass:
+		default:
+			b0 = (1.0 + cosw) / 2.0;
+			b1 = -(1.0 + cosw);
+			b2 = (1.0 + cosw) / 2.0;
+			a0 = 1.0 + alpha;
+			a1 = -2.0 * cosw;
+			a2 = 1.0 - alpha;
+			break;
+	}
+	CABiquadCoefficients c = { Float32(b0 / a0), Float32(b1 / a0), Float32(b2 / a0), Float32(a1 / a0), Float32(a2 / a0) };
+	return c;
+}
+
+void	CADSPEqualizer::Design(Sections &sections) const
+{
+	sections.mCount = mNumberBands;
+	for (UInt32 s = 0; s < mNumberBands; ++s)
+		sections.mCoefficients[s] = Design(mBands[s], mSampleRate);
+}
+
+void	CADSPEqualizer::Prepare(UInt32 nChannels, Float64 sampleRate)
+{
+	mChannels = nChannels;
+	mSampleRate = sampleRate;
+	mState.assign(2 * kMaxBands * nChannels, 0.0f);
+	Design(mSections);
+	mUpdates.Clear();
+}
+
+void	CADSPEqualizer::SetSampleRate(Float64 sampleRate)
+{
+	mSampleRate = sampleRate;
+	Sections sections;
+	Design(sections);
+	mUpdates.Post(sections, mSampleRate);
+}
+
+void	CADSPEqualizer::Reset()
+{
+	std::fill(mState.begin(), mState.end(), 0.0f);
+}
+
+// sections added since the last design start from silence, not from whatever they last held
+void	CADSPEqualizer::TakeUp(const Sections &sections)
+{
+	if (sections.mCount > mSections.mCount)
+		std::fill(mState.begin() + 2 * mSections.mCount * mChannels, mState.begin() + 2 * sections.mCount * mChannels, 0.0f);
+	mSections = sections;
+}
+
+void	CADSPEqualizer::Process(Float32 *const *channels, UInt32 nFrames)
+{
+	Sections sections;
+	if (mUpdates.Take(sections, GetRunningSampleRate()))
+		TakeUp(sections);
+	if (mSections.mCount)
+		mKernels->mProcess(channels, mChannels, nFrames, mSections.mCoefficients, mSections.mCount, mState.data());
+}
+
+#pragma mark -- CADSPGain --
+
+const Float64 CADSPGain::kRampSeconds = 0.005;
+
+CADSPGain::CADSPGain(Float32 gain) :
+	mGain(gain),
+	mSampleRate(0),
+	mChannels(0),
+	mFrom(gain),
+	mTo(gain),
+	mRampFrames(1),
+	mRampPosition(1),
+	mScale(CAGetBestSampleConverter().mScale)
+{
+}
+
+void	CADSPGain::SetGain(Float32 gain)
+{
+	ControlLock lock(*this);
+	Post(gain);
+}
+
+void	CADSPGain::Post(Float32 gain)
+{
+	mGain = gain;
+	if (mSampleRate > 0) {
+		Update update = { gain, std::max(UInt32(kRampSeconds * mSampleRate), 1u) };
+		mUpdates.Post(update, mSampleRate);
+	}
+}
+
+void	CADSPGain::Prepare(UInt32 nChannels, Float64 sampleRate)
+{
+	mChannels = nChannels;
+	mSampleRate = sampleRate;
+	mFrom = mTo = mGain;
+	mRampFrames = mRampPosition = std::max(UInt32(kRampSeconds * sampleRate), 1u);
+	mUpdates.Clear();
+}
+
+void	CADSPGain::SetSampleRate(Float64 sampleRate)
+{
+	mSampleRate = sampleRate;
+	Post(mGain);
+}
+
+void	CADSPGain::Reset()
+{
+	mFrom = mTo;
+	mRampPosition = mRampFrames;
+}
+
+Float32	CADSPGain::Current() const
+{
+	if (mRampPosition >= mRampFrames)
+		return mTo;
+	return mFrom + (mTo - mFrom) * (Float32(mRampPosition) / mRampFrames);
+}
+
+// Each frame of the ramp's gain comes from its position in the ramp, not from the frame before's,
+// so that where the blocks split it makes no difference.
+void	CADSPGain::Process(Float32 *const *channels, UInt32 nFrames)
+{
+	Update update;
+	if (mUpdates.Take(update, GetRunningSampleRate())) {
+		mFrom = Current();
+		mTo = update.mGain;
+		mRampFrames = update.mRampFrames;
+		mRampPosition = 0;
+	}
+
+	UInt32 ramped = 0;
+	if (mRampPosition < mRampFrames) {
+		ramped = std::min(nFrames, mRampFrames - mRampPosition);
+		Float32 delta = mTo - mFrom, scale = 1.0f / mRampFrames;
+		for (UInt32 ch = 0; ch < mChannels; ++ch) {
+			Float32 *x = channels[ch];
+			for (UInt32 i = 0; i < ramped; ++i)
+				x[i] *= mFrom + delta * (Float32(mRampPosition + i) * scale);
+		}
+		mRampPosition += ramped;
+	}
+	if (ramped < nFrames && mTo != 1.0f)
+		for (UInt32 ch = 0; ch < mChannels; ++ch)
+			mScale(channels[ch] + ramped, channels[ch] + ramped, mTo, nFrames - ramped);
+}
+
+#pragma mark -- CADSPLimiter --
+
+CADSPLimiter::CADSPLimiter(Float32 threshold, Float64 releaseSeconds) :
+	mThreshold(threshold),
+	mReleaseSeconds(releaseSeconds),
+	mSampleRate(0),
+	mChannels(0),
+	mReduction(0.0f)
+{
+	mCoefficients.mThreshold = threshold;
+	mCoefficients.mRelease = 0.0f;
+}
+
+void	CADSPLimiter::SetThreshold(Float32 threshold)
+{
+	ControlLock lock(*this);
+	mThreshold = threshold;
+	Publish();
+}
+
+void	CADSPLimiter::SetRelease(Float64 seconds)
+{
+	ControlLock lock(*this);
+	mReleaseSeconds = seconds;
+	Publish();
+}
+
+void	CADSPLimiter::Publish()
+{
+	if (mSampleRate <= 0)
+		return;
+	Coefficients coefficients;
+	coefficients.mThreshold = mThreshold;
+	coefficients.mRelease = mReleaseSeconds > 0 ? Float32(exp(-1.0 / (mReleaseSeconds * mSampleRate))) : 0.0f;
+	mUpdates.Post(coefficients, mSampleRate);
+}
+
+void	CADSPLimiter::Prepare(UInt32 nChannels, Float64 sampleRate)
+{
+	mChannels = nChannels;
+	mSampleRate = sampleRate;
+	Publish();
+	mUpdates.Take(mCoefficients, sampleRate);
+	mReduction = 0.0f;
+}
+
+void	CADSPLimiter::SetSampleRate(Float64 sampleRate)
+{
+	mSampleRate = sampleRate;
+	Publish();
+}
+
+void	CADSPLimiter::Reset()
+{
+	mReduction = 0.0f;
+}
+
+// A chunk at a time: every channel's peak for each frame, then the gain for each frame in turn,
+// then every channel scaled by it, unless none of it was reduced.
+void	CADSPLimiter::Process(Float32 *const *channels, UInt32 nFrames)
+{
+	mUpdates.Take(mCoefficients, GetRunningSampleRate());
+	const Float32 threshold = mCoefficients.mThreshold, release = mCoefficients.mRelease;
+	for (UInt32 first = 0; first < nFrames; first += kChunkFrames) {
+		UInt32 n = std::min(UInt32(kChunkFrames), nFrames - first);
+		std::fill(mGains, mGains + n, 0.0f);
+		for (UInt32 ch = 0; ch < mChannels; ++ch) {
+			const Float32 *x = channels[ch] + first;
+			for (UInt32 i = 0; i < n; ++i)
+				mGains[i] = std::max(mGains[i], fabsf(x[i]));
+		}
+
+		// the release decays the reduction rather than the gain, which near unity would stick
+		// a few hundred ulps short of it
+		Float32 reduction = mReduction, smallest = 1.0f;
+		for (UInt32 i = 0; i < n; ++i) {
+			reduction *= release;
+			Float32 gain = 1.0f - reduction;
+			if (mGains[i] * gain > threshold) {
+				gain = threshold / mGains[i];
+				reduction = 1.0f - gain;
+			}
+			mGains[i] = gain;
+			smallest = std::min(smallest, gain);
+		}
+		mReduction = reduction;
+
+		if (smallest < 1.0f)
+			for (UInt32 ch = 0; ch < mChannels; ++ch) {
+				Float32 *x = channels[ch] + first;
+				for (UInt32 i = 0; i < n; ++i)
+					x[i] *= mGains[i];
+			}
+	}
+}
+
+#pragma mark -- CADSPDelay --
+
+const Float64 CADSPDelay::kMaxSampleRate = 192000.0;
+
+CADSPDelay::CADSPDelay(Float64 maxSeconds, Float64 seconds) :
+	mMaxSeconds(maxSeconds),
+	mSeconds(seconds),
+	mFeedback(0.0f),
+	mMix(1.0f),
+	mSampleRate(0),
+	mChannels(0),
+	mLength(0),
+	mWrite(0),
+	mFilled(0)
+{
+	mCoefficients = Design();
+}
+
+// the delay as far as the lines go at this rate
+CADSPDelay::Coefficients	CADSPDelay::Design() const
+{
+	Coefficients coefficients;
+	Float64 frames = floor(std::max(mSeconds, 0.0) * mSampleRate + 0.5);
+	coefficients.mFrames = std::min(UInt32(frames), GetMaxDelayFrames());
+	coefficients.mFeedback = mFeedback;
+	coefficients.mDry = 1.0f - mMix;
+	coefficients.mWet = mMix;
+	return coefficients;
+}
+
+void	CADSPDelay::SetDelay(Float64 seconds)
+{
+	ControlLock lock(*this);
+	mSeconds = seconds;
+	if (mSampleRate > 0)
+		mUpdates.Post(Design(), mSampleRate);
+}
+
+void	CADSPDelay::SetFeedback(Float32 feedback)
+{
+	ControlLock lock(*this);
+	mFeedback = feedback;
+	if (mSampleRate > 0)
+		mUpdates.Post(Design(), mSampleRate);
+}
+
+void	CADSPDelay::SetMix(Float32 mix)
+{
+	ControlLock lock(*this);
+	mMix = mix;
+	if (mSampleRate > 0)
+		mUpdates.Post(Design(), mSampleRate);
+}
+
+UInt32	CADSPDelay::GetMaxDelayFrames() const
+{
+	if (mLength == 0)
+		return 0;
+	return UInt32(std::min(floor(mMaxSeconds * mSampleRate + 0.5), Float64(mLength - 1)));
+}
+
+// the lines for the maximum at kMaxSampleRate, or the rate prepared for if that's higher, so that
+// SetSampleRate, which can't allocate them again, never cuts the delay short
+void	CADSPDelay::Prepare(UInt32 nChannels, Float64 sampleRate)
+{
+	mChannels = nChannels;
+	mSampleRate = sampleRate;
+	UInt32 frames = UInt32(ceil(mMaxSeconds * std::max(sampleRate, kMaxSampleRate))) + 1;
+	for (mLength = 2; mLength < frames; mLength *= 2) { }
+	mLines.assign(nChannels * mLength, 0.0f);
+	mWrite = 0;
+	mFilled = 0;
+	mCoefficients = Design();
+	mUpdates.Clear();
+}
+
+void	CADSPDelay::SetSampleRate(Float64 sampleRate)
+{
+	mSampleRate = sampleRate;
+	mUpdates.Post(Design(), mSampleRate);
+}
+
+// The lines are as long as the maximum at kMaxSampleRate, too long to clear on the IO thread: what
+// was written before the reset is left there, and Process reads silence in its place.
+void	CADSPDelay::Reset()
+{
+	mFilled = 0;
+}
+
+void	CADSPDelay::Process(Float32 *const *channels, UInt32 nFrames)
+{
+	mUpdates.Take(mCoefficients, GetRunningSampleRate());
+	const UInt32 delay = mCoefficients.mFrames, mask = mLength - 1;
+	const Float32 feedback = mCoefficients.mFeedback, dry = mCoefficients.mDry, wet = mCoefficients.mWet;
+	// the frames whose delayed frame would be from before the reset
+	const UInt32 silent = (mFilled < delay) ? std::min(nFrames, delay - mFilled) : 0;
+	for (UInt32 ch = 0; ch < mChannels; ++ch) {
+		Float32 *x = channels[ch];
+		Float32 *line = &mLines[ch * mLength];
+		UInt32 w = mWrite, i = 0;
+		if (delay == 0) {
+			for (; i < nFrames; ++i, ++w) {
+				Float32 in = x[i];
+				line[w & mask] = in;
+				x[i] = dry * in + wet * in;
+			}
+		} else {
+			for (; i < silent; ++i, ++w) {
+				Float32 in = x[i];
+				line[w & mask] = in;
+				x[i] = dry * in;
+			}
+			for (; i < nFrames; ++i, ++w) {
+				Float32 in = x[i];
+				Float32 delayed = line[(w - delay) & mask];
+				line[w & mask] = in + feedback * delayed;
+				x[i] = dry * in + wet * delayed;
+			}
+		}
+	}
+	mWrite = (mWrite + nFrames) & mask;
+	mFilled = std::min(mFilled + nFrames, mLength);
+}
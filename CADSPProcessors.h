@@ -0,0 +1,245 @@
+/*=============================================================================
+	CADSPProcessors.h
+
+	The processors for a CADSPChain. Each one's setters are for the control
+	thread: they design the coefficients there and post them for Process to
+	take up at its next block.
+
+	CADSPEqualizer runs every channel through up to kMaxBands cascaded
+	biquads, designed from the Audio EQ Cookbook's peaking, shelving and
+	pass filters. Its kernels work across channels rather than along them,
+	which a recursive filter can't be: four channels at a time in an SSE2
+	or NEON vector, eight in AVX2, transposing four frames of each between
+	the channels' buffers and the vectors. The kernels are chosen as
+	CASampleConversion's are, and the leftover channels run on the scalar
+	kernel. A change of bands takes effect at the next block, without
+	smoothing.
+
+	CADSPGain ramps to each new gain over kRampSeconds, and scales the
+	steady gain with CASampleConversion's kernel. CADSPLimiter holds every
+	channel's peak under a threshold with one gain for all of them, taking
+	it down at once when a peak would go over and letting it back up over
+	the release time; it has no lookahead. CADSPDelay delays each channel
+	by up to the maximum it was made with, at any rate up to kMaxSampleRate,
+	with feedback and a mix of the delayed signal with the input; a change
+	of delay jumps. Its Reset leaves the lines as they are, and Process
+	reads silence in place of anything written before it.
+=============================================================================*/
+
+#ifndef __CADSPProcessors_h__
+#define __CADSPProcessors_h__
+
+#include "CADSPChain.h"
+#include "CASampleConversion.h"
+
+#include <vector>
+
+#pragma mark -- Biquads --
+
+struct CABiquadCoefficients {
+	Float32		mB0, mB1, mB2;
+	Float32		mA1, mA2;			// with a0 divided out
+};
+
+typedef void (*CABiquadProc)(Float32 *const *channels, UInt32 nChannels, UInt32 nFrames,
+							 const CABiquadCoefficients *sections, UInt32 nSections, Float32 *state);
+	// each channel through nSections cascaded transposed direct form II biquads, in place.
+	// state[(2 * section + k) * nChannels + channel] is the section's kth delay for the channel.
+
+struct CABiquadKernels {
+	const char *	mName;
+	CABiquadProc	mProcess;
+};
+
+const CABiquadKernels *	CAGetBiquadKernels(CASampleConversionISA isa);
+							// NULL if the kernels for isa were not built or the CPU lacks them
+const CABiquadKernels &	CAGetBestBiquadKernels();
+
+#pragma mark -- Equalizer --
+
+enum CADSPFilterType {
+	kCADSPFilter_Peaking = 0,
+	kCADSPFilter_LowShelf,
+	kCADSPFilter_HighShelf,
+	kCADSPFilter_LowPass,
+	kCADSPFilter_HighPass
+};
+
+struct CADSPEqualizerBand {
+	CADSPFilterType	mType;
+	Float64			mFrequency;		// Hz: the centre, the shelf's midpoint or the cutoff
+	Float64			mQ;
+	Float64			mGainDB;		// for the peaking and shelving filters
+};
+
+class CADSPEqualizer : public CADSPProcessor {
+public:
+	static const UInt32 kMaxBands = 8;
+
+	CADSPEqualizer(const CABiquadKernels *kernels = NULL);
+
+	CADSPChainError		SetBands(const CADSPEqualizerBand *bands, UInt32 nBands);
+							// kCADSPChainError_Full for more than kMaxBands
+	UInt32				GetNumberBands() const { return mNumberBands; }
+	const CADSPEqualizerBand &	GetBand(UInt32 band) const { return mBands[band]; }
+
+	static CABiquadCoefficients	Design(const CADSPEqualizerBand &band, Float64 sampleRate);
+
+	// CADSPProcessor
+	const char *		GetName() const override { return "Equalizer"; }
+	void				Prepare(UInt32 nChannels, Float64 sampleRate) override;
+	void				SetSampleRate(Float64 sampleRate) override;
+	void				Reset() override;
+	void				Process(Float32 *const *channels, UInt32 nFrames) override;
+
+private:
+	struct Sections {
+		UInt32					mCount;
+		CABiquadCoefficients	mCoefficients[kMaxBands];
+	};
+
+	void				Design(Sections &sections) const;
+	void				TakeUp(const Sections &sections);
+
+	const CABiquadKernels *	mKernels;
+	CADSPEqualizerBand		mBands[kMaxBands];	// the control thread's, as is the rate
+	UInt32					mNumberBands;
+	Float64					mSampleRate;
+	CADSPUpdates<Sections>	mUpdates;
+	Sections				mSections;			// the IO thread's, as is the state
+	UInt32					mChannels;
+	std::vector<Float32>	mState;
+};
+
+#pragma mark -- Gain --
+
+class CADSPGain : public CADSPProcessor {
+public:
+	static const Float64 kRampSeconds;
+
+	CADSPGain(Float32 gain = 1.0f);
+
+	void				SetGain(Float32 gain);
+							// linear
+	Float32				GetGain() const { return mGain; }
+
+	// CADSPProcessor
+	const char *		GetName() const override { return "Gain"; }
+	void				Prepare(UInt32 nChannels, Float64 sampleRate) override;
+	void				SetSampleRate(Float64 sampleRate) override;
+	void				Reset() override;
+	void				Process(Float32 *const *channels, UInt32 nFrames) override;
+
+private:
+	struct Update {
+		Float32		mGain;
+		UInt32		mRampFrames;
+	};
+
+	Float32				Current() const;
+	void				Post(Float32 gain);
+
+	Float32					mGain;				// the control thread's, as is the rate
+	Float64					mSampleRate;
+	CADSPUpdates<Update>	mUpdates;
+	UInt32					mChannels;			// the IO thread's from here on
+	Float32					mFrom;
+	Float32					mTo;
+	UInt32					mRampFrames;
+	UInt32					mRampPosition;		// frames into the ramp; mRampFrames once it's over
+	CAScaleFloat32Proc		mScale;
+};
+
+#pragma mark -- Limiter --
+
+class CADSPLimiter : public CADSPProcessor {
+public:
+	CADSPLimiter(Float32 threshold = 1.0f, Float64 releaseSeconds = 0.05);
+
+	void				SetThreshold(Float32 threshold);
+							// the largest magnitude out, linear
+	void				SetRelease(Float64 seconds);
+							// the time constant of the gain's return towards unity
+	Float32				GetThreshold() const { return mThreshold; }
+	Float64				GetRelease() const { return mReleaseSeconds; }
+
+	// CADSPProcessor
+	const char *		GetName() const override { return "Limiter"; }
+	void				Prepare(UInt32 nChannels, Float64 sampleRate) override;
+	void				SetSampleRate(Float64 sampleRate) override;
+	void				Reset() override;
+	void				Process(Float32 *const *channels, UInt32 nFrames) override;
+
+private:
+	enum { kChunkFrames = 256 };
+
+	struct Coefficients {
+		Float32		mThreshold;
+		Float32		mRelease;			// what's left of the gain reduction after a frame
+	};
+
+	void				Publish();
+
+	Float32					mThreshold;			// the control thread's, as are the two below
+	Float64					mReleaseSeconds;
+	Float64					mSampleRate;
+	CADSPUpdates<Coefficients>	mUpdates;
+	Coefficients			mCoefficients;		// the IO thread's from here on
+	UInt32					mChannels;
+	Float32					mReduction;			// 1 less the gain
+	Float32					mGains[kChunkFrames];	// each frame's peak, then its gain
+};
+
+#pragma mark -- Delay --
+
+class CADSPDelay : public CADSPProcessor {
+public:
+	static const Float64 kMaxSampleRate;
+
+	CADSPDelay(Float64 maxSeconds = 1.0, Float64 seconds = 0.0);
+
+	void				SetDelay(Float64 seconds);
+							// up to the maximum, at the rate prepared for
+	void				SetFeedback(Float32 feedback);
+							// of the delayed signal, back into the delay
+	void				SetMix(Float32 mix);
+							// 1, the default, for only the delayed signal; 0 for only the input
+	Float64				GetDelay() const { return mSeconds; }
+	Float32				GetFeedback() const { return mFeedback; }
+	Float32				GetMix() const { return mMix; }
+	UInt32				GetMaxDelayFrames() const;
+							// the maximum it was made with, at the rate prepared for or set since; the
+							// lines hold it at up to kMaxSampleRate
+
+	// CADSPProcessor
+	const char *		GetName() const override { return "Delay"; }
+	void				Prepare(UInt32 nChannels, Float64 sampleRate) override;
+	void				SetSampleRate(Float64 sampleRate) override;
+	void				Reset() override;
+	void				Process(Float32 *const *channels, UInt32 nFrames) override;
+
+private:
+	struct Coefficients {
+		UInt32		mFrames;
+		Float32		mFeedback;
+		Float32		mDry;
+		Float32		mWet;
+	};
+
+	Coefficients		Design() const;
+
+	Float64					mMaxSeconds;		// the control thread's, down to the rate
+	Float64					mSeconds;
+	Float32					mFeedback;
+	Float32					mMix;
+	Float64					mSampleRate;
+	CADSPUpdates<Coefficients>	mUpdates;
+	Coefficients			mCoefficients;		// the IO thread's from here on
+	UInt32					mChannels;
+	UInt32					mLength;			// each channel's line, a power of two
+	UInt32					mWrite;				// where the next frame goes, less mLength's multiples
+	UInt32					mFilled;			// frames written since the reset, up to mLength
+	std::vector<Float32>	mLines;
+};
+
+#endif // __CADSPProcessors_h__
@@ -0,0 +1,57 @@
+/*=============================================================================
+	CADriftController.cpp
+
+=============================================================================*/
+
+#include "CADriftController.h"
+
+#include <algorithm>
+#include <cmath>
+
+const Float64 CADriftController::kDefaultBandwidth = 0.05;
+const Float64 CADriftController::kDefaultMaxRateDeviation = 0.005;
+
+CADriftController::CADriftController() :
+	mMaxDeviation(kDefaultMaxRateDeviation),
+	mIntegral(1.0),
+	mRate(1.0)
+{
+	SetBandwidth(kDefaultBandwidth);
+}
+
+void	CADriftController::SetBandwidth(Float64 hz)
+{
+	Float64 w = 2.0 * M_PI * hz;
+	mBandwidth = hz;
+	mKp = 2.0 * w;
+	mKi = w * w;
+}
+
+void	CADriftController::SetMaxRateDeviation(Float64 deviation)
+{
+	mMaxDeviation = deviation;
+	mIntegral = Clamp(mIntegral);
+	mRate = Clamp(mRate);
+}
+
+Float64	CADriftController::Clamp(Float64 rate) const
+{
+	return std::max(1.0 - mMaxDeviation, std::min(1.0 + mMaxDeviation, rate));
+}
+
+void	CADriftController::Reset(Float64 rate)
+{
+	mIntegral = Clamp(rate);
+	mRate = mIntegral;
+}
+
+Float64	CADriftController::Update(Float64 latencyError, Float64 elapsed)
+{
+	Float64 rate = mIntegral + mKp * latencyError;
+	mRate = Clamp(rate);
+
+	// don't wind up while the rate is pinned at a limit
+	if (rate == mRate || (rate > mRate) != (latencyError > 0.0))
+		mIntegral = Clamp(mIntegral + mKi * latencyError * elapsed);
+	return mRate;
+}
@@ -0,0 +1,63 @@
+/*=============================================================================
+	CADriftController.h
+
+	Steers the varispeed rate between two free-running devices so that the
+	latency through the ring buffer settles on a target and stays there.
+
+	It is a second-order loop, a PI controller on the latency error, like
+	the delay-locked loops used to follow an audio clock: the proportional
+	term corrects the error and the integral term learns the ratio between
+	the two clocks, so that in steady state the error is zero with no
+	correction left to apply. With the latency error e in seconds and the
+	rate r = 1 + x, the loop is e'' + Kp e' + Ki e = 0; it is critically
+	damped with Kp = 2w and Ki = w^2, w being 2 pi times the bandwidth.
+	A narrower bandwidth rides out more callback jitter but takes longer
+	to settle: about 1 / bandwidth seconds to within a few percent.
+
+	The rate never strays further than the maximum deviation from 1, which
+	keeps any pitch change inaudible, and the integral stops growing while
+	the rate is held at that limit.
+=============================================================================*/
+
+#ifndef __CADriftController_h__
+#define __CADriftController_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+class CADriftController {
+public:
+	CADriftController();
+
+	void		SetBandwidth(Float64 hz);
+	Float64		GetBandwidth() const { return mBandwidth; }
+	void		SetMaxRateDeviation(Float64 deviation);
+					// fraction either side of 1
+	Float64		GetMaxRateDeviation() const { return mMaxDeviation; }
+
+	void		Reset(Float64 rate = 1.0);
+					// starts again from rate, the best guess at the clocks' ratio
+	Float64		Update(Float64 latencyError, Float64 elapsed);
+					// latencyError: measured minus target latency, in seconds (positive when
+					// there is too much). elapsed: seconds since the last update. Returns the
+					// rate to play at, in input frames per output frame.
+	Float64		GetRate() const { return mRate; }
+	Float64		Clamp(Float64 rate) const;
+					// rate, held within the maximum deviation from 1
+
+	static const Float64	kDefaultBandwidth;		// Hz
+	static const Float64	kDefaultMaxRateDeviation;
+
+private:
+	Float64		mBandwidth;
+	Float64		mKp;
+	Float64		mKi;
+	Float64		mMaxDeviation;
+	Float64		mIntegral;		// the learned rate
+	Float64		mRate;
+};
+
+#endif // __CADriftController_h__
@@ -0,0 +1,62 @@
+/*=============================================================================
+	CAMailbox.h
+
+	A single-value mailbox from one thread to another: the writer posts
+	values, the reader takes the latest one, and values posted in between
+	are lost. Neither side ever waits for the other.
+
+	It is a triple buffer: the writer fills a slot of its own and swaps it
+	with the middle one, and the reader, when the middle one is new, swaps
+	it with its own and reads that. T is copied in and out, so should be
+	small and trivially copyable.
+=============================================================================*/
+
+#ifndef __CAMailbox_h__
+#define __CAMailbox_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include <atomic>
+
+template <typename T>
+class CAMailbox {
+public:
+	CAMailbox() : mMiddle(1), mBack(0), mFront(2) { }
+
+	void		Post(const T &value)
+					// from the writer
+	{
+		mSlots[mBack] = value;
+		mBack = mMiddle.exchange(mBack | kNew, std::memory_order_acq_rel) & kIndex;
+	}
+
+	bool		Take(T &value)
+					// from the reader: the latest value posted, if there has been one since the last Take
+	{
+		if (!(mMiddle.load(std::memory_order_relaxed) & kNew))
+			return false;
+		mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & kIndex;
+		value = mSlots[mFront];
+		return true;
+	}
+
+	void		Clear()
+					// forget anything posted; call while neither side is using it
+	{
+		mMiddle.store(mMiddle.load(std::memory_order_relaxed) & kIndex, std::memory_order_relaxed);
+	}
+
+private:
+	enum { kIndex = 3, kNew = 4 };
+
+	T						mSlots[3];
+	std::atomic<UInt32>		mMiddle;	// the middle slot's index, and kNew if the writer put it there since the reader last took
+	UInt32					mBack;		// the writer's
+	UInt32					mFront;		// the reader's
+};
+
+#endif // __CAMailbox_h__
@@ -39,7 +39,7 @@
 			POSSIBILITY OF SUCH DAMAGE.
 */
 #include "CAPlayThrough.h"
-#include <algorithm>
+#include "CAPlayThroughEngine.h"
 
 #pragma mark -- CAPlayThrough
 
@@ -47,23 +47,34 @@
 #define CAPT_DEBUG(msg, args...)
 
 // we define the class here so that is is not accessible from any object aside from CAPlayThroughManager
-class CAPlayThrough 
+// it is the CAPlayThroughBackend for real devices: the engine does the play-through itself
+class CAPlayThrough : public CAPlayThroughBackend
 {
 public:
-	CAPlayThrough(AudioDeviceID input, AudioDeviceID output);
+	CAPlayThrough();
 	~CAPlayThrough();
 	
-	OSStatus	Init(AudioDeviceID input, AudioDeviceID output);
+	OSStatus	Init(AudioDeviceID input, AudioDeviceID output);	// once, before anything else; if it fails, delete it
 	void		Cleanup();
-	OSStatus	Start();
-	OSStatus	Stop();
+	OSStatus	Start() override;
+	OSStatus	Stop() override;
 	Boolean		IsRunning();
 	OSStatus	SetInputDeviceAsCurrent(AudioDeviceID in);
 	OSStatus	SetOutputDeviceAsCurrent(AudioDeviceID out);
+	OSStatus	Reconfigure();
 	
 	AudioDeviceID GetInputDeviceID()	{ return mInputDevice.mID;	}
 	AudioDeviceID GetOutputDeviceID()	{ return mOutputDevice.mID; }
 	
+	// CAPlayThroughBackend
+	void		SetClient(Client *client) override { }	// always mEngine
+	CAPlayThroughDeviceInfo	GetDeviceInfo(Direction direction) override;
+	bool		HasVarispeed() override { return true; }	// the graph's Varispeed AU
+	OSStatus	GetCurrentTime(Direction direction, AudioTimeStamp &outTime) override;
+	OSStatus	RenderInput(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData) override;
+	OSStatus	SetPlaybackRate(Float64 rate) override;
+	UInt64		GetCurrentHostTime() override { return AudioGetCurrentHostTime(); }
+	Float64		GetHostClockFrequency() override { return AudioGetHostClockFrequency(); }
 
 private:
 	OSStatus SetupGraph(AudioDeviceID out);
@@ -73,8 +84,7 @@ private:
 	OSStatus EnableIO();
 	OSStatus CallbackSetup();
 	OSStatus SetupBuffers();
-	
-	void ComputeThruOffset();
+	OSStatus SetUnitRates(Float64 inputRate, Float64 outputRate);
 	
 	static OSStatus InputProc(void *inRefCon,
 							  AudioUnitRenderActionFlags *ioActionFlags,
@@ -91,9 +101,12 @@ private:
 							   AudioBufferList *	ioData);
 											
 	AudioUnit mInputUnit;
-	AudioBufferList *mInputBuffer;
 	AudioDevice mInputDevice, mOutputDevice;
-	CARingBuffer *mBuffer;
+	CAPlayThroughEngine mEngine;
+	
+	//the arguments of the current InputProc, for RenderInput
+	AudioUnitRenderActionFlags *mRenderActionFlags;
+	UInt32 mRenderBusNumber;
 	
 	//AudioUnits and Graph
 	AUGraph mGraph;
@@ -101,33 +114,23 @@ private:
 	AudioUnit mVarispeedUnit;
 	AUNode mOutputNode;
 	AudioUnit mOutputUnit;
-	
-	//Buffer sample info
-	Float64 mFirstInputTime;
-	Float64 mFirstOutputTime;
-	Float64 mInToOutSampleOffset;
-    
-    static Float64 kAdjustmentOffsetSamples;
 };
 
-Float64 CAPlayThrough::kAdjustmentOffsetSamples = 128.0;
-
 #pragma mark ---Public Methods---
 
 
 #pragma mark ---CAPlayThrough Methods---
-CAPlayThrough::CAPlayThrough(AudioDeviceID input, AudioDeviceID output):
-mBuffer(NULL),
-mFirstInputTime(-1),
-mFirstOutputTime(-1),
-mInToOutSampleOffset(0)
+CAPlayThrough::CAPlayThrough():
+mInputUnit(NULL),
+mEngine(*this),
+mRenderActionFlags(NULL),
+mRenderBusNumber(0),
+mGraph(NULL),
+mVarispeedNode(0),
+mVarispeedUnit(NULL),
+mOutputNode(0),
+mOutputUnit(NULL)
 {
-	OSStatus err = noErr;
-	err =Init(input,output);
-    if(err) {
-		fprintf(stderr,"CAPlayThrough ERROR: Cannot Init CAPlayThrough");
-		exit(1);
-	}
 }
 
 CAPlayThrough::~CAPlayThrough()
@@ -163,28 +166,31 @@ OSStatus CAPlayThrough::Init(AudioDeviceID input, AudioDeviceID output)
 	checkErr(err);
 	
 	//Add latency between the two devices
-	ComputeThruOffset();
+	mEngine.ComputeThruOffset();
 		
 	return err;	
 }
 
+//however far Init got
 void CAPlayThrough::Cleanup()
 {
 	//clean up
 	Stop();
 									
-	delete mBuffer;
-	mBuffer = 0;
-	if(mInputBuffer){
-		for(UInt32 i = 0; i<mInputBuffer->mNumberBuffers; i++)
-			free(mInputBuffer->mBuffers[i].mData);
-		free(mInputBuffer);
-		mInputBuffer = 0;
-	}
+	mEngine.Deallocate();
 	
-	AudioUnitUninitialize(mInputUnit);
-	AUGraphClose(mGraph);
-	DisposeAUGraph(mGraph);
+	if(mInputUnit)
+	{
+		AudioUnitUninitialize(mInputUnit);
+		CloseComponent(mInputUnit);
+		mInputUnit = NULL;
+	}
+	if(mGraph)
+	{
+		AUGraphClose(mGraph);
+		DisposeAUGraph(mGraph);
+		mGraph = NULL;
+	}
 }
 
 #pragma mark --- Operation---
@@ -201,8 +207,8 @@ OSStatus CAPlayThrough::Start()
 		checkErr(err);
 		
 		//reset sample times
-		mFirstInputTime = -1;
-		mFirstOutputTime = -1;
+		mEngine.Reset();
+		mEngine.StartControlThread();
 	}
 	return err;	
 }
@@ -214,8 +220,8 @@ OSStatus CAPlayThrough::Stop()
 		//Stop the AUHAL
 		err = AudioOutputUnitStop(mInputUnit);
 		err = AUGraphStop(mGraph);
-		mFirstInputTime = -1;
-		mFirstOutputTime = -1;
+		mEngine.StopControlThread();
+		mEngine.Reset();
 	}
 	return err;
 }
@@ -224,7 +230,7 @@ Boolean CAPlayThrough::IsRunning()
 {	
 	OSStatus err = noErr;
 	UInt32 auhalRunning = 0, size = 0;
-	Boolean graphRunning;
+	Boolean graphRunning = false;
 	size = sizeof(auhalRunning);
 	if(mInputUnit)
 	{
@@ -301,6 +307,65 @@ OSStatus CAPlayThrough::SetInputDeviceAsCurrent(AudioDeviceID in)
 	return err;
 }
 
+//Takes up a change of the devices' sample rates, keeping the units, the graph and the engine's buffers.
+//The units only take new formats while they're stopped, so a running play-through stops for as long as
+//that takes and starts again from silence, as it would after Stop and Start. A change of either device's
+//channel count can't be taken up this way: it's returned as kCAPlayThroughSessionError_FormatChanged,
+//before anything is stopped, for the caller to make the play-through again. On any other error the
+//units get their old rates back, and a play-through that was running is started again.
+OSStatus CAPlayThrough::Reconfigure()
+{
+	OSStatus err = noErr;
+	CAStreamBasicDescription asbd, asbd_mixed, asbd_dev1_in, asbd_dev2_out;
+	UInt32 propertySize = sizeof(asbd);
+	err = AudioUnitGetProperty(mInputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 1, &asbd, &propertySize);
+	checkErr(err);
+	propertySize = sizeof(asbd_mixed);
+	err = AudioUnitGetProperty(mVarispeedUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &asbd_mixed, &propertySize);
+	checkErr(err);
+	
+	//the device sides of the units follow the devices by themselves
+	propertySize = sizeof(asbd_dev1_in);
+	err = AudioUnitGetProperty(mInputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 1, &asbd_dev1_in, &propertySize);
+	checkErr(err);
+	propertySize = sizeof(asbd_dev2_out);
+	err = AudioUnitGetProperty(mOutputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &asbd_dev2_out, &propertySize);
+	checkErr(err);
+	if(asbd.mChannelsPerFrame != asbd_dev1_in.mChannelsPerFrame || asbd_mixed.mChannelsPerFrame != asbd_dev2_out.mChannelsPerFrame)
+		return kCAPlayThroughSessionError_FormatChanged;
+	
+	Boolean running = IsRunning();
+	if(running)
+		Stop();
+	
+	AudioDevice oldInput = mInputDevice, oldOutput = mOutputDevice;
+	mInputDevice.Init(mInputDevice.mID, true);
+	mOutputDevice.Init(mOutputDevice.mID, false);
+	err = SetUnitRates(mInputDevice.mFormat.mSampleRate, mOutputDevice.mFormat.mSampleRate);
+	
+	//the new pipeline, built here and changed over to while the units are stopped, so that a change
+	//the IO procs never called back for since can't hold this one up
+	if(!err)
+		err = mEngine.Reconfigure(false);
+	
+	if(err)
+	{
+		fprintf(stdout, "CAPlayThrough Error: %ld -> %s: %d: back to the old rates\n", (long)err, __FILE__, __LINE__);
+		fflush(stdout);
+		mInputDevice = oldInput;
+		mOutputDevice = oldOutput;
+		SetUnitRates(asbd.mSampleRate, asbd_mixed.mSampleRate);
+	}
+	
+	if(running)
+	{
+		OSStatus startErr = Start();
+		if(!err)
+			err = startErr;
+	}
+	return err;
+}
+
 #pragma mark -
 #pragma mark --Private methods---
 OSStatus CAPlayThrough::SetupGraph(AudioDeviceID out)
@@ -413,10 +478,11 @@ OSStatus CAPlayThrough::SetupAUHAL(AudioDeviceID in)
 	
 	//Finds a component that meets the desc spec's
 	comp = FindNextComponent(NULL, &desc);
-	if (comp == NULL) exit (-1);
+	if (comp == NULL) return kAudioUnitErr_FailedInitialization;
 	
 	//gains access to the services provided by the component
-	OpenAComponent(comp, &mInputUnit);  
+	err = OpenAComponent(comp, &mInputUnit);  
+	checkErr(err);
 
 	//AUHAL needs to be initialized before anything is done to it
 	err = AudioUnitInitialize(mInputUnit);
@@ -489,17 +555,55 @@ OSStatus CAPlayThrough::CallbackSetup()
 	return err;
 }
 
-inline void MakeBufferSilent (AudioBufferList * ioData)
+//Gives the units new rates: the AUHAL's client side and the varispeed's input the input device's, and the
+//varispeed's output and the output unit's input the output device's. The units must be stopped. They're
+//initialized again however far it got, so that a failure leaves them with the rates they had, or can be
+//given them back.
+OSStatus CAPlayThrough::SetUnitRates(Float64 inputRate, Float64 outputRate)
 {
-	for(UInt32 i=0; i<ioData->mNumberBuffers;i++)
-		memset(ioData->mBuffers[i].mData, 0, ioData->mBuffers[i].mDataByteSize);	
+	OSStatus err = noErr;
+	CAStreamBasicDescription asbd, asbd_mixed;
+	UInt32 propertySize = sizeof(asbd);
+	err = AudioUnitGetProperty(mInputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 1, &asbd, &propertySize);
+	checkErr(err);
+	propertySize = sizeof(asbd_mixed);
+	err = AudioUnitGetProperty(mVarispeedUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &asbd_mixed, &propertySize);
+	checkErr(err);
+	
+	AudioUnitUninitialize(mInputUnit);
+	AudioUnitUninitialize(mVarispeedUnit);
+	AudioUnitUninitialize(mOutputUnit);
+	
+	asbd.mSampleRate = inputRate;
+	propertySize = sizeof(asbd);
+	err = AudioUnitSetProperty(mInputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 1, &asbd, propertySize);
+	if(!err)
+	{
+		asbd_mixed.mSampleRate = inputRate;
+		err = AudioUnitSetProperty(mVarispeedUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &asbd_mixed, propertySize);
+	}
+	if(!err)
+	{
+		asbd_mixed.mSampleRate = outputRate;
+		err = AudioUnitSetProperty(mVarispeedUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0, &asbd_mixed, propertySize);
+	}
+	if(!err)
+		err = AudioUnitSetProperty(mOutputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &asbd_mixed, propertySize);
+	
+	OSStatus initErr = AudioUnitInitialize(mInputUnit);
+	OSStatus varispeedErr = AudioUnitInitialize(mVarispeedUnit);
+	OSStatus outputErr = AudioUnitInitialize(mOutputUnit);
+	if(!err)
+		err = initErr ? initErr : (varispeedErr ? varispeedErr : outputErr);
+	checkErr(err);
+	return err;
 }
 
 //Allocate Audio Buffer List(s) to hold the data from input.
 OSStatus CAPlayThrough::SetupBuffers()
 {
 	OSStatus err = noErr;
-	UInt32 bufferSizeFrames,bufferSizeBytes,propsize;
+	UInt32 bufferSizeFrames;
 	
 	CAStreamBasicDescription asbd,asbd_dev1_in,asbd_dev2_out;			
 	Float64 rate=0;
@@ -507,7 +611,6 @@ OSStatus CAPlayThrough::SetupBuffers()
 	//Get the size of the IO buffer(s)
 	UInt32 propertySize = sizeof(bufferSizeFrames);
 	err = AudioUnitGetProperty(mInputUnit, kAudioDevicePropertyBufferFrameSize, kAudioUnitScope_Global, 0, &bufferSizeFrames, &propertySize);
-	bufferSizeBytes = bufferSizeFrames * sizeof(Float32);
     CAPT_DEBUG( "Input device buffer size is %ld frames.\n", bufferSizeFrames );
     
     UInt32 outBufferSizeFrames;
@@ -539,13 +642,14 @@ OSStatus CAPlayThrough::SetupBuffers()
 //	asbd_dev2_out.Print();
 	
 	//////////////////////////////////////
-	//Set the format of all the AUs to the input/output devices channel count
-	//For a simple case, you want to set this to the lower of count of the channels
-	//in the input device vs output device
+	//Set the format of the AUHAL's client side to the input device's channel count,
+	//and the rest of the AUs to the output device's. The engine's channel matrix
+	//mixes the one down (or up) to the other, by default input n to output n.
 	//////////////////////////////////////
-	asbd.mChannelsPerFrame =((asbd_dev1_in.mChannelsPerFrame < asbd_dev2_out.mChannelsPerFrame) ?asbd_dev1_in.mChannelsPerFrame :asbd_dev2_out.mChannelsPerFrame) ;
-	CAPT_DEBUG("Info: Input Device channel count=%ld\t Input Device channel count=%ld\n",asbd_dev1_in.mChannelsPerFrame,asbd_dev2_out.mChannelsPerFrame);	
-	CAPT_DEBUG("Info: CAPlayThrough will use %ld channels\n",asbd.mChannelsPerFrame);	
+	UInt32 nInputChannels = asbd_dev1_in.mChannelsPerFrame;
+	UInt32 nOutputChannels = asbd_dev2_out.mChannelsPerFrame;
+	asbd.mChannelsPerFrame = nInputChannels;
+	CAPT_DEBUG("Info: Input Device channel count=%ld\t Output Device channel count=%ld\n",asbd_dev1_in.mChannelsPerFrame,asbd_dev2_out.mChannelsPerFrame);	
 
 	
 	// We must get the sample rate of the input device and set it to the stream format of AUHAL
@@ -561,10 +665,11 @@ OSStatus CAPlayThrough::SetupBuffers()
 	//Set the new formats to the AUs...
 	err = AudioUnitSetProperty(mInputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 1, &asbd, propertySize);
 	checkErr(err);	
+	asbd.mChannelsPerFrame = nOutputChannels;
 	err = AudioUnitSetProperty(mVarispeedUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &asbd, propertySize);
 	checkErr(err);
 	
-	//Set the correct sample rate for the output device, but keep the channel count the same
+	//Set the correct sample rate for the output device
 	propertySize = sizeof(Float64);
     aopa.mSelector = kAudioDevicePropertyNominalSampleRate;
     aopa.mScope = kAudioDevicePropertyScopeOutput;
@@ -578,58 +683,46 @@ OSStatus CAPlayThrough::SetupBuffers()
 	err = AudioUnitSetProperty(mOutputUnit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &asbd, propertySize);
 	checkErr(err);
 
-	//calculate number of buffers from channels
-	propsize = offsetof(AudioBufferList, mBuffers[0]) + (sizeof(AudioBuffer) *asbd.mChannelsPerFrame);
+	//Alloc the ring buffer that will hold data between the two audio devices
+	mEngine.Allocate(nInputChannels, nOutputChannels);
 
-	//malloc buffer lists
-	mInputBuffer = (AudioBufferList *)malloc(propsize);
-	mInputBuffer->mNumberBuffers = asbd.mChannelsPerFrame;
-	
-	//pre-malloc buffers for AudioBufferLists
-	for(UInt32 i =0; i< mInputBuffer->mNumberBuffers ; i++) {
-		mInputBuffer->mBuffers[i].mNumberChannels = 1;
-		mInputBuffer->mBuffers[i].mDataByteSize = bufferSizeBytes;
-		mInputBuffer->mBuffers[i].mData = malloc(bufferSizeBytes);
-	}
-	
-	//Alloc ring buffer that will hold data between the two audio devices
-	mBuffer = new CARingBuffer();	
-	mBuffer->Allocate(asbd.mChannelsPerFrame, asbd.mBytesPerFrame, bufferSizeFrames * 20 );
-
-// Some test code to run the ring through its paces...
-//
-//    CARingBuffer::SampleTime readTime = 0;
-//    CARingBuffer::SampleTime writeTime = 0;
-//    for ( int i = 0; i < 32768; i++ ) {
-//        printf( "run buf %d\n", i );
-//        UInt32 writeLength = 512;
-//        UInt32 readLength = 256;//(i%2==0) ? 440 : 441;
-//        OSStatus err = mBuffer->Store( mInputBuffer, writeLength, writeTime );
-//        if( err != kCARingBufferError_OK )
-//        {
-//            printf( "HIT ERR IN Store()\n" );
-//        }
-//        writeTime += writeLength;
-//        
-//        err = mBuffer->Fetch( mInputBuffer, readLength, readTime );
-//        if(err != kCARingBufferError_OK)
-//        {
-//            printf( "HIT ERR IN Fetch()\n" );
-//            MakeBufferSilent (mInputBuffer);
-//            SInt64 bufferStartTime, bufferEndTime;
-//            mBuffer->GetTimeBounds(bufferStartTime, bufferEndTime);
-//        }        
-//        readTime += readLength;
-//    }    
-	
     return err;
 }
 
-void	CAPlayThrough::ComputeThruOffset()
+#pragma mark -
+#pragma mark -- CAPlayThroughBackend --
+CAPlayThroughDeviceInfo CAPlayThrough::GetDeviceInfo(Direction direction)
+{
+	AudioDevice &device = (direction == kInput) ? mInputDevice : mOutputDevice;
+	CAPlayThroughDeviceInfo info;
+	info.mNominalSampleRate = device.mFormat.mSampleRate;
+	info.mBufferSizeFrames = device.mBufferSizeFrames;
+	info.mSafetyOffset = device.mSafetyOffset;
+	info.mChannels = device.mFormat.mChannelsPerFrame;
+	return info;
+}
+
+OSStatus CAPlayThrough::GetCurrentTime(Direction direction, AudioTimeStamp &outTime)
 {
-	//The initial latency will at least be the saftey offset's of the devices + the buffer sizes
-	mInToOutSampleOffset = SInt32(mInputDevice.mSafetyOffset +  mInputDevice.mBufferSizeFrames +
-						mOutputDevice.mSafetyOffset + mOutputDevice.mBufferSizeFrames);
+	AudioDevice &device = (direction == kInput) ? mInputDevice : mOutputDevice;
+	return AudioDeviceGetCurrentTime(device.mID, &outTime);
+}
+
+OSStatus CAPlayThrough::RenderInput(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData)
+{
+	OSStatus err = AudioUnitRender(mInputUnit,
+						 mRenderActionFlags,
+						 &timeStamp, 
+						 mRenderBusNumber,     
+						 nFrames, //# of frames requested
+						 ioData);// Audio Buffer List to hold data
+	// no checkErr on the IO thread: the engine counts the error in its metrics
+	return err;
+}
+
+OSStatus CAPlayThrough::SetPlaybackRate(Float64 rate)
+{
+	return AudioUnitSetParameter(mVarispeedUnit,kVarispeedParam_PlaybackRate,kAudioUnitScope_Global,0, rate,0);
 }
 
 #pragma mark -
@@ -641,25 +734,10 @@ OSStatus CAPlayThrough::InputProc(void *inRefCon,
 									UInt32 inNumberFrames,
 									AudioBufferList * ioData)
 {
-    OSStatus err = noErr;
-	
 	CAPlayThrough *This = (CAPlayThrough *)inRefCon;
-	if (This->mFirstInputTime < 0.)
-		This->mFirstInputTime = inTimeStamp->mSampleTime;
-		
-	//Get the new audio data
-	err = AudioUnitRender(This->mInputUnit,
-						 ioActionFlags,
-						 inTimeStamp, 
-						 inBusNumber,     
-						 inNumberFrames, //# of frames requested
-						 This->mInputBuffer);// Audio Buffer List to hold data
-	checkErr(err);
-		
-	if(!err)
-		err = This->mBuffer->Store(This->mInputBuffer, Float64(inNumberFrames), SInt64(inTimeStamp->mSampleTime));
-	
-	return err;
+	This->mRenderActionFlags = ioActionFlags;
+	This->mRenderBusNumber = inBusNumber;
+	return This->mEngine.InputProc(*inTimeStamp, inNumberFrames);
 }
 
 OSStatus CAPlayThrough::OutputProc(void *inRefCon,
@@ -669,158 +747,80 @@ OSStatus CAPlayThrough::OutputProc(void *inRefCon,
 									 UInt32 inNumberFrames,
 									 AudioBufferList * ioData)
 {
-    OSStatus err = noErr;
 	CAPlayThrough *This = (CAPlayThrough *)inRefCon;
-	Float64 rate = 0.0;
-	AudioTimeStamp inTS, outTS;
-		
-	if (This->mFirstInputTime < 0.) {
-		// input hasn't run yet -> silence
-		MakeBufferSilent (ioData);
-		return noErr;
-	}
-	
-	//use the varispeed playback rate to offset small discrepancies in sample rate
-	//first find the rate scalars of the input and output devices
-	err = AudioDeviceGetCurrentTime(This->mInputDevice.mID, &inTS);
-	// this callback may still be called a few times after the device has been stopped
-	if (err)
-	{
-		MakeBufferSilent (ioData);
-		return noErr;
-	}
-		
-	err = AudioDeviceGetCurrentTime(This->mOutputDevice.mID, &outTS);
-	checkErr(err);
-	
-	rate = inTS.mRateScalar / outTS.mRateScalar;
-	err = AudioUnitSetParameter(This->mVarispeedUnit,kVarispeedParam_PlaybackRate,kAudioUnitScope_Global,0, rate,0);
-	checkErr(err);
-	
-	//get Delta between the devices and add it to the offset
-	if (This->mFirstOutputTime < 0.) {
-		This->mFirstOutputTime = TimeStamp->mSampleTime;
-		Float64 delta = (This->mFirstInputTime - This->mFirstOutputTime);
-		This->ComputeThruOffset();   
-		//changed: 3865519 11/10/04
-		if (delta < 0.0)
-			This->mInToOutSampleOffset -= delta;
-		else
-			This->mInToOutSampleOffset = -delta + This->mInToOutSampleOffset;
-		
-        CAPT_DEBUG( "Set initial IOOffset to %f.\n", This->mInToOutSampleOffset );
-                                			
-		MakeBufferSilent (ioData);
-		return noErr;
-	}
-
-	//copy the data from the buffers	
-	err = This->mBuffer->Fetch(ioData, inNumberFrames, SInt64(TimeStamp->mSampleTime - This->mInToOutSampleOffset));	
-	if( err != kCARingBufferError_OK ) {
-        SInt64 bufferStartTime, bufferEndTime;
-		This->mBuffer->GetTimeBounds( bufferStartTime, bufferEndTime );
-        CAPT_DEBUG( "Oops. Adjusting IOOffset from %f, ", This->mInToOutSampleOffset );
-        if ( err < kCARingBufferError_OK ) {
-            CAPT_DEBUG( "ahead " );
-            if ( err == kCARingBufferError_WayBehind ) {
-                MakeBufferSilent( ioData );
-            }
-            This->mInToOutSampleOffset += std::max( ( TimeStamp->mSampleTime - This->mInToOutSampleOffset ) - bufferStartTime, kAdjustmentOffsetSamples );
-        }
-        else if ( err > kCARingBufferError_OK ) {
-            CAPT_DEBUG( "behind " );
-            if ( err == kCARingBufferError_WayAhead ) {
-                MakeBufferSilent( ioData );
-            }
-            // Adjust by the amount that we read past in the buffer
-            This->mInToOutSampleOffset += std::max( ( ( TimeStamp->mSampleTime - This->mInToOutSampleOffset ) + inNumberFrames ) - bufferEndTime, kAdjustmentOffsetSamples );
-        }
-        CAPT_DEBUG( "to %f.\n", This->mInToOutSampleOffset );
-		MakeBufferSilent ( ioData );
-	}
-
-	return noErr;
-}
-
-#pragma mark -- Listeners --
-
-OSStatus CAPlayThroughHost::StreamListener( 
-    AudioObjectID inObjectID,
-    UInt32 inNumberAddresses,
-    const AudioObjectPropertyAddress inAddresses[],
-    void* inClientData )
-{	
-	CAPlayThroughHost *This = (CAPlayThroughHost *)inClientData;
-	This->ResetPlayThrough();	
-	return noErr;		
+	return This->mEngine.OutputProc(*TimeStamp, inNumberFrames, ioData);
 }
 
-#pragma mark -									
-#pragma mark -- CAPlayThroughHost Methods --
-
-CAPlayThroughHost::CAPlayThroughHost(AudioDeviceID input, AudioDeviceID output):
-	mPlayThrough(NULL)
-{
-	CreatePlayThrough(input, output);
-}
+#pragma mark -- Sessions --
 
-CAPlayThroughHost::~CAPlayThroughHost()
+// a route's CAPlayThrough, as CAPlayThroughSessionManager runs it
+class CAPlayThroughSession : public CAPlayThroughSessionManager::Session
 {
-	DeletePlayThrough();
-}
-
-void CAPlayThroughHost::CreatePlayThrough(AudioDeviceID input, AudioDeviceID output)
-{
-	mPlayThrough = new CAPlayThrough(input, output);
-	AddDeviceListeners(input);
-}
-
-void CAPlayThroughHost::DeletePlayThrough()
-{
-	if(mPlayThrough)
-	{
-		mPlayThrough->Stop();
-		RemoveDeviceListeners(mPlayThrough->GetInputDeviceID());
-		delete mPlayThrough;
-		mPlayThrough = NULL;
-	}
-}
+public:
+	OSStatus	Init(AudioDeviceID input, AudioDeviceID output) { return mPlayThrough.Init(input, output); }
+	
+	OSStatus	Start() override { return mPlayThrough.Start(); }
+	OSStatus	Stop() override { return mPlayThrough.Stop(); }
+	bool		IsRunning() override { return mPlayThrough.IsRunning(); }
+	OSStatus	Reconfigure() override { return mPlayThrough.Reconfigure(); }
+	
+private:
+	CAPlayThrough mPlayThrough;
+};
 
-void CAPlayThroughHost::ResetPlayThrough ()
+// A device the routes share. It listens for format changes on the device's input streams, once however
+// many routes use it, and hands them to the manager to pass on to each route's CAPlayThrough.
+class CAPlayThroughDeviceHandle : public CAPlayThroughSessionManager::Device
 {
+public:
+	CAPlayThroughDeviceHandle(CAPlayThroughSessionManager &sessions, AudioDeviceID device);
+	~CAPlayThroughDeviceHandle();
 	
-	AudioDeviceID input = mPlayThrough->GetInputDeviceID();
-	AudioDeviceID output = mPlayThrough->GetOutputDeviceID();
-
-	DeletePlayThrough();
-	CreatePlayThrough(input, output);
-	mPlayThrough->Start();
-}
+private:
+	void AddDeviceListeners();
+	void RemoveDeviceListeners();
+	
+	static OSStatus StreamListener( 
+        AudioObjectID inObjectID,
+        UInt32 inNumberAddresses,
+        const AudioObjectPropertyAddress inAddresses[],
+        void* inClientData );
+	
+	CAPlayThroughSessionManager &mSessions;
+	AudioDeviceID mID;
+};
 
-bool CAPlayThroughHost::PlayThroughExists()
+CAPlayThroughDeviceHandle::CAPlayThroughDeviceHandle(CAPlayThroughSessionManager &sessions, AudioDeviceID device):
+	mSessions(sessions),
+	mID(device)
 {
-	return (mPlayThrough != NULL) ? true : false;
+	AddDeviceListeners();
 }
 
-OSStatus	CAPlayThroughHost::Start()
+CAPlayThroughDeviceHandle::~CAPlayThroughDeviceHandle()
 {
-	if (mPlayThrough) return mPlayThrough->Start();
-	return noErr;
+	RemoveDeviceListeners();
 }
 
-OSStatus	CAPlayThroughHost::Stop()
-{
-	if (mPlayThrough) return mPlayThrough->Stop();
-	return noErr;
-}
+#pragma mark -- Listeners --
 
-Boolean		CAPlayThroughHost::IsRunning()
-{
-	if (mPlayThrough) return mPlayThrough->IsRunning();
-	return noErr;
+OSStatus CAPlayThroughDeviceHandle::StreamListener( 
+    AudioObjectID inObjectID,
+    UInt32 inNumberAddresses,
+    const AudioObjectPropertyAddress inAddresses[],
+    void* inClientData )
+{	
+	CAPlayThroughDeviceHandle *This = (CAPlayThroughDeviceHandle *)inClientData;
+	//each route on the device, in place if it can be, or else started again
+	OSStatus err = This->mSessions.DeviceChanged(This->mID);
+	if(err) {
+		fprintf(stdout, "CAPlayThrough Error: %ld -> a route on device %u kept its old format\n", (long)err, (unsigned)This->mID);
+		fflush(stdout);
+	}
+	return noErr;		
 }
 
-void CAPlayThroughHost::AddDeviceListeners(AudioDeviceID input)
+void CAPlayThroughDeviceHandle::AddDeviceListeners()
 {
     // StreamListener is called whenever the sample rate changes (as well as other format characteristics of the device)
 	UInt32 propSize;
@@ -828,11 +828,11 @@ void CAPlayThroughHost::AddDeviceListeners(AudioDeviceID input)
     aopa.mSelector = kAudioDevicePropertyStreams;
     aopa.mScope = kAudioDevicePropertyScopeInput;
     aopa.mElement = kAudioObjectPropertyElementMaster;
-    OSStatus err = AudioObjectGetPropertyDataSize(input, &aopa, 0, NULL, &propSize);
+    OSStatus err = AudioObjectGetPropertyDataSize(mID, &aopa, 0, NULL, &propSize);
 	if(!err)
 	{
 		AudioStreamID *streams = (AudioStreamID*)malloc(propSize);	
-        err = AudioObjectGetPropertyData(input, &aopa, 0, NULL, &propSize, streams);
+        err = AudioObjectGetPropertyData(mID, &aopa, 0, NULL, &propSize, streams);
 		
 		if(!err)
 		{
@@ -851,21 +851,22 @@ void CAPlayThroughHost::AddDeviceListeners(AudioDeviceID input)
                 }
 			}
 		}
+		free(streams);
 	}
 }
 
-void CAPlayThroughHost::RemoveDeviceListeners(AudioDeviceID input)
+void CAPlayThroughDeviceHandle::RemoveDeviceListeners()
 {
 	UInt32 propSize;
     AudioObjectPropertyAddress aopa;
     aopa.mSelector = kAudioDevicePropertyStreams;
     aopa.mScope = kAudioDevicePropertyScopeInput;
     aopa.mElement = kAudioObjectPropertyElementMaster;
-    OSStatus err = AudioObjectGetPropertyDataSize(input, &aopa, 0, NULL, &propSize);
+    OSStatus err = AudioObjectGetPropertyDataSize(mID, &aopa, 0, NULL, &propSize);
 	if(!err)
 	{
 		AudioStreamID *streams = (AudioStreamID*)malloc(propSize);	
-        err = AudioObjectGetPropertyData(input, &aopa, 0, NULL, &propSize, streams);
+        err = AudioObjectGetPropertyData(mID, &aopa, 0, NULL, &propSize, streams);
 		if(!err)
 		{
 			UInt32 numStreams = propSize / sizeof(AudioStreamID);
@@ -878,9 +879,89 @@ void CAPlayThroughHost::RemoveDeviceListeners(AudioDeviceID input)
                 aopa.mElement = kAudioObjectPropertyElementMaster;
                 err = AudioObjectGetPropertyData(streams[i], &aopa, 0, NULL, &propSize, &isInput);
 				if(!err && isInput) {
+                    aopa.mSelector = kAudioStreamPropertyPhysicalFormat;
                     err = AudioObjectRemovePropertyListener(streams[i], &aopa, StreamListener, this);
                 }
 			}
 		}
+		free(streams);
+	}
+}
+
+#pragma mark -									
+#pragma mark -- CAPlayThroughHost Methods --
+
+CAPlayThroughHost::CAPlayThroughHost(AudioDeviceID input, AudioDeviceID output):
+	mSessions(*this),
+	mHasRoute(false)
+{
+	CreatePlayThrough(input, output);
+}
+
+CAPlayThroughHost::~CAPlayThroughHost()
+{
+	mSessions.RemoveAllRoutes();
+}
+
+void CAPlayThroughHost::CreatePlayThrough(AudioDeviceID input, AudioDeviceID output)
+{
+	mRoute.mInput = input;
+	mRoute.mOutput = output;
+	OSStatus err = mSessions.AddRoute(mRoute);
+	mHasRoute = (err == noErr || err == kCAPlayThroughSessionError_RouteExists);
+}
+
+void CAPlayThroughHost::DeletePlayThrough()
+{
+	if(mHasRoute)
+	{
+		mSessions.RemoveRoute(mRoute);
+		mHasRoute = false;
+	}
+}
+
+bool CAPlayThroughHost::PlayThroughExists()
+{
+	return mHasRoute && mSessions.HasRoute(mRoute);
+}
+
+OSStatus	CAPlayThroughHost::Start()
+{
+	if (mHasRoute) return mSessions.Start(mRoute);
+	return noErr;
+}
+
+OSStatus	CAPlayThroughHost::Stop()
+{
+	if (mHasRoute) return mSessions.Stop(mRoute);
+	return noErr;
+}
+
+Boolean		CAPlayThroughHost::IsRunning()
+{
+	if (mHasRoute) return mSessions.IsRunning(mRoute);
+	return false;
+}
+
+CAPlayThroughSessionManager::Device *CAPlayThroughHost::OpenDevice(CAPlayThroughDeviceID device)
+{
+	if(device == kAudioDeviceUnknown)
+		return NULL;
+	return new CAPlayThroughDeviceHandle(mSessions, device);
+}
+
+CAPlayThroughSessionManager::Session *CAPlayThroughHost::CreateSession(const CAPlayThroughRoute &route,
+																		CAPlayThroughSessionManager::Device &input,
+																		CAPlayThroughSessionManager::Device &output)
+{
+	CAPlayThroughSession *session = new CAPlayThroughSession;
+	OSStatus err = session->Init(route.mInput, route.mOutput);
+	if(err)
+	{
+		fprintf(stdout, "CAPlayThrough Error: %ld -> can't play %u through to %u\n", (long)err, (unsigned)route.mInput, (unsigned)route.mOutput);
+		fflush(stdout);
+		delete session;
+		return NULL;
 	}
-}
\ No newline at end of file
+	return session;
+}
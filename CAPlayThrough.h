@@ -58,11 +58,15 @@ if(err) {\
 #include "CARingBuffer.h"
 #include "AudioDevice.h"
 #include "CAStreamBasicDescription.h"
+#include "CAPlayThroughSessions.h"
 
 class CAPlayThrough;
 
-// This class will manage the lifecycle of the play through objects
-class CAPlayThroughHost
+// This class will manage the lifecycle of the play through objects: any number of routes, each from
+// an input device to an output device with a CAPlayThrough of its own, in a CAPlayThroughSessionManager.
+// The routes share a handle per device, which listens for format changes on the device's input streams.
+// The single-route methods act on the route made by the constructor or the last CreatePlayThrough.
+class CAPlayThroughHost : public CAPlayThroughSessionManager::Factory
 {
 
 public:
@@ -76,22 +80,19 @@ public:
 	OSStatus	Start();
 	OSStatus	Stop();
 	Boolean		IsRunning();
-
-private:
-	CAPlayThrough* GetPlayThrough() { return mPlayThrough; }
-
-	void AddDeviceListeners(AudioDeviceID input);
-	void RemoveDeviceListeners(AudioDeviceID input);
 	
-	void ResetPlayThrough();
+	CAPlayThroughSessionManager &GetSessions() { return mSessions; }
+	
+	// CAPlayThroughSessionManager::Factory
+	CAPlayThroughSessionManager::Device *	OpenDevice(CAPlayThroughDeviceID device) override;
+	CAPlayThroughSessionManager::Session *	CreateSession(const CAPlayThroughRoute &route,
+														  CAPlayThroughSessionManager::Device &input,
+														  CAPlayThroughSessionManager::Device &output) override;
 
-	static OSStatus StreamListener( 
-        AudioObjectID inObjectID,
-        UInt32 inNumberAddresses,
-        const AudioObjectPropertyAddress inAddresses[],
-        void* inClientData );
 private:
-	CAPlayThrough *mPlayThrough;
+	CAPlayThroughSessionManager mSessions;
+	CAPlayThroughRoute mRoute;
+	bool mHasRoute;
 };
 
 #endif //__CAPlayThrough_H__
@@ -0,0 +1,71 @@
+/*=============================================================================
+	CAPlayThroughBackend.h
+	
+	The devices and clocks CAPlayThroughEngine runs against.
+	
+	A backend owns an input device, an output device and usually the
+	varispeed between the ring buffer and the output device. It calls its
+	client's InputProc whenever the input device has captured a buffer and
+	its OutputProc whenever the varispeed needs more frames for the output
+	device, or without a varispeed, whenever the output device does. CAPlayThrough is the backend for real devices (AUHAL and an
+	AUGraph); CASimulatedBackend drives the same engine from virtual clocks.
+=============================================================================*/
+
+#ifndef __CAPlayThroughBackend_h__
+#define __CAPlayThroughBackend_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+struct CAPlayThroughDeviceInfo {
+	Float64		mNominalSampleRate;
+	UInt32		mBufferSizeFrames;
+	UInt32		mSafetyOffset;
+	UInt32		mChannels;
+};
+
+class CAPlayThroughBackend {
+public:
+	enum Direction {
+		kInput,
+		kOutput
+	};
+	
+	class Client {
+	public:
+		virtual ~Client() { }
+		
+		virtual OSStatus	InputProc(const AudioTimeStamp &timeStamp, UInt32 nFrames) = 0;
+								// nFrames were captured at timeStamp; get them with RenderInput
+		virtual OSStatus	OutputProc(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData) = 0;
+								// fill ioData; timeStamp is in the varispeed's input sample time, or
+								// without a varispeed, the output device's
+	};
+	
+	virtual ~CAPlayThroughBackend() { }
+	
+	virtual void		SetClient(Client *client) = 0;
+	virtual OSStatus	Start() = 0;
+	virtual OSStatus	Stop() = 0;
+	
+	virtual CAPlayThroughDeviceInfo	GetDeviceInfo(Direction direction) = 0;
+	virtual bool		HasVarispeed() = 0;
+							// false if the client must convert to the output's rate itself
+	
+	virtual OSStatus	GetCurrentTime(Direction direction, AudioTimeStamp &outTime) = 0;
+							// the device's sample time and rate scalar now, as AudioDeviceGetCurrentTime
+	virtual OSStatus	RenderInput(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData) = 0;
+							// copies captured frames into ioData; only valid inside the client's InputProc
+	virtual OSStatus	SetPlaybackRate(Float64 rate) = 0;
+							// varispeed rate: input frames consumed per output frame; only with a varispeed
+	virtual UInt64		GetCurrentHostTime() = 0;
+							// the clock of AudioTimeStamp.mHostTime, now, so that threads that aren't the
+							// devices' can compare when things happened
+	virtual Float64		GetHostClockFrequency() = 0;
+							// its ticks per second
+};
+
+#endif // __CAPlayThroughBackend_h__
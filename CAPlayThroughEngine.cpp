@@ -0,0 +1,772 @@
+/*=============================================================================
+	CAPlayThroughEngine.cpp
+	
+=============================================================================*/
+
+#include "CAPlayThroughEngine.h"
+#include "CAAutoDisposer.h"
+#include "CARealtimeAudit.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+//#define CAPT_DEBUG(msg, args...) printf( msg, ##args )
+#define CAPT_DEBUG(msg, args...)
+
+const Float64 CAPlayThroughEngine::kAdjustmentOffsetSamples = 128.0;
+const Float64 CAPlayThroughEngine::kDefaultRateThreshold = 1e-7;	// about what the varispeed's Float32 parameter resolves
+const UInt32 CAPlayThroughEngine::kDefaultCrossfadeFrames = 256;
+
+static inline void MakeBufferSilent(AudioBufferList *ioData)
+{
+	for (UInt32 i = 0; i < ioData->mNumberBuffers; i++)
+		memset(ioData->mBuffers[i].mData, 0, ioData->mBuffers[i].mDataByteSize);
+}
+
+//nChannels mono Float32 buffers of nFrames each
+static AudioBufferList *NewBufferList(int nChannels, UInt32 nFrames)
+{
+	UInt32 bytes = nFrames * sizeof(Float32);
+	AudioBufferList *list = (AudioBufferList *)CA_malloc(offsetof(AudioBufferList, mBuffers[0]) + (sizeof(AudioBuffer) * nChannels));
+	list->mNumberBuffers = nChannels;
+	for (int i = 0; i < nChannels; i++) {
+		list->mBuffers[i].mNumberChannels = 1;
+		list->mBuffers[i].mDataByteSize = bytes;
+		list->mBuffers[i].mData = CA_malloc(bytes);
+	}
+	return list;
+}
+
+static void FreeBufferList(AudioBufferList *&list)
+{
+	if (list) {
+		for (UInt32 i = 0; i < list->mNumberBuffers; i++)
+			free(list->mBuffers[i].mData);
+		free(list);
+		list = NULL;
+	}
+}
+
+//Scales nFrames frames of each buffer from frame first on, by a gain that starts at gain and
+//changes by step each frame.
+static void RampBuffer(AudioBufferList *ioData, UInt32 first, UInt32 nFrames, Float32 gain, Float32 step)
+{
+	for (UInt32 i = 0; i < ioData->mNumberBuffers; i++) {
+		UInt32 nChannels = ioData->mBuffers[i].mNumberChannels;
+		Float32 *samples = (Float32 *)ioData->mBuffers[i].mData + first * nChannels;
+		Float32 g = gain;
+		for (UInt32 frame = 0; frame < nFrames; frame++, g += step)
+			for (UInt32 ch = 0; ch < nChannels; ch++)
+				*samples++ *= g;
+	}
+}
+
+namespace {
+
+// Marks the thread real-time for CARealtimeAudit, times an IO proc into the metrics and brackets
+// it in the trace. Return through Result.
+class CallbackScope {
+public:
+	CallbackScope(CAPlayThroughMetrics &metrics, CAPlayThroughTrace &trace, CAPlayThroughMetrics::Direction direction,
+				  const AudioTimeStamp &timeStamp, UInt32 nFrames) :
+		mTimer(metrics, direction), mTrace(trace), mThread(CAPlayThroughTrace::Thread(direction)), mErr(noErr)
+	{
+		mTrace.Record(mThread, CAPlayThroughTrace::kCallbackBegan, 0, timeStamp.mSampleTime, nFrames);
+	}
+	~CallbackScope() { mTrace.Record(mThread, CAPlayThroughTrace::kCallbackEnded, mErr); }
+	OSStatus	Result(OSStatus err) { mErr = err; return mTimer.Result(err); }
+
+private:
+	CARealtimeAudit::Scope				mRealtime;
+	CAPlayThroughMetrics::CallbackTimer	mTimer;
+	CAPlayThroughTrace &				mTrace;
+	CAPlayThroughTrace::Thread			mThread;
+	OSStatus							mErr;
+};
+
+} // namespace
+
+CAPlayThroughEngine::Pipeline::Pipeline() :
+	mChannels(0),
+	mOutputChannels(0),
+	mSampleRate(0),
+	mInputBuffer(NULL),
+	mInputBufferFrames(0),
+	mStoreHead(NULL),
+	mStoreTail(NULL),
+	mFirstInputTime(-1),
+	mMatrixInput(NULL),
+	mMatrixInputFrames(0),
+	mResampling(false),
+	mResamplerInput(NULL),
+	mResamplerView(NULL),
+	mNominalRatio(1.0)
+{
+}
+
+void	CAPlayThroughEngine::Pipeline::Deallocate()
+{
+	mBuffer.Deallocate();
+	FreeBufferList(mInputBuffer);
+	mInputBufferFrames = 0;
+	free(mStoreHead);
+	mStoreHead = NULL;
+	free(mStoreTail);
+	mStoreTail = NULL;
+	FreeBufferList(mMatrixInput);
+	mMatrixInputFrames = 0;
+	mChannels = mOutputChannels = 0;
+	
+	mResampler.Deallocate();
+	FreeBufferList(mResamplerInput);
+	free(mResamplerView);
+	mResamplerView = NULL;
+	mResampling = false;
+}
+
+CAPlayThroughEngine::CAPlayThroughEngine(CAPlayThroughBackend &backend) :
+	mBackend(backend),
+	mInputPipeline(&mPipelines[0]),
+	mOutputPipeline(&mPipelines[0]),
+	mPendingPipeline(NULL),
+	mCrossfadeFrames(kDefaultCrossfadeFrames),
+	mFadingOut(false),
+	mFadeInFrames(0),
+	mFadingIn(false),
+	mWorkerPool(NULL),
+	mFirstOutputTime(-1),
+	mInToOutSampleOffset(0),
+	mTargetLatency(0),
+	mInputSampleRate(0),
+	mAdaptiveLatency(false),
+	mLastClockTime(0),
+	mOutputSampleRate(0),
+	mControlInterval(0),
+	mRateThreshold(kDefaultRateThreshold),
+	mAppliedRate(1.0),
+	mHostClockFrequency(1.0),
+	mOutputStarts(0),
+	mControlStart(0),
+	mControlHostTime(0),
+	mControlRunning(false),
+	mResamplerQuality(kCAResamplerQuality_Medium),
+	mResamplerSampleTime(0)
+{
+	memset(&mStats, 0, sizeof(mStats));
+	mStats.mRate = 1.0;
+}
+
+CAPlayThroughEngine::~CAPlayThroughEngine()
+{
+	StopControlThread();
+	Deallocate();
+}
+
+void	CAPlayThroughEngine::Allocate(int nInputChannels, int nOutputChannels)
+{
+	Deallocate();
+	mMatrix.Initialize(nInputChannels, nOutputChannels);
+	AllocatePipeline(mPipelines[0], nInputChannels, nOutputChannels);
+	mDSPChain.Prepare(nOutputChannels, mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput).mNominalSampleRate);
+}
+
+void	CAPlayThroughEngine::Deallocate()
+{
+	for (Pipeline &pipeline : mPipelines)
+		pipeline.Deallocate();
+	mInputPipeline = mOutputPipeline = &mPipelines[0];
+	mPendingPipeline = NULL;
+	mFadingOut = mFadingIn = false;
+}
+
+//Sizes pipeline for the devices as they are now. What it already has is kept where it is big
+//enough, so that a Reconfigure for new sample rates allocates nothing once both pipelines have
+//been used.
+void	CAPlayThroughEngine::AllocatePipeline(Pipeline &pipeline, int nInputChannels, int nOutputChannels)
+{
+	CAPlayThroughDeviceInfo input = mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput);
+	CAPlayThroughDeviceInfo output = mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput);
+	UInt32 bufferSizeFrames = input.mBufferSizeFrames;
+	size_t propsize = offsetof(AudioBufferList, mBuffers[0]) + (sizeof(AudioBuffer) * nInputChannels);
+	
+	if (pipeline.mChannels != nInputChannels || pipeline.mOutputChannels != nOutputChannels
+			|| pipeline.mInputBufferFrames < bufferSizeFrames
+			|| pipeline.mBuffer.GetCapacityFrames() < bufferSizeFrames * 20) {
+		pipeline.Deallocate();
+	
+		pipeline.mInputBuffer = NewBufferList(nInputChannels, bufferSizeFrames);
+		pipeline.mInputBufferFrames = bufferSizeFrames;
+	
+		//mirrored where available, so InputProc can always render straight into the ring, and
+		//locked so that the IO threads never page-fault on it
+		pipeline.mBuffer.Allocate(nInputChannels, sizeof(Float32), bufferSizeFrames * 20, CARingBuffer::kDeinterleaved,
+								  CARingBuffer::kAllocateMirrored | CARingBuffer::kAllocateLocked);
+	
+		//buffer lists with no storage of their own, pointed into mBuffer by BeginStore
+		pipeline.mStoreHead = (AudioBufferList *)calloc(1, propsize);
+		pipeline.mStoreTail = (AudioBufferList *)calloc(1, propsize);
+		pipeline.mChannels = nInputChannels;
+		pipeline.mOutputChannels = nOutputChannels;
+	}
+	pipeline.mFirstInputTime = -1;
+	pipeline.mSampleRate = input.mNominalSampleRate;
+	
+	//without a varispeed, resample from the ring into the output device's buffers ourselves, at
+	//up to the drift controller's largest rate and output buffers up to four times today's size
+	pipeline.mResampling = !mBackend.HasVarispeed();
+	if (pipeline.mResampling) {
+		pipeline.mNominalRatio = input.mNominalSampleRate / output.mNominalSampleRate;
+		Float64 maxRatio = pipeline.mNominalRatio * (1.0 + mDriftController.GetMaxRateDeviation());
+		CAResampler &resampler = pipeline.mResampler;
+		// the ratio sets the filter's cutoff, so only the same one will do
+		if (resampler.GetMaxRatio() != maxRatio || resampler.GetQuality() != mResamplerQuality
+				|| resampler.GetMaxOutputFrames() < output.mBufferSizeFrames * 4 || !pipeline.mResamplerInput) {
+			//mixed before it is resampled, so it has the output's channels
+			resampler.Initialize(nOutputChannels, output.mBufferSizeFrames * 4, maxRatio, mResamplerQuality);
+	
+			FreeBufferList(pipeline.mResamplerInput);
+			pipeline.mResamplerInput = NewBufferList(nOutputChannels, resampler.GetMaxInputFrames());
+			free(pipeline.mResamplerView);
+			pipeline.mResamplerView = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0])
+																+ (sizeof(AudioBuffer) * nOutputChannels));
+		}
+	}
+	
+	//what the matrix mixes from: as much as one fetch from the ring can be, whichever IO proc it is
+	//for and however fast the drift controller has the varispeed pulling
+	Float64 maxRatio = input.mNominalSampleRate / output.mNominalSampleRate * (1.0 + mDriftController.GetMaxRateDeviation());
+	UInt32 matrixFrames = std::max(bufferSizeFrames, UInt32(output.mBufferSizeFrames * 4 * std::max(1.0, maxRatio)) + 1);
+	if (pipeline.mResampling)
+		matrixFrames = std::max(matrixFrames, pipeline.mResampler.GetMaxInputFrames());
+	if (pipeline.mMatrixInputFrames < matrixFrames) {
+		FreeBufferList(pipeline.mMatrixInput);
+		pipeline.mMatrixInput = NewBufferList(nInputChannels, matrixFrames);
+		pipeline.mMatrixInputFrames = matrixFrames;
+	}
+	
+	if (mWorkerPool)
+		mWorkerPool->SetPeriod(output.mBufferSizeFrames / output.mNominalSampleRate);
+}
+
+void	CAPlayThroughEngine::SetWorkerPool(CARealtimeWorkerPool *pool)
+{
+	mWorkerPool = pool;
+	if (pool) {
+		CAPlayThroughDeviceInfo output = mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput);
+		if (output.mNominalSampleRate > 0)
+			pool->SetPeriod(output.mBufferSizeFrames / output.mNominalSampleRate);
+	}
+}
+
+OSStatus	CAPlayThroughEngine::Reconfigure(bool running)
+{
+	if (running && IsReconfiguring())
+		return kCAPlayThroughEngineError_Reconfiguring;
+	
+	// neither IO thread is on the other one now, nor will be until it's published; stopped, neither
+	// is on anything, and the other one may be the last pending one, built over again
+	Pipeline *current = mOutputPipeline.load(std::memory_order_acquire);
+	Pipeline &next = (current == &mPipelines[0]) ? mPipelines[1] : mPipelines[0];
+	AllocatePipeline(next, current->mChannels, current->mOutputChannels);
+	if (running) {
+		// the old pipeline's last blocks are still to be processed at the old rate
+		mDSPChain.SetPendingSampleRate(next.mSampleRate);
+		mPendingPipeline.store(&next, std::memory_order_release);
+		return noErr;
+	}
+	
+	// the IO threads' changeover, done for them: the next start is on the new pipeline, as any start is
+	mInputPipeline.store(&next, std::memory_order_release);
+	mOutputPipeline.store(&next, std::memory_order_release);
+	mPendingPipeline.store(NULL, std::memory_order_release);
+	mFadingOut = mFadingIn = false;
+	mFirstOutputTime = -1;
+	++mStats.mReconfigurations;
+	mDSPChain.SetSampleRate(next.mSampleRate);
+	return noErr;
+}
+
+bool	CAPlayThroughEngine::IsReconfiguring() const
+{
+	Pipeline *pending = mPendingPipeline.load(std::memory_order_acquire);
+	return pending && (mInputPipeline.load(std::memory_order_acquire) != pending
+					   || mOutputPipeline.load(std::memory_order_acquire) != pending);
+}
+
+void	CAPlayThroughEngine::Reset()
+{
+	mInputPipeline.load()->mFirstInputTime = -1;
+	mFirstOutputTime = -1;
+}
+
+void	CAPlayThroughEngine::ComputeThruOffset()
+{
+	CAPlayThroughDeviceInfo input = mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput);
+	CAPlayThroughDeviceInfo output = mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput);
+	const Pipeline &pipeline = OutputPipeline();
+	
+	//The initial latency will at least be the saftey offset's of the devices + the buffer sizes
+	mInToOutSampleOffset = SInt32(input.mSafetyOffset + input.mBufferSizeFrames +
+								  output.mSafetyOffset + output.mBufferSizeFrames);
+	if (pipeline.mResampling)
+		mInToOutSampleOffset += pipeline.mResampler.GetLatency();
+}
+
+Float64	CAPlayThroughEngine::DefaultTargetLatency()
+{
+	CAPlayThroughDeviceInfo input = mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput);
+	CAPlayThroughDeviceInfo output = mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput);
+	
+	//by the time the output reads a frame, the input must have captured it and called back
+	//with it, and the output must still have its whole buffer ahead of it
+	Float64 ratio = input.mNominalSampleRate / output.mNominalSampleRate;
+	return input.mSafetyOffset + input.mBufferSizeFrames + ratio * (output.mSafetyOffset + output.mBufferSizeFrames)
+		 + kAdjustmentOffsetSamples;
+}
+
+//worked out afresh on each callback, so that the default follows buffer size changes
+Float64	CAPlayThroughEngine::ConfiguredTargetLatency()
+{
+	Float64 target = mTargetLatency.load(std::memory_order_relaxed);
+	return (target > 0.0) ? target : DefaultTargetLatency();
+}
+
+Float64	CAPlayThroughEngine::TargetLatency()
+{
+	if (mAdaptiveLatency)
+		return mAdaptiveLatencyController.GetTarget() * mInputSampleRate;
+	return ConfiguredTargetLatency();
+}
+
+OSStatus	CAPlayThroughEngine::InputProc(const AudioTimeStamp &timeStamp, UInt32 nFrames)
+{
+	CallbackScope timer(mMetrics, mTrace, CAPlayThroughMetrics::kInput, timeStamp, nFrames);
+	OSStatus err = noErr;
+	
+	//after a Reconfigure, store into the new pipeline from this callback on
+	Pipeline *pipeline = mInputPipeline.load(std::memory_order_relaxed);
+	Pipeline *pending = mPendingPipeline.load(std::memory_order_acquire);
+	if (pending && pending != pipeline) {
+		pipeline = pending;
+		mInputPipeline.store(pipeline, std::memory_order_release);
+	}
+	
+	if (pipeline->mFirstInputTime < 0.)
+		pipeline->mFirstInputTime = timeStamp.mSampleTime;
+	
+	//Render straight into the ring when the frames don't straddle its end. If the
+	//render fails the frames are simply never published.
+	SInt64 sampleTime = SInt64(timeStamp.mSampleTime);
+	UInt32 headFrames = 0;
+	if (pipeline->mBuffer.BeginStore(nFrames, sampleTime, pipeline->mStoreHead, pipeline->mStoreTail, headFrames)
+			== kCARingBufferError_OK && headFrames == nFrames) {
+		err = mBackend.RenderInput(timeStamp, nFrames, pipeline->mStoreHead);
+		if (!err)
+			pipeline->mBuffer.EndStore(nFrames, sampleTime);
+		return timer.Result(err);
+	}
+	
+	//Get the new audio data
+	if (nFrames > pipeline->mInputBufferFrames)
+		return timer.Result(kCARingBufferError_TooMuch);
+	err = mBackend.RenderInput(timeStamp, nFrames, pipeline->mInputBuffer);
+	if (!err)
+		err = pipeline->mBuffer.Store(pipeline->mInputBuffer, nFrames, sampleTime);
+	
+	return timer.Result(err);
+}
+
+OSStatus	CAPlayThroughEngine::OutputProc(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData)
+{
+	CallbackScope timer(mMetrics, mTrace, CAPlayThroughMetrics::kOutput, timeStamp, nFrames);
+	OSStatus err = noErr;
+	AudioTimeStamp inTS, outTS;
+	
+	//after a Reconfigure, one more callback from the old pipeline to fade it out, then start
+	//again on the new one as if the devices had just started
+	Pipeline *pipeline = mOutputPipeline.load(std::memory_order_relaxed);
+	Pipeline *pending = mPendingPipeline.load(std::memory_order_acquire);
+	bool fadeOut = false;
+	if (pending && pending != pipeline) {
+		if (mCrossfadeFrames > 0 && !mFadingOut && mFirstOutputTime >= 0.) {
+			mFadingOut = fadeOut = true;
+		} else {
+			pipeline = pending;
+			mOutputPipeline.store(pipeline, std::memory_order_release);
+			mDSPChain.TakeUpSampleRate(pipeline->mSampleRate);
+			mFadingOut = false;
+			mFadingIn = mCrossfadeFrames > 0;
+			mFadeInFrames = 0;
+			mFirstOutputTime = -1;
+			++mStats.mReconfigurations;
+		}
+	}
+	
+	Float64 firstInputTime = pipeline->mFirstInputTime;
+	if (firstInputTime < 0.) {
+		// input hasn't run yet -> silence
+		MakeBufferSilent(ioData);
+		return timer.Result(noErr);
+	}
+	
+	//where the input device is now, to measure the latency against; with a control thread, only
+	//to start from
+	bool readClocks = !IsControlled() || mFirstOutputTime < 0.;
+	if (readClocks) {
+		err = mBackend.GetCurrentTime(CAPlayThroughBackend::kInput, inTS);
+		// this callback may still be called a few times after the device has been stopped
+		if (err) {
+			MakeBufferSilent(ioData);
+			return timer.Result(noErr);
+		}
+	
+		err = mBackend.GetCurrentTime(CAPlayThroughBackend::kOutput, outTS);
+		if (err) return timer.Result(err);
+	}
+	UInt64 hostTime = IsControlled() ? mBackend.GetCurrentHostTime() : 0;
+	
+	//the varispeed's input sample time, or when there is none, the engine's own
+	Float64 sampleTime = pipeline->mResampling ? mResamplerSampleTime : timeStamp.mSampleTime;
+	
+	//start reading the target latency behind the input, at the rate the devices' rate
+	//scalars suggest, and from then on let the drift controller steer
+	if (mFirstOutputTime < 0.) {
+		mFirstOutputTime = sampleTime;
+		mInputSampleRate = mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput).mNominalSampleRate;
+		mOutputSampleRate = mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput).mNominalSampleRate;
+		mHostClockFrequency = mBackend.GetHostClockFrequency();
+		if (mAdaptiveLatency) {
+			// never so far behind that the input catches up with the read position
+			mLastClockTime = ClockTime(outTS, hostTime);
+			mAdaptiveLatencyController.Reset(ConfiguredTargetLatency() / mInputSampleRate,
+											 pipeline->mBuffer.GetCapacityFrames() / 2 / mInputSampleRate);
+		}
+		mInToOutSampleOffset = sampleTime - (inTS.mSampleTime - TargetLatency());
+	
+		bool haveRateScalars = (inTS.mFlags & outTS.mFlags & kAudioTimeStampRateScalarValid) && outTS.mRateScalar > 0.0;
+		++mOutputStarts;
+		mStats.mRate = mDriftController.Clamp(haveRateScalars ? inTS.mRateScalar / outTS.mRateScalar : 1.0);
+		if (!IsControlled())
+			mDriftController.Reset(mStats.mRate);	// or the control thread does, once it hears of this start
+		mStats.mLatencyError = 0.0;
+		mStats.mTargetLatency = TargetLatency();
+		mTrace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kRate, 0, mStats.mRate, 0.0, mStats.mTargetLatency);
+	
+		CAPT_DEBUG("Set initial IOOffset to %f.\n", mInToOutSampleOffset);
+	
+		mDSPChain.Reset();
+		MakeBufferSilent(ioData);
+		if (pipeline->mResampling) {
+			// as if a varispeed had played the silence
+			pipeline->mResampler.Reset();
+			mResamplerSampleTime += floor(nFrames * pipeline->mNominalRatio * mStats.mRate + 0.5);
+			return timer.Result(noErr);
+		}
+		mAppliedRate = mStats.mRate;
+		++mStats.mRateUpdates;
+		return timer.Result(mBackend.SetPlaybackRate(mStats.mRate));
+	}
+	
+	if (IsControlled()) {
+		//the control thread's latest decision, if there's one for this start
+		Decision decision;
+		if (mDecisions.Take(decision) && decision.mStart == mOutputStarts) {
+			mStats.mRate = decision.mRate;
+			mStats.mLatencyError = decision.mLatencyError;
+			mStats.mTargetLatency = decision.mTargetLatency;
+			mTrace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kRate, 0, mStats.mRate, mStats.mLatencyError,
+						  mStats.mTargetLatency);
+		}
+	} else {
+		Float64 readTime = sampleTime - mInToOutSampleOffset;
+		Float64 inputFrames = pipeline->mResampling ? nFrames * pipeline->mNominalRatio : nFrames;
+		mStats.mTargetLatency = TargetLatency();
+		mStats.mLatencyError = (inTS.mSampleTime - readTime) - mStats.mTargetLatency;
+		mStats.mRate = mDriftController.Update(mStats.mLatencyError / mInputSampleRate, inputFrames / mInputSampleRate);
+		mTrace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kRate, 0, mStats.mRate, mStats.mLatencyError,
+					  mStats.mTargetLatency);
+	}
+	
+	const AudioTimeStamp *input = readClocks ? &inTS : NULL;
+	Float64 clockTime = ClockTime(outTS, hostTime);
+	bool fetched = false;
+	if (pipeline->mResampling) {
+		err = Resample(*pipeline, sampleTime, nFrames, ioData, input, clockTime, fetched);
+	} else {
+		err = ApplyRate();
+		if (!err)
+			err = FetchAndMix(*pipeline, sampleTime, nFrames, ioData, input, clockTime, false, fetched);
+	}
+	
+	//down to silence at the end of the old pipeline's last buffer, and up from it at the start of
+	//the new one's first
+	if (fadeOut) {
+		UInt32 fadeFrames = std::min(nFrames, mCrossfadeFrames);
+		RampBuffer(ioData, nFrames - fadeFrames, fadeFrames, Float32(fadeFrames - 1) / fadeFrames, -1.0f / fadeFrames);
+	} else if (mFadingIn && fetched) {
+		UInt32 fadeFrames = std::min(nFrames, mCrossfadeFrames - mFadeInFrames);
+		RampBuffer(ioData, 0, fadeFrames, Float32(mFadeInFrames + 1) / mCrossfadeFrames, 1.0f / mCrossfadeFrames);
+		mFadeInFrames += fadeFrames;
+		mFadingIn = mFadeInFrames < mCrossfadeFrames;
+	}
+	
+	//tell the control thread where this callback read from, as the offset now has it
+	if (IsControlled()) {
+		RenderState state = { hostTime, sampleTime - mInToOutSampleOffset, TargetLatency(), mInputSampleRate,
+							  mStats.mRate, mOutputStarts };
+		mRenderStates.Post(state);
+	}
+	return timer.Result(err);
+}
+
+//the clock the adaptive latency measures callback intervals by, in seconds: the output device's,
+//or with a control thread, which leaves the output's time unread, the host's
+Float64	CAPlayThroughEngine::ClockTime(const AudioTimeStamp &outTS, UInt64 hostTime) const
+{
+	return IsControlled() ? hostTime / mHostClockFrequency : outTS.mSampleTime / mOutputSampleRate;
+}
+
+//Sets the varispeed to the rate decided on, unless it is already within the threshold of it.
+OSStatus	CAPlayThroughEngine::ApplyRate()
+{
+	if (fabs(mStats.mRate - mAppliedRate) <= mRateThreshold)
+		return noErr;
+	mAppliedRate = mStats.mRate;
+	++mStats.mRateUpdates;
+	return mBackend.SetPlaybackRate(mAppliedRate);
+}
+
+//Copies the frames for sampleTime, in the varispeed's (or the resampler's) input sample time,
+//out of the ring. If they aren't there, moves the read position, leaves ioData silent and
+//returns false. inTS is where the input device was at the start of the callback, if the engine
+//read it.
+bool	CAPlayThroughEngine::FetchFromRing(Pipeline &pipeline, Float64 sampleTime, UInt32 nFrames, AudioBufferList *ioData,
+										   const AudioTimeStamp *inTS, Float64 clockTime)
+{
+	CARingBuffer &buffer = pipeline.mBuffer;
+	Float64 readTime = sampleTime - mInToOutSampleOffset;
+	OSStatus err = buffer.Fetch(ioData, nFrames, SInt64(readTime));
+	
+	//what's stored beyond what we just read
+	SInt64 bufferStartTime, bufferEndTime;
+	buffer.GetTimeBounds(bufferStartTime, bufferEndTime);
+	Float64 headroom = bufferEndTime - (SInt64(readTime) + nFrames);
+	mMetrics.CountFetch(err);
+	mTrace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kFetch, err, readTime, bufferStartTime, bufferEndTime);
+	mMetrics.SetOutputState(headroom, mStats.mRate, mStats.mLatencyError, mStats.mTargetLatency);
+	if (err == kCARingBufferError_OK) {
+		if (mAdaptiveLatency)
+			AdaptLatency(headroom, clockTime, false);
+		return true;
+	}
+	
+	Float64 oldOffset = mInToOutSampleOffset;
+	AudioTimeStamp inputNow;
+	CAPlayThroughTrace::OffsetReason reason = CAPlayThroughTrace::kOffsetStarting;
+	CAPT_DEBUG("Oops. Adjusting IOOffset from %f, ", mInToOutSampleOffset);
+	if (err < kCARingBufferError_OK && bufferStartTime <= SInt64(pipeline.mFirstInputTime.load())) {
+		// just started: the offset leaves room for the input to get ahead, and it will
+		CAPT_DEBUG("early ");
+	} else if (err < kCARingBufferError_OK) {
+		CAPT_DEBUG("behind ");
+		reason = CAPlayThroughTrace::kOffsetBehind;
+		// The input has already overwritten what we wanted: the output stalled for longer
+		// than the ring holds. Pick up again at the target latency behind the input.
+		// (Adding to the offset here, as the ahead case does, reads further back still and
+		// never catches up.) With a control thread, only now is the input's clock needed.
+		if (!inTS && mBackend.GetCurrentTime(CAPlayThroughBackend::kInput, inputNow) == noErr)
+			inTS = &inputNow;
+		if (inTS)
+			mInToOutSampleOffset = sampleTime - (inTS->mSampleTime - TargetLatency());
+		++mStats.mOverruns;
+	} else if (err > kCARingBufferError_OK) {
+		CAPT_DEBUG("ahead ");
+		reason = CAPlayThroughTrace::kOffsetAhead;
+		// Adjust by the amount that we read past in the buffer
+		if (mAdaptiveLatency)
+			AdaptLatency(headroom, clockTime, true);
+		mInToOutSampleOffset += std::max(((sampleTime - mInToOutSampleOffset) + nFrames) - bufferEndTime, kAdjustmentOffsetSamples);
+		++mStats.mUnderruns;
+	}
+	CAPT_DEBUG("to %f.\n", mInToOutSampleOffset);
+	if (mInToOutSampleOffset != oldOffset) {
+		mMetrics.CountOffsetAdjustment(mInToOutSampleOffset - oldOffset);
+		mTrace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kOffsetAdjusted, reason, oldOffset,
+					  mInToOutSampleOffset, inTS ? inTS->mSampleTime : 0.0);
+	}
+	if (reason != CAPlayThroughTrace::kOffsetStarting)
+		mTrace.Glitch(err, nFrames);
+	// a clipped Fetch leaves mDataByteSize covering only what it copied
+	for (UInt32 i = 0; i < ioData->mNumberBuffers; i++)
+		ioData->mBuffers[i].mDataByteSize = nFrames * ioData->mBuffers[i].mNumberChannels * sizeof(Float32);
+	MakeBufferSilent(ioData);
+	mStats.mSilentFramesInserted += nFrames;
+	return false;
+}
+
+//FetchFromRing, through the channel matrix unless it is the identity: the input's channels are
+//fetched into mMatrixInput and mixed from there into ioData's. byReference as for
+//CAChannelMatrix::Process. Then the DSP chain, on whatever ioData ends up holding; a block it
+//refuses is left silent, not played unprocessed.
+OSStatus	CAPlayThroughEngine::FetchAndMix(Pipeline &pipeline, Float64 sampleTime, UInt32 nFrames, AudioBufferList *ioData,
+											 const AudioTimeStamp *inTS, Float64 clockTime, bool byReference, bool &fetched)
+{
+	OSStatus err = noErr;
+	if (mMatrix.IsIdentity()) {
+		fetched = FetchFromRing(pipeline, sampleTime, nFrames, ioData, inTS, clockTime);
+		err = ProcessDSP(ioData, nFrames);
+		if (err)
+			fetched = false;
+		return err;
+	}
+	
+	fetched = false;
+	if (nFrames > pipeline.mMatrixInputFrames) {
+		MakeBufferSilent(ioData);
+		return kCAPlayThroughEngineError_TooManyFrames;
+	}
+	AudioBufferList *mixInput = pipeline.mMatrixInput;
+	for (UInt32 i = 0; i < mixInput->mNumberBuffers; i++)
+		mixInput->mBuffers[i].mDataByteSize = nFrames * sizeof(Float32);
+	fetched = FetchFromRing(pipeline, sampleTime, nFrames, mixInput, inTS, clockTime);
+	if (fetched) {
+		err = mMatrix.Process(mixInput, ioData, nFrames, byReference, mWorkerPool);
+	} else {
+		for (UInt32 i = 0; i < ioData->mNumberBuffers; i++)
+			ioData->mBuffers[i].mDataByteSize = nFrames * ioData->mBuffers[i].mNumberChannels * sizeof(Float32);
+		MakeBufferSilent(ioData);
+	}
+	if (!err)
+		err = ProcessDSP(ioData, nFrames);
+	if (err)
+		fetched = false;
+	return err;
+}
+
+//The DSP chain's CADSPChainError as the engine's own, with the block silenced and counted.
+OSStatus	CAPlayThroughEngine::ProcessDSP(AudioBufferList *ioData, UInt32 nFrames)
+{
+	if (mDSPChain.Process(ioData, nFrames) == kCADSPChainError_OK)
+		return noErr;
+	MakeBufferSilent(ioData);
+	mMetrics.CountDSPError();
+	return kCAPlayThroughEngineError_DSP;
+}
+
+//Stands in for the varispeed: reads as many input frames as nFrames output frames take at the
+//controller's rate, mixes them to the output's channels, and resamples them into ioData.
+OSStatus	CAPlayThroughEngine::Resample(Pipeline &pipeline, Float64 sampleTime, UInt32 nFrames, AudioBufferList *ioData,
+										  const AudioTimeStamp *inTS, Float64 clockTime, bool &fetched)
+{
+	CAResampler &resampler = pipeline.mResampler;
+	fetched = false;
+	if (nFrames > resampler.GetMaxOutputFrames()) {
+		MakeBufferSilent(ioData);
+		return kCAResamplerError_TooManyFrames;
+	}
+	
+	Float64 ratio = std::min(pipeline.mNominalRatio * mStats.mRate, resampler.GetMaxRatio());
+	UInt32 nInputFrames = resampler.InputFramesNeeded(nFrames, ratio);
+	//the matrix may point the view's buffers at its input's, so start each callback from our own
+	AudioBufferList *view = pipeline.mResamplerView;
+	view->mNumberBuffers = pipeline.mResamplerInput->mNumberBuffers;
+	for (UInt32 i = 0; i < view->mNumberBuffers; i++) {
+		view->mBuffers[i] = pipeline.mResamplerInput->mBuffers[i];
+		view->mBuffers[i].mDataByteSize = nInputFrames * sizeof(Float32);
+	}
+	//by reference only if nothing is to process the view in place: two outputs may share an input
+	bool byReference = mDSPChain.GetNumberProcessors() == 0;
+	OSStatus err = FetchAndMix(pipeline, sampleTime, nInputFrames, view, inTS, clockTime, byReference, fetched);
+	mResamplerSampleTime += nInputFrames;
+	
+	if (!err)
+		err = resampler.Process(view, nInputFrames, ioData, nFrames, ratio, mWorkerPool);
+	if (err) {
+		MakeBufferSilent(ioData);
+		fetched = false;
+	}
+	return err;
+}
+
+//Tells the adaptive latency how much headroom there was, in input frames, as it would have been
+//with the latency on target, and how long since the last callback.
+void	CAPlayThroughEngine::AdaptLatency(Float64 headroom, Float64 clockTime, bool underrun)
+{
+	Float64 interval = clockTime - mLastClockTime;
+	mLastClockTime = clockTime;
+	mAdaptiveLatencyController.Update((headroom - mStats.mLatencyError) / mInputSampleRate, interval, underrun);
+}
+
+#pragma mark -- Control plane --
+
+//The latency as OutputProc would measure it: from where the output last read, carried on at the
+//input's nominal rate to the moment the input's clock was read, to where the input is then.
+OSStatus	CAPlayThroughEngine::ControlTick()
+{
+	RenderState state;
+	if (!mRenderStates.Take(state))
+		return noErr;	// the output hasn't called back since the last tick
+	
+	if (state.mStart != mControlStart) {
+		// the output has (re)started: begin again from its rate, and measure from the next tick
+		mControlStart = state.mStart;
+		mControlHostTime = state.mHostTime;
+		mDriftController.Reset(state.mStartRate);
+		return noErr;
+	}
+	
+	AudioTimeStamp inTS;
+	OSStatus err = mBackend.GetCurrentTime(CAPlayThroughBackend::kInput, inTS);
+	if (err) return err;
+	UInt64 hostTime = mBackend.GetCurrentHostTime();
+	Float64 frequency = mBackend.GetHostClockFrequency();
+	
+	Float64 readTime = state.mReadTime + SInt64(hostTime - state.mHostTime) / frequency * state.mInputSampleRate;
+	Decision decision;
+	decision.mTargetLatency = state.mTargetLatency;
+	decision.mLatencyError = (inTS.mSampleTime - readTime) - state.mTargetLatency;
+	decision.mRate = mDriftController.Update(decision.mLatencyError / state.mInputSampleRate,
+											 SInt64(hostTime - mControlHostTime) / frequency);
+	decision.mStart = state.mStart;
+	mControlHostTime = hostTime;
+	mDecisions.Post(decision);
+	return noErr;
+}
+
+void	CAPlayThroughEngine::StartControlThread()
+{
+	if (!IsControlled() || mControlThread.joinable())
+		return;
+	mControlRunning = true;
+	mControlThread = std::thread(&CAPlayThroughEngine::ControlLoop, this);
+}
+
+void	CAPlayThroughEngine::StopControlThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(mControlMutex);
+		mControlRunning = false;
+	}
+	mControlWake.notify_all();
+	if (mControlThread.joinable())
+		mControlThread.join();
+}
+
+void	CAPlayThroughEngine::ControlLoop()
+{
+	auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<Float64>(mControlInterval));
+	auto next = std::chrono::steady_clock::now() + interval;
+	std::unique_lock<std::mutex> lock(mControlMutex);
+	while (mControlRunning) {
+		if (mControlWake.wait_until(lock, next) != std::cv_status::timeout)
+			continue;
+		next += interval;
+		lock.unlock();
+		ControlTick();
+		lock.lock();
+	}
+}
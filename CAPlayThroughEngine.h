@@ -0,0 +1,313 @@
+/*=============================================================================
+	CAPlayThroughEngine.h
+	
+	The device-independent half of CAPlayThrough: the ring buffer between the
+	input and output devices, the offset between their sample times, and the
+	varispeed rate that tracks the difference between their clocks. It talks
+	to the devices only through a CAPlayThroughBackend.
+	
+	The latency is the distance from where the input device is now to where
+	the output is reading the ring, in input frames. It starts out at the
+	target latency, and a CADriftController steers the varispeed to keep it
+	there, so that the read position never runs into either end of what the
+	input has stored. Fetch errors still move the read position, but only
+	when something other than clock drift (a stall, say) has upset it.
+	
+	In adaptive latency mode a CAAdaptiveLatency moves the target instead:
+	down, slowly, while the ring has headroom to spare, and back up on an
+	underrun.
+	
+	The IO procs record what they do in a CAPlayThroughMetrics, which any
+	thread may read while they run, and, once it is allocated, event by event
+	in a CAPlayThroughTrace, marking a glitch wherever they silence the output
+	after an underrun or an overrun.
+	
+	By default OutputProc reads both devices' clocks and runs the drift
+	controller on every callback. With a control interval it leaves that to
+	a control thread instead: each callback posts where it is reading, and
+	when, to a CAMailbox, and ControlTick, every interval, reads the input
+	device's clock, carries the read position on to the same moment, and
+	posts the drift controller's decision back through another. The output
+	thread takes the latest decision when there is one. Either way it only
+	sets the varispeed rate when the rate has moved by more than the rate
+	threshold. An offset adjustment after a fetch error stays on the output
+	thread, which then reads the input's clock itself if it must.
+	
+	A backend without a varispeed calls OutputProc for output device frames.
+	The engine then resamples with a CAResampler of its own, at the ratio of
+	the nominal rates times the drift controller's rate, and keeps its own
+	count of the input frames it has read in place of the varispeed's sample
+	time.
+	
+	The ring and the buffers around it make up a pipeline, sized for the
+	devices' formats. When a format changes while the devices run,
+	Reconfigure builds a second pipeline for the new formats on the calling
+	thread, reusing that pipeline's last allocations when they are big
+	enough, and publishes it. The input thread changes over to it at its
+	next callback. The output thread fades out of the old one over one
+	more callback, then changes over and starts again as it does when the
+	devices start, fading in once the new ring has the frames it reads.
+	Told that they are stopped, Reconfigure changes them over itself, so
+	that a route that isn't running still takes up every change.
+	
+	The ring holds the input device's channels, and OutputProc fills the
+	output device's through a CAChannelMatrix, mixing ahead of the varispeed
+	or the resampler so that the rate conversion runs on the output's
+	channels. By default it passes input n to output n, as far as both go,
+	and costs nothing when the counts match; set its gains while stopped.
+	
+	Given a CARealtimeWorkerPool, OutputProc runs the matrix and the
+	resampler a group of channels at a time on its workers as well as its
+	own thread, for routes with more channels than one core keeps up with.
+	
+	A CADSPChain runs on the output's channels after the channel matrix, in
+	place and ahead of the varispeed or the resampler, so at the input's
+	nominal rate. It runs on the silence put in for a failed fetch as well,
+	so that filters and delays ring on through it, and is reset whenever the
+	output starts. A block the chain refuses is played as silence, returned
+	as kCAPlayThroughEngineError_DSP and counted in the metrics.
+=============================================================================*/
+
+#ifndef __CAPlayThroughEngine_h__
+#define __CAPlayThroughEngine_h__
+
+#include "CAPlayThroughBackend.h"
+#include "CAAdaptiveLatency.h"
+#include "CAChannelMatrix.h"
+#include "CADSPChain.h"
+#include "CADriftController.h"
+#include "CAPlayThroughMetrics.h"
+#include "CAPlayThroughTrace.h"
+#include "CAMailbox.h"
+#include "CAResampler.h"
+#include "CARealtimeWorkerPool.h"
+#include "CARingBuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+enum {
+	kCAPlayThroughEngineError_Reconfiguring = 1,	// the IO threads haven't both taken up the last Reconfigure
+	kCAPlayThroughEngineError_TooManyFrames = 2,	// a callback for more frames than the pipeline was sized for
+	kCAPlayThroughEngineError_DSP = 3				// the DSP chain refused the block, which was played as silence
+};
+
+struct CAPlayThroughEngineStats {
+	UInt64		mUnderruns;				// Fetches for frames the input hadn't stored yet
+	UInt64		mOverruns;				// Fetches for frames the input had already overwritten
+	UInt64		mSilentFramesInserted;	// input frames silenced in place of a failed Fetch
+	Float64		mLatencyError;			// latency less the target at the last output callback, in input frames
+	Float64		mTargetLatency;			// the target at the last output callback, in input frames
+	Float64		mRate;					// the last rate decided on
+	UInt64		mRateUpdates;			// SetPlaybackRate calls
+	UInt64		mReconfigurations;		// pipelines the output changed over to
+};
+
+class CAPlayThroughEngine : public CAPlayThroughBackend::Client {
+public:
+	CAPlayThroughEngine(CAPlayThroughBackend &backend);
+	~CAPlayThroughEngine();
+	
+	void				Allocate(int nInputChannels, int nOutputChannels);
+							// Float32 deinterleaved buffers, sized from the input device's buffer size,
+							// and the resampler if the backend has no varispeed. The ring holds the input's
+							// channels, and OutputProc fills the output's through the channel matrix.
+	void				Allocate(int nChannels) { Allocate(nChannels, nChannels); }
+	void				Deallocate();
+	OSStatus			Reconfigure(bool running = true);
+							// the devices' formats, but not their channel counts, have changed: builds a
+							// pipeline for them. Not from the IO threads. While they run, they change over
+							// to it, and until they have both taken up the last one this returns
+							// kCAPlayThroughEngineError_Reconfiguring. With running false, from the thread
+							// that has stopped them, it's theirs at once, whatever was still pending.
+	bool				IsReconfiguring() const;
+	void				SetCrossfadeFrames(UInt32 frames) { mCrossfadeFrames = frames; }
+							// the fades out of the old pipeline and into the new, in frames of
+							// OutputProc's; call while stopped. 0 changes over at once, without fades.
+	UInt32				GetCrossfadeFrames() const { return mCrossfadeFrames; }
+	
+	void				Reset();
+							// forget when the devices started; call whenever they (re)start
+	void				ComputeThruOffset();
+							// the initial latency: the devices' safety offsets plus their buffer sizes,
+							// and the resampler's group delay if the engine resamples
+	
+	void				SetTargetLatency(Float64 frames) { mTargetLatency = frames; }
+							// in input frames. Can be changed while running: the latency then slews to
+							// the new target. 0, the default, targets DefaultTargetLatency.
+	Float64				DefaultTargetLatency();
+							// the input's buffer size and safety offset, the output's in input frames,
+							// and kAdjustmentOffsetSamples to spare for callback jitter
+	Float64				GetTargetLatency() const { return mTargetLatency; }
+	void				SetAdaptiveLatency(bool adaptive) { mAdaptiveLatency = adaptive; }
+							// call while stopped. The target starts where SetTargetLatency puts it, and
+							// GetAdaptiveLatency then moves it; see mTargetLatency in the stats.
+	bool				IsAdaptiveLatency() const { return mAdaptiveLatency; }
+	CAAdaptiveLatency &	GetAdaptiveLatency() { return mAdaptiveLatencyController; }
+							// configure while stopped
+	CADriftController &	GetDriftController() { return mDriftController; }
+							// configure while stopped, and before Allocate if the engine resamples
+	void				SetResamplerQuality(CAResamplerQuality quality) { mResamplerQuality = quality; }
+							// for backends without a varispeed; call before Allocate
+	bool				IsResampling() const { return OutputPipeline().mResampling; }
+	CAChannelMatrix &	GetChannelMatrix() { return mMatrix; }
+							// from the ring's channels to OutputProc's. Allocate sets it to the diagonal;
+							// change it after that, while stopped. An identity matrix costs nothing.
+	void				SetWorkerPool(CARealtimeWorkerPool *pool);
+							// for the matrix and the resampler, or NULL, the default, for neither; call
+							// while stopped. This, Allocate and Reconfigure set its period to the output's
+							// buffer, and nothing else may Run it while the output runs.
+	CARealtimeWorkerPool *	GetWorkerPool() const { return mWorkerPool; }
+	CADSPChain &		GetDSPChain() { return mDSPChain; }
+							// on OutputProc's channels. Add processors while stopped; Allocate prepares
+							// them, and Reconfigure redesigns them for the new rate, under the chain's
+							// control lock, from whatever thread it's called on. The output thread takes
+							// the new designs up when it changes over to the new pipeline.
+	
+	void				SetControlInterval(Float64 seconds) { mControlInterval = seconds; }
+							// call while stopped. 0, the default, has OutputProc decide the rate on every
+							// callback; otherwise ControlTick decides it, every so many seconds.
+	Float64				GetControlInterval() const { return mControlInterval; }
+	void				SetRateThreshold(Float64 threshold) { mRateThreshold = threshold; }
+							// how far the rate must move before OutputProc sets it again; call while stopped
+	Float64				GetRateThreshold() const { return mRateThreshold; }
+	OSStatus			ControlTick();
+							// with a control interval, from one thread other than the IO threads: decides
+							// the rate from the output's last callback and the input's clock now
+	void				StartControlThread();
+							// calls ControlTick every control interval on a thread of the engine's own,
+							// until StopControlThread; does nothing without a control interval
+	void				StopControlThread();
+	
+	// CAPlayThroughBackend::Client
+	OSStatus			InputProc(const AudioTimeStamp &timeStamp, UInt32 nFrames) override;
+	OSStatus			OutputProc(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData) override;
+	
+	void				GetStats(CAPlayThroughEngineStats &stats) const { stats = mStats; }
+							// call while the devices are stopped
+	const CAPlayThroughMetrics &	GetMetrics() const { return mMetrics; }
+							// from any thread, at any time
+	CAPlayThroughTrace &	GetTrace() { return mTrace; }
+							// Allocate it while stopped to turn tracing on; read it from any thread
+	Float64				GetInToOutSampleOffset() const { return mInToOutSampleOffset; }
+	CARingBuffer &		GetRingBuffer() { return OutputPipeline().mBuffer; }
+	
+	static const Float64 kAdjustmentOffsetSamples;
+	static const Float64 kDefaultRateThreshold;
+	static const UInt32 kDefaultCrossfadeFrames;
+	
+private:
+	// the ring and the buffers around it
+	struct Pipeline {
+		Pipeline();
+		~Pipeline() { Deallocate(); }
+		void		Deallocate();
+		
+		int						mChannels;		// the input's, in the ring
+		int						mOutputChannels;
+		Float64					mSampleRate;	// the input's nominal, which the DSP chain runs at
+		CARingBuffer			mBuffer;
+		AudioBufferList *		mInputBuffer;
+		UInt32					mInputBufferFrames;
+		AudioBufferList *		mStoreHead;		// views into mBuffer, see InputProc
+		AudioBufferList *		mStoreTail;
+		std::atomic<Float64>	mFirstInputTime;
+		AudioBufferList *		mMatrixInput;	// what's fetched for the channel matrix, unless it is the identity
+		UInt32					mMatrixInputFrames;
+		
+		// for backends without a varispeed
+		bool					mResampling;
+		CAResampler				mResampler;
+		AudioBufferList *		mResamplerInput;
+		AudioBufferList *		mResamplerView;	// mResamplerInput, or where the channel matrix routed to instead
+		Float64					mNominalRatio;	// input over output nominal sample rate
+	};
+	
+	// from the output thread to the control thread, after each callback
+	struct RenderState {
+		UInt64		mHostTime;
+		Float64		mReadTime;			// where the callback read from, at mHostTime
+		Float64		mTargetLatency;
+		Float64		mInputSampleRate;
+		Float64		mStartRate;			// for the drift controller, when the output starts
+		UInt32		mStart;				// which start of the output this is
+	};
+	
+	// and back
+	struct Decision {
+		Float64		mRate;
+		Float64		mLatencyError;
+		Float64		mTargetLatency;
+		UInt32		mStart;
+	};
+	
+	Pipeline &			OutputPipeline() const { return *mOutputPipeline.load(std::memory_order_acquire); }
+	void				AllocatePipeline(Pipeline &pipeline, int nInputChannels, int nOutputChannels);
+	bool				IsControlled() const { return mControlInterval > 0.0; }
+	Float64				ConfiguredTargetLatency();
+	Float64				TargetLatency();
+	Float64				ClockTime(const AudioTimeStamp &outTS, UInt64 hostTime) const;
+	OSStatus			ApplyRate();
+	bool				FetchFromRing(Pipeline &pipeline, Float64 sampleTime, UInt32 nFrames, AudioBufferList *ioData,
+									  const AudioTimeStamp *inTS, Float64 clockTime);
+	OSStatus			FetchAndMix(Pipeline &pipeline, Float64 sampleTime, UInt32 nFrames, AudioBufferList *ioData,
+									const AudioTimeStamp *inTS, Float64 clockTime, bool byReference, bool &fetched);
+	OSStatus			ProcessDSP(AudioBufferList *ioData, UInt32 nFrames);
+	OSStatus			Resample(Pipeline &pipeline, Float64 sampleTime, UInt32 nFrames, AudioBufferList *ioData,
+								 const AudioTimeStamp *inTS, Float64 clockTime, bool &fetched);
+	void				AdaptLatency(Float64 headroom, Float64 clockTime, bool underrun);
+	void				ControlLoop();
+	
+	CAPlayThroughBackend &	mBackend;
+	
+	// Reconfigure builds whichever pipeline neither IO thread is on and makes it the pending one;
+	// each IO thread then moves its own pointer to it
+	Pipeline				mPipelines[2];
+	std::atomic<Pipeline *>	mInputPipeline;
+	std::atomic<Pipeline *>	mOutputPipeline;
+	std::atomic<Pipeline *>	mPendingPipeline;
+	UInt32					mCrossfadeFrames;
+	bool					mFadingOut;			// output thread only, as are the two below
+	UInt32					mFadeInFrames;		// of the fade in so far
+	bool					mFadingIn;
+	CAChannelMatrix			mMatrix;
+	CARealtimeWorkerPool *	mWorkerPool;
+	CADSPChain				mDSPChain;
+	
+	Float64					mFirstOutputTime;
+	Float64					mInToOutSampleOffset;
+	std::atomic<Float64>	mTargetLatency;
+	Float64					mInputSampleRate;
+	CADriftController		mDriftController;	// the output thread's, or with a control interval, the control thread's
+	bool					mAdaptiveLatency;
+	CAAdaptiveLatency		mAdaptiveLatencyController;
+	Float64					mLastClockTime;		// for the adaptive latency's callback intervals, in seconds
+	Float64					mOutputSampleRate;
+	
+	// the control plane
+	Float64					mControlInterval;
+	Float64					mRateThreshold;
+	Float64					mAppliedRate;		// output thread only
+	Float64					mHostClockFrequency;
+	UInt32					mOutputStarts;		// output thread only
+	CAMailbox<RenderState>	mRenderStates;
+	CAMailbox<Decision>		mDecisions;
+	UInt32					mControlStart;		// control thread only, as is the one below
+	UInt64					mControlHostTime;	// of the last tick
+	std::thread				mControlThread;
+	std::mutex				mControlMutex;
+	std::condition_variable	mControlWake;
+	bool					mControlRunning;
+	
+	// for backends without a varispeed
+	CAResamplerQuality		mResamplerQuality;
+	Float64					mResamplerSampleTime;	// input frames read so far, as a varispeed's sample time
+	
+	CAPlayThroughEngineStats mStats;	// output thread only, or Reconfigure's while it's stopped
+	CAPlayThroughMetrics	mMetrics;
+	CAPlayThroughTrace		mTrace;
+};
+
+#endif // __CAPlayThroughEngine_h__
@@ -0,0 +1,210 @@
+/*=============================================================================
+	CAPlayThroughMetrics.cpp
+
+=============================================================================*/
+
+#include "CAPlayThroughMetrics.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+static const char *kFetchResultNames[CAPlayThroughMetrics::kFetchResultCount] = {
+	"wayBehind", "slightlyBehind", "ok", "slightlyAhead", "wayAhead", "tooMuch"
+};
+
+CAPlayThroughMetrics::CAPlayThroughMetrics()
+{
+	for (int i = 0; i < 2; ++i) {
+		mDirections[i].mLastBegan = 0;
+		mDirections[i].mBegan = 0;
+	}
+}
+
+UInt64	CAPlayThroughMetrics::Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#pragma mark -- Writers --
+
+void	CAPlayThroughMetrics::AtomicHistogram::Record(UInt64 nanos)
+{
+	int bucket = (nanos > 1) ? 63 - __builtin_clzll(nanos) : 0;
+	mBuckets[std::min(bucket, int(kHistogramBuckets - 1))].Add(1);
+	mCount.Add(1);
+	mSum.Add(nanos);
+	if (nanos > mMax.Get())
+		mMax.mValue.store(nanos, std::memory_order_relaxed);
+}
+
+void	CAPlayThroughMetrics::CallbackBegan(Direction direction, UInt64 now)
+{
+	DirectionMetrics &metrics = mDirections[direction];
+	if (metrics.mLastBegan != 0)
+		metrics.mInterval.Record(now - metrics.mLastBegan);
+	metrics.mLastBegan = now;
+	metrics.mBegan = now;
+}
+
+void	CAPlayThroughMetrics::CallbackEnded(Direction direction, UInt64 now, OSStatus err)
+{
+	DirectionMetrics &metrics = mDirections[direction];
+	metrics.mDuration.Record(now - metrics.mBegan);
+	metrics.mCallbacks.Add(1);
+	if (err)
+		metrics.mErrors.Add(1);
+}
+
+void	CAPlayThroughMetrics::CountFetch(CARingBufferError err)
+{
+	int index = FetchResultIndex(err);
+	if (index >= 0 && index < kFetchResultCount)
+		mFetchResults[index].Add(1);
+}
+
+void	CAPlayThroughMetrics::CountOffsetAdjustment(Float64 frames)
+{
+	mOffsetAdjustments.Add(1);
+	mOffsetAdjustmentFrames.Set(mOffsetAdjustmentFrames.Get() + (frames < 0 ? -frames : frames));
+}
+
+void	CAPlayThroughMetrics::SetOutputState(Float64 ringFill, Float64 rate, Float64 latencyError, Float64 targetLatency)
+{
+	mRingFill.Set(ringFill);
+	mRate.Set(rate);
+	mLatencyError.Set(latencyError);
+	mTargetLatency.Set(targetLatency);
+}
+
+#pragma mark -- Readers --
+
+void	CAPlayThroughMetrics::AtomicHistogram::Read(Histogram &histogram) const
+{
+	histogram.mCount = mCount.Get();
+	histogram.mSumNanos = mSum.Get();
+	histogram.mMaxNanos = mMax.Get();
+	for (int i = 0; i < kHistogramBuckets; ++i)
+		histogram.mBuckets[i] = mBuckets[i].Get();
+}
+
+void	CAPlayThroughMetrics::DirectionMetrics::Read(DirectionSnapshot &snapshot) const
+{
+	snapshot.mCallbacks = mCallbacks.Get();
+	snapshot.mErrors = mErrors.Get();
+	mDuration.Read(snapshot.mDuration);
+	mInterval.Read(snapshot.mInterval);
+}
+
+void	CAPlayThroughMetrics::GetSnapshot(Snapshot &snapshot) const
+{
+	mDirections[kInput].Read(snapshot.mInput);
+	mDirections[kOutput].Read(snapshot.mOutput);
+	for (int i = 0; i < kFetchResultCount; ++i)
+		snapshot.mFetchResults[i] = mFetchResults[i].Get();
+	snapshot.mOffsetAdjustments = mOffsetAdjustments.Get();
+	snapshot.mOffsetAdjustmentFrames = mOffsetAdjustmentFrames.Get();
+	snapshot.mDSPErrors = mDSPErrors.Get();
+	snapshot.mRingFill = mRingFill.Get();
+	snapshot.mRate = mRate.Get();
+	snapshot.mLatencyError = mLatencyError.Get();
+	snapshot.mTargetLatency = mTargetLatency.Get();
+}
+
+UInt64	CAPlayThroughMetrics::Histogram::PercentileNanos(Float64 percent) const
+{
+	UInt64 total = 0;
+	for (int i = 0; i < kHistogramBuckets; ++i)
+		total += mBuckets[i];
+	if (total == 0)
+		return 0;
+
+	UInt64 rank = std::max(UInt64(percent / 100.0 * total + 0.999999), UInt64(1));
+	UInt64 seen = 0;
+	for (int i = 0; i < kHistogramBuckets; ++i) {
+		seen += mBuckets[i];
+		if (seen >= rank)
+			return std::min(UInt64(2) << i, mMaxNanos);
+	}
+	return mMaxNanos;
+}
+
+#pragma mark -- Reports --
+
+static void AppendHistogramText(std::string &out, const char *name, const CAPlayThroughMetrics::Histogram &h)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "    %-9s n %llu  mean %.1f us  p50 %.1f us  p99 %.1f us  max %.1f us\n", name,
+			 (unsigned long long)h.mCount, h.MeanNanos() / 1e3, h.PercentileNanos(50) / 1e3, h.PercentileNanos(99) / 1e3,
+			 h.mMaxNanos / 1e3);
+	out += line;
+}
+
+std::string	CAPlayThroughMetrics::FormatText(const Snapshot &snapshot)
+{
+	std::string out;
+	char line[256];
+	const DirectionSnapshot *directions[2] = { &snapshot.mInput, &snapshot.mOutput };
+	const char *names[2] = { "input", "output" };
+	for (int i = 0; i < 2; ++i) {
+		snprintf(line, sizeof(line), "%s: %llu callbacks, %llu errors\n", names[i],
+				 (unsigned long long)directions[i]->mCallbacks, (unsigned long long)directions[i]->mErrors);
+		out += line;
+		AppendHistogramText(out, "duration", directions[i]->mDuration);
+		AppendHistogramText(out, "interval", directions[i]->mInterval);
+	}
+	out += "fetch:";
+	for (int i = 0; i < kFetchResultCount; ++i) {
+		snprintf(line, sizeof(line), " %s %llu", kFetchResultNames[i], (unsigned long long)snapshot.mFetchResults[i]);
+		out += line;
+	}
+	snprintf(line, sizeof(line), "\noffset adjustments: %llu, %.0f frames\nDSP errors: %llu\n"
+			 "ring fill %.0f frames, rate %.6f, latency error %.1f frames, target latency %.1f frames\n",
+			 (unsigned long long)snapshot.mOffsetAdjustments, snapshot.mOffsetAdjustmentFrames,
+			 (unsigned long long)snapshot.mDSPErrors, snapshot.mRingFill, snapshot.mRate, snapshot.mLatencyError, snapshot.mTargetLatency);
+	out += line;
+	return out;
+}
+
+static void AppendHistogramJSON(std::string &out, const char *name, const CAPlayThroughMetrics::Histogram &h)
+{
+	char text[256];
+	snprintf(text, sizeof(text), "\"%s\":{\"count\":%llu,\"sumNs\":%llu,\"maxNs\":%llu,\"buckets\":[", name,
+			 (unsigned long long)h.mCount, (unsigned long long)h.mSumNanos, (unsigned long long)h.mMaxNanos);
+	out += text;
+	for (int i = 0; i < CAPlayThroughMetrics::kHistogramBuckets; ++i) {
+		snprintf(text, sizeof(text), "%s%llu", i ? "," : "", (unsigned long long)h.mBuckets[i]);
+		out += text;
+	}
+	out += "]}";
+}
+
+// one line, buckets as counts of [2^i, 2^(i+1)) ns
+std::string	CAPlayThroughMetrics::FormatJSON(const Snapshot &snapshot)
+{
+	std::string out = "{";
+	char text[256];
+	const DirectionSnapshot *directions[2] = { &snapshot.mInput, &snapshot.mOutput };
+	const char *names[2] = { "input", "output" };
+	for (int i = 0; i < 2; ++i) {
+		snprintf(text, sizeof(text), "\"%s\":{\"callbacks\":%llu,\"errors\":%llu,", names[i],
+				 (unsigned long long)directions[i]->mCallbacks, (unsigned long long)directions[i]->mErrors);
+		out += text;
+		AppendHistogramJSON(out, "duration", directions[i]->mDuration);
+		out += ",";
+		AppendHistogramJSON(out, "interval", directions[i]->mInterval);
+		out += "},";
+	}
+	out += "\"fetch\":{";
+	for (int i = 0; i < kFetchResultCount; ++i) {
+		snprintf(text, sizeof(text), "%s\"%s\":%llu", i ? "," : "", kFetchResultNames[i], (unsigned long long)snapshot.mFetchResults[i]);
+		out += text;
+	}
+	snprintf(text, sizeof(text), "},\"offsetAdjustments\":%llu,\"offsetAdjustmentFrames\":%.17g,\"dspErrors\":%llu,"
+			 "\"ringFill\":%.17g,\"rate\":%.17g,\"latencyError\":%.17g,\"targetLatency\":%.17g}",
+			 (unsigned long long)snapshot.mOffsetAdjustments, snapshot.mOffsetAdjustmentFrames,
+			 (unsigned long long)snapshot.mDSPErrors, snapshot.mRingFill,
+			 snapshot.mRate, snapshot.mLatencyError, snapshot.mTargetLatency);
+	out += text;
+	return out;
+}
@@ -0,0 +1,156 @@
+/*=============================================================================
+	CAPlayThroughMetrics.h
+
+	Counters, gauges and histograms kept by CAPlayThroughEngine from its IO
+	threads, for a non-real-time thread to read at any time.
+
+	Each value has one writer: the input thread, or the output thread. A
+	writer updates it with a relaxed load and store of its own atomic, no
+	read-modify-write and no lock, so that recording costs the IO thread no
+	more than a few plain stores. GetSnapshot reads them all, wait-free. A
+	snapshot is not taken at one instant: each value is exact, but values
+	written by different callbacks may be one callback apart.
+
+	Durations and intervals go in histograms of power-of-two buckets of
+	nanoseconds, and are timed with CAPlayThroughMetrics::Now. The ring fill
+	is the input frames stored beyond the end of the last Fetch.
+
+	FormatText and FormatJSON turn a snapshot into a report; they allocate,
+	and are for the reading thread.
+=============================================================================*/
+
+#ifndef __CAPlayThroughMetrics_h__
+#define __CAPlayThroughMetrics_h__
+
+#include "CARingBuffer.h"
+
+#include <atomic>
+#include <string>
+
+class CAPlayThroughMetrics {
+public:
+	enum Direction {
+		kInput,
+		kOutput
+	};
+
+	enum {
+		kHistogramBuckets = 40,		// bucket b holds [2^b, 2^(b+1)) ns, bucket 0 also 0; 2^40 ns is 18 minutes
+		kFetchResultCount = 6		// CARingBufferError from kCARingBufferError_WayBehind to _TooMuch
+	};
+
+	struct Histogram {
+		UInt64		mCount;
+		UInt64		mSumNanos;
+		UInt64		mMaxNanos;
+		UInt64		mBuckets[kHistogramBuckets];
+
+		Float64		MeanNanos() const { return mCount ? Float64(mSumNanos) / mCount : 0.0; }
+		UInt64		PercentileNanos(Float64 percent) const;
+						// the upper edge of the bucket holding the percentile
+	};
+
+	struct DirectionSnapshot {
+		UInt64		mCallbacks;
+		UInt64		mErrors;			// callbacks that returned an error
+		Histogram	mDuration;			// from entering the callback to leaving it
+		Histogram	mInterval;			// from entering one callback to entering the next
+	};
+
+	struct Snapshot {
+		DirectionSnapshot	mInput;
+		DirectionSnapshot	mOutput;
+		UInt64		mFetchResults[kFetchResultCount];	// index with FetchResultIndex
+		UInt64		mOffsetAdjustments;		// read position moved after a failed Fetch
+		Float64		mOffsetAdjustmentFrames;	// by this much altogether, either way
+		UInt64		mDSPErrors;				// blocks the DSP chain refused, played as silence
+		Float64		mRingFill;				// input frames, at the last output callback
+		Float64		mRate;					// the varispeed's, or the engine's resampler's
+		Float64		mLatencyError;			// input frames
+		Float64		mTargetLatency;			// input frames
+	};
+
+	CAPlayThroughMetrics();
+
+	static UInt64		Now();
+							// nanoseconds on a monotonic clock
+	static int			FetchResultIndex(CARingBufferError err) { return int(err - kCARingBufferError_WayBehind); }
+
+	// from the input or the output thread
+	void				CallbackBegan(Direction direction, UInt64 now);
+	void				CallbackEnded(Direction direction, UInt64 now, OSStatus err);
+
+	// RAII for the above
+	class CallbackTimer {
+	public:
+		CallbackTimer(CAPlayThroughMetrics &metrics, Direction direction) : mMetrics(metrics), mDirection(direction), mErr(noErr)
+			{ mMetrics.CallbackBegan(direction, Now()); }
+		~CallbackTimer() { mMetrics.CallbackEnded(mDirection, Now(), mErr); }
+		OSStatus	Result(OSStatus err) { mErr = err; return err; }
+						// return through this to count errors
+	private:
+		CAPlayThroughMetrics &	mMetrics;
+		Direction				mDirection;
+		OSStatus				mErr;
+	};
+
+	// from the output thread
+	void				CountFetch(CARingBufferError err);
+	void				CountOffsetAdjustment(Float64 frames);
+	void				CountDSPError() { mDSPErrors.Add(1); }
+	void				SetOutputState(Float64 ringFill, Float64 rate, Float64 latencyError, Float64 targetLatency);
+
+	// from any thread
+	void				GetSnapshot(Snapshot &snapshot) const;
+	static std::string	FormatText(const Snapshot &snapshot);
+	static std::string	FormatJSON(const Snapshot &snapshot);
+
+private:
+	// one writer each, so plain loads and stores
+	struct Counter {
+		std::atomic<UInt64>		mValue;
+		Counter() : mValue(0) { }
+		void		Add(UInt64 n) { mValue.store(mValue.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+		UInt64		Get() const { return mValue.load(std::memory_order_relaxed); }
+	};
+
+	struct Gauge {
+		std::atomic<Float64>	mValue;
+		Gauge() : mValue(0) { }
+		void		Set(Float64 value) { mValue.store(value, std::memory_order_relaxed); }
+		Float64		Get() const { return mValue.load(std::memory_order_relaxed); }
+	};
+
+	struct AtomicHistogram {
+		Counter		mCount;
+		Counter		mSum;
+		Counter		mMax;
+		Counter		mBuckets[kHistogramBuckets];
+
+		void		Record(UInt64 nanos);
+		void		Read(Histogram &histogram) const;
+	};
+
+	struct DirectionMetrics {
+		Counter				mCallbacks;
+		Counter				mErrors;
+		AtomicHistogram		mDuration;
+		AtomicHistogram		mInterval;
+		UInt64				mLastBegan;		// writer only
+		UInt64				mBegan;
+
+		void		Read(DirectionSnapshot &snapshot) const;
+	};
+
+	DirectionMetrics	mDirections[2];
+	Counter				mFetchResults[kFetchResultCount];
+	Counter				mOffsetAdjustments;
+	Gauge				mOffsetAdjustmentFrames;
+	Counter				mDSPErrors;
+	Gauge				mRingFill;
+	Gauge				mRate;
+	Gauge				mLatencyError;
+	Gauge				mTargetLatency;
+};
+
+#endif // __CAPlayThroughMetrics_h__
@@ -0,0 +1,270 @@
+/*=============================================================================
+	CAPlayThroughSessions.cpp
+
+=============================================================================*/
+
+#include "CAPlayThroughSessions.h"
+
+CAPlayThroughSessionManager::CAPlayThroughSessionManager(Factory &factory) :
+	mFactory(factory)
+{
+}
+
+CAPlayThroughSessionManager::~CAPlayThroughSessionManager()
+{
+	RemoveAllRoutes();
+}
+
+#pragma mark -- Devices --
+
+// the device's handle, opened if no route has it yet, and counted as used once more
+CAPlayThroughSessionManager::Device *	CAPlayThroughSessionManager::RetainDevice(CAPlayThroughDeviceID device)
+{
+	std::map<CAPlayThroughDeviceID, OpenDevice>::iterator open = mDevices.find(device);
+	if (open != mDevices.end()) {
+		++open->second.mUseCount;
+		return open->second.mDevice;
+	}
+
+	Device *handle = mFactory.OpenDevice(device);
+	if (handle) {
+		OpenDevice opened = { handle, 1 };
+		mDevices[device] = opened;
+	}
+	return handle;
+}
+
+void	CAPlayThroughSessionManager::ReleaseDevice(CAPlayThroughDeviceID device)
+{
+	std::map<CAPlayThroughDeviceID, OpenDevice>::iterator open = mDevices.find(device);
+	if (open != mDevices.end() && --open->second.mUseCount == 0) {
+		delete open->second.mDevice;
+		mDevices.erase(open);
+	}
+}
+
+UInt32	CAPlayThroughSessionManager::GetNumberOpenDevices()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return UInt32(mDevices.size());
+}
+
+UInt32	CAPlayThroughSessionManager::GetDeviceUseCount(CAPlayThroughDeviceID device)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	std::map<CAPlayThroughDeviceID, OpenDevice>::iterator open = mDevices.find(device);
+	return (open != mDevices.end()) ? open->second.mUseCount : 0;
+}
+
+// Only a change the session can't take up is a reason to make it again. Any other failure leaves
+// it as it was, and the change pending, for the next try.
+OSStatus	CAPlayThroughSessionManager::TakeUpChange(std::map<CAPlayThroughRoute, Session *>::iterator session)
+{
+	CAPlayThroughRoute route = session->first;
+	bool wasRunning = session->second->IsRunning();
+	OSStatus err = session->second->Reconfigure();
+	if (err == kCAPlayThroughSessionError_FormatChanged)
+		err = RecreateSession(session, wasRunning);
+	else if (err)
+		mPendingChanges.insert(route);
+	else
+		mPendingChanges.erase(route);
+	return err;
+}
+
+OSStatus	CAPlayThroughSessionManager::DeviceChanged(CAPlayThroughDeviceID device)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	OSStatus result = noErr;
+	for (std::map<CAPlayThroughRoute, Session *>::iterator it = mSessions.begin(); it != mSessions.end(); ) {
+		std::map<CAPlayThroughRoute, Session *>::iterator session = it++;		// RecreateSession may erase it
+		if (session->first.mInput != device && session->first.mOutput != device && !mPendingChanges.count(session->first))
+			continue;
+		OSStatus err = TakeUpChange(session);
+		if (err && !result)
+			result = err;
+	}
+	return result;
+}
+
+OSStatus	CAPlayThroughSessionManager::RetryDeviceChanges()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	OSStatus result = noErr;
+	for (std::map<CAPlayThroughRoute, Session *>::iterator it = mSessions.begin(); it != mSessions.end(); ) {
+		std::map<CAPlayThroughRoute, Session *>::iterator session = it++;
+		if (!mPendingChanges.count(session->first))
+			continue;
+		OSStatus err = TakeUpChange(session);
+		if (err && !result)
+			result = err;
+	}
+	return result;
+}
+
+bool	CAPlayThroughSessionManager::HasPendingChange(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mPendingChanges.count(route) != 0;
+}
+
+#pragma mark -- Routes --
+
+OSStatus	CAPlayThroughSessionManager::AddRoute(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	if (mSessions.count(route))
+		return kCAPlayThroughSessionError_RouteExists;
+
+	// a route from a device to itself uses it once
+	Device *input = RetainDevice(route.mInput);
+	if (!input)
+		return kCAPlayThroughSessionError_DeviceUnavailable;
+	Device *output = (route.mOutput == route.mInput) ? input : RetainDevice(route.mOutput);
+	Session *session = output ? mFactory.CreateSession(route, *input, *output) : NULL;
+	if (!session) {
+		if (output && route.mOutput != route.mInput)
+			ReleaseDevice(route.mOutput);
+		ReleaseDevice(route.mInput);
+		return kCAPlayThroughSessionError_DeviceUnavailable;
+	}
+	mSessions[route] = session;
+	return noErr;
+}
+
+void	CAPlayThroughSessionManager::DeleteSession(std::map<CAPlayThroughRoute, Session *>::iterator session)
+{
+	CAPlayThroughRoute route = session->first;
+	session->second->Stop();
+	delete session->second;
+	mSessions.erase(session);
+	mPendingChanges.erase(route);
+	if (route.mOutput != route.mInput)
+		ReleaseDevice(route.mOutput);
+	ReleaseDevice(route.mInput);
+}
+
+OSStatus	CAPlayThroughSessionManager::RemoveRoute(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	std::map<CAPlayThroughRoute, Session *>::iterator session = mSessions.find(route);
+	if (session == mSessions.end())
+		return kCAPlayThroughSessionError_NoSuchRoute;
+	DeleteSession(session);
+	return noErr;
+}
+
+void	CAPlayThroughSessionManager::RemoveAllRoutes()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	while (!mSessions.empty())
+		DeleteSession(mSessions.begin());
+}
+
+// The devices stay open, so the new session finds them as they are now. If it can't be made, the
+// route goes.
+OSStatus	CAPlayThroughSessionManager::RecreateSession(std::map<CAPlayThroughRoute, Session *>::iterator session,
+													 bool start)
+{
+	CAPlayThroughRoute route = session->first;
+	session->second->Stop();
+	delete session->second;
+	mPendingChanges.erase(route);
+	session->second = mFactory.CreateSession(route, *mDevices[route.mInput].mDevice, *mDevices[route.mOutput].mDevice);
+	if (!session->second) {
+		mSessions.erase(session);
+		if (route.mOutput != route.mInput)
+			ReleaseDevice(route.mOutput);
+		ReleaseDevice(route.mInput);
+		return kCAPlayThroughSessionError_DeviceUnavailable;
+	}
+	return start ? session->second->Start() : noErr;
+}
+
+OSStatus	CAPlayThroughSessionManager::ResetRoute(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	std::map<CAPlayThroughRoute, Session *>::iterator session = mSessions.find(route);
+	if (session == mSessions.end())
+		return kCAPlayThroughSessionError_NoSuchRoute;
+	return RecreateSession(session, session->second->IsRunning());
+}
+
+bool	CAPlayThroughSessionManager::HasRoute(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return mSessions.count(route) != 0;
+}
+
+UInt32	CAPlayThroughSessionManager::GetNumberRoutes()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	return UInt32(mSessions.size());
+}
+
+#pragma mark -- Running --
+
+OSStatus	CAPlayThroughSessionManager::Start(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	std::map<CAPlayThroughRoute, Session *>::iterator session = mSessions.find(route);
+	if (session == mSessions.end())
+		return kCAPlayThroughSessionError_NoSuchRoute;
+	// a session made again in its place keeps the iterator; one that fails to be made is an error
+	if (mPendingChanges.count(route)) {
+		OSStatus err = TakeUpChange(session);
+		if (err)
+			return err;
+	}
+	return session->second->Start();
+}
+
+OSStatus	CAPlayThroughSessionManager::Stop(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	std::map<CAPlayThroughRoute, Session *>::iterator session = mSessions.find(route);
+	if (session == mSessions.end())
+		return kCAPlayThroughSessionError_NoSuchRoute;
+	return session->second->Stop();
+}
+
+bool	CAPlayThroughSessionManager::IsRunning(const CAPlayThroughRoute &route)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	std::map<CAPlayThroughRoute, Session *>::iterator session = mSessions.find(route);
+	return session != mSessions.end() && session->second->IsRunning();
+}
+
+OSStatus	CAPlayThroughSessionManager::StartAll()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	OSStatus result = noErr;
+	for (std::map<CAPlayThroughRoute, Session *>::iterator it = mSessions.begin(); it != mSessions.end(); ) {
+		std::map<CAPlayThroughRoute, Session *>::iterator session = it++;		// RecreateSession may erase it
+		OSStatus err = mPendingChanges.count(session->first) ? TakeUpChange(session) : noErr;
+		if (!err)
+			err = session->second->Start();
+		if (err && !result)
+			result = err;
+	}
+	return result;
+}
+
+OSStatus	CAPlayThroughSessionManager::StopAll()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	OSStatus result = noErr;
+	for (std::map<CAPlayThroughRoute, Session *>::iterator it = mSessions.begin(); it != mSessions.end(); ++it) {
+		OSStatus err = it->second->Stop();
+		if (err && !result)
+			result = err;
+	}
+	return result;
+}
+
+void	CAPlayThroughSessionManager::ForEachSession(const std::function<void(const CAPlayThroughRoute &, Session &)> &proc)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	for (std::map<CAPlayThroughRoute, Session *>::iterator it = mSessions.begin(); it != mSessions.end(); ++it)
+		proc(it->first, *it->second);
+}
@@ -0,0 +1,149 @@
+/*=============================================================================
+	CAPlayThroughSessions.h
+
+	Many play-through routes in one process. A route is an input device and
+	an output device; each has a session of its own, with its own backend
+	and engine, and the manager keys them by route. Sessions are independent
+	of each other: starting, stopping, resetting or removing one leaves the
+	rest running.
+
+	Devices are shared. The first route that uses a device opens a handle
+	to it, the routes after it share that handle, and the last one to go
+	closes it. A change to a device's format arrives once, at its handle,
+	and DeviceChanged passes it on to every session on the device:
+	Reconfigure where the session can take the change up in place, and a
+	reset where Reconfigure returns kCAPlayThroughSessionError_FormatChanged.
+	A session that fails to take a change up for any other reason is left
+	as it was, and the change is kept for it: DeviceChanged tries again on
+	the next notification from any device, Start before the route starts,
+	and RetryDeviceChanges whenever the caller likes, until it goes through.
+
+	A Factory makes the device handles and sessions: CAPlayThroughHost's for
+	AUHAL devices, CASimulatedSessionFactory's for simulated ones. The
+	manager's methods are for the control threads, UI and device
+	notifications, and hold a lock; nothing here runs on the IO threads.
+=============================================================================*/
+
+#ifndef __CAPlayThroughSessions_h__
+#define __CAPlayThroughSessions_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+
+enum {
+	kCAPlayThroughSessionError_RouteExists = 1,			// AddRoute for a route that already has a session
+	kCAPlayThroughSessionError_NoSuchRoute = 2,
+	kCAPlayThroughSessionError_DeviceUnavailable = 3,	// the factory couldn't open a device or make the session
+	kCAPlayThroughSessionError_FormatChanged = 4		// from Session::Reconfigure, for a change only a new session can take up
+};
+
+typedef UInt32 CAPlayThroughDeviceID;		// an AudioDeviceID on the Mac
+
+struct CAPlayThroughRoute {
+	CAPlayThroughDeviceID	mInput;
+	CAPlayThroughDeviceID	mOutput;
+
+	bool operator<(const CAPlayThroughRoute &other) const
+		{ return mInput < other.mInput || (mInput == other.mInput && mOutput < other.mOutput); }
+	bool operator==(const CAPlayThroughRoute &other) const
+		{ return mInput == other.mInput && mOutput == other.mOutput; }
+};
+
+class CAPlayThroughSessionManager {
+public:
+	// a device, open for as long as any route uses it
+	class Device {
+	public:
+		virtual ~Device() { }
+	};
+
+	// one route's play-through
+	class Session {
+	public:
+		virtual ~Session() { }
+
+		virtual OSStatus	Start() = 0;
+		virtual OSStatus	Stop() = 0;
+		virtual bool		IsRunning() = 0;
+		virtual OSStatus	Reconfigure() = 0;
+								// one of its devices' formats has changed. kCAPlayThroughSessionError_FormatChanged,
+								// before anything is stopped, if the session can't take the change up in place
+								// and must be made again; on any other error, as it was before the call
+	};
+
+	class Factory {
+	public:
+		virtual ~Factory() { }
+
+		virtual Device *	OpenDevice(CAPlayThroughDeviceID device) = 0;
+								// NULL if there's no such device
+		virtual Session *	CreateSession(const CAPlayThroughRoute &route, Device &input, Device &output) = 0;
+								// stopped; NULL if it can't be made
+	};
+
+	CAPlayThroughSessionManager(Factory &factory);
+	~CAPlayThroughSessionManager();
+							// removes every route
+
+	OSStatus			AddRoute(const CAPlayThroughRoute &route);
+							// opens the devices the route needs that aren't open yet, and makes its
+							// session, stopped
+	OSStatus			RemoveRoute(const CAPlayThroughRoute &route);
+							// stops and deletes its session, and closes the devices no other route uses
+	void				RemoveAllRoutes();
+	OSStatus			ResetRoute(const CAPlayThroughRoute &route);
+							// deletes the session and makes it again, running again if it was
+	bool				HasRoute(const CAPlayThroughRoute &route);
+	UInt32				GetNumberRoutes();
+
+	OSStatus			Start(const CAPlayThroughRoute &route);
+	OSStatus			Stop(const CAPlayThroughRoute &route);
+	bool				IsRunning(const CAPlayThroughRoute &route);
+	OSStatus			StartAll();
+							// the first error, after trying every route
+	OSStatus			StopAll();
+
+	OSStatus			DeviceChanged(CAPlayThroughDeviceID device);
+							// from the device's handle: has each session on it, and each with a change still
+							// to take up, take the change up, making it again for
+							// kCAPlayThroughSessionError_FormatChanged. The first error, after trying every
+							// session; the sessions that failed keep their change
+	OSStatus			RetryDeviceChanges();
+							// has each session with a change still to take up try again; the first error
+	bool				HasPendingChange(const CAPlayThroughRoute &route);
+							// a device change its session failed to take up
+	UInt32				GetNumberOpenDevices();
+	UInt32				GetDeviceUseCount(CAPlayThroughDeviceID device);
+							// the routes that use it, as input, output or both
+
+	void				ForEachSession(const std::function<void(const CAPlayThroughRoute &, Session &)> &proc);
+							// with the manager locked; proc mustn't call back into it
+
+private:
+	struct OpenDevice {
+		Device *	mDevice;
+		UInt32		mUseCount;
+	};
+
+	Device *			RetainDevice(CAPlayThroughDeviceID device);
+	void				ReleaseDevice(CAPlayThroughDeviceID device);
+	void				DeleteSession(std::map<CAPlayThroughRoute, Session *>::iterator session);
+	OSStatus			RecreateSession(std::map<CAPlayThroughRoute, Session *>::iterator session, bool start);
+	OSStatus			TakeUpChange(std::map<CAPlayThroughRoute, Session *>::iterator session);
+
+	Factory &			mFactory;
+	std::mutex			mLock;
+	std::map<CAPlayThroughRoute, Session *>		mSessions;
+	std::map<CAPlayThroughDeviceID, OpenDevice>	mDevices;
+	std::set<CAPlayThroughRoute>				mPendingChanges;	// routes whose session failed to take one up
+};
+
+#endif // __CAPlayThroughSessions_h__
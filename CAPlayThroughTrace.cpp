@@ -0,0 +1,265 @@
+/*=============================================================================
+	CAPlayThroughTrace.cpp
+
+=============================================================================*/
+
+#include "CAPlayThroughTrace.h"
+#include "CAPlayThroughMetrics.h"
+
+#include <string.h>
+#include <algorithm>
+
+CAPlayThroughTrace::CAPlayThroughTrace() :
+	mCapacity(0),
+	mGlitches(0)
+{
+	for (int i = 0; i < 2; ++i) {
+		mRings[i].mWords = NULL;
+		mRings[i].mHead = 0;
+	}
+}
+
+CAPlayThroughTrace::~CAPlayThroughTrace()
+{
+	Allocate(0);
+}
+
+void	CAPlayThroughTrace::Allocate(UInt32 eventsPerThread)
+{
+	for (int i = 0; i < 2; ++i) {
+		delete [] mRings[i].mWords;
+		mRings[i].mWords = NULL;
+		mRings[i].mHead = 0;
+	}
+	mCapacity = 0;
+	mGlitches = 0;
+	if (eventsPerThread == 0)
+		return;
+
+	UInt32 capacity = 1;
+	while (capacity < eventsPerThread)
+		capacity <<= 1;
+	for (int i = 0; i < 2; ++i) {
+		mRings[i].mWords = new std::atomic<UInt64>[capacity * kEventWords];
+		for (UInt32 j = 0; j < capacity * kEventWords; ++j)
+			mRings[i].mWords[j].store(0, std::memory_order_relaxed);
+	}
+	mCapacity = capacity;
+}
+
+static inline UInt64 FloatBits(Float64 value)
+{
+	UInt64 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline Float64 BitsFloat(UInt64 bits)
+{
+	Float64 value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+#pragma mark -- Writers --
+
+void	CAPlayThroughTrace::Write(Thread thread, EventType type, SInt32 value, Float64 a, Float64 b, Float64 c)
+{
+	Ring &ring = mRings[thread];
+	UInt64 head = ring.mHead.load(std::memory_order_relaxed);
+	std::atomic<UInt64> *words = ring.mWords + (head & (mCapacity - 1)) * kEventWords;
+
+	// A reader that sees any of these words sees the head published before them, and so knows
+	// the slot may be torn; see CopyOut.
+	std::atomic_thread_fence(std::memory_order_release);
+	words[0].store(CAPlayThroughMetrics::Now(), std::memory_order_relaxed);
+	words[1].store(UInt64(type) | (UInt64(thread) << 16) | (UInt64(UInt32(value)) << 32), std::memory_order_relaxed);
+	words[2].store(FloatBits(a), std::memory_order_relaxed);
+	words[3].store(FloatBits(b), std::memory_order_relaxed);
+	words[4].store(FloatBits(c), std::memory_order_relaxed);
+	ring.mHead.store(head + 1, std::memory_order_release);
+}
+
+void	CAPlayThroughTrace::Glitch(SInt32 err, Float64 frames)
+{
+	if (!mCapacity)
+		return;
+	Write(kOutput, kGlitch, err, frames, 0, 0);
+	mGlitches.store(mGlitches.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+#pragma mark -- Readers --
+
+void	CAPlayThroughTrace::Ring::CopyOut(UInt32 capacity, std::vector<Event> &events) const
+{
+	// the slot of event head - capacity is the one the writer may be in the middle of
+	UInt64 head = mHead.load(std::memory_order_acquire);
+	UInt64 first = (head >= capacity) ? head - capacity + 1 : 0;
+	size_t start = events.size();
+	for (UInt64 i = first; i < head; ++i) {
+		const std::atomic<UInt64> *words = mWords + (i & (capacity - 1)) * kEventWords;
+		Event event;
+		event.mNanos = words[0].load(std::memory_order_relaxed);
+		UInt64 tag = words[1].load(std::memory_order_relaxed);
+		event.mType = UInt16(tag);
+		event.mThread = UInt16(tag >> 16);
+		event.mValue = SInt32(UInt32(tag >> 32));
+		event.mA = BitsFloat(words[2].load(std::memory_order_relaxed));
+		event.mB = BitsFloat(words[3].load(std::memory_order_relaxed));
+		event.mC = BitsFloat(words[4].load(std::memory_order_relaxed));
+		events.push_back(event);
+	}
+
+	// and since then it may have gone on to the slot of event newHead, overwriting all before it
+	std::atomic_thread_fence(std::memory_order_acquire);
+	UInt64 newHead = mHead.load(std::memory_order_relaxed);
+	if (newHead >= first + capacity) {
+		UInt64 overwritten = std::min(newHead + 1 - capacity - first, head - first);
+		events.erase(events.begin() + start, events.begin() + start + overwritten);
+	}
+}
+
+void	CAPlayThroughTrace::CopyEvents(std::vector<Event> &events, Float64 seconds) const
+{
+	events.clear();
+	if (!mCapacity)
+		return;
+
+	std::vector<Event> input;
+	mRings[kInput].CopyOut(mCapacity, input);
+	mRings[kOutput].CopyOut(mCapacity, events);
+	size_t nOutput = events.size();
+	events.insert(events.end(), input.begin(), input.end());
+	auto earlier = [](const Event &x, const Event &y) { return x.mNanos < y.mNanos; };
+	std::inplace_merge(events.begin(), events.begin() + nOutput, events.end(), earlier);
+	if (events.empty())
+		return;
+
+	UInt64 span = UInt64(seconds * 1e9);
+	UInt64 newest = events.back().mNanos;
+	if (newest > span) {
+		Event cutoff;
+		cutoff.mNanos = newest - span;
+		events.erase(events.begin(), std::lower_bound(events.begin(), events.end(), cutoff, earlier));
+	}
+}
+
+#pragma mark -- Chrome trace --
+
+static const char *kThreadNames[2] = { "input", "output" };
+static const char *kOffsetReasonNames[3] = { "starting", "behind", "ahead" };
+
+bool	CAPlayThroughTrace::WriteChromeTrace(FILE *file, const std::vector<Event> &events)
+{
+	// times in microseconds from the first event; tid 1 is the input thread, 2 the output
+	UInt64 origin = events.empty() ? 0 : events.front().mNanos;
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CAPlayThrough\"}}");
+	for (int i = 0; i < 2; ++i)
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i + 1, kThreadNames[i]);
+
+	for (const Event &event : events) {
+		int tid = (event.mThread == kInput) ? 1 : 2;
+		Float64 ts = (event.mNanos - origin) / 1e3;
+		fprintf(file, ",\n");
+		switch (event.mType) {
+			case kCallbackBegan:
+				fprintf(file, "{\"name\":\"%s callback\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+						"\"args\":{\"sampleTime\":%.17g,\"frames\":%.17g}}", kThreadNames[tid - 1], tid, ts, event.mA, event.mB);
+				break;
+			case kCallbackEnded:
+				fprintf(file, "{\"name\":\"%s callback\",\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+						"\"args\":{\"err\":%d}}", kThreadNames[tid - 1], tid, ts, (int)event.mValue);
+				break;
+			case kFetch:
+				fprintf(file, "{\"name\":\"Fetch\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+						"\"args\":{\"result\":%d,\"readTime\":%.17g,\"ringStart\":%.17g,\"ringEnd\":%.17g}}",
+						tid, ts, (int)event.mValue, event.mA, event.mB, event.mC);
+				break;
+			case kRate:
+				fprintf(file, "{\"name\":\"rate\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"rate\":%.17g}},\n"
+						"{\"name\":\"latency\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"error\":%.17g,\"target\":%.17g}}",
+						tid, ts, event.mA, tid, ts, event.mB, event.mC);
+				break;
+			case kOffsetAdjusted:
+				fprintf(file, "{\"name\":\"offset adjusted\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+						"\"args\":{\"reason\":\"%s\",\"from\":%.17g,\"to\":%.17g,\"inputTime\":%.17g}}",
+						tid, ts, (event.mValue >= 0 && event.mValue < 3) ? kOffsetReasonNames[event.mValue] : "?",
+						event.mA, event.mB, event.mC);
+				break;
+			case kGlitch:
+				fprintf(file, "{\"name\":\"glitch\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+						"\"args\":{\"result\":%d,\"frames\":%.17g}}", tid, ts, (int)event.mValue, event.mA);
+				break;
+			default:
+				fprintf(file, "{\"name\":\"unknown\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", tid, ts);
+				break;
+		}
+	}
+	fprintf(file, "\n]}\n");
+	return !ferror(file);
+}
+
+bool	CAPlayThroughTrace::WriteChromeTrace(const char *path, Float64 seconds) const
+{
+	std::vector<Event> events;
+	CopyEvents(events, seconds);
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return false;
+	bool ok = WriteChromeTrace(file, events);
+	return (fclose(file) == 0) && ok;
+}
+
+#pragma mark -- CAPlayThroughTraceDumper --
+
+void	CAPlayThroughTraceDumper::Start(const std::string &pathPrefix, Float64 seconds, UInt32 maxDumps, Float64 pollSeconds)
+{
+	Stop();
+	mPathPrefix = pathPrefix;
+	mSeconds = seconds;
+	mMaxDumps = maxDumps;
+	mPollSeconds = pollSeconds;
+	mDumps = 0;
+	mRunning = true;
+	mThread = std::thread(&CAPlayThroughTraceDumper::Watch, this);
+}
+
+void	CAPlayThroughTraceDumper::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRunning = false;
+	}
+	mWake.notify_all();
+	if (mThread.joinable())
+		mThread.join();
+}
+
+std::string	CAPlayThroughTraceDumper::GetLastPath() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mLastPath;
+}
+
+void	CAPlayThroughTraceDumper::Watch()
+{
+	UInt64 seen = mTrace.GetGlitches();
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mRunning) {
+		mWake.wait_for(lock, std::chrono::duration<Float64>(mPollSeconds));
+		UInt64 glitches = mTrace.GetGlitches();
+		if (glitches == seen || mDumps >= mMaxDumps)
+			continue;
+		// named for the latest glitch; a trace covers any others close before it
+		seen = glitches;
+		std::string path = mPathPrefix + std::to_string((unsigned long long)glitches) + ".json";
+		lock.unlock();
+		bool ok = mTrace.WriteChromeTrace(path.c_str(), mSeconds);
+		lock.lock();
+		if (ok) {
+			mLastPath = path;
+			++mDumps;
+		}
+	}
+}
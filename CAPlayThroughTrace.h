@@ -0,0 +1,139 @@
+/*=============================================================================
+	CAPlayThroughTrace.h
+
+	A record of what CAPlayThroughEngine's IO threads did lately, kept so
+	that when the output glitches the events that led up to it can be
+	looked at afterwards.
+
+	Each IO thread writes its own ring of fixed-size events, allocated up
+	front, overwriting the oldest: no locks and no allocation on the audio
+	threads, and a disabled trace costs a branch. Events are stamped with
+	CAPlayThroughMetrics::Now. A reader copies the rings out while they are
+	being written, and drops any event the writer may have overwritten
+	while it was copying.
+
+	Glitch marks a glitch: the engine calls it when it silences a buffer
+	after an underrun or an overrun. CAPlayThroughTraceDumper watches for
+	glitches on a thread of its own and writes the last few seconds of
+	events to a file in the Chrome trace event format, which chrome://tracing
+	and Perfetto open.
+=============================================================================*/
+
+#ifndef __CAPlayThroughTrace_h__
+#define __CAPlayThroughTrace_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CAPlayThroughTrace {
+public:
+	enum Thread {
+		kInput,
+		kOutput
+	};
+
+	enum EventType {
+		kCallbackBegan,			// a: the callback's sample time, b: frames
+		kCallbackEnded,			// value: the OSStatus it returned
+		kFetch,					// value: the CARingBufferError, a: the sample time read, b, c: the ring's start and end times
+		kRate,					// a: the rate, b: the latency error, c: the target latency, in input frames
+		kOffsetAdjusted,		// value: an OffsetReason, a: the old offset, b: the new one, c: the input's sample time, if read
+		kGlitch					// value: the CARingBufferError, a: the frames silenced
+	};
+
+	enum OffsetReason {
+		kOffsetStarting,		// the input hadn't stored enough yet
+		kOffsetBehind,			// the input had overwritten the frames
+		kOffsetAhead			// the input hadn't stored the frames yet
+	};
+
+	struct Event {
+		UInt64		mNanos;
+		UInt16		mType;
+		UInt16		mThread;
+		SInt32		mValue;
+		Float64		mA, mB, mC;
+	};
+
+	CAPlayThroughTrace();
+	~CAPlayThroughTrace();
+
+	void				Allocate(UInt32 eventsPerThread);
+							// rounded up to a power of two; 0 turns the trace off. Call while no thread is
+							// recording. A reader gets back one event fewer than this from each thread.
+	UInt32				GetCapacity() const { return mCapacity; }
+	bool				IsEnabled() const { return mCapacity != 0; }
+
+	// from the given thread only
+	void				Record(Thread thread, EventType type, SInt32 value, Float64 a = 0, Float64 b = 0, Float64 c = 0)
+							{ if (mCapacity) Write(thread, type, value, a, b, c); }
+	void				Glitch(SInt32 err, Float64 frames);
+							// from the output thread
+
+	// from any thread
+	UInt64				GetGlitches() const { return mGlitches.load(std::memory_order_acquire); }
+	void				CopyEvents(std::vector<Event> &events, Float64 seconds) const;
+							// those of both threads in the last seconds up to the newest, oldest first
+	static bool			WriteChromeTrace(FILE *file, const std::vector<Event> &events);
+	bool				WriteChromeTrace(const char *path, Float64 seconds) const;
+
+private:
+	// an Event as atomic words, so that it can be read while it's overwritten
+	enum { kEventWords = 5 };
+	struct Ring {
+		std::atomic<UInt64> *	mWords;
+		std::atomic<UInt64>		mHead;			// events written; the writer's alone
+
+		void		CopyOut(UInt32 capacity, std::vector<Event> &events) const;
+	};
+
+	void				Write(Thread thread, EventType type, SInt32 value, Float64 a, Float64 b, Float64 c);
+
+	UInt32					mCapacity;
+	Ring					mRings[2];
+	std::atomic<UInt64>		mGlitches;
+};
+
+// Writes a Chrome trace of the last few seconds to <prefix><n>.json after glitch n, up to a
+// limit on the number of files. It checks for glitches every so often, so the trace runs on a
+// little past the glitch.
+class CAPlayThroughTraceDumper {
+public:
+	CAPlayThroughTraceDumper(const CAPlayThroughTrace &trace) : mTrace(trace), mRunning(false), mDumps(0) { }
+	~CAPlayThroughTraceDumper() { Stop(); }
+
+	void				Start(const std::string &pathPrefix, Float64 seconds = 5.0, UInt32 maxDumps = 16,
+							  Float64 pollSeconds = 0.1);
+	void				Stop();
+	UInt32				GetDumps() const { return mDumps.load(); }
+	std::string			GetLastPath() const;
+
+private:
+	void				Watch();
+
+	const CAPlayThroughTrace &	mTrace;
+	std::string					mPathPrefix;
+	Float64						mSeconds;
+	UInt32						mMaxDumps;
+	Float64						mPollSeconds;
+
+	std::thread					mThread;
+	mutable std::mutex			mMutex;
+	std::condition_variable		mWake;
+	bool						mRunning;
+	std::atomic<UInt32>			mDumps;
+	std::string					mLastPath;
+};
+
+#endif // __CAPlayThroughTrace_h__
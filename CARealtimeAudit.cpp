@@ -0,0 +1,374 @@
+/*=============================================================================
+	CARealtimeAudit.cpp
+
+=============================================================================*/
+
+#include "CARealtimeAudit.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+
+static std::atomic<UInt64>	sViolations[CARealtimeAudit::kViolationCount];
+static std::atomic<int>		sMode(-1);		// read from the environment on first use
+
+void	CARealtimeAudit::SetMode(Mode mode)
+{
+	sMode.store(mode, std::memory_order_relaxed);
+}
+
+CARealtimeAudit::Mode	CARealtimeAudit::GetMode()
+{
+	int mode = sMode.load(std::memory_order_relaxed);
+	if (mode < 0) {
+		const char *setting = getenv("CAPT_REALTIME_AUDIT");
+		mode = (setting && setting[0] == 'l') ? kLog : kAbort;
+		sMode.store(mode, std::memory_order_relaxed);
+	}
+	return Mode(mode);
+}
+
+UInt64	CARealtimeAudit::GetViolations(Violation kind)
+{
+	return sViolations[kind].load(std::memory_order_relaxed);
+}
+
+#if !CAPT_REALTIME_AUDIT
+
+bool	CARealtimeAudit::IsRealtimeThread()
+{
+	return false;
+}
+
+void	CARealtimeAudit::Report(Violation kind, const char *function)
+{
+}
+
+#else
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// plain TLS, since the allocator's replacements read them
+static __thread int sDepth;
+static __thread int sReporting;
+
+static const char *kViolationNames[CARealtimeAudit::kViolationCount] = {
+	"allocation", "lock", "blocking call", "stdio"
+};
+
+void	CARealtimeAudit::Enter()
+{
+	++sDepth;
+}
+
+void	CARealtimeAudit::Leave()
+{
+	--sDepth;
+}
+
+bool	CARealtimeAudit::IsRealtimeThread()
+{
+	return sDepth > 0;
+}
+
+// Writes with write(2) and backtrace_symbols_fd, which neither allocate nor take stdio's locks.
+// Anything the report itself calls is let through.
+void	CARealtimeAudit::Report(Violation kind, const char *function)
+{
+	if (sReporting || !sDepth)
+		return;
+	sReporting = 1;
+	sViolations[kind].fetch_add(1, std::memory_order_relaxed);
+
+	char message[256];
+	int length = snprintf(message, sizeof(message), "CARealtimeAudit: %s (%s) on a real-time thread\n",
+						  function, kViolationNames[kind]);
+	if (length > 0 && write(STDERR_FILENO, message, std::min(length, int(sizeof(message) - 1))) < 0)
+		length = 0;
+	void *frames[32];
+	int nFrames = backtrace(frames, 32);
+	backtrace_symbols_fd(frames + 1, nFrames - 1, STDERR_FILENO);
+
+	if (GetMode() == kAbort)
+		abort();
+	sReporting = 0;
+}
+
+static inline void Check(CARealtimeAudit::Violation kind, const char *function)
+{
+	if (sDepth && !sReporting)
+		CARealtimeAudit::Report(kind, function);
+}
+
+// the next definition of a function, looked up once; the race to store it stores the same value
+template <typename F>
+static inline F Next(std::atomic<void *> &cache, const char *name)
+{
+	void *function = cache.load(std::memory_order_relaxed);
+	if (!function) {
+		function = dlsym(RTLD_NEXT, name);
+		cache.store(function, std::memory_order_relaxed);
+	}
+	return F(function);
+}
+
+#define CAPT_NEXT(name) Next<decltype(&name)>(sNext_##name, #name)
+#define CAPT_DECLARE_NEXT(name) static std::atomic<void *> sNext_##name
+
+#if defined(__GLIBC__)
+
+extern "C" {
+
+void *	__libc_malloc(size_t size);
+void *	__libc_calloc(size_t count, size_t size);
+void *	__libc_realloc(void *p, size_t size);
+void *	__libc_memalign(size_t alignment, size_t size);
+void	__libc_free(void *p);
+
+#pragma mark -- Allocation --
+
+void *	malloc(size_t size) noexcept
+{
+	Check(CARealtimeAudit::kAllocation, "malloc");
+	return __libc_malloc(size);
+}
+
+void *	calloc(size_t count, size_t size) noexcept
+{
+	Check(CARealtimeAudit::kAllocation, "calloc");
+	return __libc_calloc(count, size);
+}
+
+void *	realloc(void *p, size_t size) noexcept
+{
+	Check(CARealtimeAudit::kAllocation, "realloc");
+	return __libc_realloc(p, size);
+}
+
+void	free(void *p) noexcept
+{
+	if (p)
+		Check(CARealtimeAudit::kAllocation, "free");
+	__libc_free(p);
+}
+
+void *	memalign(size_t alignment, size_t size) noexcept
+{
+	Check(CARealtimeAudit::kAllocation, "memalign");
+	return __libc_memalign(alignment, size);
+}
+
+void *	aligned_alloc(size_t alignment, size_t size) noexcept
+{
+	Check(CARealtimeAudit::kAllocation, "aligned_alloc");
+	return __libc_memalign(alignment, size);
+}
+
+int		posix_memalign(void **p, size_t alignment, size_t size) noexcept
+{
+	Check(CARealtimeAudit::kAllocation, "posix_memalign");
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+	void *memory = __libc_memalign(alignment, size);
+	if (!memory)
+		return ENOMEM;
+	*p = memory;
+	return 0;
+}
+
+#pragma mark -- Locks and waits --
+
+// A wait on a condition variable needs its mutex first, so the mutex catches it. (The condition
+// variable functions themselves have more than one symbol version, and aren't replaced.)
+
+CAPT_DECLARE_NEXT(pthread_mutex_lock);
+CAPT_DECLARE_NEXT(pthread_rwlock_rdlock);
+CAPT_DECLARE_NEXT(pthread_rwlock_wrlock);
+CAPT_DECLARE_NEXT(nanosleep);
+CAPT_DECLARE_NEXT(clock_nanosleep);
+CAPT_DECLARE_NEXT(usleep);
+CAPT_DECLARE_NEXT(sleep);
+
+int		pthread_mutex_lock(pthread_mutex_t *mutex) noexcept
+{
+	Check(CARealtimeAudit::kLock, "pthread_mutex_lock");
+	return CAPT_NEXT(pthread_mutex_lock)(mutex);
+}
+
+int		pthread_rwlock_rdlock(pthread_rwlock_t *lock) noexcept
+{
+	Check(CARealtimeAudit::kLock, "pthread_rwlock_rdlock");
+	return CAPT_NEXT(pthread_rwlock_rdlock)(lock);
+}
+
+int		pthread_rwlock_wrlock(pthread_rwlock_t *lock) noexcept
+{
+	Check(CARealtimeAudit::kLock, "pthread_rwlock_wrlock");
+	return CAPT_NEXT(pthread_rwlock_wrlock)(lock);
+}
+
+int		nanosleep(const struct timespec *request, struct timespec *remaining)
+{
+	Check(CARealtimeAudit::kBlocking, "nanosleep");
+	return CAPT_NEXT(nanosleep)(request, remaining);
+}
+
+int		clock_nanosleep(clockid_t clock, int flags, const struct timespec *request, struct timespec *remaining)
+{
+	Check(CARealtimeAudit::kBlocking, "clock_nanosleep");
+	return CAPT_NEXT(clock_nanosleep)(clock, flags, request, remaining);
+}
+
+int		usleep(useconds_t microseconds)
+{
+	Check(CARealtimeAudit::kBlocking, "usleep");
+	return CAPT_NEXT(usleep)(microseconds);
+}
+
+unsigned int	sleep(unsigned int seconds)
+{
+	Check(CARealtimeAudit::kBlocking, "sleep");
+	return CAPT_NEXT(sleep)(seconds);
+}
+
+#pragma mark -- stdio --
+
+// With _FORTIFY_SOURCE the compiler calls the __*_chk versions instead.
+
+int		__vfprintf_chk(FILE *file, int flag, const char *format, va_list args);
+
+CAPT_DECLARE_NEXT(vfprintf);
+CAPT_DECLARE_NEXT(__vfprintf_chk);
+CAPT_DECLARE_NEXT(fputs);
+CAPT_DECLARE_NEXT(puts);
+CAPT_DECLARE_NEXT(fputc);
+CAPT_DECLARE_NEXT(fwrite);
+CAPT_DECLARE_NEXT(fflush);
+
+int		vfprintf(FILE *file, const char *format, va_list args)
+{
+	Check(CARealtimeAudit::kStdio, "vfprintf");
+	return CAPT_NEXT(vfprintf)(file, format, args);
+}
+
+int		vprintf(const char *format, va_list args)
+{
+	Check(CARealtimeAudit::kStdio, "vprintf");
+	return CAPT_NEXT(vfprintf)(stdout, format, args);
+}
+
+int		fprintf(FILE *file, const char *format, ...)
+{
+	Check(CARealtimeAudit::kStdio, "fprintf");
+	va_list args;
+	va_start(args, format);
+	int result = CAPT_NEXT(vfprintf)(file, format, args);
+	va_end(args);
+	return result;
+}
+
+int		printf(const char *format, ...)
+{
+	Check(CARealtimeAudit::kStdio, "printf");
+	va_list args;
+	va_start(args, format);
+	int result = CAPT_NEXT(vfprintf)(stdout, format, args);
+	va_end(args);
+	return result;
+}
+
+int		__vfprintf_chk(FILE *file, int flag, const char *format, va_list args)
+{
+	Check(CARealtimeAudit::kStdio, "vfprintf");
+	return CAPT_NEXT(__vfprintf_chk)(file, flag, format, args);
+}
+
+int		__fprintf_chk(FILE *file, int flag, const char *format, ...)
+{
+	Check(CARealtimeAudit::kStdio, "fprintf");
+	va_list args;
+	va_start(args, format);
+	int result = CAPT_NEXT(__vfprintf_chk)(file, flag, format, args);
+	va_end(args);
+	return result;
+}
+
+int		__printf_chk(int flag, const char *format, ...)
+{
+	Check(CARealtimeAudit::kStdio, "printf");
+	va_list args;
+	va_start(args, format);
+	int result = CAPT_NEXT(__vfprintf_chk)(stdout, flag, format, args);
+	va_end(args);
+	return result;
+}
+
+int		fputs(const char *text, FILE *file)
+{
+	Check(CARealtimeAudit::kStdio, "fputs");
+	return CAPT_NEXT(fputs)(text, file);
+}
+
+int		puts(const char *text)
+{
+	Check(CARealtimeAudit::kStdio, "puts");
+	return CAPT_NEXT(puts)(text);
+}
+
+int		fputc(int c, FILE *file)
+{
+	Check(CARealtimeAudit::kStdio, "fputc");
+	return CAPT_NEXT(fputc)(c, file);
+}
+
+size_t	fwrite(const void *data, size_t size, size_t count, FILE *file)
+{
+	Check(CARealtimeAudit::kStdio, "fwrite");
+	return CAPT_NEXT(fwrite)(data, size, count, file);
+}
+
+int		fflush(FILE *file)
+{
+	Check(CARealtimeAudit::kStdio, "fflush");
+	return CAPT_NEXT(fflush)(file);
+}
+
+} // extern "C"
+
+#endif // __GLIBC__
+
+// Looks everything up, and has backtrace load what it needs, before any thread is real-time.
+static struct CARealtimeAuditSetup {
+	CARealtimeAuditSetup()
+	{
+		void *frames[4];
+		backtrace(frames, 4);
+		CARealtimeAudit::GetMode();
+#if defined(__GLIBC__)
+		CAPT_NEXT(pthread_mutex_lock);
+		CAPT_NEXT(pthread_rwlock_rdlock);
+		CAPT_NEXT(pthread_rwlock_wrlock);
+		CAPT_NEXT(nanosleep);
+		CAPT_NEXT(clock_nanosleep);
+		CAPT_NEXT(usleep);
+		CAPT_NEXT(sleep);
+		CAPT_NEXT(vfprintf);
+		CAPT_NEXT(__vfprintf_chk);
+		CAPT_NEXT(fputs);
+		CAPT_NEXT(puts);
+		CAPT_NEXT(fputc);
+		CAPT_NEXT(fwrite);
+		CAPT_NEXT(fflush);
+#endif
+	}
+} sSetup;
+
+#endif // CAPT_REALTIME_AUDIT
@@ -0,0 +1,80 @@
+/*=============================================================================
+	CARealtimeAudit.h
+
+	A debug mode that catches the IO procs doing what a real-time thread
+	must not: allocating, taking a lock, sleeping or waiting, or calling
+	stdio.
+
+	A CARealtimeAudit::Scope marks its thread real-time for as long as it
+	lives; CAPlayThroughEngine puts one round each IO proc. Built with
+	CAPT_REALTIME_AUDIT defined to 1, CARealtimeAudit.cpp replaces malloc
+	and its relatives, the pthread mutex, rwlock, condition variable and
+	semaphore waits, the sleeps and the stdio output functions with
+	versions that report a violation when they are called inside a Scope,
+	and then carry on as the originals. A violation is written to stderr
+	with a backtrace, and in kAbort mode, the default, aborts the process.
+	The CAPT_REALTIME_AUDIT environment variable set to "log" starts the
+	process in kLog mode instead.
+
+	The replacements are for glibc. Elsewhere, and without
+	CAPT_REALTIME_AUDIT, a Scope does nothing and costs nothing.
+	CMakeLists.txt builds the audited engine as CAPlayThroughEngineAudited,
+	and with the CAPT_REALTIME_AUDIT option, the ordinary one too.
+=============================================================================*/
+
+#ifndef __CARealtimeAudit_h__
+#define __CARealtimeAudit_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#ifndef CAPT_REALTIME_AUDIT
+	#define CAPT_REALTIME_AUDIT 0
+#endif
+
+class CARealtimeAudit {
+public:
+	enum Mode {
+		kLog,		// report and carry on
+		kAbort		// report and abort
+	};
+
+	enum Violation {
+		kAllocation,
+		kLock,
+		kBlocking,		// sleeps and waits
+		kStdio,
+		kViolationCount
+	};
+
+	class Scope {
+	public:
+#if CAPT_REALTIME_AUDIT
+		Scope() { Enter(); }
+		~Scope() { Leave(); }
+#else
+		Scope() { }		// so that one held only for its lifetime isn't an unused variable
+#endif
+	};
+
+	static bool			IsAuditing() { return CAPT_REALTIME_AUDIT != 0; }
+							// whether this build catches anything
+	static bool			IsRealtimeThread();
+							// inside a Scope
+
+	static void			SetMode(Mode mode);
+	static Mode			GetMode();
+	static UInt64		GetViolations(Violation kind);
+							// since the process started, on any thread
+	static void			Report(Violation kind, const char *function);
+							// on a real-time thread; for checks of one's own
+
+private:
+	static void			Enter();
+	static void			Leave();
+};
+
+#endif // __CARealtimeAudit_h__
@@ -0,0 +1,285 @@
+/*=============================================================================
+	CARealtimeWorkerPool.cpp
+
+=============================================================================*/
+
+#include "CARealtimeWorkerPool.h"
+#include "CARealtimeAudit.h"
+
+#include <chrono>
+#include <pthread.h>
+
+#if __APPLE__
+	#include <mach/mach.h>
+	#include <mach/mach_time.h>
+	#include <mach/thread_policy.h>
+#else
+	#include <sched.h>
+#endif
+
+namespace {
+
+// how long a worker spins after a block before it sleeps: long enough to catch the next channel
+// group's Run within the same callback, short against a buffer period
+const UInt64 kSpinNanos = 100000;
+
+inline UInt64 Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void Pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+} // namespace
+
+CARealtimeWorkerPool::CARealtimeWorkerPool() :
+	mRanges(1),
+	mGeneration(0),
+	mQuit(false),
+	mProc(NULL),
+	mContext(NULL),
+	mPeriodNanos(0),
+	mRealtime(false),
+	mPending(0),
+	mCriticalPathNanos(0),
+	mWorkNanos(0),
+	mStolen(0),
+	mBlocks(0),
+	mDeadlineMisses(0),
+	mMaxWallNanos(0),
+	mTotalStolen(0)
+{
+}
+
+CARealtimeWorkerPool::~CARealtimeWorkerPool()
+{
+	Teardown();
+}
+
+void	CARealtimeWorkerPool::Initialize(UInt32 nWorkers, Float64 periodSeconds)
+{
+	Teardown();
+	SetPeriod(periodSeconds);
+	mRanges = std::vector<Range>(nWorkers + 1);
+	mQuit = false;
+	mRealtime = nWorkers > 0;
+	for (UInt32 i = 0; i < nWorkers; ++i) {
+		Worker *worker = new Worker;
+		worker->mSleeping = false;
+#if __APPLE__
+		semaphore_create(mach_task_self(), &worker->mWake, SYNC_POLICY_FIFO, 0);
+#else
+		sem_init(&worker->mWake, 0, 0);
+#endif
+		mWorkers.push_back(worker);
+	}
+	for (UInt32 i = 0; i < nWorkers; ++i)
+		mWorkers[i]->mThread = std::thread(&CARealtimeWorkerPool::WorkerLoop, this, i);
+}
+
+void	CARealtimeWorkerPool::Teardown()
+{
+	mQuit.store(true, std::memory_order_seq_cst);
+	for (Worker *worker : mWorkers)
+		Wake(*worker);
+	for (Worker *worker : mWorkers) {
+		worker->mThread.join();
+#if __APPLE__
+		semaphore_destroy(mach_task_self(), worker->mWake);
+#else
+		sem_destroy(&worker->mWake);
+#endif
+		delete worker;
+	}
+	mWorkers.clear();
+	mRanges = std::vector<Range>(1);
+	mRealtime = false;
+}
+
+void	CARealtimeWorkerPool::SetPeriod(Float64 periodSeconds)
+{
+	mPeriodNanos.store(UInt64(periodSeconds * 1e9), std::memory_order_relaxed);
+}
+
+void	CARealtimeWorkerPool::GetStats(CARealtimeWorkerPoolStats &stats) const
+{
+	stats.mBlocks = mBlocks.load(std::memory_order_relaxed);
+	stats.mDeadlineMisses = mDeadlineMisses.load(std::memory_order_relaxed);
+	stats.mMaxWallNanos = mMaxWallNanos.load(std::memory_order_relaxed);
+	stats.mStolen = mTotalStolen.load(std::memory_order_relaxed);
+	stats.mRealtime = mRealtime.load(std::memory_order_relaxed);
+}
+
+#pragma mark -- Workers --
+
+// Time-constraint on the Mac, with the period's half as the computation it may need; SCHED_FIFO
+// elsewhere, in the middle of its range, below the audio devices' own threads. Without the
+// privilege for it the worker runs at its ordinary priority, and the stats say so.
+void	CARealtimeWorkerPool::ElevatePriority()
+{
+	bool elevated;
+#if __APPLE__
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	Float64 ticksPerNano = Float64(timebase.denom) / timebase.numer;
+	UInt64 periodNanos = mPeriodNanos.load(std::memory_order_relaxed);
+	Float64 period = (periodNanos ? periodNanos : 5000000) * ticksPerNano;
+	thread_time_constraint_policy_data_t policy;
+	policy.period = UInt32(period);
+	policy.computation = UInt32(period / 2);
+	policy.constraint = UInt32(period);
+	policy.preemptible = 1;
+	elevated = thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_TIME_CONSTRAINT_POLICY,
+								 (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS;
+#else
+	sched_param param;
+	param.sched_priority = (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2;
+	elevated = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+	if (!elevated)
+		mRealtime = false;
+}
+
+void	CARealtimeWorkerPool::Wake(Worker &worker)
+{
+	if (worker.mSleeping.exchange(false))
+#if __APPLE__
+		semaphore_signal(worker.mWake);
+#else
+		sem_post(&worker.mWake);
+#endif
+}
+
+// A worker that finds no new block before its spin runs out says it's sleeping, then looks once
+// more; if a block has come in the meantime, it takes its flag back, unless Run got there first,
+// in which case the semaphore has been signalled and the wait returns at once.
+void	CARealtimeWorkerPool::WorkerLoop(UInt32 index)
+{
+	ElevatePriority();
+	Worker &worker = *mWorkers[index];
+	UInt32 seen = mGeneration.load(std::memory_order_acquire);
+	UInt64 idleSince = Now();
+	while (!mQuit.load(std::memory_order_acquire)) {
+		UInt32 generation = mGeneration.load(std::memory_order_acquire);
+		if (generation != seen) {
+			seen = generation;
+			CARealtimeAudit::Scope realtime;
+			Participate(index + 1, generation);
+			idleSince = Now();
+			continue;
+		}
+		if (Now() - idleSince < kSpinNanos) {
+			Pause();
+			continue;
+		}
+
+		worker.mSleeping.store(true, std::memory_order_seq_cst);
+		if ((mGeneration.load(std::memory_order_seq_cst) != seen || mQuit.load(std::memory_order_seq_cst))
+				&& worker.mSleeping.exchange(false))
+			continue;
+#if __APPLE__
+		semaphore_wait(worker.mWake);
+#else
+		while (sem_wait(&worker.mWake) != 0) { }	// EINTR
+#endif
+		idleSince = Now();
+	}
+}
+
+#pragma mark -- Blocks --
+
+bool	CARealtimeWorkerPool::TakeTask(UInt32 range, UInt32 generation, UInt32 &task)
+{
+	std::atomic<UInt64> &word = mRanges[range].mWord;
+	UInt64 value = word.load(std::memory_order_relaxed);
+	for (;;) {
+		UInt32 next = UInt32(value >> kIndexBits) & kIndexMask;
+		UInt32 end = UInt32(value) & kIndexMask;
+		if ((UInt32(value >> (2 * kIndexBits)) & kGenerationMask) != generation || next >= end)
+			return false;
+		if (word.compare_exchange_weak(value, MakeRange(generation, next + 1, end), std::memory_order_acquire,
+									   std::memory_order_relaxed)) {
+			task = next;
+			return true;
+		}
+	}
+}
+
+// The participant's own range first, then each of the others' in turn.
+void	CARealtimeWorkerPool::Participate(UInt32 index, UInt32 generation)
+{
+	UInt32 participants = UInt32(mRanges.size());
+	UInt64 busy = 0;
+	for (UInt32 i = 0; i < participants; ++i) {
+		UInt32 range = (index + i) % participants;
+		UInt32 task;
+		while (TakeTask(range, generation, task)) {
+			UInt64 began = Now();
+			mProc(mContext, task);
+			UInt64 elapsed = Now() - began;
+			busy += elapsed;
+
+			mWorkNanos.fetch_add(elapsed, std::memory_order_relaxed);
+			if (i)
+				mStolen.fetch_add(1, std::memory_order_relaxed);
+			UInt64 longest = mCriticalPathNanos.load(std::memory_order_relaxed);
+			while (busy > longest && !mCriticalPathNanos.compare_exchange_weak(longest, busy, std::memory_order_relaxed)) { }
+			mPending.fetch_sub(1, std::memory_order_release);
+		}
+	}
+}
+
+void	CARealtimeWorkerPool::Run(UInt32 nTasks, TaskProc proc, void *context)
+{
+	if (nTasks == 0)
+		return;
+	if (nTasks > kMaxTasks) {
+		for (UInt32 task = 0; task < nTasks; ++task)
+			proc(context, task);
+		return;
+	}
+
+	UInt64 began = Now();
+	UInt32 generation = (mGeneration.load(std::memory_order_relaxed) + 1) & kGenerationMask;
+	UInt32 participants = UInt32(mRanges.size());
+	mProc = proc;
+	mContext = context;
+	mPending.store(nTasks, std::memory_order_relaxed);
+	mCriticalPathNanos.store(0, std::memory_order_relaxed);
+	mWorkNanos.store(0, std::memory_order_relaxed);
+	mStolen.store(0, std::memory_order_relaxed);
+	for (UInt32 p = 0; p < participants; ++p)
+		mRanges[p].mWord.store(MakeRange(generation, UInt64(nTasks) * p / participants, UInt64(nTasks) * (p + 1) / participants),
+							   std::memory_order_relaxed);
+	mGeneration.store(generation, std::memory_order_seq_cst);
+	for (Worker *worker : mWorkers)
+		Wake(*worker);
+
+	Participate(0, generation);
+	while (mPending.load(std::memory_order_acquire) != 0)
+		Pause();
+
+	CARealtimeWorkerPoolBlock block;
+	block.mWallNanos = Now() - began;
+	block.mCriticalPathNanos = mCriticalPathNanos.load(std::memory_order_relaxed);
+	block.mWorkNanos = mWorkNanos.load(std::memory_order_relaxed);
+	block.mPeriodNanos = mPeriodNanos.load(std::memory_order_relaxed);
+	block.mTasks = nTasks;
+	block.mStolen = mStolen.load(std::memory_order_relaxed);
+	mLastBlock.Post(block);
+
+	// Run's caller is the only writer of these
+	mBlocks.store(mBlocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (block.mPeriodNanos && block.mWallNanos > block.mPeriodNanos)
+		mDeadlineMisses.store(mDeadlineMisses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (block.mWallNanos > mMaxWallNanos.load(std::memory_order_relaxed))
+		mMaxWallNanos.store(block.mWallNanos, std::memory_order_relaxed);
+	mTotalStolen.store(mTotalStolen.load(std::memory_order_relaxed) + block.mStolen, std::memory_order_relaxed);
+}
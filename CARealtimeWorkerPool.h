@@ -0,0 +1,150 @@
+/*=============================================================================
+	CARealtimeWorkerPool.h
+
+	Worker threads that share an IO proc's work across cores. Run hands out
+	nTasks calls of a task proc, by index, among the workers and the calling
+	thread, and returns once every one of them has finished, within the
+	callback that called it.
+
+	The workers are spawned by Initialize, at real-time priority where the
+	system allows it, and never allocate, lock or wait while there is work.
+	Each block's tasks are split into a contiguous range per participant,
+	and each participant takes tasks from the front of its own range and,
+	once that is empty, from the others'. The calling thread does the same,
+	so a worker that hasn't woken yet, or has been preempted, only delays
+	the task it is running: the rest of its range is stolen, and the join
+	never waits for work that hasn't started.
+
+	Between blocks the workers spin for a while, then sleep on a semaphore
+	that Run signals; signalling one doesn't block the IO thread.
+
+	Each block's timing goes to a CAMailbox for any thread to read: its
+	wall time from Run to the join, its critical path (the longest time any
+	one participant spent running tasks, which is as short as the block can
+	be with these workers), the total time of its tasks, and the buffer
+	period it has to fit in. A block longer than the period counts as a
+	deadline miss.
+=============================================================================*/
+
+#ifndef __CARealtimeWorkerPool_h__
+#define __CARealtimeWorkerPool_h__
+
+#include "CAMailbox.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if __APPLE__
+	#include <mach/semaphore.h>
+#else
+	#include <semaphore.h>
+#endif
+
+struct CARealtimeWorkerPoolBlock {
+	UInt64		mWallNanos;			// Run to the join
+	UInt64		mCriticalPathNanos;	// the longest any participant spent running tasks
+	UInt64		mWorkNanos;			// all the tasks' times together
+	UInt64		mPeriodNanos;		// what it had to fit in; 0 if not set
+	UInt32		mTasks;
+	UInt32		mStolen;			// tasks run by a participant other than the one they were split to
+};
+
+struct CARealtimeWorkerPoolStats {
+	UInt64		mBlocks;
+	UInt64		mDeadlineMisses;	// blocks whose wall time was over the period
+	UInt64		mMaxWallNanos;
+	UInt64		mStolen;
+	bool		mRealtime;			// the workers got real-time priority
+};
+
+class CARealtimeWorkerPool {
+public:
+	typedef void (*TaskProc)(void *context, UInt32 task);
+
+	CARealtimeWorkerPool();
+	~CARealtimeWorkerPool();
+
+	void				Initialize(UInt32 nWorkers, Float64 periodSeconds = 0.0);
+							// spawns the workers, besides the calling thread, and sets the period;
+							// not from the IO threads
+	void				Teardown();
+	void				SetPeriod(Float64 periodSeconds);
+							// the buffer period each block has to fit in, for the reports; any
+							// thread. The workers' real-time constraint is the period they were
+							// spawned with.
+	UInt32				GetConcurrency() const { return UInt32(mWorkers.size()) + 1; }
+							// the workers and the calling thread
+	UInt32				GetTasks(UInt32 nChannels, UInt32 minChannelsPerTask = 2) const
+		{ return mWorkers.empty() ? 1 : std::max(std::min(GetConcurrency() * 2, nChannels / minChannelsPerTask), 1u); }
+							// how many tasks to split nChannels' work into: two per participant, to
+							// leave something to steal, unless that makes them too small to be worth it;
+							// 1 without workers
+
+	void				Run(UInt32 nTasks, TaskProc proc, void *context);
+							// proc(context, task) for each task in [0, nTasks), on the workers and
+							// the calling thread; returns when they have all finished. Real-time safe.
+							// One caller at a time.
+
+	bool				GetLastBlock(CARealtimeWorkerPoolBlock &block) { return mLastBlock.Take(block); }
+							// the latest block since the last call, if there has been one
+	void				GetStats(CARealtimeWorkerPoolStats &stats) const;
+
+	static const UInt32	kMaxTasks = (1 << 22) - 1;
+
+private:
+	// Each participant's range is one word: the block's generation, the next task and the end, so
+	// that taking a task is one compare-and-swap, and one left over from an earlier block never
+	// matches.
+	enum {
+		kIndexBits = 22,
+		kIndexMask = (1 << kIndexBits) - 1,
+		kGenerationMask = (1 << 20) - 1
+	};
+
+	struct alignas(64) Range {
+		std::atomic<UInt64>	mWord;
+	};
+
+	struct alignas(64) Worker {
+		std::thread			mThread;
+		std::atomic<bool>	mSleeping;
+#if __APPLE__
+		semaphore_t			mWake;
+#else
+		sem_t				mWake;
+#endif
+	};
+
+	static UInt64		MakeRange(UInt32 generation, UInt32 next, UInt32 end)
+		{ return (UInt64(generation & kGenerationMask) << (2 * kIndexBits)) | (UInt64(next) << kIndexBits) | end; }
+	void				WorkerLoop(UInt32 index);
+	void				Participate(UInt32 index, UInt32 generation);
+	bool				TakeTask(UInt32 range, UInt32 generation, UInt32 &task);
+	void				Wake(Worker &worker);
+	void				ElevatePriority();
+
+	std::vector<Worker *>	mWorkers;
+	std::vector<Range>		mRanges;			// one per participant, the caller's first
+	std::atomic<UInt32>		mGeneration;
+	std::atomic<bool>		mQuit;
+	TaskProc				mProc;
+	void *					mContext;
+	std::atomic<UInt64>		mPeriodNanos;
+	std::atomic<bool>		mRealtime;
+
+	// the block in progress
+	alignas(64) std::atomic<UInt32>	mPending;
+	std::atomic<UInt64>		mCriticalPathNanos;
+	std::atomic<UInt64>		mWorkNanos;
+	std::atomic<UInt32>		mStolen;
+
+	CAMailbox<CARealtimeWorkerPoolBlock> mLastBlock;
+	std::atomic<UInt64>		mBlocks;
+	std::atomic<UInt64>		mDeadlineMisses;
+	std::atomic<UInt64>		mMaxWallNanos;
+	std::atomic<UInt64>		mTotalStolen;
+};
+
+#endif // __CARealtimeWorkerPool_h__
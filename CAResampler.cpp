@@ -0,0 +1,436 @@
+/*=============================================================================
+	CAResampler.cpp
+
+=============================================================================*/
+
+#include "CAResampler.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define CARS_X86 1
+	#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+	#define CARS_NEON 1
+	#include <arm_neon.h>
+#endif
+
+namespace {
+
+struct QualitySpec {
+	UInt32		mFilterLength;
+	UInt32		mPhases;
+	Float64		mKaiserBeta;
+	Float64		mRolloff;		// cutoff as a fraction of the output Nyquist
+};
+
+const QualitySpec kQualitySpecs[kCAResamplerQuality_Count] = {
+	{ 4,	0,		0,		0 },		// cubic
+	{ 16,	64,		6.0,	0.80 },
+	{ 32,	256,	8.5,	0.90 },
+	{ 64,	512,	10.0,	0.95 },
+};
+
+// Catmull-Rom through p1 and p2
+inline Float32 Cubic(Float32 p0, Float32 p1, Float32 p2, Float32 p3, Float32 t)
+{
+	return p1 + 0.5f * t * (p2 - p0 + t * (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3 + t * (3.0f * (p1 - p2) + p3 - p0)));
+}
+
+#pragma mark -- Scalar --
+
+void Sinc_Scalar(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames, const Float32 *table, UInt32 filterLength)
+{
+	for (UInt32 k = 0; k < nFrames; ++k) {
+		const Float32 *x = input + taps[k].mFirst;
+		const Float32 *c0 = table + taps[k].mPhase * filterLength;
+		const Float32 *c1 = c0 + filterLength;
+		Float32 s0 = 0.0f, s1 = 0.0f;
+		for (UInt32 j = 0; j < filterLength; ++j) {
+			s0 += x[j] * c0[j];
+			s1 += x[j] * c1[j];
+		}
+		output[k] = s0 + taps[k].mFraction * (s1 - s0);
+	}
+}
+
+void Cubic_Scalar(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames)
+{
+	for (UInt32 k = 0; k < nFrames; ++k) {
+		const Float32 *x = input + taps[k].mFirst;
+		output[k] = Cubic(x[0], x[1], x[2], x[3], taps[k].mFraction);
+	}
+}
+
+const CAResamplerKernels kScalarKernels = { "Scalar", Sinc_Scalar, Cubic_Scalar };
+
+#if CARS_X86
+#pragma mark -- SSE2 --
+
+inline Float32 HorizontalSum(__m128 v)
+{
+	__m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+// filter lengths are multiples of 8
+void Sinc_SSE2(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames, const Float32 *table, UInt32 filterLength)
+{
+	for (UInt32 k = 0; k < nFrames; ++k) {
+		const Float32 *x = input + taps[k].mFirst;
+		const Float32 *c0 = table + taps[k].mPhase * filterLength;
+		const Float32 *c1 = c0 + filterLength;
+		__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+		for (UInt32 j = 0; j < filterLength; j += 4) {
+			__m128 xj = _mm_loadu_ps(x + j);
+			s0 = _mm_add_ps(s0, _mm_mul_ps(xj, _mm_loadu_ps(c0 + j)));
+			s1 = _mm_add_ps(s1, _mm_mul_ps(xj, _mm_loadu_ps(c1 + j)));
+		}
+		Float32 a = HorizontalSum(s0), b = HorizontalSum(s1);
+		output[k] = a + taps[k].mFraction * (b - a);
+	}
+}
+
+void Cubic_SSE2(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames)
+{
+	const __m128 half = _mm_set1_ps(0.5f), two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f), four = _mm_set1_ps(4.0f), five = _mm_set1_ps(5.0f);
+	UInt32 k = 0;
+	for (; k + 4 <= nFrames; k += 4) {
+		const Float32 *x0 = input + taps[k].mFirst, *x1 = input + taps[k + 1].mFirst;
+		const Float32 *x2 = input + taps[k + 2].mFirst, *x3 = input + taps[k + 3].mFirst;
+		// transpose four frames' four points into one vector per point
+		__m128 r0 = _mm_loadu_ps(x0), r1 = _mm_loadu_ps(x1), r2 = _mm_loadu_ps(x2), r3 = _mm_loadu_ps(x3);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		__m128 t = _mm_set_ps(taps[k + 3].mFraction, taps[k + 2].mFraction, taps[k + 1].mFraction, taps[k].mFraction);
+		__m128 c = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(three, _mm_sub_ps(r1, r2)), r0), r3);
+		__m128 b = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(two, r0), _mm_mul_ps(five, r1)), _mm_mul_ps(four, r2)), r3);
+		__m128 a = _mm_sub_ps(r2, r0);
+		__m128 y = _mm_add_ps(r1, _mm_mul_ps(_mm_mul_ps(half, t), _mm_add_ps(a, _mm_mul_ps(t, _mm_add_ps(b, _mm_mul_ps(t, c))))));
+		_mm_storeu_ps(output + k, y);
+	}
+	Cubic_Scalar(input, output + k, taps + k, nFrames - k);
+}
+
+const CAResamplerKernels kSSE2Kernels = { "SSE2", Sinc_SSE2, Cubic_SSE2 };
+
+#pragma mark -- AVX2 --
+
+#define CARS_AVX2 __attribute__((target("avx2")))
+
+CARS_AVX2 inline Float32 HorizontalSum256(__m256 v)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+	sum = _mm_add_ps(sum, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sum);
+	return _mm_cvtss_f32(_mm_add_ss(sum, shuffled));
+}
+
+CARS_AVX2 void Sinc_AVX2(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames, const Float32 *table, UInt32 filterLength)
+{
+	for (UInt32 k = 0; k < nFrames; ++k) {
+		const Float32 *x = input + taps[k].mFirst;
+		const Float32 *c0 = table + taps[k].mPhase * filterLength;
+		const Float32 *c1 = c0 + filterLength;
+		__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+		for (UInt32 j = 0; j < filterLength; j += 8) {
+			__m256 xj = _mm256_loadu_ps(x + j);
+			s0 = _mm256_add_ps(s0, _mm256_mul_ps(xj, _mm256_loadu_ps(c0 + j)));
+			s1 = _mm256_add_ps(s1, _mm256_mul_ps(xj, _mm256_loadu_ps(c1 + j)));
+		}
+		Float32 a = HorizontalSum256(s0), b = HorizontalSum256(s1);
+		output[k] = a + taps[k].mFraction * (b - a);
+	}
+}
+
+// no Cubic_AVX2: gathering the points costs more than SSE2's loads and transpose save
+const CAResamplerKernels kAVX2Kernels = { "AVX2", Sinc_AVX2, Cubic_SSE2 };
+#endif // CARS_X86
+
+#if CARS_NEON
+#pragma mark -- NEON --
+
+void Sinc_NEON(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames, const Float32 *table, UInt32 filterLength)
+{
+	for (UInt32 k = 0; k < nFrames; ++k) {
+		const Float32 *x = input + taps[k].mFirst;
+		const Float32 *c0 = table + taps[k].mPhase * filterLength;
+		const Float32 *c1 = c0 + filterLength;
+		float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+		for (UInt32 j = 0; j < filterLength; j += 4) {
+			float32x4_t xj = vld1q_f32(x + j);
+			s0 = vmlaq_f32(s0, xj, vld1q_f32(c0 + j));
+			s1 = vmlaq_f32(s1, xj, vld1q_f32(c1 + j));
+		}
+		Float32 a = vaddvq_f32(s0), b = vaddvq_f32(s1);
+		output[k] = a + taps[k].mFraction * (b - a);
+	}
+}
+
+void Cubic_NEON(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames)
+{
+	const float32x4_t half = vdupq_n_f32(0.5f), two = vdupq_n_f32(2.0f), three = vdupq_n_f32(3.0f), four = vdupq_n_f32(4.0f), five = vdupq_n_f32(5.0f);
+	UInt32 k = 0;
+	for (; k + 4 <= nFrames; k += 4) {
+		// four frames' four points, transposed into one vector per point
+		float32x4x4_t p;
+		for (int i = 0; i < 4; ++i)
+			p = vld4q_lane_f32(input + taps[k + i].mFirst, p, i);
+		const Float32 fractions[4] = { taps[k].mFraction, taps[k + 1].mFraction, taps[k + 2].mFraction, taps[k + 3].mFraction };
+		float32x4_t t = vld1q_f32(fractions);
+		float32x4_t c = vaddq_f32(vsubq_f32(vmulq_f32(three, vsubq_f32(p.val[1], p.val[2])), p.val[0]), p.val[3]);
+		float32x4_t b = vsubq_f32(vaddq_f32(vsubq_f32(vmulq_f32(two, p.val[0]), vmulq_f32(five, p.val[1])), vmulq_f32(four, p.val[2])), p.val[3]);
+		float32x4_t a = vsubq_f32(p.val[2], p.val[0]);
+		float32x4_t y = vaddq_f32(p.val[1], vmulq_f32(vmulq_f32(half, t), vaddq_f32(a, vmulq_f32(t, vaddq_f32(b, vmulq_f32(t, c))))));
+		vst1q_f32(output + k, y);
+	}
+	Cubic_Scalar(input, output + k, taps + k, nFrames - k);
+}
+
+const CAResamplerKernels kNEONKernels = { "NEON", Sinc_NEON, Cubic_NEON };
+#endif // CARS_NEON
+
+// zeroth-order modified Bessel function of the first kind, for the Kaiser window
+Float64 BesselI0(Float64 x)
+{
+	Float64 sum = 1.0, term = 1.0;
+	for (int k = 1; k < 50; ++k) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-17)
+			break;
+	}
+	return sum;
+}
+
+} // namespace
+
+const CAResamplerKernels *	CAGetResamplerKernels(CASampleConversionISA isa)
+{
+	switch (isa) {
+		case kCASampleConversionISA_Scalar:
+			return &kScalarKernels;
+#if CARS_X86
+		case kCASampleConversionISA_SSE2:
+			return __builtin_cpu_supports("sse2") ? &kSSE2Kernels : NULL;
+		case kCASampleConversionISA_AVX2:
+			return __builtin_cpu_supports("avx2") ? &kAVX2Kernels : NULL;
+#endif
+#if CARS_NEON
+		case kCASampleConversionISA_NEON:
+			return &kNEONKernels;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+static const CAResamplerKernels *ChooseBestResamplerKernels()
+{
+	const CAResamplerKernels *best = NULL;
+	for (int isa = kCASampleConversionISA_Count - 1; isa >= 0 && best == NULL; --isa)
+		best = CAGetResamplerKernels(CASampleConversionISA(isa));
+	return best;
+}
+
+const CAResamplerKernels &	CAGetBestResamplerKernels()
+{
+	static const CAResamplerKernels *best = ChooseBestResamplerKernels();
+	return *best;
+}
+
+#pragma mark -- CAResampler --
+
+CAResampler::CAResampler() :
+	mChannels(0),
+	mQuality(kCAResamplerQuality_Medium),
+	mKernels(NULL),
+	mFilterLength(0),
+	mPhases(0),
+	mMaxOutputFrames(0),
+	mMaxInputFrames(0),
+	mMaxRatio(0),
+	mWorkStride(0),
+	mHistoryFrames(0),
+	mPosition(0),
+	mRatio(1.0)
+{
+}
+
+CAResampler::~CAResampler()
+{
+}
+
+void	CAResampler::Initialize(int nChannels, UInt32 maxOutputFrames, Float64 maxRatio, CAResamplerQuality quality, const CAResamplerKernels *kernels)
+{
+	mChannels = nChannels;
+	mQuality = quality;
+	mKernels = kernels ? kernels : &CAGetBestResamplerKernels();
+	mFilterLength = kQualitySpecs[quality].mFilterLength;
+	mPhases = kQualitySpecs[quality].mPhases;
+	mMaxOutputFrames = maxOutputFrames;
+	mMaxRatio = maxRatio;
+	// the ratio ramps up to at most maxRatio across a block, and the block can end a frame later
+	mMaxInputFrames = UInt32(ceil(maxOutputFrames * maxRatio)) + 2;
+	mWorkStride = mMaxInputFrames + mFilterLength;
+	mWork.assign(size_t(mWorkStride) * nChannels, 0.0f);
+	mTaps.resize(maxOutputFrames);
+	DesignFilter(maxRatio);
+	mRatio = std::min(1.0, maxRatio);
+	Reset();
+}
+
+void	CAResampler::Deallocate()
+{
+	mWork.clear();
+	mWork.shrink_to_fit();
+	mTaps.clear();
+	mTaps.shrink_to_fit();
+	mTable.clear();
+	mTable.shrink_to_fit();
+	mChannels = 0;
+	mMaxOutputFrames = mMaxInputFrames = 0;
+}
+
+// Row p of the table holds the coefficients for an output frame p / mPhases of an input frame
+// past the input frame under coefficient mFilterLength / 2 - 1. Each row sums to 1.
+void	CAResampler::DesignFilter(Float64 maxRatio)
+{
+	mTable.clear();
+	if (mQuality == kCAResamplerQuality_Cubic)
+		return;
+
+	const QualitySpec &spec = kQualitySpecs[mQuality];
+	Float64 cutoff = 0.5 * spec.mRolloff / std::max(1.0, maxRatio);	// cycles per input frame
+	Float64 halfLength = mFilterLength / 2;
+	Float64 windowScale = 1.0 / BesselI0(spec.mKaiserBeta);
+
+	mTable.resize(size_t(mPhases + 1) * mFilterLength);
+	for (UInt32 p = 0; p <= mPhases; ++p) {
+		Float32 *row = &mTable[size_t(p) * mFilterLength];
+		Float64 phase = Float64(p) / mPhases;
+		Float64 sum = 0.0;
+		std::vector<Float64> h(mFilterLength);
+		for (UInt32 j = 0; j < mFilterLength; ++j) {
+			Float64 d = j - (halfLength - 1) - phase;
+			Float64 x = 2.0 * cutoff * d;
+			Float64 sinc = (d == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			Float64 r = d / halfLength;
+			Float64 window = (fabs(r) >= 1.0) ? 0.0 : BesselI0(spec.mKaiserBeta * sqrt(1.0 - r * r)) * windowScale;
+			h[j] = 2.0 * cutoff * sinc * window;
+			sum += h[j];
+		}
+		for (UInt32 j = 0; j < mFilterLength; ++j)
+			row[j] = Float32(h[j] / sum);
+	}
+}
+
+// The history starts as silence, with the first output frame half a filter before the first
+// input frame: the output lags the input by GetLatency.
+void	CAResampler::Reset()
+{
+	std::fill(mWork.begin(), mWork.end(), 0.0f);
+	mHistoryFrames = mFilterLength - 1;
+	mPosition = mFilterLength / 2 - 1;
+}
+
+// Works out, identically for InputFramesNeeded and Process, where each output frame of the block
+// falls; returns the position of the last one.
+Float64	CAResampler::EndPosition(UInt32 nOutputFrames, Float64 ratio, CAResamplerTap *taps) const
+{
+	Float64 position = mPosition, last = mPosition;
+	Float64 step = (ratio - mRatio) / nOutputFrames;
+	for (UInt32 k = 0; k < nOutputFrames; ++k) {
+		if (taps) {
+			Float64 whole = floor(position);
+			Float64 fraction = position - whole;
+			taps[k].mFirst = UInt32(whole) - (mFilterLength / 2 - 1);
+			if (mPhases) {
+				Float64 phase = fraction * mPhases;
+				Float64 row = std::min(floor(phase), Float64(mPhases - 1));
+				taps[k].mPhase = UInt32(row);
+				taps[k].mFraction = Float32(phase - row);
+			} else {
+				taps[k].mPhase = 0;
+				taps[k].mFraction = Float32(fraction);
+			}
+		}
+		last = position;
+		position += mRatio + step * (k + 1);
+	}
+	return last;
+}
+
+UInt32	CAResampler::InputFramesNeeded(UInt32 nOutputFrames, Float64 ratio) const
+{
+	if (nOutputFrames == 0)
+		return 0;
+	Float64 last = EndPosition(nOutputFrames, ratio, NULL);
+	SInt64 needed = SInt64(floor(last)) + mFilterLength / 2 + 1 - SInt64(mHistoryFrames);
+	return UInt32(std::max(needed, SInt64(0)));
+}
+
+void	CAResampler::ProcessChannels(const AudioBufferList *input, UInt32 nInputFrames, AudioBufferList *output,
+									 UInt32 nOutputFrames, int first, int end)
+{
+	for (int ch = first; ch < end; ++ch) {
+		Float32 *work = &mWork[size_t(ch) * mWorkStride];
+		memcpy(work + mHistoryFrames, input->mBuffers[ch].mData, nInputFrames * sizeof(Float32));
+		Float32 *out = (Float32 *)output->mBuffers[ch].mData;
+		if (mPhases)
+			mKernels->mSinc(work, out, &mTaps[0], nOutputFrames, &mTable[0], mFilterLength);
+		else
+			mKernels->mCubic(work, out, &mTaps[0], nOutputFrames);
+		output->mBuffers[ch].mDataByteSize = nOutputFrames * sizeof(Float32);
+	}
+}
+
+void	CAResampler::ProcessTask(void *context, UInt32 task)
+{
+	Block &block = *(Block *)context;
+	int channels = block.mResampler->mChannels;
+	block.mResampler->ProcessChannels(block.mInput, block.mInputFrames, block.mOutput, block.mOutputFrames,
+									  int(channels * task / block.mTasks), int(channels * (task + 1) / block.mTasks));
+}
+
+CAResamplerError	CAResampler::Process(const AudioBufferList *input, UInt32 nInputFrames, AudioBufferList *output,
+										 UInt32 nOutputFrames, Float64 ratio, CARealtimeWorkerPool *pool)
+{
+	if (nOutputFrames > mMaxOutputFrames)
+		return kCAResamplerError_TooManyFrames;
+	if (!(ratio > 0.0) || ratio > mMaxRatio)
+		return kCAResamplerError_BadRatio;
+	if (nOutputFrames == 0)
+		return kCAResamplerError_OK;
+	if (nInputFrames != InputFramesNeeded(nOutputFrames, ratio))
+		return kCAResamplerError_InputFrames;
+
+	Float64 last = EndPosition(nOutputFrames, ratio, &mTaps[0]);
+	UInt32 length = mHistoryFrames + nInputFrames;
+
+	UInt32 nTasks = pool ? pool->GetTasks(mChannels) : 1;
+	if (nTasks <= 1) {
+		ProcessChannels(input, nInputFrames, output, nOutputFrames, 0, mChannels);
+	} else {
+		Block block = { this, input, nInputFrames, output, nOutputFrames, nTasks };
+		pool->Run(nTasks, ProcessTask, &block);
+	}
+
+	// keep what the next block's first frame will need
+	Float64 next = last + ratio;
+	SInt64 consumed = std::min(SInt64(floor(next)) - SInt64(mFilterLength / 2 - 1), SInt64(length));
+	consumed = std::max(consumed, SInt64(0));
+	mHistoryFrames = length - UInt32(consumed);
+	for (int ch = 0; ch < mChannels; ++ch) {
+		Float32 *work = &mWork[size_t(ch) * mWorkStride];
+		memmove(work, work + consumed, mHistoryFrames * sizeof(Float32));
+	}
+	mPosition = next - consumed;
+	mRatio = ratio;
+	return kCAResamplerError_OK;
+}
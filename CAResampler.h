@@ -0,0 +1,139 @@
+/*=============================================================================
+	CAResampler.h
+
+	A fractional resampler for deinterleaved Float32 audio, to stand in for
+	the Varispeed AudioUnit where there is none.
+
+	Each output frame is interpolated from the input at a position that
+	advances by the ratio (input frames per output frame) from one output
+	frame to the next. The ratio can change on every call: it ramps linearly
+	across the block from the previous ratio to the new one, so that a drift
+	controller can steer it without clicks.
+
+	The sinc qualities are Kaiser-windowed sinc filters, stored polyphase
+	with linear interpolation between neighbouring phases, with the cutoff
+	lowered for the largest ratio they are set up for so that downsampling
+	doesn't alias. kCAResamplerQuality_Cubic is 4-point Catmull-Rom
+	interpolation: no anti-aliasing, but a fraction of the cost.
+
+	All qualities are linear phase. The output lags the input by GetLatency
+	input frames, half the filter length, which a caller should count in its
+	latency.
+
+	The kernels are chosen as CASampleConversion's are: the fastest the CPU
+	supports, or a given CASampleConversionISA for testing. The channels
+	share a block's positions and taps, worked out once, and are filtered
+	independently, so a CARealtimeWorkerPool can take them a group at a time.
+=============================================================================*/
+
+#ifndef __CAResampler_h__
+#define __CAResampler_h__
+
+#include "CARealtimeWorkerPool.h"
+#include "CASampleConversion.h"
+
+#include <vector>
+
+enum CAResamplerQuality {
+	kCAResamplerQuality_Cubic = 0,		// 4 points
+	kCAResamplerQuality_Low = 1,		// 16-tap sinc
+	kCAResamplerQuality_Medium = 2,		// 32-tap sinc
+	kCAResamplerQuality_High = 3,		// 64-tap sinc
+	kCAResamplerQuality_Count = 4
+};
+
+enum {
+	kCAResamplerError_OK = 0,
+	kCAResamplerError_TooManyFrames = 1,	// more than the resampler was initialized for
+	kCAResamplerError_BadRatio = 2,			// not positive, or above the maximum ratio
+	kCAResamplerError_InputFrames = 3		// not what InputFramesNeeded asked for
+};
+
+typedef SInt32 CAResamplerError;
+
+// One output frame: where its filter starts in the input, and which phase it uses.
+struct CAResamplerTap {
+	UInt32		mFirst;		// input frame under the first coefficient
+	UInt32		mPhase;		// row of the polyphase table; unused by cubic
+	Float32		mFraction;	// between mPhase and mPhase + 1, or between input frames for cubic
+};
+
+typedef void (*CAResampleSincProc)(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames,
+								   const Float32 *table, UInt32 filterLength);
+typedef void (*CAResampleCubicProc)(const Float32 *input, Float32 *output, const CAResamplerTap *taps, UInt32 nFrames);
+
+struct CAResamplerKernels {
+	const char *		mName;
+	CAResampleSincProc	mSinc;
+	CAResampleCubicProc	mCubic;
+};
+
+const CAResamplerKernels *	CAGetResamplerKernels(CASampleConversionISA isa);
+								// NULL if the kernels for isa were not built or the CPU lacks them
+const CAResamplerKernels &	CAGetBestResamplerKernels();
+
+class CAResampler {
+public:
+	CAResampler();
+	~CAResampler();
+
+	void				Initialize(int nChannels, UInt32 maxOutputFrames, Float64 maxRatio,
+								   CAResamplerQuality quality = kCAResamplerQuality_Medium,
+								   const CAResamplerKernels *kernels = NULL);
+							// allocates; not for the IO thread. maxRatio bounds the ratio of
+							// every Process call and sets the sinc filters' cutoff.
+	void				Deallocate();
+	void				Reset();
+							// forgets the input so far and goes back to the last ratio
+
+	UInt32				GetLatency() const { return mFilterLength / 2; }
+							// group delay, in input frames
+	CAResamplerQuality	GetQuality() const { return mQuality; }
+	UInt32				GetMaxInputFrames() const { return mMaxInputFrames; }
+	UInt32				GetMaxOutputFrames() const { return mMaxOutputFrames; }
+	Float64				GetMaxRatio() const { return mMaxRatio; }
+
+	UInt32				InputFramesNeeded(UInt32 nOutputFrames, Float64 ratio) const;
+							// exactly what Process will consume to make nOutputFrames at ratio
+	CAResamplerError	Process(const AudioBufferList *input, UInt32 nInputFrames, AudioBufferList *output,
+								UInt32 nOutputFrames, Float64 ratio, CARealtimeWorkerPool *pool = NULL);
+							// Deinterleaved Float32, a buffer per channel. nInputFrames must be
+							// InputFramesNeeded(nOutputFrames, ratio). With a pool, the channels are
+							// filtered a group at a time across its workers.
+
+private:
+	struct Block {
+		CAResampler *			mResampler;
+		const AudioBufferList *	mInput;
+		UInt32					mInputFrames;
+		AudioBufferList *		mOutput;
+		UInt32					mOutputFrames;
+		UInt32					mTasks;
+	};
+
+	void				ProcessChannels(const AudioBufferList *input, UInt32 nInputFrames, AudioBufferList *output,
+										UInt32 nOutputFrames, int first, int end);
+	static void			ProcessTask(void *context, UInt32 task);
+	Float64				EndPosition(UInt32 nOutputFrames, Float64 ratio, CAResamplerTap *taps) const;
+	void				DesignFilter(Float64 maxRatio);
+
+	int						mChannels;
+	CAResamplerQuality		mQuality;
+	const CAResamplerKernels *mKernels;
+	UInt32					mFilterLength;		// taps
+	UInt32					mPhases;
+	std::vector<Float32>	mTable;				// mPhases + 1 rows of mFilterLength
+	UInt32					mMaxOutputFrames;
+	UInt32					mMaxInputFrames;
+	Float64					mMaxRatio;
+
+	// per channel: the input not yet consumed, then the new input
+	std::vector<Float32>	mWork;
+	UInt32					mWorkStride;
+	UInt32					mHistoryFrames;
+	Float64					mPosition;			// of the next output frame, in mWork frames
+	Float64					mRatio;				// the last ratio
+	std::vector<CAResamplerTap> mTaps;
+};
+
+#endif // __CAResampler_h__
@@ -39,14 +39,13 @@
 			POSSIBILITY OF SUCH DAMAGE.
 */
 #include "CARingBuffer.h"
+#include "CARingBufferMemory.h"
 #include "CABitOperations.h"
 #include "CAAutoDisposer.h"
-#include "CAAtomic.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
-#include <libkern/OSAtomic.h>
 
 //#define CARB_DEBUG( msg, fmt... ) printf( msg, ##fmt )
 #define CARB_DEBUG( msg, fmt... )
@@ -54,9 +53,19 @@
 static CARingBufferError worse(CARingBufferError a, CARingBufferError b);
 
 CARingBuffer::CARingBuffer() :
-	mBuffers(NULL), mNumberChannels(0), mCapacityFrames(0), mCapacityBytes(0), mTimeBoundsQueuePtr(0)
+	mBuffers(NULL), mMirror(NULL), mPages(NULL), mPagesBytes(0), mAllocationOptions(0), mNUMANode(-1), mNumberChannels(0), mNumberBuffers(0), mCapacityFrames(0), mCapacityBytes(0),
+	mWriterStartTime(0), mWriterEndTime(0), mWriterGeneration(0), mTimeBoundsGeneration(0)
 {
-
+	for (UInt32 i = 0; i<kGeneralRingTimeBoundsQueueSize; ++i)
+	{
+		mTimeBoundsQueue[i].mStartTime.store(0, std::memory_order_relaxed);
+		mTimeBoundsQueue[i].mEndTime.store(0, std::memory_order_relaxed);
+	}
+	mConversion.mFromFloat32 = NULL;
+	mConversion.mToFloat32 = NULL;
+	mConversion.mSampleBytes = 0;
+	mConversion.mScale = CAGetBestSampleConverter().mScale;
+	mConversion.mMix = CAGetBestSampleConverter().mMix;
 }
 
 CARingBuffer::~CARingBuffer()
@@ -65,47 +74,131 @@ CARingBuffer::~CARingBuffer()
 }
 
 
-void	CARingBuffer::Allocate(int nChannels, UInt32 bytesPerFrame, UInt32 capacityFrames)
+void	CARingBuffer::Allocate(int nChannels, UInt32 bytesPerFrame, UInt32 capacityFrames, Layout layout, UInt32 options, int numaNode)
 {
 	Deallocate();
 	
 	capacityFrames = NextPowerOfTwo(capacityFrames);
 	
+	// an interleaved ring is a single buffer whose frames hold every channel
+	int nBuffers = (layout == kInterleaved) ? 1 : nChannels;
+	if (layout == kInterleaved)
+		bytesPerFrame *= nChannels;
+	
 	mNumberChannels = nChannels;
+	mNumberBuffers = nBuffers;
 	mBytesPerFrame = bytesPerFrame;
 	mCapacityFrames = capacityFrames;
 	mCapacityFramesMask = capacityFrames - 1;
 	mCapacityBytes = bytesPerFrame * capacityFrames;
-
-	// put everything in one memory allocation, first the pointers, then the deinterleaved channels
-	UInt32 allocSize = (mCapacityBytes + sizeof(Byte *)) * nChannels;
-	Byte *p = (Byte *)CA_malloc(allocSize);
-	memset(p, 0, allocSize);
-	mBuffers = (Byte **)p;
-	p += nChannels * sizeof(Byte *);
-	for (int i = 0; i < nChannels; ++i) {
-		mBuffers[i] = p;
-		p += mCapacityBytes;
+	
+	if (options & kAllocateMirrored) {
+		// the mapping works in whole pages; pageSize frames is always enough
+		UInt32 mirroredFrames = capacityFrames;
+		while ((mirroredFrames * bytesPerFrame) % CARingBufferPageSize() != 0)
+			mirroredFrames *= 2;
+		mMirror = CARingBufferMapMirrored(mirroredFrames * bytesPerFrame, nBuffers);
+		if (mMirror) {
+			mCapacityFrames = mirroredFrames;
+			mCapacityFramesMask = mirroredFrames - 1;
+			mCapacityBytes = bytesPerFrame * mirroredFrames;
+			mBuffers = (Byte **)CA_malloc(nBuffers * sizeof(Byte *));
+			for (int i = 0; i < nBuffers; ++i)
+				mBuffers[i] = mMirror + 2 * i * mCapacityBytes;
+			mAllocationOptions |= kAllocateMirrored;
+		}
+	}
+	
+	if (!mMirror && ((options & (kAllocateHugePages | kAllocateLocked)) || numaNode >= 0)) {
+		// page-aligned memory of our own, so the placement below applies to just the buffers
+		bool hugeTLB = (options & kAllocateHugePages);
+		mPagesBytes = mCapacityBytes * nBuffers;
+		mPages = CARingBufferMapPages(mPagesBytes, hugeTLB);
+		if (mPages) {
+			mBuffers = (Byte **)CA_malloc(nBuffers * sizeof(Byte *));
+			for (int i = 0; i < nBuffers; ++i)
+				mBuffers[i] = mPages + i * mCapacityBytes;
+			if (hugeTLB)
+				mAllocationOptions |= kAllocateHugePages;
+		}
+	}
+	
+	if (mMirror || mPages) {
+		Byte *pages = mMirror ? mMirror : mPages;
+		size_t bytes = mMirror ? 2 * mCapacityBytes * nBuffers : mPagesBytes;
+		
+		// placement has to come before the first touch
+		if ((options & kAllocateHugePages) && !(mAllocationOptions & kAllocateHugePages) && CARingBufferAdviseHugePages(pages, bytes))
+			mAllocationOptions |= kAllocateHugePages;
+		if (numaNode >= 0 && CARingBufferBindToNUMANode(pages, bytes, numaNode))
+			mNUMANode = numaNode;
+		
+		// fault everything in now rather than on the real-time thread
+		if ((options & kAllocateLocked) && CARingBufferLockPages(pages, bytes))
+			mAllocationOptions |= kAllocateLocked;
+		else
+			CARingBufferTouchPages(pages, bytes);
+	} else {
+		// put everything in one memory allocation, first the pointers, then the buffers
+		UInt32 allocSize = (mCapacityBytes + sizeof(Byte *)) * nBuffers;
+		Byte *p = (Byte *)CA_malloc(allocSize);
+		memset(p, 0, allocSize);
+		mBuffers = (Byte **)p;
+		p += nBuffers * sizeof(Byte *);
+		for (int i = 0; i < nBuffers; ++i) {
+			mBuffers[i] = p;
+			p += mCapacityBytes;
+		}
 	}
 	
 	for (UInt32 i = 0; i<kGeneralRingTimeBoundsQueueSize; ++i)
 	{
-		mTimeBoundsQueue[i].mStartTime = 0;
-		mTimeBoundsQueue[i].mEndTime = 0;
-		mTimeBoundsQueue[i].mUpdateCounter = 0;
+		mTimeBoundsQueue[i].mStartTime.store(0, std::memory_order_relaxed);
+		mTimeBoundsQueue[i].mEndTime.store(0, std::memory_order_relaxed);
+	}
+	mWriterStartTime = 0;
+	mWriterEndTime = 0;
+	mWriterGeneration = 0;
+	mTimeBoundsGeneration.store(0, std::memory_order_release);
+}
+
+void	CARingBuffer::Allocate(int nChannels, CASampleFormat storedFormat, UInt32 capacityFrames, Layout layout, UInt32 options, int numaNode)
+{
+	UInt32 sampleBytes = CASampleFormatBytes(storedFormat);
+	Allocate(nChannels, sampleBytes, capacityFrames, layout, options, numaNode);
+	
+	if (storedFormat != kCASampleFormat_Float32) {
+		const CASampleConverter &converter = CAGetBestSampleConverter();
+		mConversion.mFromFloat32 = converter.mFromFloat32[storedFormat];
+		mConversion.mToFloat32 = converter.mToFloat32[storedFormat];
+		mConversion.mSampleBytes = sampleBytes;
 	}
-	mTimeBoundsQueuePtr = 0;
 }
 
 void	CARingBuffer::Deallocate()
 {
+	if (mMirror) {
+		CARingBufferUnmapMirrored(mMirror, mCapacityBytes, mNumberBuffers);
+		mMirror = NULL;
+	}
+	if (mPages) {
+		CARingBufferUnmapPages(mPages, mPagesBytes);
+		mPages = NULL;
+		mPagesBytes = 0;
+	}
+	mAllocationOptions = 0;
+	mNUMANode = -1;
 	if (mBuffers) {
 		free(mBuffers);
 		mBuffers = NULL;
 	}
 	mNumberChannels = 0;
+	mNumberBuffers = 0;
 	mCapacityBytes = 0;
 	mCapacityFrames = 0;
+	mConversion.mFromFloat32 = NULL;
+	mConversion.mToFloat32 = NULL;
+	mConversion.mSampleBytes = 0;
 }
 
 inline void ZeroRange(Byte **buffers, int nchannels, int offset, int nbytes)
@@ -116,10 +209,20 @@ inline void ZeroRange(Byte **buffers, int nchannels, int offset, int nbytes)
 	}
 }
 
-inline void StoreABL(Byte **buffers, int destOffset, const AudioBufferList *abl, int srcOffset, int nbytes)
+// In the ABL helpers below all offsets and sizes are in ring bytes.
+
+inline void StoreABL(Byte **buffers, int destOffset, const AudioBufferList *abl, int srcOffset, int nbytes, const CARingBufferSampleConversion &conv)
 {
 	int nchannels = abl->mNumberBuffers;
 	const AudioBuffer *src = abl->mBuffers;
+	if (conv.mFromFloat32) {
+		while (--nchannels >= 0) {
+			conv.mFromFloat32((const Float32 *)src->mData + srcOffset / conv.mSampleBytes, *buffers + destOffset, nbytes / conv.mSampleBytes);
+			++buffers;
+			++src;
+		}
+		return;
+	}
 	while (--nchannels >= 0) {
 		memcpy(*buffers + destOffset, (Byte *)src->mData + srcOffset, nbytes);
 		++buffers;
@@ -127,10 +230,18 @@ inline void StoreABL(Byte **buffers, int destOffset, const AudioBufferList *abl,
 	}
 }
 
-inline void FetchABL(AudioBufferList *abl, int destOffset, Byte **buffers, int srcOffset, int nbytes)
+inline void FetchABL(AudioBufferList *abl, int destOffset, Byte **buffers, int srcOffset, int nbytes, const CARingBufferSampleConversion &conv)
 {
 	int nchannels = abl->mNumberBuffers;
 	AudioBuffer *dest = abl->mBuffers;
+	if (conv.mToFloat32) {
+		while (--nchannels >= 0) {
+			conv.mToFloat32(*buffers + srcOffset, (Float32 *)dest->mData + destOffset / conv.mSampleBytes, nbytes / conv.mSampleBytes);
+			++buffers;
+			++dest;
+		}
+		return;
+	}
 	while (--nchannels >= 0) {
 		memcpy((Byte *)dest->mData + destOffset, *buffers + srcOffset, nbytes);
 		++buffers;
@@ -138,10 +249,85 @@ inline void FetchABL(AudioBufferList *abl, int destOffset, Byte **buffers, int s
 	}
 }
 
-inline void ZeroABL(AudioBufferList *abl, int destOffset, int nbytes)
+// Samples a converting ring's FetchGainABL takes through Float32 at a time, on the stack.
+const UInt32 kGainChunkSamples = 256;
+
+inline void GainSamples(const Float32 *src, Float32 *dest, Float32 gain, UInt32 nSamples, bool mix, const CARingBufferSampleConversion &conv)
+{
+	if (mix)
+		conv.mMix(src, dest, gain, nSamples);
+	else
+		conv.mScale(src, dest, gain, nSamples);
+}
+
+// Interleaved samples of nchannels, each channel with its own gain, from channel ch on.
+inline void GainFrames(const Float32 *src, Float32 *dest, const Float32 *gains, int nchannels, int ch, UInt32 nSamples, bool mix)
+{
+	for (UInt32 i = 0; i < nSamples; ++i) {
+		Float32 x = src[i] * gains[ch];
+		dest[i] = mix ? dest[i] + x : x;
+		if (++ch == nchannels)
+			ch = 0;
+	}
+}
+
+// FetchABL for FetchScaled and FetchMix. A gain of 1 scaled is a plain copy, and 0 is a memset, or
+// nothing at all mixed. An interleaved buffer whose channels all have the same gain goes through
+// the kernels as one long channel.
+inline void FetchGainABL(AudioBufferList *abl, int destOffset, Byte **buffers, int srcOffset, int nbytes, const CARingBufferSampleConversion &conv,
+						 bool mix, const Float32 *gains, int nchannels)
+{
+	UInt32 sampleBytes = conv.mToFloat32 ? conv.mSampleBytes : sizeof(Float32);
+	UInt32 nSamples = nbytes / sampleBytes;
+	int nBuffers = abl->mNumberBuffers;
+	bool perSample = false;		// interleaved, with gains that differ
+	if (nBuffers == 1)
+		for (int ch = 1; ch < nchannels; ++ch)
+			perSample = perSample || (gains[ch] != gains[0]);
+	
+	for (int b = 0; b < nBuffers; ++b) {
+		const Byte *src = buffers[b] + srcOffset;
+		Float32 *dest = (Float32 *)abl->mBuffers[b].mData + destOffset / sampleBytes;
+		Float32 gain = gains[b];
+		if (!perSample && gain == 0.0f) {
+			if (!mix)
+				memset(dest, 0, nSamples * sizeof(Float32));
+			continue;
+		}
+		if (!perSample && gain == 1.0f && !mix) {
+			if (conv.mToFloat32)
+				conv.mToFloat32(src, dest, nSamples);
+			else
+				memcpy(dest, src, nSamples * sizeof(Float32));
+			continue;
+		}
+		
+		// an offset into an interleaved buffer is a whole number of frames, so it starts on channel 0
+		const Float32 *from = (const Float32 *)src;
+		Float32 scratch[kGainChunkSamples];
+		UInt32 chunk = conv.mToFloat32 ? kGainChunkSamples : nSamples;
+		for (UInt32 i = 0; i < nSamples; i += chunk) {
+			UInt32 n = std::min(chunk, nSamples - i);
+			if (conv.mToFloat32) {
+				conv.mToFloat32(src + i * sampleBytes, scratch, n);
+				from = scratch;
+			} else {
+				from = (const Float32 *)src + i;
+			}
+			if (perSample)
+				GainFrames(from, dest + i, gains, nchannels, i % nchannels, n, mix);
+			else
+				GainSamples(from, dest + i, gain, n, mix, conv);
+		}
+	}
+}
+
+inline void ZeroABL(AudioBufferList *abl, int destOffset, int nbytes, const CARingBufferSampleConversion &conv)
 {
 	int nBuffers = abl->mNumberBuffers;
 	AudioBuffer *dest = abl->mBuffers;
+	destOffset = conv.ClientBytes(destOffset);
+	nbytes = conv.ClientBytes(nbytes);
 	while (--nBuffers >= 0) {
 		memset((Byte *)dest->mData + destOffset, 0, nbytes);
 		++dest;
@@ -149,7 +335,7 @@ inline void ZeroABL(AudioBufferList *abl, int destOffset, int nbytes)
 }
 
 
-CARingBufferError	CARingBuffer::Store(const AudioBufferList *abl, UInt32 framesToWrite, SampleTime startWrite)
+CARingBufferError	CARingBuffer::PrepareStore(UInt32 framesToWrite, SampleTime startWrite)
 {
 	if (framesToWrite > mCapacityFrames)
 		return kCARingBufferError_TooMuch;		// too big!
@@ -168,31 +354,44 @@ CARingBufferError	CARingBuffer::Store(const AudioBufferList *abl, UInt32 framesT
 		SetTimeBounds(newStart, newEnd);
 	}
 	
-	// write the new frames
-	Byte **buffers = mBuffers;
-	int nchannels = mNumberChannels;
-	int offset0, offset1, nbytes;
-	
 	if (startWrite > EndTime()) {
 		// we are skipping some samples, so zero the range we are skipping
-		offset0 = FrameOffset(EndTime());
-		offset1 = FrameOffset(startWrite);
-		if (offset0 < offset1)
-			ZeroRange(buffers, nchannels, offset0, offset1 - offset0);
+		int offset0 = FrameOffset(EndTime());
+		int offset1 = FrameOffset(startWrite);
+		if (mMirror)
+			ZeroRange(mBuffers, mNumberBuffers, offset0, std::min(startWrite - EndTime(), SampleTime(mCapacityFrames)) * mBytesPerFrame);
+		else if (offset0 < offset1)
+			ZeroRange(mBuffers, mNumberBuffers, offset0, offset1 - offset0);
 		else {
-			ZeroRange(buffers, nchannels, offset0, mCapacityBytes - offset0);
-			ZeroRange(buffers, nchannels, 0, offset1);
+			ZeroRange(mBuffers, mNumberBuffers, offset0, mCapacityBytes - offset0);
+			ZeroRange(mBuffers, mNumberBuffers, 0, offset1);
 		}
 	}
+	
+	return kCARingBufferError_OK;
+}
+
+CARingBufferError	CARingBuffer::Store(const AudioBufferList *abl, UInt32 framesToWrite, SampleTime startWrite)
+{
+	CARingBufferError err = PrepareStore(framesToWrite, startWrite);
+	if (err) return err;
+	
+	SampleTime endWrite = startWrite + framesToWrite;
+	
+	// write the new frames
+	Byte **buffers = mBuffers;
+	int offset0, offset1, nbytes;
 
     offset0 = FrameOffset(startWrite);
 	offset1 = FrameOffset(endWrite);
-	if (offset0 < offset1)
-		StoreABL(buffers, offset0, abl, 0, offset1 - offset0);
+	if (mMirror)
+		StoreABL(buffers, offset0, abl, 0, framesToWrite * mBytesPerFrame, mConversion);
+	else if (offset0 < offset1)
+		StoreABL(buffers, offset0, abl, 0, offset1 - offset0, mConversion);
 	else {
 		nbytes = mCapacityBytes - offset0;
-		StoreABL(buffers, offset0, abl, 0,      nbytes);
-		StoreABL(buffers, 0,       abl, nbytes, offset1);
+		StoreABL(buffers, offset0, abl, 0,      nbytes,  mConversion);
+		StoreABL(buffers, 0,       abl, nbytes, offset1, mConversion);
 	}
 	
 	// now update the end time
@@ -201,31 +400,113 @@ CARingBufferError	CARingBuffer::Store(const AudioBufferList *abl, UInt32 framesT
 	return kCARingBufferError_OK;	// success
 }
 
+UInt32	CARingBuffer::GetSpans(SampleTime startTime, UInt32 nFrames, AudioBufferList *head, AudioBufferList *tail)
+{
+	int offset0 = FrameOffset(startTime);
+	int offset1 = FrameOffset(startTime + nFrames);
+	UInt32 headBytes, tailBytes;
+	if (offset0 < offset1 || nFrames == 0 || mMirror) {
+		headBytes = nFrames * mBytesPerFrame;
+		tailBytes = 0;
+	} else {
+		headBytes = mCapacityBytes - offset0;
+		tailBytes = offset1;
+	}
+	
+	UInt32 channelsPerBuffer = mNumberChannels / mNumberBuffers;
+	head->mNumberBuffers = tail->mNumberBuffers = mNumberBuffers;
+	for (int i = 0; i < mNumberBuffers; ++i) {
+		head->mBuffers[i].mNumberChannels = tail->mBuffers[i].mNumberChannels = channelsPerBuffer;
+		head->mBuffers[i].mData = mBuffers[i] + offset0;
+		head->mBuffers[i].mDataByteSize = headBytes;
+		tail->mBuffers[i].mData = mBuffers[i];
+		tail->mBuffers[i].mDataByteSize = tailBytes;
+	}
+	return headBytes / mBytesPerFrame;
+}
+
+CARingBufferError	CARingBuffer::BeginStore(UInt32 nFrames, SampleTime startWrite, AudioBufferList *head, AudioBufferList *tail, UInt32 &headFrames)
+{
+	headFrames = 0;
+	CARingBufferError err = PrepareStore(nFrames, startWrite);
+	if (err) return err;
+	
+	headFrames = GetSpans(startWrite, nFrames, head, tail);
+	return kCARingBufferError_OK;
+}
+
+void	CARingBuffer::EndStore(UInt32 nFrames, SampleTime startWrite)
+{
+	SetTimeBounds(StartTime(), startWrite + nFrames);
+}
+
+CARingBufferError	CARingBuffer::BeginFetch(UInt32 nFrames, SampleTime startRead, AudioBufferList *head, AudioBufferList *tail, UInt32 &headFrames)
+{
+	headFrames = 0;
+	SampleTime endRead = startRead + nFrames;
+	CARingBufferError err = ClipTimeBounds(startRead, endRead);
+	if (err) return err;
+	
+	headFrames = GetSpans(startRead, nFrames, head, tail);
+	return kCARingBufferError_OK;
+}
+
+CARingBufferError	CARingBuffer::EndFetch(UInt32 nFrames, SampleTime startRead)
+{
+	// order the caller's reads of the spans before the bounds check
+	std::atomic_thread_fence(std::memory_order_acquire);
+	SampleTime endRead = startRead + nFrames;
+	return ClipTimeBounds(startRead, endRead);
+}
+
 void	CARingBuffer::SetTimeBounds(SampleTime startTime, SampleTime endTime)
 {
-	UInt32 nextPtr = mTimeBoundsQueuePtr + 1;
-	UInt32 index = nextPtr & kGeneralRingTimeBoundsQueueMask;
+	UInt32 nextGeneration = mWriterGeneration + 1;
+	TimeBounds &bounds = mTimeBoundsQueue[nextGeneration & kGeneralRingTimeBoundsQueueMask];
 	
-	mTimeBoundsQueue[index].mStartTime = startTime;
-	mTimeBoundsQueue[index].mEndTime = endTime;
-	mTimeBoundsQueue[index].mUpdateCounter = nextPtr;
-    
-	CAAtomicCompareAndSwap32Barrier(mTimeBoundsQueuePtr, mTimeBoundsQueuePtr + 1, (SInt32*)&mTimeBoundsQueuePtr);
+	bounds.mStartTime.store(startTime, std::memory_order_relaxed);
+	bounds.mEndTime.store(endTime, std::memory_order_relaxed);
+	mTimeBoundsGeneration.store(nextGeneration, std::memory_order_release);
+	
+	// a reader that sees anything stored after this point (a reused slot, or sample data
+	// overwritten after the start time moved) will also see this generation
+	std::atomic_thread_fence(std::memory_order_release);
+	
+	mWriterStartTime = startTime;
+	mWriterEndTime = endTime;
+	mWriterGeneration = nextGeneration;
 }
 
 CARingBufferError	CARingBuffer::GetTimeBounds(SampleTime &startTime, SampleTime &endTime)
 {
-	for ( int i = 0; i < 8; ++i ) // fail after a few tries.
+	SnapshotTimeBounds(startTime, endTime);
+	return kCARingBufferError_OK;
+}
+
+UInt32	CARingBuffer::SnapshotTimeBounds(SampleTime &startTime, SampleTime &endTime)
+{
+	UInt32 generation = mTimeBoundsGeneration.load(std::memory_order_acquire);
+	for (;;)
 	{
-		CARingBuffer::TimeBounds* bounds = mTimeBoundsQueue + ( mTimeBoundsQueuePtr & kGeneralRingTimeBoundsQueueMask );
+		const TimeBounds &bounds = mTimeBoundsQueue[generation & kGeneralRingTimeBoundsQueueMask];
+		startTime = bounds.mStartTime.load(std::memory_order_relaxed);
+		endTime = bounds.mEndTime.load(std::memory_order_relaxed);
 		
-		startTime = bounds->mStartTime;
-		endTime = bounds->mEndTime;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		UInt32 latest = mTimeBoundsGeneration.load(std::memory_order_relaxed);
 		
-		if ( bounds->mUpdateCounter == mTimeBoundsQueuePtr ) 
-			return kCARingBufferError_OK;
+		// the slot we read is only rewritten once the writer is a full lap ahead of it
+		if (latest - generation < kGeneralRingTimeBoundsQueueSize - 1)
+			return generation;
+		
+		generation = mTimeBoundsGeneration.load(std::memory_order_acquire);
 	}
-	return kCARingBufferError_CPUOverload;
+}
+
+bool	CARingBuffer::TimeBoundsUnchangedSince(UInt32 generation)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return mTimeBoundsGeneration.load(std::memory_order_relaxed) == generation;
 }
 
 #if 0
@@ -287,7 +568,69 @@ CARingBufferError	CARingBuffer::ClipTimeBounds(SampleTime& startRead, SampleTime
 
 CARingBufferError	CARingBuffer::Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead)
 {
+	return FetchWith(abl, nFrames, startRead, kFetchCopy, NULL);
+}
+
+CARingBufferError	CARingBuffer::FetchScaled(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead, const Float32 *gains)
+{
+	return FetchWith(abl, nFrames, startRead, kFetchScaled, gains);
+}
+
+CARingBufferError	CARingBuffer::FetchMix(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead, const Float32 *gains)
+{
+	return FetchWith(abl, nFrames, startRead, kFetchMix, gains);
+}
+
+CARingBufferError	CARingBuffer::FetchWith(AudioBufferList *abl, UInt32 nFrames, SampleTime startRead, FetchMode mode, const Float32 *gains)
+{
+	// each span of the ring, copied, or through the gains
+	auto fetch = [&](int destOffset, int srcOffset, int nbytes) {
+		if (mode == kFetchCopy)
+			FetchABL(abl, destOffset, mBuffers, srcOffset, nbytes, mConversion);
+		else
+			FetchGainABL(abl, destOffset, mBuffers, srcOffset, nbytes, mConversion, mode == kFetchMix, gains, mNumberChannels);
+	};
+	
+	// with no frames the offsets below would be the same, which reads as the whole ring
+	if (nFrames == 0)
+		return kCARingBufferError_OK;
+	
 	SampleTime endRead = startRead + nFrames;
+	
+	// Fast path: the whole range is in the buffer, so there is nothing to clip or zero.
+	// One snapshot of the bounds up front, and a generation compare after the copy to
+	// catch the writer having moved the start time past what we were reading.
+	SampleTime startTime, endTime;
+	UInt32 generation = SnapshotTimeBounds(startTime, endTime);
+	if (startRead >= startTime && endRead <= endTime) {
+		int offset0 = FrameOffset(startRead);
+		int offset1 = FrameOffset(endRead);
+		int nbytes = nFrames * mBytesPerFrame;
+		
+		if (offset0 < offset1 || mMirror)
+			fetch(0, offset0, nbytes);
+		else {
+			int nbytes0 = mCapacityBytes - offset0;
+			fetch(0,       offset0, nbytes0);
+			fetch(nbytes0, 0,       offset1);
+		}
+		
+		int nchannels = abl->mNumberBuffers;
+		AudioBuffer *dest = abl->mBuffers;
+		UInt32 clientBytes = mConversion.ClientBytes(nbytes);
+		while (--nchannels >= 0) {
+			dest->mDataByteSize = clientBytes;
+			dest++;
+		}
+		
+		if (TimeBoundsUnchangedSince(generation))
+			return kCARingBufferError_OK;
+		
+		// the writer has been busy; what we copied is only good if it is still in the buffer
+		return ClipTimeBounds(startRead, endRead);
+	}
+	
+	// Slow path: part or all of the range is outside the buffer.
 
 	SampleTime startRead0 = startRead;
 	SampleTime endRead0 = endRead;
@@ -299,37 +642,41 @@ CARingBufferError	CARingBuffer::Fetch(AudioBufferList *abl, UInt32 nFrames, Samp
     }
 	
 	SInt32 destStartFrameOffset = startRead - startRead0; 
-	if ( destStartFrameOffset > 0 ) {
+	// zero what isn't in the ring; mixed in, it adds nothing
+	if ( destStartFrameOffset > 0 && mode != kFetchMix ) {
         CARB_DEBUG( "Fetch - Zeroing start bound\n" );
-		ZeroABL(abl, 0, destStartFrameOffset * mBytesPerFrame);
+		ZeroABL(abl, 0, destStartFrameOffset * mBytesPerFrame, mConversion);
 	}
 
 	SInt32 destEndSize = endRead0 - endRead; 
-	if ( destEndSize > 0 ) {
+	if ( destEndSize > 0 && mode != kFetchMix ) {
         CARB_DEBUG( "Fetch - Zeroing end bound (%ld frames off)\n", destEndSize );
-		ZeroABL(abl, ( destStartFrameOffset + readSizeFrames ) * mBytesPerFrame, destEndSize * mBytesPerFrame);
+		ZeroABL(abl, ( destStartFrameOffset + readSizeFrames ) * mBytesPerFrame, destEndSize * mBytesPerFrame, mConversion);
 	}
 	
-	Byte **buffers = mBuffers;
 	int offset0 = FrameOffset(startRead);
 	int offset1 = FrameOffset(endRead);
     int destStartByteOffset = destStartFrameOffset * mBytesPerFrame;
 	int nbytes;
     
-	if ( offset0 < offset1 ) {
+	if ( mMirror ) {
+		nbytes = (endRead - startRead) * mBytesPerFrame;
+		fetch( destStartByteOffset         , offset0, nbytes  );
+	} else if ( offset0 < offset1 ) {
         nbytes = offset1 - offset0;
-		FetchABL( abl, destStartByteOffset         , buffers, offset0, nbytes );
+		fetch( destStartByteOffset         , offset0, nbytes  );
 	} else {
 		nbytes = mCapacityBytes - offset0;
-		FetchABL( abl, destStartByteOffset         , buffers, offset0, nbytes  );
-		FetchABL( abl, destStartByteOffset + nbytes, buffers, 0      , offset1 );
+		fetch( destStartByteOffset         , offset0, nbytes  );
+		fetch( destStartByteOffset + nbytes, 0      , offset1 );
 		nbytes += offset1;
 	}
 
 	int nchannels = abl->mNumberBuffers;
 	AudioBuffer *dest = abl->mBuffers;
+	UInt32 clientBytes = mConversion.ClientBytes(nbytes);
 	while (--nchannels >= 0) {
-		dest->mDataByteSize = nbytes;
+		dest->mDataByteSize = clientBytes;
 		dest++;
 	}
     
@@ -48,6 +48,9 @@
 #ifndef CARingBuffer_Header
 #define CARingBuffer_Header
 
+#include "CASampleConversion.h"
+#include <atomic>
+
 enum {
 	kCARingBufferError_WayBehind = -2, // both fetch times are earlier than buffer start time
 	kCARingBufferError_SlightlyBehind = -1, // fetch start time is earlier than buffer start time (fetch end time OK)
@@ -55,7 +58,7 @@ enum {
 	kCARingBufferError_SlightlyAhead = 1, // fetch end time is later than buffer end time (fetch start time OK)
 	kCARingBufferError_WayAhead = 2, // both fetch times are later than buffer end time
 	kCARingBufferError_TooMuch = 3, // fetch start time is earlier than buffer start time and fetch end time is later than buffer end time
-	kCARingBufferError_CPUOverload = 4 // the reader is unable to get enough CPU cycles to capture a consistent snapshot of the time bounds
+	kCARingBufferError_CPUOverload = 4 // no longer returned; the time bounds can always be read consistently
 };
 
 typedef SInt32 CARingBufferError;
@@ -63,17 +66,63 @@ typedef SInt32 CARingBufferError;
 const UInt32 kGeneralRingTimeBoundsQueueSize = 32;
 const UInt32 kGeneralRingTimeBoundsQueueMask = kGeneralRingTimeBoundsQueueSize - 1;
 
+const size_t kCARingBufferCacheLineSize = 64;
+
+// How samples move between the ring and a client AudioBufferList. With no converter the
+// bytes are copied as they are; otherwise the client side is Float32 and the ring holds
+// mSampleBytes per sample. Offsets and sizes passed around Store/Fetch are always in ring
+// bytes; ClientBytes() gives the matching size on the AudioBufferList side.
+struct CARingBufferSampleConversion {
+	CAConvertFromFloat32Proc	mFromFloat32;
+	CAConvertToFloat32Proc		mToFloat32;
+	UInt32						mSampleBytes;
+	CAScaleFloat32Proc			mScale;			// for FetchScaled and FetchMix, whatever the ring holds
+	CAMixFloat32Proc			mMix;
+	
+	UInt32		ClientBytes(UInt32 ringBytes) const { return mFromFloat32 ? ringBytes / mSampleBytes * sizeof(Float32) : ringBytes; }
+};
+
 class CARingBuffer {
 public:
 	typedef SInt64 SampleTime;
+	
+	enum Layout {
+		kDeinterleaved,		// one buffer per channel; Store/Fetch take one AudioBuffer per channel
+		kInterleaved		// one buffer of interleaved frames; Store/Fetch take a single interleaved AudioBuffer
+	};
+	
+	enum {
+		kAllocateMirrored = (1 << 0),	// map each buffer twice, back to back, so no range ever has to be
+										// split at the end of the ring. The capacity is rounded up further to
+										// a whole number of pages. Falls back to an ordinary allocation where
+										// the platform can't do it; check IsMirrored().
+		kAllocateHugePages = (1 << 1),	// back the buffers with explicit huge pages if any are reserved,
+										// otherwise ask for transparent huge pages
+		kAllocateLocked = (1 << 2)		// mlock the buffers so the real-time thread never page-faults on
+										// them; needs a large enough RLIMIT_MEMLOCK
+	};
 
 	CARingBuffer();
 	~CARingBuffer();
 	
-	void					Allocate(int nChannels, UInt32 bytesPerFrame, UInt32 capacityFrames);
+	void					Allocate(int nChannels, UInt32 bytesPerFrame, UInt32 capacityFrames, Layout layout = kDeinterleaved, UInt32 options = 0, int numaNode = -1);
 								// capacityFrames will be rounded up to a power of 2
+								// bytesPerFrame is for one channel, whatever the layout
+								// numaNode >= 0 binds the buffers to that node
+								// Every page is faulted in before Allocate returns. Each option is best
+								// effort; GetAllocationOptions() and GetNUMANode() report what took effect.
+	void					Allocate(int nChannels, CASampleFormat storedFormat, UInt32 capacityFrames, Layout layout = kDeinterleaved, UInt32 options = 0, int numaNode = -1);
+								// Store and Fetch take Float32 AudioBufferLists and convert to and from
+								// storedFormat on the way in and out, so the ring can be kept in a device's
+								// native integer format
 	void					Deallocate();
 	
+	bool					IsInterleaved() const { return mNumberBuffers == 1 && mNumberChannels > 1; }
+	bool					IsMirrored() const { return mMirror != NULL; }
+	UInt32					GetAllocationOptions() const { return mAllocationOptions; }
+	int						GetNUMANode() const { return mNUMANode; }	// -1 if not bound
+	UInt32					GetCapacityFrames() const { return mCapacityFrames; }
+	
 	CARingBufferError	Store(const AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber);
 							// Copy nFrames of data into the ring buffer at the specified sample time.
 							// The sample time should normally increase sequentially, though gaps
@@ -87,36 +136,102 @@ public:
 	CARingBufferError	Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber);
 								// will alter mNumDataBytes of the buffers
 	
+	// Fetch, with a gain per channel applied on the way out, for rings of Float32 samples, whether
+	// stored as such or converted. gains has one per channel, interleaved or not. Each sample is
+	// read from the ring and written to abl once, where a Fetch and a second pass over abl would
+	// touch abl twice; the range is clipped, split at the wrap and checked against the writer
+	// exactly as Fetch does it, and returns the same errors.
+	
+	CARingBufferError	FetchScaled(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber, const Float32 *gains);
+								// abl = gain * ring. Frames outside the ring are zeroed, as by Fetch.
+	CARingBufferError	FetchMix(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber, const Float32 *gains);
+								// abl += gain * ring, summing one more source into what abl holds. Frames
+								// outside the ring add nothing, and a channel at 0 isn't read at all.
+	
 	CARingBufferError	GetTimeBounds(SampleTime &startTime, SampleTime &endTime);
+								// Lock-free and safe to call from any thread while another thread is
+								// in Store. Always returns kCARingBufferError_OK.
+	
+	// Zero-copy access. Instead of copying through an AudioBufferList of its own, the caller
+	// is handed the ring memory itself as up to two spans per buffer: head, and tail when the
+	// range wraps past the end of the ring (tail buffers get mDataByteSize 0 otherwise). Both
+	// lists need room for as many buffers as the ring has; their mNumberBuffers, mData and
+	// mDataByteSize are overwritten. The spans are in the ring's stored format, so with a
+	// converting ring the caller reads and writes the stored samples directly. A mirrored
+	// ring always returns the whole range as the head.
+	
+	CARingBufferError	BeginStore(UInt32 nFrames, SampleTime frameNumber, AudioBufferList *head, AudioBufferList *tail, UInt32 &headFrames);
+								// Prepares the ring for nFrames at frameNumber exactly as Store would
+								// (moving the start time, zeroing a gap) and returns where to write them.
+								// Write the frames, then call EndStore with the same arguments. If the
+								// frames cannot be produced, just don't call EndStore.
+	void				EndStore(UInt32 nFrames, SampleTime frameNumber);
+								// publishes frames written after BeginStore
+	
+	CARingBufferError	BeginFetch(UInt32 nFrames, SampleTime frameNumber, AudioBufferList *head, AudioBufferList *tail, UInt32 &headFrames);
+								// Returns the spans holding nFrames at frameNumber. Only succeeds when the
+								// whole range is in the buffer; otherwise returns the same error Fetch
+								// would and sets headFrames to 0, and the caller should use Fetch.
+	CARingBufferError	EndFetch(UInt32 nFrames, SampleTime frameNumber);
+								// Call once done reading the spans. Returns an error if the writer
+								// overwrote any of the range in the meantime.
 	
 protected:
+	enum FetchMode {
+		kFetchCopy,
+		kFetchScaled,
+		kFetchMix
+	};
 
 	int						FrameOffset(SampleTime frameNumber) { return (frameNumber & mCapacityFramesMask) * mBytesPerFrame; }
+	
 
 	CARingBufferError		ClipTimeBounds(SampleTime& startRead, SampleTime& endRead);
+	CARingBufferError		FetchWith(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber, FetchMode mode, const Float32 *gains);
+	CARingBufferError		PrepareStore(UInt32 framesToWrite, SampleTime startWrite);
+	UInt32					GetSpans(SampleTime startTime, UInt32 nFrames, AudioBufferList *head, AudioBufferList *tail);
+	UInt32					SnapshotTimeBounds(SampleTime &startTime, SampleTime &endTime);
+								// like GetTimeBounds, also returns the generation the bounds were read at
+	bool					TimeBoundsUnchangedSince(UInt32 generation);
+								// true if no bounds were published since the snapshot; call after reading sample data
 	
 	// these should only be called from Store.
-	SampleTime				StartTime() const { return mTimeBoundsQueue[mTimeBoundsQueuePtr & kGeneralRingTimeBoundsQueueMask].mStartTime; }
-	SampleTime				EndTime()   const { return mTimeBoundsQueue[mTimeBoundsQueuePtr & kGeneralRingTimeBoundsQueueMask].mEndTime; }
+	SampleTime				StartTime() const { return mWriterStartTime; }
+	SampleTime				EndTime()   const { return mWriterEndTime; }
 	void					SetTimeBounds(SampleTime startTime, SampleTime endTime);
 	
 protected:
-	Byte **					mBuffers;				// allocated in one chunk of memory
+	Byte **					mBuffers;				// allocated in one chunk of memory, unless mirrored
+	Byte *					mMirror;				// the mirrored mapping mBuffers point into, or NULL
+	Byte *					mPages;					// or the plain mapping they point into, or NULL
+	size_t					mPagesBytes;
+	UInt32					mAllocationOptions;		// the options that took effect
+	int						mNUMANode;
 	int						mNumberChannels;
-	UInt32					mBytesPerFrame;			// within one deinterleaved channel
+	int						mNumberBuffers;			// mNumberChannels, or 1 when interleaved
+	UInt32					mBytesPerFrame;			// within one buffer: one channel, or all channels when interleaved
 	UInt32					mCapacityFrames;		// per channel, must be a power of 2
 	UInt32					mCapacityFramesMask;
 	UInt32					mCapacityBytes;			// per channel
+	CARingBufferSampleConversion mConversion;
+	
+	// The time bounds are published through a queue of slots. The writer fills in the
+	// slot after the current one and then releases the new generation; a reader
+	// acquires the generation, copies that slot and checks that the writer has not
+	// lapped the queue while it was copying. The writer never waits on readers, and a
+	// reader only has to retry if the writer completed a whole lap of the queue under it.
+	struct alignas(kCARingBufferCacheLineSize) TimeBounds {
+		std::atomic<SampleTime>	mStartTime;
+		std::atomic<SampleTime>	mEndTime;
+	};
 	
-	// range of valid sample time in the buffer
-	typedef struct {
-		volatile SampleTime		mStartTime;
-		volatile SampleTime		mEndTime;
-		volatile UInt32			mUpdateCounter;
-	} TimeBounds;
+	// writer-only copy of the current bounds, so Store never reads the shared slots
+	alignas(kCARingBufferCacheLineSize) SampleTime mWriterStartTime;
+	SampleTime				mWriterEndTime;
+	UInt32					mWriterGeneration;
 	
-	CARingBuffer::TimeBounds mTimeBoundsQueue[kGeneralRingTimeBoundsQueueSize];
-	UInt32 mTimeBoundsQueuePtr;
+	alignas(kCARingBufferCacheLineSize) std::atomic<UInt32> mTimeBoundsGeneration;
+	TimeBounds				mTimeBoundsQueue[kGeneralRingTimeBoundsQueueSize];
 };
 
 
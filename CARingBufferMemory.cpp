@@ -0,0 +1,198 @@
+/*=============================================================================
+	CARingBufferMemory.cpp
+	
+=============================================================================*/
+
+#include "CARingBufferMemory.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+	#include <sys/syscall.h>
+	#if defined(MFD_CLOEXEC)
+		#define CARB_MIRROR_MEMFD 1
+	#endif
+#elif defined(__APPLE__)
+	#include <mach/mach.h>
+	#define CARB_MIRROR_MACH 1
+#endif
+
+size_t	CARingBufferPageSize()
+{
+	static const size_t pageSize = sysconf(_SC_PAGESIZE);
+	return pageSize;
+}
+
+#if CARB_MIRROR_MEMFD
+
+// One memfd holds every buffer; each buffer's pages are mapped into both halves of
+// its own slot in a reservation twice the size.
+Byte *	CARingBufferMapMirrored(size_t bufferBytes, int nBuffers)
+{
+	if (bufferBytes == 0 || bufferBytes % CARingBufferPageSize() != 0)
+		return NULL;
+	
+	int fd = memfd_create("CARingBuffer", MFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	
+	Byte *mapping = NULL;
+	if (ftruncate(fd, bufferBytes * nBuffers) == 0) {
+		void *reserved = mmap(NULL, 2 * bufferBytes * nBuffers, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (reserved != MAP_FAILED) {
+			mapping = (Byte *)reserved;
+			for (int i = 0; i < nBuffers && mapping; ++i) {
+				Byte *slot = mapping + 2 * i * bufferBytes;
+				off_t offset = off_t(i) * bufferBytes;
+				if (mmap(slot,               bufferBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED
+				 || mmap(slot + bufferBytes, bufferBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+					munmap(reserved, 2 * bufferBytes * nBuffers);
+					mapping = NULL;
+				}
+			}
+		}
+	}
+	close(fd);	// the mappings keep the memory alive
+	return mapping;
+}
+
+void	CARingBufferUnmapMirrored(Byte *mapping, size_t bufferBytes, int nBuffers)
+{
+	munmap(mapping, 2 * bufferBytes * nBuffers);
+}
+
+#elif CARB_MIRROR_MACH
+
+// Allocate both halves of every slot, then replace each upper half with a remapping
+// of the lower one.
+Byte *	CARingBufferMapMirrored(size_t bufferBytes, int nBuffers)
+{
+	if (bufferBytes == 0 || bufferBytes % CARingBufferPageSize() != 0)
+		return NULL;
+	
+	vm_size_t totalBytes = 2 * bufferBytes * nBuffers;
+	vm_address_t mapping;
+	if (vm_allocate(mach_task_self(), &mapping, totalBytes, VM_FLAGS_ANYWHERE) != KERN_SUCCESS)
+		return NULL;
+	
+	for (int i = 0; i < nBuffers; ++i) {
+		vm_address_t lower = mapping + 2 * i * bufferBytes;
+		vm_address_t upper = lower + bufferBytes;
+		vm_prot_t curProtection, maxProtection;
+		if (vm_deallocate(mach_task_self(), upper, bufferBytes) != KERN_SUCCESS
+		 || vm_remap(mach_task_self(), &upper, bufferBytes, 0, VM_FLAGS_FIXED, mach_task_self(), lower, FALSE,
+					 &curProtection, &maxProtection, VM_INHERIT_DEFAULT) != KERN_SUCCESS
+		 || upper != lower + bufferBytes) {
+			vm_deallocate(mach_task_self(), mapping, totalBytes);
+			return NULL;
+		}
+	}
+	return (Byte *)mapping;
+}
+
+void	CARingBufferUnmapMirrored(Byte *mapping, size_t bufferBytes, int nBuffers)
+{
+	vm_deallocate(mach_task_self(), (vm_address_t)mapping, 2 * bufferBytes * nBuffers);
+}
+
+#else
+
+Byte *	CARingBufferMapMirrored(size_t, int)
+{
+	return NULL;
+}
+
+void	CARingBufferUnmapMirrored(Byte *, size_t, int)
+{
+}
+
+#endif
+
+// returns 0 where explicit huge pages aren't available
+static size_t	HugePageSize()
+{
+#if defined(__linux__) && defined(MAP_HUGETLB)
+	static const size_t hugePageSize = [] {
+		size_t kb = 0;
+		if (FILE *meminfo = fopen("/proc/meminfo", "r")) {
+			char line[128];
+			while (fgets(line, sizeof(line), meminfo))
+				if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+					break;
+			fclose(meminfo);
+		}
+		return kb * 1024;
+	}();
+	return hugePageSize;
+#else
+	return 0;
+#endif
+}
+
+Byte *	CARingBufferMapPages(size_t &bytes, bool &hugeTLB)
+{
+#if defined(MAP_HUGETLB)
+	size_t hugePageSize = HugePageSize();
+	if (hugeTLB && hugePageSize) {
+		size_t hugeBytes = (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+		void *pages = mmap(NULL, hugeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (pages != MAP_FAILED) {
+			bytes = hugeBytes;
+			return (Byte *)pages;
+		}
+	}
+#endif
+	hugeTLB = false;
+	size_t pageSize = CARingBufferPageSize();
+	bytes = (bytes + pageSize - 1) / pageSize * pageSize;
+	void *pages = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (pages != MAP_FAILED) ? (Byte *)pages : NULL;
+}
+
+void	CARingBufferUnmapPages(Byte *pages, size_t bytes)
+{
+	munmap(pages, bytes);
+}
+
+bool	CARingBufferAdviseHugePages(Byte *pages, size_t bytes)
+{
+#if defined(MADV_HUGEPAGE)
+	return madvise(pages, bytes, MADV_HUGEPAGE) == 0;
+#else
+	(void)pages; (void)bytes;
+	return false;
+#endif
+}
+
+bool	CARingBufferBindToNUMANode(Byte *pages, size_t bytes, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	// from <numaif.h>, which would pull in libnuma
+	const int kMPOL_BIND = 2;
+	const unsigned kMPOL_MF_MOVE = 1 << 1;
+	
+	unsigned long nodeMask[16] = { 0 };
+	const int kMaxNodes = sizeof(nodeMask) * 8;
+	if (node < 0 || node >= kMaxNodes)
+		return false;
+	nodeMask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+	return syscall(SYS_mbind, pages, bytes, kMPOL_BIND, nodeMask, kMaxNodes + 1, kMPOL_MF_MOVE) == 0;
+#else
+	(void)pages; (void)bytes; (void)node;
+	return false;
+#endif
+}
+
+bool	CARingBufferLockPages(Byte *pages, size_t bytes)
+{
+	return mlock(pages, bytes) == 0;
+}
+
+void	CARingBufferTouchPages(Byte *pages, size_t bytes)
+{
+	size_t pageSize = CARingBufferPageSize();
+	for (size_t offset = 0; offset < bytes; offset += pageSize)
+		((volatile Byte *)pages)[offset] = pages[offset];
+}
@@ -0,0 +1,51 @@
+/*=============================================================================
+	CARingBufferMemory.h
+	
+	Virtual memory helpers for CARingBuffer.
+	
+	The placement helpers let a ring be backed by huge pages, bound to a NUMA
+	node and locked into memory so that the real-time thread never takes a
+	page fault on it. Each returns false where the platform or the process's
+	limits don't allow it, and the ring carries on without.
+	
+	A mirrored allocation maps each buffer's pages twice, back to back, so that
+	buffer[capacity + i] is the same byte as buffer[i]. Any range of up to one
+	capacity starting inside the buffer is then contiguous, and the ring never
+	has to split a copy at its end.
+=============================================================================*/
+
+#ifndef __CARingBufferMemory_h__
+#define __CARingBufferMemory_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+#include <stddef.h>
+
+size_t		CARingBufferPageSize();
+
+Byte *		CARingBufferMapMirrored(size_t bufferBytes, int nBuffers);
+				// Returns nBuffers zeroed buffers of bufferBytes each, buffer i starting at
+				// result + 2 * i * bufferBytes and mapped twice. bufferBytes must be a multiple
+				// of the page size. Returns NULL if the platform can't do it.
+void		CARingBufferUnmapMirrored(Byte *mapping, size_t bufferBytes, int nBuffers);
+
+Byte *		CARingBufferMapPages(size_t &bytes, bool &hugeTLB);
+				// Page-aligned, zeroed anonymous memory; bytes is rounded up to whole pages. With
+				// hugeTLB, tries explicit huge pages first and clears hugeTLB if it had to fall
+				// back to ordinary pages. Returns NULL on failure.
+void		CARingBufferUnmapPages(Byte *pages, size_t bytes);
+
+bool		CARingBufferAdviseHugePages(Byte *pages, size_t bytes);
+				// asks for transparent huge pages
+bool		CARingBufferBindToNUMANode(Byte *pages, size_t bytes, int node);
+				// call before the pages are first touched
+bool		CARingBufferLockPages(Byte *pages, size_t bytes);
+				// wires the pages, faulting them all in
+void		CARingBufferTouchPages(Byte *pages, size_t bytes);
+				// faults every page in without changing its contents
+
+#endif // __CARingBufferMemory_h__
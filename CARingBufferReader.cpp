@@ -0,0 +1,70 @@
+/*=============================================================================
+	CARingBufferReader.cpp
+	
+=============================================================================*/
+
+#include "CARingBufferReader.h"
+
+CARingBufferReader::CARingBufferReader(CARingBuffer &ring, SampleTime offset) :
+	mRing(ring), mOffset(offset), mHasFetched(false), mPosition(0),
+	mFetches(0), mFramesFetched(0), mUnderruns(0), mOverruns(0), mDiscontinuities(0)
+{
+}
+
+// Only the reading thread writes the counters, so a relaxed load and store is
+// enough to keep them readable from elsewhere.
+static inline void Increment(std::atomic<UInt64> &counter, UInt64 n = 1)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+CARingBufferError	CARingBufferReader::Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber)
+{
+	SampleTime ringTime = frameNumber - mOffset;
+	if (mHasFetched && ringTime != mPosition.load(std::memory_order_relaxed))
+		Increment(mDiscontinuities);
+	mHasFetched = true;
+	
+	CARingBufferError err = mRing.Fetch(abl, nFrames, ringTime);
+	
+	Increment(mFetches);
+	switch (err) {
+	case kCARingBufferError_OK:
+		Increment(mFramesFetched, nFrames);
+		break;
+	case kCARingBufferError_SlightlyAhead:
+	case kCARingBufferError_WayAhead:
+		Increment(mUnderruns);
+		break;
+	case kCARingBufferError_SlightlyBehind:
+	case kCARingBufferError_WayBehind:
+	case kCARingBufferError_TooMuch:
+		Increment(mOverruns);
+		break;
+	}
+	mPosition.store(ringTime + nFrames, std::memory_order_relaxed);
+	return err;
+}
+
+CARingBufferError	CARingBufferReader::FetchNext(AudioBufferList *abl, UInt32 nFrames)
+{
+	return Fetch(abl, nFrames, mPosition.load(std::memory_order_relaxed) + mOffset);
+}
+
+void	CARingBufferReader::GetStats(CARingBufferReaderStats &stats) const
+{
+	stats.mFetches = mFetches.load(std::memory_order_relaxed);
+	stats.mFramesFetched = mFramesFetched.load(std::memory_order_relaxed);
+	stats.mUnderruns = mUnderruns.load(std::memory_order_relaxed);
+	stats.mOverruns = mOverruns.load(std::memory_order_relaxed);
+	stats.mDiscontinuities = mDiscontinuities.load(std::memory_order_relaxed);
+}
+
+void	CARingBufferReader::ResetStats()
+{
+	mFetches.store(0, std::memory_order_relaxed);
+	mFramesFetched.store(0, std::memory_order_relaxed);
+	mUnderruns.store(0, std::memory_order_relaxed);
+	mOverruns.store(0, std::memory_order_relaxed);
+	mDiscontinuities.store(0, std::memory_order_relaxed);
+}
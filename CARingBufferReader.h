@@ -0,0 +1,69 @@
+/*=============================================================================
+	CARingBufferReader.h
+	
+	One consumer of a CARingBuffer.
+	
+	A CARingBuffer can be fetched from by any number of threads at once: Fetch
+	never writes to the ring, so readers neither block the writer nor each
+	other, and the input is stored once however many consumers there are. A
+	CARingBufferReader adds what each consumer needs on top of that: its own
+	sample-time offset from the writer, its own read position, and its own
+	count of underruns and overruns. Give every consumer its own reader.
+	
+	Only the reading thread calls Fetch, FetchNext, Seek, SetOffset and
+	ResetStats.
+	GetPosition and GetStats can be called from any thread.
+=============================================================================*/
+
+#ifndef __CARingBufferReader_h__
+#define __CARingBufferReader_h__
+
+#include "CARingBuffer.h"
+
+#include <atomic>
+
+struct CARingBufferReaderStats {
+	UInt64		mFetches;
+	UInt64		mFramesFetched;		// by fetches that returned kCARingBufferError_OK
+	UInt64		mUnderruns;			// fetches that got ahead of the writer
+	UInt64		mOverruns;			// fetches the writer had already overwritten some of
+	UInt64		mDiscontinuities;	// fetches that did not start where the previous one ended
+};
+
+class CARingBufferReader {
+public:
+	typedef CARingBuffer::SampleTime SampleTime;
+	
+	CARingBufferReader(CARingBuffer &ring, SampleTime offset = 0);
+	
+	CARingBufferError	Fetch(AudioBufferList *abl, UInt32 nFrames, SampleTime frameNumber);
+							// Fetches from the ring at frameNumber - offset. Errors are those of
+							// CARingBuffer::Fetch: the Ahead errors count as underruns, the Behind
+							// errors and TooMuch as overruns.
+	CARingBufferError	FetchNext(AudioBufferList *abl, UInt32 nFrames);
+							// fetches the nFrames following the previous fetch
+	
+	void				Seek(SampleTime ringTime) { mPosition.store(ringTime, std::memory_order_relaxed); }
+	SampleTime			GetPosition() const { return mPosition.load(std::memory_order_relaxed); }
+							// ring sample time the next FetchNext starts at
+	
+	void				SetOffset(SampleTime offset) { mOffset = offset; }
+	SampleTime			GetOffset() const { return mOffset; }
+	
+	void				GetStats(CARingBufferReaderStats &stats) const;
+	void				ResetStats();
+	
+private:
+	CARingBuffer &				mRing;
+	SampleTime					mOffset;
+	bool						mHasFetched;
+	
+	std::atomic<SampleTime>		mPosition;
+	std::atomic<UInt64>			mFetches;
+	std::atomic<UInt64>			mFramesFetched;
+	std::atomic<UInt64>			mUnderruns;
+	std::atomic<UInt64>			mOverruns;
+	std::atomic<UInt64>			mDiscontinuities;
+};
+
+#endif // __CARingBufferReader_h__
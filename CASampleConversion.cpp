@@ -0,0 +1,480 @@
+/*=============================================================================
+	CASampleConversion.cpp
+
+=============================================================================*/
+
+#include "CASampleConversion.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define CASC_X86 1
+	#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+	#define CASC_NEON 1
+	#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Largest Float32 below 2^31; anything at or above it would overflow the conversion.
+const Float32 kInt32Max = 2147483520.0f;
+
+const Float32 kInt16Scale = 32768.0f;
+const Float32 kInt24Scale = 8388608.0f;
+const Float32 kInt32Scale = 2147483648.0f;
+
+inline Float32 Clip(Float32 x, Float32 lo, Float32 hi)
+{
+	if (x < lo) x = lo;
+	if (x > hi) x = hi;
+	return x;
+}
+
+#pragma mark -- Scalar --
+
+void CopyFloat32(const void *src, Float32 *dest, UInt32 n)		{ memcpy(dest, src, n * sizeof(Float32)); }
+void CopyFromFloat32(const Float32 *src, void *dest, UInt32 n)	{ memcpy(dest, src, n * sizeof(Float32)); }
+
+void Float32ToInt16_Scalar(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt16 *d = (SInt16 *)dest;
+	for (UInt32 i = 0; i < n; ++i)
+		d[i] = SInt16(lrintf(Clip(src[i] * kInt16Scale, -32768.0f, 32767.0f)));
+}
+
+void Int16ToFloat32_Scalar(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt16 *s = (const SInt16 *)src;
+	for (UInt32 i = 0; i < n; ++i)
+		dest[i] = Float32(s[i]) * (1.0f / kInt16Scale);
+}
+
+void Float32ToInt24_Scalar(const Float32 *src, void *dest, UInt32 n)
+{
+	Byte *d = (Byte *)dest;
+	for (UInt32 i = 0; i < n; ++i, d += 3) {
+		SInt32 x = SInt32(lrintf(Clip(src[i] * kInt24Scale, -8388608.0f, 8388607.0f)));
+		d[0] = Byte(x);
+		d[1] = Byte(x >> 8);
+		d[2] = Byte(x >> 16);
+	}
+}
+
+void Int24ToFloat32_Scalar(const void *src, Float32 *dest, UInt32 n)
+{
+	const Byte *s = (const Byte *)src;
+	for (UInt32 i = 0; i < n; ++i, s += 3) {
+		SInt32 x = SInt32(UInt32(s[0]) << 8 | UInt32(s[1]) << 16 | UInt32(s[2]) << 24) >> 8;
+		dest[i] = Float32(x) * (1.0f / kInt24Scale);
+	}
+}
+
+void Float32ToInt32_Scalar(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt32 *d = (SInt32 *)dest;
+	for (UInt32 i = 0; i < n; ++i)
+		d[i] = SInt32(lrintf(Clip(src[i] * kInt32Scale, -kInt32Scale, kInt32Max)));
+}
+
+void Int32ToFloat32_Scalar(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt32 *s = (const SInt32 *)src;
+	for (UInt32 i = 0; i < n; ++i)
+		dest[i] = Float32(s[i]) * (1.0f / kInt32Scale);
+}
+
+void ScaleFloat32_Scalar(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	for (UInt32 i = 0; i < n; ++i)
+		dest[i] = src[i] * gain;
+}
+
+void MixFloat32_Scalar(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	for (UInt32 i = 0; i < n; ++i)
+		dest[i] += src[i] * gain;
+}
+
+const CASampleConverter kScalarConverter = {
+	"Scalar",
+	{ CopyFromFloat32, Float32ToInt16_Scalar, Float32ToInt24_Scalar, Float32ToInt32_Scalar },
+	{ CopyFloat32, Int16ToFloat32_Scalar, Int24ToFloat32_Scalar, Int32ToFloat32_Scalar },
+	ScaleFloat32_Scalar,
+	MixFloat32_Scalar
+};
+
+#if CASC_X86
+#pragma mark -- SSE2 --
+
+void Float32ToInt16_SSE2(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt16 *d = (SInt16 *)dest;
+	const __m128 scale = _mm_set1_ps(kInt16Scale), lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), lo), hi);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), lo), hi);
+		_mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+	Float32ToInt16_Scalar(src + i, d + i, n - i);
+}
+
+void Int16ToFloat32_SSE2(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt16 *s = (const SInt16 *)src;
+	const __m128 scale = _mm_set1_ps(1.0f / kInt16Scale);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+		// sign extend by placing each sample in the top half of a 32-bit lane and shifting down
+		__m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(dest + i,     _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+		_mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+	}
+	Int16ToFloat32_Scalar(s + i, dest + i, n - i);
+}
+
+void Float32ToInt32_SSE2(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt32 *d = (SInt32 *)dest;
+	const __m128 scale = _mm_set1_ps(kInt32Scale), lo = _mm_set1_ps(-kInt32Scale), hi = _mm_set1_ps(kInt32Max);
+	UInt32 i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), lo), hi);
+		_mm_storeu_si128((__m128i *)(d + i), _mm_cvtps_epi32(a));
+	}
+	Float32ToInt32_Scalar(src + i, d + i, n - i);
+}
+
+void Int32ToFloat32_SSE2(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt32 *s = (const SInt32 *)src;
+	const __m128 scale = _mm_set1_ps(1.0f / kInt32Scale);
+	UInt32 i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(s + i))), scale));
+	Int32ToFloat32_Scalar(s + i, dest + i, n - i);
+}
+
+void ScaleFloat32_SSE2(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm_storeu_ps(dest + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+		_mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_loadu_ps(src + i + 4), g));
+	}
+	ScaleFloat32_Scalar(src + i, dest + i, gain, n - i);
+}
+
+void MixFloat32_SSE2(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+		_mm_storeu_ps(dest + i + 4, _mm_add_ps(_mm_loadu_ps(dest + i + 4), _mm_mul_ps(_mm_loadu_ps(src + i + 4), g)));
+	}
+	MixFloat32_Scalar(src + i, dest + i, gain, n - i);
+}
+
+// SSE2 has no byte shuffle, so packed 24-bit stays scalar here; the AVX2 kernels handle it.
+const CASampleConverter kSSE2Converter = {
+	"SSE2",
+	{ CopyFromFloat32, Float32ToInt16_SSE2, Float32ToInt24_Scalar, Float32ToInt32_SSE2 },
+	{ CopyFloat32, Int16ToFloat32_SSE2, Int24ToFloat32_Scalar, Int32ToFloat32_SSE2 },
+	ScaleFloat32_SSE2,
+	MixFloat32_SSE2
+};
+
+#pragma mark -- AVX2 --
+
+#define CASC_AVX2 __attribute__((target("avx2")))
+
+CASC_AVX2 void Float32ToInt16_AVX2(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt16 *d = (SInt16 *)dest;
+	const __m256 scale = _mm256_set1_ps(kInt16Scale), lo = _mm256_set1_ps(-32768.0f), hi = _mm256_set1_ps(32767.0f);
+	UInt32 i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), lo), hi);
+		__m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale), lo), hi);
+		// packs works within 128-bit lanes, so put the quadwords back in order afterwards
+		__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		_mm256_storeu_si256((__m256i *)(d + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	Float32ToInt16_SSE2(src + i, d + i, n - i);
+}
+
+CASC_AVX2 void Int16ToFloat32_AVX2(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt16 *s = (const SInt16 *)src;
+	const __m256 scale = _mm256_set1_ps(1.0f / kInt16Scale);
+	UInt32 i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(s + i)));
+		__m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(s + i + 8)));
+		_mm256_storeu_ps(dest + i,     _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+		_mm256_storeu_ps(dest + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+	}
+	Int16ToFloat32_SSE2(s + i, dest + i, n - i);
+}
+
+CASC_AVX2 void Float32ToInt24_AVX2(const Float32 *src, void *dest, UInt32 n)
+{
+	Byte *d = (Byte *)dest;
+	const __m256 scale = _mm256_set1_ps(kInt24Scale), lo = _mm256_set1_ps(-8388608.0f), hi = _mm256_set1_ps(8388607.0f);
+	// drop the top byte of each 32-bit sample, packing four samples into the low 12 bytes of each lane
+	const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+										  0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8, d += 24) {
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), lo), hi);
+		__m256i packed = _mm256_shuffle_epi8(_mm256_cvtps_epi32(a), pack);
+		__m128i lane0 = _mm256_castsi256_si128(packed);
+		__m128i lane1 = _mm256_extracti128_si256(packed, 1);
+		SInt32 tail0 = _mm_cvtsi128_si32(_mm_srli_si128(lane0, 8));
+		SInt32 tail1 = _mm_cvtsi128_si32(_mm_srli_si128(lane1, 8));
+		_mm_storel_epi64((__m128i *)d, lane0);
+		memcpy(d + 8, &tail0, 4);
+		_mm_storel_epi64((__m128i *)(d + 12), lane1);
+		memcpy(d + 20, &tail1, 4);
+	}
+	Float32ToInt24_Scalar(src + i, d, n - i);
+}
+
+CASC_AVX2 void Int24ToFloat32_AVX2(const void *src, Float32 *dest, UInt32 n)
+{
+	const Byte *s = (const Byte *)src;
+	const __m256 scale = _mm256_set1_ps(1.0f / kInt24Scale);
+	// move each 3-byte sample into the top of a 32-bit lane; the arithmetic shift then sign extends it
+	const __m256i unpack = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+											-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	UInt32 i = 0;
+	// each iteration loads 16 bytes at s + 12, so stop while 28 bytes are still in range
+	for (; i + 10 <= n; i += 8, s += 24) {
+		__m128i lane0 = _mm_loadu_si128((const __m128i *)s);
+		__m128i lane1 = _mm_loadu_si128((const __m128i *)(s + 12));
+		__m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lane0), lane1, 1);
+		x = _mm256_srai_epi32(_mm256_shuffle_epi8(x, unpack), 8);
+		_mm256_storeu_ps(dest + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+	Int24ToFloat32_Scalar(s, dest + i, n - i);
+}
+
+CASC_AVX2 void Float32ToInt32_AVX2(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt32 *d = (SInt32 *)dest;
+	const __m256 scale = _mm256_set1_ps(kInt32Scale), lo = _mm256_set1_ps(-kInt32Scale), hi = _mm256_set1_ps(kInt32Max);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), lo), hi);
+		_mm256_storeu_si256((__m256i *)(d + i), _mm256_cvtps_epi32(a));
+	}
+	Float32ToInt32_SSE2(src + i, d + i, n - i);
+}
+
+CASC_AVX2 void Int32ToFloat32_AVX2(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt32 *s = (const SInt32 *)src;
+	const __m256 scale = _mm256_set1_ps(1.0f / kInt32Scale);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dest + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(s + i))), scale));
+	Int32ToFloat32_SSE2(s + i, dest + i, n - i);
+}
+
+CASC_AVX2 void ScaleFloat32_AVX2(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	const __m256 g = _mm256_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 16 <= n; i += 16) {
+		_mm256_storeu_ps(dest + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), g));
+		_mm256_storeu_ps(dest + i + 8, _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), g));
+	}
+	_mm256_zeroupper();		// the tail call isn't given one, and the SSE2 code would stall on the dirty upper halves
+	ScaleFloat32_SSE2(src + i, dest + i, gain, n - i);
+}
+
+// multiply, then add, as the other kernels do, rather than FMA, so that all of them round alike
+CASC_AVX2 void MixFloat32_AVX2(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	const __m256 g = _mm256_set1_ps(gain);
+	UInt32 i = 0;
+	for (; i + 16 <= n; i += 16) {
+		_mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_loadu_ps(dest + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), g)));
+		_mm256_storeu_ps(dest + i + 8, _mm256_add_ps(_mm256_loadu_ps(dest + i + 8), _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), g)));
+	}
+	_mm256_zeroupper();
+	MixFloat32_SSE2(src + i, dest + i, gain, n - i);
+}
+
+const CASampleConverter kAVX2Converter = {
+	"AVX2",
+	{ CopyFromFloat32, Float32ToInt16_AVX2, Float32ToInt24_AVX2, Float32ToInt32_AVX2 },
+	{ CopyFloat32, Int16ToFloat32_AVX2, Int24ToFloat32_AVX2, Int32ToFloat32_AVX2 },
+	ScaleFloat32_AVX2,
+	MixFloat32_AVX2
+};
+#endif // CASC_X86
+
+#if CASC_NEON
+#pragma mark -- NEON --
+
+inline int32x4_t ScaleClipRound(float32x4_t x, float32x4_t scale, float32x4_t lo, float32x4_t hi)
+{
+	return vcvtnq_s32_f32(vminq_f32(vmaxq_f32(vmulq_f32(x, scale), lo), hi));
+}
+
+void Float32ToInt16_NEON(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt16 *d = (SInt16 *)dest;
+	const float32x4_t scale = vdupq_n_f32(kInt16Scale), lo = vdupq_n_f32(-32768.0f), hi = vdupq_n_f32(32767.0f);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int32x4_t a = ScaleClipRound(vld1q_f32(src + i), scale, lo, hi);
+		int32x4_t b = ScaleClipRound(vld1q_f32(src + i + 4), scale, lo, hi);
+		vst1q_s16(d + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+	}
+	Float32ToInt16_Scalar(src + i, d + i, n - i);
+}
+
+void Int16ToFloat32_NEON(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt16 *s = (const SInt16 *)src;
+	const float32x4_t scale = vdupq_n_f32(1.0f / kInt16Scale);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t x = vld1q_s16(s + i);
+		vst1q_f32(dest + i,     vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+		vst1q_f32(dest + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+	}
+	Int16ToFloat32_Scalar(s + i, dest + i, n - i);
+}
+
+void Float32ToInt24_NEON(const Float32 *src, void *dest, UInt32 n)
+{
+	Byte *d = (Byte *)dest;
+	const float32x4_t scale = vdupq_n_f32(kInt24Scale), lo = vdupq_n_f32(-8388608.0f), hi = vdupq_n_f32(8388607.0f);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8, d += 24) {
+		uint32x4_t a = vreinterpretq_u32_s32(ScaleClipRound(vld1q_f32(src + i), scale, lo, hi));
+		uint32x4_t b = vreinterpretq_u32_s32(ScaleClipRound(vld1q_f32(src + i + 4), scale, lo, hi));
+		// split into low, middle and high byte planes; vst3 interleaves them back into packed samples
+		uint8x8x3_t planes;
+		planes.val[0] = vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(b)));
+		planes.val[1] = vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(a, 8)), vmovn_u32(vshrq_n_u32(b, 8))));
+		planes.val[2] = vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(a, 16)), vmovn_u32(vshrq_n_u32(b, 16))));
+		vst3_u8(d, planes);
+	}
+	Float32ToInt24_Scalar(src + i, d, n - i);
+}
+
+inline float32x4_t Int24PlanesToFloat32(uint16x4_t l, uint16x4_t m, uint16x4_t h, float32x4_t scale)
+{
+	uint32x4_t x = vorrq_u32(vshlq_n_u32(vmovl_u16(h), 24), vorrq_u32(vshlq_n_u32(vmovl_u16(m), 16), vshlq_n_u32(vmovl_u16(l), 8)));
+	return vmulq_f32(vcvtq_f32_s32(vshrq_n_s32(vreinterpretq_s32_u32(x), 8)), scale);
+}
+
+void Int24ToFloat32_NEON(const void *src, Float32 *dest, UInt32 n)
+{
+	const Byte *s = (const Byte *)src;
+	const float32x4_t scale = vdupq_n_f32(1.0f / kInt24Scale);
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8, s += 24) {
+		uint8x8x3_t planes = vld3_u8(s);
+		uint16x8_t l = vmovl_u8(planes.val[0]), m = vmovl_u8(planes.val[1]), h = vmovl_u8(planes.val[2]);
+		vst1q_f32(dest + i,     Int24PlanesToFloat32(vget_low_u16(l), vget_low_u16(m), vget_low_u16(h), scale));
+		vst1q_f32(dest + i + 4, Int24PlanesToFloat32(vget_high_u16(l), vget_high_u16(m), vget_high_u16(h), scale));
+	}
+	Int24ToFloat32_Scalar(s, dest + i, n - i);
+}
+
+void Float32ToInt32_NEON(const Float32 *src, void *dest, UInt32 n)
+{
+	SInt32 *d = (SInt32 *)dest;
+	const float32x4_t scale = vdupq_n_f32(kInt32Scale), lo = vdupq_n_f32(-kInt32Scale), hi = vdupq_n_f32(kInt32Max);
+	UInt32 i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_s32(d + i, ScaleClipRound(vld1q_f32(src + i), scale, lo, hi));
+	Float32ToInt32_Scalar(src + i, d + i, n - i);
+}
+
+void Int32ToFloat32_NEON(const void *src, Float32 *dest, UInt32 n)
+{
+	const SInt32 *s = (const SInt32 *)src;
+	const float32x4_t scale = vdupq_n_f32(1.0f / kInt32Scale);
+	UInt32 i = 0;
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dest + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(s + i)), scale));
+	Int32ToFloat32_Scalar(s + i, dest + i, n - i);
+}
+
+void ScaleFloat32_NEON(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		vst1q_f32(dest + i, vmulq_n_f32(vld1q_f32(src + i), gain));
+		vst1q_f32(dest + i + 4, vmulq_n_f32(vld1q_f32(src + i + 4), gain));
+	}
+	ScaleFloat32_Scalar(src + i, dest + i, gain, n - i);
+}
+
+void MixFloat32_NEON(const Float32 *src, Float32 *dest, Float32 gain, UInt32 n)
+{
+	UInt32 i = 0;
+	for (; i + 8 <= n; i += 8) {
+		vst1q_f32(dest + i, vaddq_f32(vld1q_f32(dest + i), vmulq_n_f32(vld1q_f32(src + i), gain)));
+		vst1q_f32(dest + i + 4, vaddq_f32(vld1q_f32(dest + i + 4), vmulq_n_f32(vld1q_f32(src + i + 4), gain)));
+	}
+	MixFloat32_Scalar(src + i, dest + i, gain, n - i);
+}
+
+const CASampleConverter kNEONConverter = {
+	"NEON",
+	{ CopyFromFloat32, Float32ToInt16_NEON, Float32ToInt24_NEON, Float32ToInt32_NEON },
+	{ CopyFloat32, Int16ToFloat32_NEON, Int24ToFloat32_NEON, Int32ToFloat32_NEON },
+	ScaleFloat32_NEON,
+	MixFloat32_NEON
+};
+#endif // CASC_NEON
+
+} // namespace
+
+const CASampleConverter *	CAGetSampleConverter(CASampleConversionISA isa)
+{
+	switch (isa) {
+		case kCASampleConversionISA_Scalar:
+			return &kScalarConverter;
+#if CASC_X86
+		case kCASampleConversionISA_SSE2:
+			return __builtin_cpu_supports("sse2") ? &kSSE2Converter : NULL;
+		case kCASampleConversionISA_AVX2:
+			return __builtin_cpu_supports("avx2") ? &kAVX2Converter : NULL;
+#endif
+#if CASC_NEON
+		case kCASampleConversionISA_NEON:
+			return &kNEONConverter;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+static const CASampleConverter *ChooseBestSampleConverter()
+{
+	const CASampleConverter *best = NULL;
+	for (int isa = kCASampleConversionISA_Count - 1; isa >= 0 && best == NULL; --isa)
+		best = CAGetSampleConverter(CASampleConversionISA(isa));
+	return best;
+}
+
+const CASampleConverter &	CAGetBestSampleConverter()
+{
+	static const CASampleConverter *best = ChooseBestSampleConverter();
+	return *best;
+}
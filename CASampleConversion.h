@@ -0,0 +1,68 @@
+/*=============================================================================
+	CASampleConversion.h
+
+	Conversion between Float32 and packed native-endian integer samples, used
+	by CARingBuffer to keep the ring in a device's integer format.
+
+	Float32 to integer scales by 2^(bits-1), rounds to nearest (ties to even,
+	no dither) and clips. Integer to Float32 scales by 2^-(bits-1). Every
+	kernel produces bit-identical results to the scalar one.
+
+	Alongside them are the gain kernels for CARingBuffer's FetchScaled and
+	FetchMix, which scale Float32 samples, or scale them and add them to
+	what is there. Those multiply and then add, unfused, though a compiler
+	that contracts the scalar loop into FMAs can move its last bit.
+=============================================================================*/
+
+#ifndef __CASampleConversion_h__
+#define __CASampleConversion_h__
+
+#if !defined(__COREAUDIO_USE_FLAT_INCLUDES__)
+	#include <CoreAudio/CoreAudioTypes.h>
+#else
+	#include <CoreAudioTypes.h>
+#endif
+
+enum CASampleFormat {
+	kCASampleFormat_Float32 = 0,
+	kCASampleFormat_Int16 = 1,
+	kCASampleFormat_Int24 = 2,	// packed, 3 bytes per sample
+	kCASampleFormat_Int32 = 3,
+	kCASampleFormat_Count = 4
+};
+
+inline UInt32 CASampleFormatBytes(CASampleFormat format)
+{
+	static const UInt32 kBytes[kCASampleFormat_Count] = { 4, 2, 3, 4 };
+	return kBytes[format];
+}
+
+enum CASampleConversionISA {
+	kCASampleConversionISA_Scalar = 0,
+	kCASampleConversionISA_SSE2,
+	kCASampleConversionISA_AVX2,
+	kCASampleConversionISA_NEON,
+	kCASampleConversionISA_Count
+};
+
+typedef void (*CAConvertFromFloat32Proc)(const Float32 *src, void *dest, UInt32 nSamples);
+typedef void (*CAConvertToFloat32Proc)(const void *src, Float32 *dest, UInt32 nSamples);
+typedef void (*CAScaleFloat32Proc)(const Float32 *src, Float32 *dest, Float32 gain, UInt32 nSamples);
+	// dest[i] = src[i] * gain
+typedef void (*CAMixFloat32Proc)(const Float32 *src, Float32 *dest, Float32 gain, UInt32 nSamples);
+	// dest[i] += src[i] * gain
+
+struct CASampleConverter {
+	const char *				mName;
+	CAConvertFromFloat32Proc	mFromFloat32[kCASampleFormat_Count];
+	CAConvertToFloat32Proc		mToFloat32[kCASampleFormat_Count];
+	CAScaleFloat32Proc			mScale;
+	CAMixFloat32Proc			mMix;
+};
+
+const CASampleConverter *	CAGetSampleConverter(CASampleConversionISA isa);
+								// NULL if the kernels for isa were not built or the CPU lacks them
+const CASampleConverter &	CAGetBestSampleConverter();
+								// the fastest converter the CPU supports, chosen once
+
+#endif // __CASampleConversion_h__
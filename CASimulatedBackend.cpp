@@ -0,0 +1,493 @@
+/*=============================================================================
+	CASimulatedBackend.cpp
+	
+=============================================================================*/
+
+#include "CASimulatedBackend.h"
+#include "CAAutoDisposer.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+// The input signal: sample n of the input device is (n mod 2^18) + 1 on every channel,
+// exact in a Float32 and never 0, so silence can't be mistaken for signal. The wrap is
+// over five seconds at 48 kHz, and leaves five bits of fraction for a resampled counter.
+static const UInt32 kCounterMask = 0x3FFFF;
+
+// input frames a resampler may ring for after a step in its input, longer than any CAResampler filter
+static const UInt32 kRingingFrames = 64;
+
+const Float64 CASimulatedBackend::kLatencyResolution = 0.0001;
+static const UInt32 kLatencyBins = 20000;		// two seconds
+
+static inline Float32 EncodeCounter(UInt64 n)
+{
+	return Float32((n & kCounterMask) + 1);
+}
+
+CASimulatedDeviceConfig	CASimulatedBackend::DefaultDeviceConfig()
+{
+	CASimulatedDeviceConfig config;
+	config.mNominalSampleRate = 48000.0;
+	config.mDriftPPM = 0.0;
+	config.mJitterSeconds = 0.0;
+	config.mStallProbability = 0.0;
+	config.mStallSeconds = 0.0;
+	config.mBufferSizeFrames = 512;
+	config.mSafetyOffset = 0;
+	config.mChannels = 2;
+	config.mStartSampleTime = 0.0;
+	return config;
+}
+
+#pragma mark -- Devices --
+
+// The input device calls back once a buffer has been captured and its safety offset
+// has passed; the output device calls back a buffer ahead of playing it. Positions
+// rather than callback counts keep this right across buffer size changes, and counting
+// from the last rate change, across those.
+Float64	CASimulatedBackend::Device::CallbackTime() const
+{
+	Float64 frames = Float64(mPosition - mEpochPosition);
+	if (mIsInput)
+		frames += Float64(mConfig.mBufferSizeFrames) + mConfig.mSafetyOffset;
+	return mEpochTime + frames / mActualRate;
+}
+
+Float64	CASimulatedBackend::Device::PlayTime() const
+{
+	return mEpochTime + (Float64(mPosition - mEpochPosition) + mConfig.mBufferSizeFrames + mConfig.mSafetyOffset) / mActualRate;
+}
+
+void	CASimulatedBackend::Device::Advance(Float64 now)
+{
+	mPosition += mConfig.mBufferSizeFrames;
+	mLastCallbackTime = now;	// a late callback holds up the ones after it
+	DrawDelay();
+}
+
+// a callback due more than a buffer ago was missed altogether
+UInt64	CASimulatedBackend::Device::SkipMissedCycles(Float64 now)
+{
+	UInt64 skipped = 0;
+	while (CallbackTime() + mConfig.mBufferSizeFrames / mActualRate <= now) {
+		mPosition += mConfig.mBufferSizeFrames;
+		++skipped;
+	}
+	return skipped;
+}
+
+void	CASimulatedBackend::Device::DrawDelay()
+{
+	mNextDelay = std::uniform_real_distribution<Float64>(0.0, mConfig.mJitterSeconds)(mRandom);
+	if (mConfig.mStallProbability > 0.0 && std::uniform_real_distribution<Float64>(0.0, 1.0)(mRandom) < mConfig.mStallProbability)
+		mNextDelay += mConfig.mStallSeconds;
+}
+
+CASimulatedBackend::CASimulatedBackend(const CASimulatedDeviceConfig &input, const CASimulatedDeviceConfig &output, UInt32 seed) :
+	mClient(NULL),
+	mRealTime(false),
+	mSimulatedNow(0),
+	mRealOffset(0),
+	mRunning(false),
+	mControlInterval(0),
+	mNextControlTime(0),
+	mInputFramesCaptured(0),
+	mHasVarispeed(true),
+	mRate(1.0),
+	mVarispeedSampleTime(output.mStartSampleTime),
+	mVarispeedRemainder(0),
+	mHeardSound(false),
+	mInSilence(false),
+	mHavePrevious(false),
+	mWasContinuous(true),
+	mContinuousFrames(0),
+	mPreviousValue(0),
+	mUncheckedFrames(0),
+	mLatencySum(0),
+	mLatencyCount(0),
+	mLatencyHistogram(kLatencyBins, 0)
+{
+	Device *devices[2] = { &mInput, &mOutput };
+	const CASimulatedDeviceConfig *configs[2] = { &input, &output };
+	for (int i = 0; i < 2; ++i) {
+		Device &device = *devices[i];
+		device.mConfig = *configs[i];
+		device.mActualRate = device.mConfig.mNominalSampleRate * (1.0 + device.mConfig.mDriftPPM * 1e-6);
+		device.mIsInput = (i == 0);
+		device.mPosition = 0;
+		device.mEpochTime = 0;
+		device.mEpochPosition = 0;
+		device.mLastCallbackTime = 0;
+		device.mRandom.seed(seed * 2 + i);
+		device.DrawDelay();
+	}
+	Epoch epoch = { 0.0, 0, mInput.mActualRate };
+	mInputEpochs.push_back(epoch);
+	
+	// what the varispeed hands the client: the output device's channels
+	UInt32 nChannels = output.mChannels;
+	mOutputList = (AudioBufferList *)CA_malloc(offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nChannels);
+	mOutputList->mNumberBuffers = nChannels;
+	AllocateOutputList();
+	
+	memset(&mStats, 0, sizeof(mStats));
+	mStats.mLastRate = 1.0;
+}
+
+CASimulatedBackend::~CASimulatedBackend()
+{
+	Stop();
+	free(mOutputList);
+}
+
+// room for an output buffer pulled at up to twice the nominal rate
+void	CASimulatedBackend::AllocateOutputList()
+{
+	mOutputListFrames = UInt32(2.0 * mOutput.mConfig.mBufferSizeFrames * std::max(1.0, NominalRatio())) + 2;
+	mOutputStorage.assign(mOutputList->mNumberBuffers * mOutputListFrames, 0.0f);
+	for (UInt32 i = 0; i < mOutputList->mNumberBuffers; ++i) {
+		mOutputList->mBuffers[i].mNumberChannels = 1;
+		mOutputList->mBuffers[i].mData = &mOutputStorage[i * mOutputListFrames];
+	}
+}
+
+void	CASimulatedBackend::SetBufferSize(Direction direction, UInt32 nFrames)
+{
+	if (mRunning)
+		return;
+	Device &device = (direction == kInput) ? mInput : mOutput;
+	device.mConfig.mBufferSizeFrames = nFrames;
+	if (direction == kOutput)
+		AllocateOutputList();
+}
+
+void	CASimulatedBackend::SetControlProc(std::function<void()> proc, Float64 interval)
+{
+	if (mRunning)
+		return;
+	mControlProc = proc;
+	mControlInterval = interval;
+	mNextControlTime = mSimulatedNow + interval;
+}
+
+// The device's next callback is for the frames after the last, as if it had restarted now at the
+// new rate.
+void	CASimulatedBackend::SetSampleRate(Direction direction, Float64 sampleRate)
+{
+	if (mRunning)
+		return;
+	Device &device = (direction == kInput) ? mInput : mOutput;
+	device.mConfig.mNominalSampleRate = sampleRate;
+	device.mActualRate = sampleRate * (1.0 + device.mConfig.mDriftPPM * 1e-6);
+	device.mEpochTime = mSimulatedNow;
+	device.mEpochPosition = device.mPosition;
+	if (direction == kInput) {
+		Epoch epoch = { mSimulatedNow, device.mPosition, device.mActualRate };
+		mInputEpochs.push_back(epoch);
+	}
+	AllocateOutputList();
+}
+
+void	CASimulatedBackend::Stall(Direction direction, Float64 seconds)
+{
+	Device &device = (direction == kInput) ? mInput : mOutput;
+	device.mNextDelay += seconds;
+}
+
+#pragma mark -- Running --
+
+Float64	CASimulatedBackend::Now() const
+{
+	if (!mRealTime)
+		return mSimulatedNow;
+	return mRealOffset + std::chrono::duration<Float64>(std::chrono::steady_clock::now() - mRealStart).count();
+}
+
+void	CASimulatedBackend::Run(Float64 seconds)
+{
+	if (mRunning)
+		return;
+	
+	Float64 end = mSimulatedNow + seconds;
+	for (;;) {
+		Float64 nextInput = mInput.NextCallbackTime();
+		Float64 nextOutput = mOutput.NextCallbackTime();
+		Float64 next = std::min(nextInput, nextOutput);
+		bool control = mControlProc && mNextControlTime < next;
+		if (control)
+			next = mNextControlTime;
+		if (next > end)
+			break;
+		mSimulatedNow = next;
+		if (control) {
+			mControlProc();
+			mNextControlTime += mControlInterval;
+		} else if (nextInput <= nextOutput)
+			DoInput();
+		else
+			DoOutput();
+	}
+	mSimulatedNow = end;
+}
+
+OSStatus	CASimulatedBackend::Start()
+{
+	if (mRunning)
+		return noErr;
+	
+	mRealOffset = mSimulatedNow;
+	mRealStart = std::chrono::steady_clock::now();
+	mRealTime = true;
+	mRunning = true;
+	
+	// each device sleeps until its next callback is due, as a HAL IO thread would
+	auto deviceThread = [this](Device &device) {
+		while (mRunning.load(std::memory_order_relaxed)) {
+			Float64 due = device.NextCallbackTime() - mRealOffset;
+			std::this_thread::sleep_until(mRealStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<Float64>(due)));
+			if (!mRunning.load(std::memory_order_relaxed))
+				break;
+			if (device.mIsInput)
+				DoInput();
+			else
+				DoOutput();
+		}
+	};
+	mInputThread = std::thread(deviceThread, std::ref(mInput));
+	mOutputThread = std::thread(deviceThread, std::ref(mOutput));
+	return noErr;
+}
+
+OSStatus	CASimulatedBackend::Stop()
+{
+	if (!mRunning)
+		return noErr;
+	
+	mRunning = false;
+	mInputThread.join();
+	mOutputThread.join();
+	mSimulatedNow = Now();
+	mRealTime = false;
+	return noErr;
+}
+
+#pragma mark -- Callbacks --
+
+AudioTimeStamp	CASimulatedBackend::MakeTimeStamp(Float64 sampleTime, Float64 hostSeconds, const Device &device) const
+{
+	AudioTimeStamp timeStamp;
+	memset(&timeStamp, 0, sizeof(timeStamp));
+	timeStamp.mSampleTime = sampleTime;
+	timeStamp.mHostTime = UInt64(hostSeconds * 1e9);
+	timeStamp.mRateScalar = device.mActualRate / device.mConfig.mNominalSampleRate;
+	timeStamp.mFlags = kAudioTimeStampSampleHostTimeValid | kAudioTimeStampRateScalarValid;
+	return timeStamp;
+}
+
+void	CASimulatedBackend::DoInput()
+{
+	Float64 now = Now();
+	mStats.mInputOverloads += mInput.SkipMissedCycles(now);
+	UInt32 nFrames = mInput.mConfig.mBufferSizeFrames;
+	Float64 sampleTime = mInput.mConfig.mStartSampleTime + Float64(mInput.mPosition);
+	AudioTimeStamp timeStamp = MakeTimeStamp(sampleTime, now, mInput);
+	
+	mInputFramesCaptured.store(mInput.mPosition + nFrames, std::memory_order_release);
+	if (mClient)
+		mClient->InputProc(timeStamp, nFrames);
+	++mStats.mInputCallbacks;
+	mInput.Advance(now);
+}
+
+void	CASimulatedBackend::DoOutput()
+{
+	Float64 now = Now();
+	mStats.mOutputOverloads += mOutput.SkipMissedCycles(now);
+	
+	// pull frames through the varispeed at the client's rate, converting between the nominal rates,
+	// or without one, ask for the output device's buffer
+	Float64 rate = std::max(0.5, std::min(2.0, mRate.load(std::memory_order_relaxed)));
+	UInt32 nFrames = mOutput.mConfig.mBufferSizeFrames;
+	Float64 sampleTime = mOutput.mConfig.mStartSampleTime + Float64(mOutput.mPosition);
+	if (mHasVarispeed) {
+		Float64 wanted = nFrames * NominalRatio() * rate + mVarispeedRemainder;
+		nFrames = UInt32(wanted);
+		mVarispeedRemainder = wanted - nFrames;
+		sampleTime = mVarispeedSampleTime;
+	}
+	
+	for (UInt32 i = 0; i < mOutputList->mNumberBuffers; ++i)
+		mOutputList->mBuffers[i].mDataByteSize = nFrames * sizeof(Float32);
+	
+	AudioTimeStamp timeStamp = MakeTimeStamp(sampleTime, now, mOutput);
+	if (!mClient || mClient->OutputProc(timeStamp, nFrames, mOutputList) != noErr)
+		memset(mOutputList->mBuffers[0].mData, 0, nFrames * sizeof(Float32));
+	if (mHasVarispeed)
+		mVarispeedSampleTime += nFrames;
+	mStats.mLastRate = rate;
+	
+	// the device plays this buffer once the one before it and its safety offset have gone out
+	CheckOutput(mOutput.PlayTime(), nFrames);
+	
+	++mStats.mOutputCallbacks;
+	mOutput.Advance(now);
+}
+
+void	CASimulatedBackend::CheckOutput(Float64 playTime, UInt32 nFrames)
+{
+	const Float32 *samples = (const Float32 *)mOutputList->mBuffers[0].mData;
+	// output frames, when upsampling, that the ringing lasts for
+	UInt32 ringingFrames = UInt32(kRingingFrames * std::max(1.0, 1.0 / NominalRatio()));
+	// how long each frame plays for
+	Float64 frameSeconds = (mHasVarispeed ? 1.0 / (NominalRatio() * mStats.mLastRate) : 1.0) / mOutput.mActualRate;
+	bool measured = false;
+	for (UInt32 i = 0; i < nFrames; ++i) {
+		if (samples[i] == 0.0f) {
+			if (mHeardSound) {
+				++mStats.mSilentFrames;
+				if (!mInSilence)
+					++mStats.mDropouts;
+				mInSilence = true;
+			}
+			mHavePrevious = false;
+			if (!mHasVarispeed)
+				mUncheckedFrames = ringingFrames;
+			continue;
+		}
+		mHeardSound = true;
+		mInSilence = false;
+		
+		Float64 value = samples[i] - 1.0;
+		if (!mHasVarispeed) {
+			if (mHavePrevious && mPreviousValue + NominalRatio() > kCounterMask + 1 - kRingingFrames)
+				mUncheckedFrames = 2 * ringingFrames;
+			if (mUncheckedFrames > 0) {
+				--mUncheckedFrames;
+				mHavePrevious = false;
+				continue;
+			}
+		}
+		
+		bool continuous = false;
+		if (mHavePrevious) {
+			continuous = IsContinuous(value);
+			if (!continuous && mWasContinuous)
+				++mStats.mDiscontinuities;
+			mWasContinuous = continuous;
+		}
+		mContinuousFrames = continuous ? mContinuousFrames + 1 : 0;
+		mPreviousValue = value;
+		mHavePrevious = true;
+		
+		// a frame is only trusted once it follows on from the one before, so that a fade can't pass
+		// for the counter, and a resampled one a few frames into such a run, where ringing can't either
+		bool trusted = mContinuousFrames >= (mHasVarispeed ? 1 : 4);
+		if (!measured && trusted && value >= 0.0 && value <= kCounterMask) {
+			// the newest input sample with this counter value, and when it was captured
+			UInt64 captured = mInputFramesCaptured.load(std::memory_order_acquire);
+			UInt64 whole = UInt64(value);
+			Float64 n = Float64(captured - 1 - ((captured - 1 - whole) & kCounterMask)) + (value - whole);
+			Float64 latency = playTime + i * frameSeconds - CaptureTime(n);
+			if (mLatencyCount == 0 || latency < mStats.mLatencyMin)
+				mStats.mLatencyMin = latency;
+			if (mLatencyCount == 0 || latency > mStats.mLatencyMax)
+				mStats.mLatencyMax = latency;
+			mLatencySum += latency;
+			++mLatencyCount;
+			++mLatencyHistogram[std::min(UInt64(std::max(0.0, latency) / kLatencyResolution), UInt64(kLatencyBins - 1))];
+			measured = true;
+		}
+	}
+	mStats.mFramesPlayed += nFrames;
+}
+
+// when the input captured its nth sample, at the rate it ran at then
+Float64	CASimulatedBackend::CaptureTime(Float64 n) const
+{
+	auto epoch = mInputEpochs.end() - 1;
+	while (epoch != mInputEpochs.begin() && n < epoch->mPosition)
+		--epoch;
+	return epoch->mTime + (n - epoch->mPosition) / epoch->mRate;
+}
+
+// Whether value follows on from the previous frame's: exactly the next counter value through a
+// varispeed, or when resampled, a step of the nominal ratio give or take the client's small rate
+// changes and the filter's error.
+bool	CASimulatedBackend::IsContinuous(Float64 value)
+{
+	if (mHasVarispeed)
+		return value == Float64((UInt32(mPreviousValue) + 1) & kCounterMask);
+	return std::fabs(value - mPreviousValue - NominalRatio()) < 0.25;
+}
+
+void	CASimulatedBackend::GetStats(CASimulatedBackendStats &stats) const
+{
+	stats = mStats;
+	stats.mLatencyMean = mLatencyCount ? mLatencySum / mLatencyCount : 0.0;
+	stats.mLatencyP1 = GetLatencyPercentile(1);
+	stats.mLatencyP50 = GetLatencyPercentile(50);
+	stats.mLatencyP99 = GetLatencyPercentile(99);
+}
+
+Float64	CASimulatedBackend::GetLatencyPercentile(Float64 percent) const
+{
+	if (mLatencyCount == 0)
+		return 0.0;
+	
+	// the upper edge of the bin that holds the percentile
+	UInt64 rank = UInt64(std::ceil(percent / 100.0 * mLatencyCount));
+	UInt64 seen = 0;
+	for (UInt32 bin = 0; bin < kLatencyBins; ++bin) {
+		seen += mLatencyHistogram[bin];
+		if (seen >= std::max(rank, UInt64(1)))
+			return (bin + 1) * kLatencyResolution;
+	}
+	return kLatencyBins * kLatencyResolution;
+}
+
+#pragma mark -- CAPlayThroughBackend --
+
+CAPlayThroughDeviceInfo	CASimulatedBackend::GetDeviceInfo(Direction direction)
+{
+	const CASimulatedDeviceConfig &config = (direction == kInput) ? mInput.mConfig : mOutput.mConfig;
+	CAPlayThroughDeviceInfo info;
+	info.mNominalSampleRate = config.mNominalSampleRate;
+	info.mBufferSizeFrames = config.mBufferSizeFrames;
+	info.mSafetyOffset = config.mSafetyOffset;
+	info.mChannels = config.mChannels;
+	return info;
+}
+
+OSStatus	CASimulatedBackend::GetCurrentTime(Direction direction, AudioTimeStamp &outTime)
+{
+	const Device &device = (direction == kInput) ? mInput : mOutput;
+	Float64 now = Now();
+	Float64 sampleTime = device.mConfig.mStartSampleTime + device.mEpochPosition + (now - device.mEpochTime) * device.mActualRate;
+	outTime = MakeTimeStamp(sampleTime, now, device);
+	return noErr;
+}
+
+OSStatus	CASimulatedBackend::RenderInput(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData)
+{
+	UInt64 first = UInt64(timeStamp.mSampleTime - mInput.mConfig.mStartSampleTime);
+	for (UInt32 b = 0; b < ioData->mNumberBuffers; ++b) {
+		AudioBuffer &buffer = ioData->mBuffers[b];
+		Float32 *samples = (Float32 *)buffer.mData;
+		UInt32 nChannels = buffer.mNumberChannels;
+		for (UInt32 i = 0; i < nFrames; ++i)
+			for (UInt32 ch = 0; ch < nChannels; ++ch)
+				samples[i * nChannels + ch] = EncodeCounter(first + i);
+		buffer.mDataByteSize = nFrames * nChannels * sizeof(Float32);
+	}
+	return noErr;
+}
+
+OSStatus	CASimulatedBackend::SetPlaybackRate(Float64 rate)
+{
+	mRate.store(rate, std::memory_order_relaxed);
+	return noErr;
+}
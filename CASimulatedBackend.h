@@ -0,0 +1,206 @@
+/*=============================================================================
+	CASimulatedBackend.h
+	
+	A CAPlayThroughBackend without hardware. Two virtual clocks stand in for
+	the input and output devices, each with its own nominal rate, drift and
+	buffer size, and callbacks that arrive up to a configurable jitter late.
+	A device can also stall now and then, holding up a callback for much
+	longer. Jitter alone makes callbacks bunch up; a callback more than a
+	buffer late makes the device skip the cycles it missed, as the HAL does
+	on an overload, and the input frames of those cycles are lost.
+	
+	Start/Stop run the devices in real time on two threads of their own, as
+	a HAL would. Run instead steps through a stretch of simulated time on the
+	calling thread as fast as it can, which makes runs repeatable: the same
+	configuration and seed always produce the same callbacks.
+	
+	The input device produces a counter, one value per input sample. The
+	output side checks what it receives for dropouts and discontinuities,
+	and from each counter value works out how long that sample took from
+	capture to playback. The varispeed does not resample; it pulls frames at
+	the ratio of the nominal rates times the requested playback rate, so that
+	the ring buffer sees the same traffic.
+	
+	SetControlProc has Run call a function of the client's every so often
+	between callbacks, in simulated time, as a control thread would.
+	
+	SetSampleRate changes a device's nominal rate between runs, as another
+	application or the user might through the HAL. The device carries on
+	from where it was, counting at the new rate from then on; it is up to
+	the client to notice and reconfigure.
+	
+	SetVarispeed(false) takes the varispeed away, as on a backend without
+	one, and leaves the client to resample. The counter then arrives
+	interpolated: each output frame holds the input position it was
+	resampled from, and a discontinuity is a step between frames that
+	differs from the ratio. Around the counter's wrap, and after silence,
+	the client's filter rings, so those frames are not checked.
+=============================================================================*/
+
+#ifndef __CASimulatedBackend_h__
+#define __CASimulatedBackend_h__
+
+#include "CAPlayThroughBackend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct CASimulatedDeviceConfig {
+	Float64		mNominalSampleRate;
+	Float64		mDriftPPM;				// the device really runs at mNominalSampleRate * (1 + mDriftPPM / 1e6)
+	Float64		mJitterSeconds;			// each callback arrives up to this much late
+	Float64		mStallProbability;		// the chance that a callback is held up by a further mStallSeconds
+	Float64		mStallSeconds;
+	UInt32		mBufferSizeFrames;
+	UInt32		mSafetyOffset;
+	UInt32		mChannels;
+	Float64		mStartSampleTime;		// the device's sample time when it starts
+};
+
+struct CASimulatedBackendStats {
+	UInt64		mInputCallbacks;
+	UInt64		mOutputCallbacks;
+	UInt64		mInputOverloads;		// cycles skipped because a callback was too late
+	UInt64		mOutputOverloads;
+	UInt64		mFramesPlayed;			// frames pulled through the varispeed
+	UInt64		mSilentFrames;			// after the first non-silent one
+	UInt64		mDropouts;				// runs of silence after the first non-silent frame
+	UInt64		mDiscontinuities;		// non-silent frames that don't follow on from the previous one
+	Float64		mLatencyMin;			// capture to playback, in seconds
+	Float64		mLatencyMax;
+	Float64		mLatencyMean;
+	Float64		mLatencyP1;				// percentiles, to kLatencyResolution
+	Float64		mLatencyP50;
+	Float64		mLatencyP99;
+	Float64		mLastRate;				// the last varispeed rate set
+};
+
+class CASimulatedBackend : public CAPlayThroughBackend {
+public:
+	CASimulatedBackend(const CASimulatedDeviceConfig &input, const CASimulatedDeviceConfig &output, UInt32 seed = 1);
+	~CASimulatedBackend();
+	
+	static CASimulatedDeviceConfig	DefaultDeviceConfig();
+										// 48 kHz, no drift, jitter or stalls, 512 frames, stereo
+	
+	static const Float64	kLatencyResolution;		// seconds
+	
+	void				Run(Float64 seconds);
+							// runs the devices for that much simulated time on this thread, as fast
+							// as possible; successive calls carry on where the last one stopped
+	void				GetStats(CASimulatedBackendStats &stats) const;
+							// call while the devices are stopped
+	Float64				GetLatencyPercentile(Float64 percent) const;
+							// of the capture to playback latencies heard so far, in seconds
+	
+	void				SetBufferSize(Direction direction, UInt32 nFrames);
+							// takes effect from the device's next callback; call while stopped
+	void				Stall(Direction direction, Float64 seconds);
+							// holds up the device's next callback by that much more
+	void				SetVarispeed(bool varispeed) { if (!mRunning) mHasVarispeed = varispeed; }
+							// with one by default; call while stopped, before the client allocates
+	void				SetControlProc(std::function<void()> proc, Float64 interval);
+							// Run calls proc every interval seconds from now; Start doesn't. Call while stopped.
+	void				SetSampleRate(Direction direction, Float64 sampleRate);
+							// from now on, with the device's drift kept; call while stopped
+	
+	// CAPlayThroughBackend
+	void				SetClient(Client *client) override { mClient = client; }
+	OSStatus			Start() override;	// real time, on two threads
+	OSStatus			Stop() override;
+	bool				IsRunning() const { return mRunning; }
+	CAPlayThroughDeviceInfo	GetDeviceInfo(Direction direction) override;
+	bool				HasVarispeed() override { return mHasVarispeed; }
+	OSStatus			GetCurrentTime(Direction direction, AudioTimeStamp &outTime) override;
+	OSStatus			RenderInput(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData) override;
+	OSStatus			SetPlaybackRate(Float64 rate) override;
+	UInt64				GetCurrentHostTime() override { return UInt64(Now() * 1e9); }
+							// in simulated nanoseconds, as the time stamps' host times
+	Float64				GetHostClockFrequency() override { return 1e9; }
+	
+private:
+	struct Device {
+		CASimulatedDeviceConfig	mConfig;
+		Float64					mActualRate;
+		bool					mIsInput;
+		UInt64					mPosition;		// frames captured or played before the next callback
+		Float64					mEpochTime;		// when the device last changed rate, and its position then
+		UInt64					mEpochPosition;
+		Float64					mLastCallbackTime;
+		std::mt19937			mRandom;
+		Float64					mNextDelay;		// jitter and stall for the next callback
+		
+		Float64					CallbackTime() const;
+									// when the next callback is due, without delay, in seconds from the start
+		Float64					PlayTime() const;
+									// when the output device plays the buffer of the next callback
+		Float64					NextCallbackTime() const { return std::max(CallbackTime() + mNextDelay, mLastCallbackTime); }
+		void					Advance(Float64 now);
+		UInt64					SkipMissedCycles(Float64 now);
+		void					DrawDelay();
+	};
+	
+	struct Epoch {
+		Float64					mTime;
+		UInt64					mPosition;
+		Float64					mRate;
+	};
+	
+	Float64				Now() const;
+	void				DoInput();
+	void				DoOutput();
+	void				CheckOutput(Float64 playTime, UInt32 nFrames);
+	bool				IsContinuous(Float64 value);
+	void				AllocateOutputList();
+	Float64				NominalRatio() const { return mInput.mConfig.mNominalSampleRate / mOutput.mConfig.mNominalSampleRate; }
+	AudioTimeStamp		MakeTimeStamp(Float64 sampleTime, Float64 hostSeconds, const Device &device) const;
+	Float64				CaptureTime(Float64 n) const;
+	
+	Client *			mClient;
+	Device				mInput;
+	Device				mOutput;
+	
+	// time: simulated by Run, or read from the clock when started
+	bool				mRealTime;
+	Float64				mSimulatedNow;
+	std::chrono::steady_clock::time_point mRealStart;
+	Float64				mRealOffset;		// simulated time already run before the clock started
+	std::atomic<bool>	mRunning;
+	std::thread			mInputThread;
+	std::thread			mOutputThread;
+	std::function<void()> mControlProc;
+	Float64				mControlInterval;
+	Float64				mNextControlTime;
+	
+	std::atomic<UInt64>	mInputFramesCaptured;
+	std::vector<Epoch>	mInputEpochs;		// each rate the input has run at, to date its samples by
+	
+	// varispeed stand-in, output thread only
+	bool				mHasVarispeed;
+	std::atomic<Float64> mRate;
+	Float64				mVarispeedSampleTime;
+	Float64				mVarispeedRemainder;
+	std::vector<Float32> mOutputStorage;
+	AudioBufferList *	mOutputList;
+	UInt32				mOutputListFrames;
+	
+	// output analysis, output thread only
+	CASimulatedBackendStats mStats;
+	bool				mHeardSound;
+	bool				mInSilence;
+	bool				mHavePrevious;
+	bool				mWasContinuous;
+	UInt32				mContinuousFrames;
+	Float64				mPreviousValue;
+	UInt32				mUncheckedFrames;	// while a resampler rings
+	Float64				mLatencySum;
+	UInt64				mLatencyCount;
+	std::vector<UInt64>	mLatencyHistogram;	// kLatencyResolution wide bins, the last one open-ended
+};
+
+#endif // __CASimulatedBackend_h__
@@ -0,0 +1,109 @@
+/*=============================================================================
+	CASimulatedSessions.cpp
+
+=============================================================================*/
+
+#include "CASimulatedSessions.h"
+
+#pragma mark -- Device --
+
+CASimulatedSessionFactory::Device::Device(CASimulatedSessionFactory &factory, CAPlayThroughDeviceID id) :
+	mFactory(factory),
+	mID(id)
+{
+	++mFactory.mOpenDevices;
+}
+
+CASimulatedSessionFactory::Device::~Device()
+{
+	--mFactory.mOpenDevices;
+}
+
+#pragma mark -- Session --
+
+// seeded by the route, so that routes on the same devices still see their own jitter
+CASimulatedSessionFactory::Session::Session(const CAPlayThroughRoute &route, Device &input, Device &output, bool varispeed) :
+	mInput(input),
+	mOutput(output),
+	mBackend(input.GetConfig(), output.GetConfig(), route.mInput * 7919 + route.mOutput + 1),
+	mEngine(mBackend)
+{
+	mBackend.SetVarispeed(varispeed);
+	mEngine.Allocate(input.GetConfig().mChannels, output.GetConfig().mChannels);
+	mEngine.ComputeThruOffset();
+	mBackend.SetClient(&mEngine);
+}
+
+OSStatus	CASimulatedSessionFactory::Session::Start()
+{
+	if (mBackend.IsRunning())
+		return noErr;
+	mEngine.Reset();
+	return mBackend.Start();
+}
+
+OSStatus	CASimulatedSessionFactory::Session::Stop()
+{
+	return mBackend.Stop();
+}
+
+// The simulated devices only change rate while stopped, so a running session stops for as long as
+// that takes, and the engine changes over while it is stopped; then it starts again as Start does,
+// as on the Mac. As there, a change of channel count is refused before anything stops, and a failure
+// puts the old rates back.
+OSStatus	CASimulatedSessionFactory::Session::Reconfigure()
+{
+	if (mInput.GetConfig().mChannels != mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput).mChannels
+			|| mOutput.GetConfig().mChannels != mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput).mChannels)
+		return kCAPlayThroughSessionError_FormatChanged;
+
+	Float64 inputRate = mInput.GetConfig().mNominalSampleRate;
+	Float64 outputRate = mOutput.GetConfig().mNominalSampleRate;
+	if (inputRate == mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput).mNominalSampleRate
+			&& outputRate == mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput).mNominalSampleRate)
+		return noErr;	// the other device's change
+	if (OSStatus err = mInput.GetReconfigureError())
+		return err;
+
+	bool running = mBackend.IsRunning();
+	if (running)
+		Stop();
+	CAPlayThroughDeviceInfo input = mBackend.GetDeviceInfo(CAPlayThroughBackend::kInput);
+	CAPlayThroughDeviceInfo output = mBackend.GetDeviceInfo(CAPlayThroughBackend::kOutput);
+	mBackend.SetSampleRate(CAPlayThroughBackend::kInput, inputRate);
+	mBackend.SetSampleRate(CAPlayThroughBackend::kOutput, outputRate);
+	OSStatus err = mEngine.Reconfigure(false);
+	if (err) {
+		mBackend.SetSampleRate(CAPlayThroughBackend::kInput, input.mNominalSampleRate);
+		mBackend.SetSampleRate(CAPlayThroughBackend::kOutput, output.mNominalSampleRate);
+	}
+	if (running) {
+		OSStatus startErr = Start();
+		if (!err)
+			err = startErr;
+	}
+	return err;
+}
+
+#pragma mark -- Factory --
+
+void	CASimulatedSessionFactory::SetSampleRate(CAPlayThroughDeviceID id, Float64 sampleRate)
+{
+	std::map<CAPlayThroughDeviceID, CASimulatedDeviceConfig>::iterator config = mConfigs.find(id);
+	if (config != mConfigs.end())
+		config->second.mNominalSampleRate = sampleRate;
+}
+
+CAPlayThroughSessionManager::Device *	CASimulatedSessionFactory::OpenDevice(CAPlayThroughDeviceID device)
+{
+	if (!mConfigs.count(device))
+		return NULL;
+	return new Device(*this, device);
+}
+
+CAPlayThroughSessionManager::Session *	CASimulatedSessionFactory::CreateSession(const CAPlayThroughRoute &route,
+																				 CAPlayThroughSessionManager::Device &input,
+																				 CAPlayThroughSessionManager::Device &output)
+{
+	return new Session(route, static_cast<Device &>(input), static_cast<Device &>(output), mVarispeed);
+}
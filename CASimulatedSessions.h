@@ -0,0 +1,90 @@
+/*=============================================================================
+	CASimulatedSessions.h
+
+	CAPlayThroughSessionManager's factory for simulated devices. Devices are
+	configured by ID before any route uses them; a route's session is a
+	CASimulatedBackend between its two devices' configurations, and an
+	engine allocated for their channels. Two routes that share a device
+	share its configuration, so they see the same rate and drift, and
+	SetSampleRate followed by the manager's DeviceChanged changes it for
+	all of them.
+
+	Run steps a session through simulated time, offline, as
+	CASimulatedBackend::Run does; Start and Stop run it in real time.
+=============================================================================*/
+
+#ifndef __CASimulatedSessions_h__
+#define __CASimulatedSessions_h__
+
+#include "CAPlayThroughSessions.h"
+#include "CAPlayThroughEngine.h"
+#include "CASimulatedBackend.h"
+
+#include <map>
+
+class CASimulatedSessionFactory : public CAPlayThroughSessionManager::Factory {
+public:
+	class Device : public CAPlayThroughSessionManager::Device {
+	public:
+		Device(CASimulatedSessionFactory &factory, CAPlayThroughDeviceID id);
+		~Device();
+
+		CAPlayThroughDeviceID	GetID() const { return mID; }
+		const CASimulatedDeviceConfig &GetConfig() const { return mFactory.mConfigs[mID]; }
+		OSStatus				GetReconfigureError() const { return mFactory.mReconfigureError; }
+
+	private:
+		CASimulatedSessionFactory &	mFactory;
+		CAPlayThroughDeviceID		mID;
+	};
+
+	class Session : public CAPlayThroughSessionManager::Session {
+	public:
+		Session(const CAPlayThroughRoute &route, Device &input, Device &output, bool varispeed);
+
+		OSStatus			Start() override;
+		OSStatus			Stop() override;
+		bool				IsRunning() override { return mBackend.IsRunning(); }
+		OSStatus			Reconfigure() override;
+								// takes up the devices' sample rates as they are configured now, or fails with
+								// the factory's reconfigure error, as it was
+
+		void				Run(Float64 seconds) { mBackend.Run(seconds); }
+		CASimulatedBackend &	GetBackend() { return mBackend; }
+		CAPlayThroughEngine &	GetEngine() { return mEngine; }
+
+	private:
+		Device &			mInput;
+		Device &			mOutput;
+		CASimulatedBackend	mBackend;
+		CAPlayThroughEngine	mEngine;
+	};
+
+	CASimulatedSessionFactory() : mVarispeed(true), mOpenDevices(0), mReconfigureError(noErr) { }
+
+	void				AddDevice(CAPlayThroughDeviceID id, const CASimulatedDeviceConfig &config) { mConfigs[id] = config; }
+							// a device routes may then use; OpenDevice fails for any other ID
+	void				SetSampleRate(CAPlayThroughDeviceID id, Float64 sampleRate);
+							// for the sessions on it to take up at their next Reconfigure
+	void				SetVarispeed(bool varispeed) { mVarispeed = varispeed; }
+							// for the sessions made from now on
+	void				SetReconfigureError(OSStatus err) { mReconfigureError = err; }
+							// what every session's Reconfigure fails with from now on, as devices that won't
+							// take a new rate would; noErr, the default, for none
+	UInt32				GetOpenDevices() const { return mOpenDevices; }
+							// handles open, to check that the routes share them
+
+	// CAPlayThroughSessionManager::Factory
+	CAPlayThroughSessionManager::Device *	OpenDevice(CAPlayThroughDeviceID device) override;
+	CAPlayThroughSessionManager::Session *	CreateSession(const CAPlayThroughRoute &route,
+														  CAPlayThroughSessionManager::Device &input,
+														  CAPlayThroughSessionManager::Device &output) override;
+
+private:
+	std::map<CAPlayThroughDeviceID, CASimulatedDeviceConfig> mConfigs;
+	bool				mVarispeed;
+	UInt32				mOpenDevices;
+	OSStatus			mReconfigureError;
+};
+
+#endif // __CASimulatedSessions_h__
@@ -0,0 +1,21 @@
+/*=============================================================================
+	CAAutoDisposer.h
+	
+	Linux stand-in for the PublicUtility header of the same name. Only the
+	CA_malloc helper is provided.
+=============================================================================*/
+
+#ifndef __CAPtr_h__
+#define __CAPtr_h__
+
+#include <stdlib.h>
+#include <new>
+
+inline void* CA_malloc(size_t size)
+{
+	void* p = malloc(size);
+	if (!p && size) throw std::bad_alloc();
+	return p;
+}
+
+#endif // __CAPtr_h__
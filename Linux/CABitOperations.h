@@ -0,0 +1,31 @@
+/*=============================================================================
+	CABitOperations.h
+	
+	Linux stand-in for the PublicUtility header of the same name. Provides
+	only what CARingBuffer needs.
+=============================================================================*/
+
+#ifndef _CABitOperations_h_
+#define _CABitOperations_h_
+
+#include <CoreAudio/CoreAudioTypes.h>
+
+// count the leading zeroes in a word
+inline UInt32 CountLeadingZeroes(UInt32 arg)
+{
+	return arg == 0 ? 32 : __builtin_clz(arg);
+}
+
+// base 2 log of next power of two greater or equal to x
+inline UInt32 Log2Ceil(UInt32 x)
+{
+	return 32 - CountLeadingZeroes(x - 1);
+}
+
+// next power of two greater or equal to x
+inline UInt32 NextPowerOfTwo(UInt32 x)
+{
+	return 1 << Log2Ceil(x);
+}
+
+#endif // _CABitOperations_h_
@@ -0,0 +1,79 @@
+/*=============================================================================
+	CoreAudioTypes.h
+	
+	Minimal stand-in for <CoreAudio/CoreAudioTypes.h> so that the portable
+	parts of CAPlayThrough (CARingBuffer and friends) build off Mac OS X.
+	Only the types those sources actually use are declared here.
+=============================================================================*/
+
+#ifndef __CoreAudioTypes_Linux_h__
+#define __CoreAudioTypes_Linux_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t			UInt8;
+typedef int8_t			SInt8;
+typedef uint16_t		UInt16;
+typedef int16_t			SInt16;
+typedef uint32_t		UInt32;
+typedef int32_t			SInt32;
+typedef uint64_t		UInt64;
+typedef int64_t			SInt64;
+typedef float			Float32;
+typedef double			Float64;
+typedef UInt8			Byte;
+typedef unsigned char	Boolean;
+typedef SInt32			OSStatus;
+
+enum {
+	noErr = 0
+};
+
+struct AudioBuffer {
+	UInt32	mNumberChannels;
+	UInt32	mDataByteSize;
+	void *	mData;
+};
+typedef struct AudioBuffer AudioBuffer;
+
+struct AudioBufferList {
+	UInt32		mNumberBuffers;
+	AudioBuffer	mBuffers[1]; // this is a variable length array of mNumberBuffers elements
+};
+typedef struct AudioBufferList AudioBufferList;
+
+struct SMPTETime {
+	SInt16	mSubframes;
+	SInt16	mSubframeDivisor;
+	UInt32	mCounter;
+	UInt32	mType;
+	UInt32	mFlags;
+	SInt16	mHours;
+	SInt16	mMinutes;
+	SInt16	mSeconds;
+	SInt16	mFrames;
+};
+typedef struct SMPTETime SMPTETime;
+
+struct AudioTimeStamp {
+	Float64		mSampleTime;
+	UInt64		mHostTime;
+	Float64		mRateScalar;
+	UInt64		mWordClockTime;
+	SMPTETime	mSMPTETime;
+	UInt32		mFlags;
+	UInt32		mReserved;
+};
+typedef struct AudioTimeStamp AudioTimeStamp;
+
+enum {
+	kAudioTimeStampSampleTimeValid		= (1U << 0),
+	kAudioTimeStampHostTimeValid		= (1U << 1),
+	kAudioTimeStampRateScalarValid		= (1U << 2),
+	kAudioTimeStampWordClockTimeValid	= (1U << 3),
+	kAudioTimeStampSMPTETimeValid		= (1U << 4),
+	kAudioTimeStampSampleHostTimeValid	= (kAudioTimeStampSampleTimeValid | kAudioTimeStampHostTimeValid)
+};
+
+#endif // __CoreAudioTypes_Linux_h__
@@ -0,0 +1,103 @@
+/*=============================================================================
+	CAAdaptiveLatencyTests.cpp
+
+	CAAdaptiveLatency fed headroom directly: a play-through whose latency
+	sits on the target, with a fixed need for latency and callbacks that
+	come a little early or late.
+=============================================================================*/
+
+#include "CAAdaptiveLatency.h"
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+
+namespace {
+
+struct Loop {
+	// need: the latency below which the play-through underruns
+	Loop(Float64 start, Float64 need, Float64 jitter = 0.0) : mNeed(need), mJitter(jitter), mRandom(5), mUnderruns(0), mTime(0)
+	{
+		mAdaptive.Reset(start, 1.0);
+	}
+
+	void Run(Float64 seconds)
+	{
+		const Float64 kInterval = 512 / 48000.0;
+		std::uniform_real_distribution<Float64> lateness(0.0, mJitter);
+		for (Float64 end = mTime + seconds; mTime < end; mTime += kInterval) {
+			Float64 late = lateness(mRandom);
+			Float64 headroom = mAdaptive.GetTarget() - mNeed - late;
+			if (headroom < 0)
+				++mUnderruns;
+			mAdaptive.Update(headroom, kInterval + late - mLastLate, headroom < 0);
+			mLastLate = late;
+		}
+	}
+
+	CAAdaptiveLatency	mAdaptive;
+	Float64				mNeed;
+	Float64				mJitter;
+	Float64				mLastLate = 0;
+	std::mt19937		mRandom;
+	UInt64				mUnderruns;
+	Float64				mTime;
+};
+
+} // namespace
+
+TEST(CAAdaptiveLatencyTest, ComesDownSlowlyToTheMargin)
+{
+	Loop loop(0.030, 0.010);
+
+	// no more than a step per window
+	loop.Run(CAAdaptiveLatency::kDefaultWindow * 4 + 0.1);
+	EXPECT_NEAR(0.030 - 4 * CAAdaptiveLatency::kDefaultMaxStep, loop.mAdaptive.GetTarget(), 1e-9);
+
+	// and in the end to the need and the margin, halving what's left each window
+	loop.Run(600);
+	EXPECT_NEAR(0.010 + CAAdaptiveLatency::kDefaultMinMargin, loop.mAdaptive.GetTarget(), 20e-6);
+	EXPECT_GE(loop.mAdaptive.GetTarget(), 0.010 + CAAdaptiveLatency::kDefaultMinMargin);
+	EXPECT_EQ(0u, loop.mUnderruns);
+}
+
+TEST(CAAdaptiveLatencyTest, LeavesRoomForTheJitter)
+{
+	Loop loop(0.030, 0.010, 0.002);
+	loop.Run(1200);
+
+	// callbacks up to 2 ms late, and that much kept spare on top of the worst headroom seen
+	EXPECT_NEAR(0.002, loop.mAdaptive.GetJitter(), 0.0002);
+	EXPECT_GT(loop.mAdaptive.GetTarget(), 0.010 + 0.002 + 0.0015);
+	EXPECT_LT(loop.mAdaptive.GetTarget(), 0.010 + 0.002 + 0.0025);
+	EXPECT_EQ(0u, loop.mUnderruns);
+}
+
+TEST(CAAdaptiveLatencyTest, BacksOffOnAnUnderrun)
+{
+	Loop loop(0.012, 0.010);
+	loop.Run(60);
+	Float64 settled = loop.mAdaptive.GetTarget();
+
+	// the play-through suddenly needs 3 ms more
+	loop.mNeed = 0.013;
+	loop.Run(0.05);
+	EXPECT_EQ(1u, loop.mAdaptive.GetBackoffs());
+	EXPECT_NEAR(0.013 + CAAdaptiveLatency::kDefaultBackoff, loop.mAdaptive.GetTarget(), 1e-9);
+	EXPECT_LT(settled, 0.011);
+
+	// then comes down again, no lower than before
+	loop.Run(600);
+	EXPECT_NEAR(0.013 + CAAdaptiveLatency::kDefaultMinMargin, loop.mAdaptive.GetTarget(), 20e-6);
+}
+
+TEST(CAAdaptiveLatencyTest, NeverAboveTheLimit)
+{
+	CAAdaptiveLatency adaptive;
+	adaptive.Reset(0.5, 0.1);
+	EXPECT_EQ(0.1, adaptive.GetTarget());
+	for (int i = 0; i < 100; ++i)
+		adaptive.Update(-0.05, 0.01, true);
+	EXPECT_EQ(0.1, adaptive.GetTarget());
+	EXPECT_EQ(100u, adaptive.GetBackoffs());
+}
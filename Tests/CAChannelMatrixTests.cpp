@@ -0,0 +1,160 @@
+/*=============================================================================
+	CAChannelMatrixTests.cpp
+
+	CAChannelMatrix's plan for sparse and dense matrices, every kernel
+	against a double-precision reference, and routing by reference.
+=============================================================================*/
+
+#include "CAChannelMatrix.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+
+std::vector<const CAChannelMatrixKernels *> AvailableKernels()
+{
+	std::vector<const CAChannelMatrixKernels *> kernels;
+	for (int isa = 0; isa < kCASampleConversionISA_Count; ++isa)
+		if (const CAChannelMatrixKernels *k = CAGetChannelMatrixKernels(CASampleConversionISA(isa)))
+			kernels.push_back(k);
+	return kernels;
+}
+
+void FillRandom(TestABL &abl, int nChannels, UInt32 nFrames, std::mt19937 &random)
+{
+	std::uniform_real_distribution<Float32> sample(-1.0f, 1.0f);
+	for (int ch = 0; ch < nChannels; ++ch)
+		for (UInt32 i = 0; i < nFrames; ++i)
+			abl.Channel(ch)[i] = sample(random);
+}
+
+} // namespace
+
+TEST(CAChannelMatrixTest, DefaultsToTheDiagonal)
+{
+	CAChannelMatrix matrix;
+	matrix.Initialize(4, 4);
+	EXPECT_TRUE(matrix.IsIdentity());
+	EXPECT_TRUE(matrix.IsRouting());
+	EXPECT_EQ(4u, matrix.GetTerms());
+
+	// fewer outputs: the extra inputs go nowhere, as they did when the channel count was the smaller
+	matrix.Initialize(8, 2);
+	EXPECT_FALSE(matrix.IsIdentity());
+	EXPECT_TRUE(matrix.IsRouting());
+	EXPECT_EQ(2u, matrix.GetTerms());
+	EXPECT_EQ(1.0f, matrix.GetGain(1, 1));
+	EXPECT_EQ(0.0f, matrix.GetGain(1, 7));
+
+	TestABL in(8, 64), out(2, 64);
+	in.Fill(0);
+	ASSERT_EQ(kCAChannelMatrixError_OK, matrix.Process(in.List(), out.List(), 64));
+	for (int ch = 0; ch < 2; ++ch)
+		for (UInt32 i = 0; i < 64; ++i)
+			EXPECT_EQ(SampleValue(ch, i), out.Sample(ch, i));
+}
+
+TEST(CAChannelMatrixTest, PlansOnlyTheNonZeroGains)
+{
+	CAChannelMatrix matrix;
+	matrix.Initialize(8, 4);
+	matrix.Clear();
+	EXPECT_EQ(0u, matrix.GetTerms());
+	EXPECT_TRUE(matrix.IsRouting());
+
+	matrix.SetGain(0, 6, 1.0f);			// route input 7 to output 1
+	matrix.SetGain(2, 0, 0.5f);
+	matrix.SetGain(2, 1, 0.5f);
+	EXPECT_EQ(3u, matrix.GetTerms());
+	EXPECT_FALSE(matrix.IsRouting());
+	EXPECT_FALSE(matrix.IsIdentity());
+
+	TestABL in(8, 100), out(4, 100);
+	in.Fill(1000);
+	ASSERT_EQ(kCAChannelMatrixError_OK, matrix.Process(in.List(), out.List(), 100));
+	for (UInt32 i = 0; i < 100; ++i) {
+		EXPECT_EQ(SampleValue(6, 1000 + i), out.Sample(0, i));
+		EXPECT_EQ(0.0f, out.Sample(1, i));
+		EXPECT_FLOAT_EQ(0.5f * (SampleValue(0, 1000 + i) + SampleValue(1, 1000 + i)), out.Sample(2, i));
+		EXPECT_EQ(0.0f, out.Sample(3, i));
+	}
+
+	matrix.SetGain(2, 0, 0.0f);
+	matrix.SetGain(2, 1, 0.0f);
+	EXPECT_EQ(1u, matrix.GetTerms());
+	EXPECT_TRUE(matrix.IsRouting());
+	matrix.SetDiagonal();
+	EXPECT_EQ(4u, matrix.GetTerms());
+}
+
+TEST(CAChannelMatrixTest, RoutesByReference)
+{
+	CAChannelMatrix matrix;
+	matrix.Initialize(4, 3);
+	matrix.Clear();
+	matrix.SetGain(0, 3, 1.0f);
+	matrix.SetGain(1, 0, 1.0f);
+	matrix.SetGain(2, 2, 0.25f);		// not a copy: written through its own buffer
+
+	TestABL in(4, 32), out(3, 32);
+	in.Fill(0);
+	out.Scribble();
+	Float32 *own = out.Channel(2);
+	ASSERT_EQ(kCAChannelMatrixError_OK, matrix.Process(in.List(), out.List(), 32, true));
+	EXPECT_EQ(in.List()->mBuffers[3].mData, out.List()->mBuffers[0].mData);
+	EXPECT_EQ(in.List()->mBuffers[0].mData, out.List()->mBuffers[1].mData);
+	EXPECT_EQ(own, out.List()->mBuffers[2].mData);
+	EXPECT_EQ(kGarbage, out.Channel(0)[0]);		// left alone
+	for (UInt32 i = 0; i < 32; ++i)
+		EXPECT_EQ(0.25f * SampleValue(2, i), own[i]);
+}
+
+TEST(CAChannelMatrixTest, RejectsTheWrongChannelCounts)
+{
+	CAChannelMatrix matrix;
+	matrix.Initialize(4, 2);
+	TestABL in(3, 16), out(2, 16), wide(4, 16);
+	EXPECT_EQ(kCAChannelMatrixError_Channels, matrix.Process(in.List(), out.List(), 16));
+	EXPECT_EQ(kCAChannelMatrixError_Channels, matrix.Process(wide.List(), wide.List(), 16));
+}
+
+// Dense random matrices, and frame counts that leave every kind of tail, against a mix in doubles.
+TEST(CAChannelMatrixTest, KernelsMatchTheReference)
+{
+	std::mt19937 random(3);
+	std::uniform_real_distribution<Float32> gain(-1.0f, 1.0f);
+	const UInt32 kShapes[][2] = { { 1, 1 }, { 2, 2 }, { 8, 2 }, { 64, 64 }, { 128, 8 }, { 3, 5 } };
+	const UInt32 kFrames[] = { 1, 3, 7, 16, 37, 512 };
+
+	for (const CAChannelMatrixKernels *kernels : AvailableKernels()) {
+		for (const UInt32 *shape : kShapes) {
+			const UInt32 nIn = shape[0], nOut = shape[1];
+			CAChannelMatrix matrix;
+			matrix.Initialize(nIn, nOut, kernels);
+			for (UInt32 m = 0; m < nOut; ++m)
+				for (UInt32 n = 0; n < nIn; ++n)
+					matrix.SetGain(m, n, gain(random));
+			EXPECT_EQ(nIn * nOut, matrix.GetTerms());
+
+			for (UInt32 nFrames : kFrames) {
+				SCOPED_TRACE(testing::Message() << kernels->mName << " " << nIn << "x" << nOut << " " << nFrames << " frames");
+				TestABL in(nIn, nFrames), out(nOut, nFrames);
+				FillRandom(in, nIn, nFrames, random);
+				ASSERT_EQ(kCAChannelMatrixError_OK, matrix.Process(in.List(), out.List(), nFrames));
+				for (UInt32 m = 0; m < nOut; ++m) {
+					EXPECT_EQ(nFrames * sizeof(Float32), out.List()->mBuffers[m].mDataByteSize);
+					for (UInt32 i = 0; i < nFrames; ++i) {
+						Float64 expected = 0;
+						for (UInt32 n = 0; n < nIn; ++n)
+							expected += Float64(matrix.GetGain(m, n)) * in.Channel(n)[i];
+						ASSERT_NEAR(expected, out.Channel(m)[i], 1e-5 * nIn) << "output " << m << " frame " << i;
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,607 @@
+/*=============================================================================
+	CADSPChainTests.cpp
+
+	CADSPChain's processors: every biquad kernel against the scalar one, the
+	equalizer's response, the gain's ramp, the limiter's ceiling and the
+	delay's taps; the same output whatever the block sizes; the order and
+	the parameters changed from a control thread while a block is running;
+	and a delay in the engine's output adding to the play-through's latency.
+=============================================================================*/
+
+#include "CADSPProcessors.h"
+#include "CAPlayThroughEngine.h"
+#include "CASimulatedBackend.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const Float64 kSampleRate = 48000.0;
+
+std::vector<const CABiquadKernels *> AvailableKernels()
+{
+	std::vector<const CABiquadKernels *> kernels;
+	for (int isa = 0; isa < kCASampleConversionISA_Count; ++isa)
+		if (const CABiquadKernels *k = CAGetBiquadKernels(CASampleConversionISA(isa)))
+			kernels.push_back(k);
+	return kernels;
+}
+
+void FillRandom(TestABL &abl, int nChannels, UInt32 nFrames, std::mt19937 &random, Float32 amplitude = 1.0f)
+{
+	std::uniform_real_distribution<Float32> sample(-amplitude, amplitude);
+	for (int ch = 0; ch < nChannels; ++ch)
+		for (UInt32 i = 0; i < nFrames; ++i)
+			abl.Channel(ch)[i] = sample(random);
+}
+
+void FillSine(TestABL &abl, int nChannels, UInt32 nFrames, Float64 frequency, Float32 amplitude)
+{
+	for (int ch = 0; ch < nChannels; ++ch)
+		for (UInt32 i = 0; i < nFrames; ++i)
+			abl.Channel(ch)[i] = amplitude * Float32(sin(2.0 * M_PI * frequency * i / kSampleRate));
+}
+
+// the largest magnitude from frame first on
+Float32 Peak(TestABL &abl, int channel, UInt32 first, UInt32 nFrames)
+{
+	Float32 peak = 0.0f;
+	for (UInt32 i = first; i < nFrames; ++i)
+		peak = std::max(peak, std::fabs(abl.Channel(channel)[i]));
+	return peak;
+}
+
+// nFrames of abl, from frame first, as a buffer list of its own
+class Slice {
+public:
+	Slice(TestABL &abl, int nChannels, UInt32 first, UInt32 nFrames) : mView(nChannels)
+	{
+		for (int ch = 0; ch < nChannels; ++ch) {
+			AudioBuffer &buffer = mView.List()->mBuffers[ch];
+			buffer.mNumberChannels = 1;
+			buffer.mDataByteSize = nFrames * sizeof(Float32);
+			buffer.mData = abl.Channel(ch) + first;
+		}
+	}
+	AudioBufferList *	List() { return mView.List(); }
+
+private:
+	SpanABL		mView;
+};
+
+CADSPEqualizerBand Band(CADSPFilterType type, Float64 frequency, Float64 q, Float64 gainDB)
+{
+	CADSPEqualizerBand band = { type, frequency, q, gainDB };
+	return band;
+}
+
+// the designed filter's gain at frequency, from its transfer function on the unit circle
+Float64 ResponseDB(const CABiquadCoefficients &c, Float64 frequency)
+{
+	const Float64 w = 2.0 * M_PI * frequency / kSampleRate;
+	const Float64 re1 = cos(w), im1 = -sin(w), re2 = cos(2.0 * w), im2 = -sin(2.0 * w);
+	const Float64 nr = c.mB0 + c.mB1 * re1 + c.mB2 * re2, ni = c.mB1 * im1 + c.mB2 * im2;
+	const Float64 dr = 1.0 + c.mA1 * re1 + c.mA2 * re2, di = c.mA1 * im1 + c.mA2 * im2;
+	return 10.0 * log10((nr * nr + ni * ni) / (dr * dr + di * di));
+}
+
+// an equalizer, a gain on its way to a new value, a limiter that works and a delay that feeds back
+void AddEverything(CADSPChain &chain)
+{
+	CADSPEqualizer *eq = new CADSPEqualizer;
+	CADSPEqualizerBand bands[] = { Band(kCADSPFilter_HighPass, 40, 0.707, 0), Band(kCADSPFilter_Peaking, 1000, 2, 6),
+								   Band(kCADSPFilter_HighShelf, 8000, 0.707, -3) };
+	eq->SetBands(bands, 3);
+	chain.Add(eq);
+	CADSPGain *gain = new CADSPGain(2.0f);
+	chain.Add(gain);
+	chain.Add(new CADSPLimiter(0.8f, 0.01));
+	CADSPDelay *delay = new CADSPDelay(0.1, 0.003);
+	delay->SetFeedback(0.4f);
+	delay->SetMix(0.5f);
+	chain.Add(delay);
+	chain.Prepare(5, kSampleRate);
+	gain->SetGain(0.75f);
+}
+
+} // namespace
+
+TEST(CADSPChainTest, BiquadKernelsMatchScalar)
+{
+	const CABiquadKernels &scalar = *CAGetBiquadKernels(kCASampleConversionISA_Scalar);
+	std::mt19937 random(3);
+	std::uniform_real_distribution<Float64> frequency(30.0, 20000.0), q(0.3, 8.0), gain(-12.0, 12.0);
+	for (const CABiquadKernels *kernels : AvailableKernels()) {
+		for (UInt32 nSections : { 1u, 5u, 11u }) {
+			std::vector<CABiquadCoefficients> sections;
+			for (UInt32 s = 0; s < nSections; ++s)
+				sections.push_back(CADSPEqualizer::Design(Band(CADSPFilterType(s % 5), frequency(random), q(random), gain(random)),
+														  kSampleRate));
+			for (int nChannels : { 1, 3, 4, 7, 8, 12, 19 }) {
+				for (UInt32 nFrames : { 1u, 3u, 4u, 67u, 256u }) {
+					SCOPED_TRACE(testing::Message() << kernels->mName << ", " << nSections << " sections, " << nChannels
+								 << " channels, " << nFrames << " frames");
+					TestABL expected(nChannels, 2 * nFrames), actual(nChannels, 2 * nFrames);
+					FillRandom(expected, nChannels, 2 * nFrames, random);
+					for (int ch = 0; ch < nChannels; ++ch)
+						std::copy(expected.Channel(ch), expected.Channel(ch) + 2 * nFrames, actual.Channel(ch));
+					std::vector<Float32> expectedState(2 * nSections * nChannels, 0.0f), actualState(expectedState);
+
+					// two blocks, so that the second starts from the state the first left
+					for (UInt32 first = 0; first < 2 * nFrames; first += nFrames) {
+						std::vector<Float32 *> e, a;
+						for (int ch = 0; ch < nChannels; ++ch) {
+							e.push_back(expected.Channel(ch) + first);
+							a.push_back(actual.Channel(ch) + first);
+						}
+						scalar.mProcess(e.data(), nChannels, nFrames, sections.data(), nSections, expectedState.data());
+						kernels->mProcess(a.data(), nChannels, nFrames, sections.data(), nSections, actualState.data());
+					}
+					for (int ch = 0; ch < nChannels; ++ch)
+						for (UInt32 i = 0; i < 2 * nFrames; ++i)
+							ASSERT_NEAR(expected.Sample(ch, i), actual.Sample(ch, i), 1e-5f * std::max(1.0f, std::fabs(expected.Sample(ch, i))))
+								<< "channel " << ch << " frame " << i;
+				}
+			}
+		}
+	}
+}
+
+TEST(CADSPChainTest, EqualizerShapesTheResponse)
+{
+	const UInt32 kFrames = 9600;
+	struct Case {
+		CADSPEqualizerBand	mBand;
+		Float64				mFrequency;		// of the sine put through it
+		Float64				mGainDB;		// expected
+		Float64				mToleranceDB;
+	} cases[] = {
+		{ Band(kCADSPFilter_Peaking, 1000, 1.0, 6.0), 1000, 6.0, 0.05 },
+		{ Band(kCADSPFilter_Peaking, 1000, 1.0, 6.0), 50, 0.0, 0.1 },
+		{ Band(kCADSPFilter_Peaking, 1000, 1.0, -9.0), 1000, -9.0, 0.05 },
+		{ Band(kCADSPFilter_LowShelf, 200, 0.707, 4.0), 30, 4.0, 0.2 },
+		{ Band(kCADSPFilter_HighShelf, 4000, 0.707, -4.0), 14000, -4.0, 0.2 },
+		{ Band(kCADSPFilter_LowPass, 1000, 0.707, 0.0), 1000, -3.01, 0.05 },
+		// steeper than the analog filter's -40: the bilinear transform puts Nyquist at infinity
+		{ Band(kCADSPFilter_LowPass, 1000, 0.707, 0.0), 10000, -42.8, 0.2 },
+		{ Band(kCADSPFilter_HighPass, 1000, 0.707, 0.0), 100, -40.0, 1.5 },
+	};
+	for (const CABiquadKernels *kernels : AvailableKernels()) {
+		for (const Case &c : cases) {
+			SCOPED_TRACE(testing::Message() << kernels->mName << ", filter " << c.mBand.mType << " at " << c.mBand.mFrequency
+						 << " Hz, sine at " << c.mFrequency << " Hz");
+			CADSPChain chain;
+			CADSPEqualizer *eq = new CADSPEqualizer(kernels);
+			eq->SetBands(&c.mBand, 1);
+			chain.Add(eq);
+			chain.Prepare(6, kSampleRate);
+			TestABL abl(6, kFrames);
+			FillSine(abl, 6, kFrames, c.mFrequency, 0.5f);
+			ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+			EXPECT_NEAR(c.mGainDB, ResponseDB(CADSPEqualizer::Design(c.mBand, kSampleRate), c.mFrequency), c.mToleranceDB);
+			// and what comes out is what was designed, to within the sampled sine's peaks
+			for (int ch = 0; ch < 6; ++ch)
+				EXPECT_NEAR(ResponseDB(CADSPEqualizer::Design(c.mBand, kSampleRate), c.mFrequency),
+							20.0 * log10(Peak(abl, ch, kFrames / 2, kFrames) / 0.5), 0.1) << "channel " << ch;
+		}
+	}
+}
+
+TEST(CADSPChainTest, GainRampsToEachNewGain)
+{
+	const UInt32 kFrames = 1024;
+	const UInt32 kRampFrames = UInt32(CADSPGain::kRampSeconds * kSampleRate);
+	CADSPChain chain;
+	CADSPGain *gain = new CADSPGain(0.5f);
+	chain.Add(gain);
+	chain.Prepare(2, kSampleRate);
+
+	TestABL abl(2, kFrames);
+	for (int ch = 0; ch < 2; ++ch)
+		std::fill(abl.Channel(ch), abl.Channel(ch) + kFrames, 1.0f);
+	ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+	EXPECT_EQ(0.5f, abl.Sample(0, 0));
+	EXPECT_EQ(0.5f, abl.Sample(1, kFrames - 1));
+
+	gain->SetGain(0.25f);
+	EXPECT_EQ(0.25f, gain->GetGain());
+	for (int ch = 0; ch < 2; ++ch)
+		std::fill(abl.Channel(ch), abl.Channel(ch) + kFrames, 1.0f);
+	ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+	EXPECT_EQ(0.5f, abl.Sample(0, 0));
+	for (UInt32 i = 1; i < kRampFrames; ++i)
+		ASSERT_LT(abl.Sample(0, i), abl.Sample(0, i - 1)) << "frame " << i;
+	EXPECT_GT(abl.Sample(0, kRampFrames - 1), 0.25f);
+	for (UInt32 i = kRampFrames; i < kFrames; ++i)
+		ASSERT_EQ(0.25f, abl.Sample(1, i)) << "frame " << i;
+}
+
+TEST(CADSPChainTest, LimiterHoldsPeaksUnderTheThreshold)
+{
+	const UInt32 kFrames = 48000;
+	CADSPChain chain;
+	chain.Add(new CADSPLimiter(0.5f, 0.02));
+	chain.Prepare(3, kSampleRate);
+
+	// loud for a quarter of a second, with spikes on one channel, then quiet
+	TestABL abl(3, kFrames);
+	FillSine(abl, 3, kFrames, 440, 0.1f);
+	for (int ch = 0; ch < 3; ++ch)
+		for (UInt32 i = 0; i < kFrames / 4; ++i)
+			abl.Channel(ch)[i] *= 15.0f;
+	for (UInt32 i = 100; i < kFrames / 4; i += 997)
+		abl.Channel(2)[i] = 4.0f;
+	std::vector<Float32> quiet(abl.Channel(0) + kFrames / 2, abl.Channel(0) + kFrames);
+	Float32 beside = abl.Channel(0)[100];
+
+	for (UInt32 first = 0; first < kFrames; first += 512) {
+		Slice slice(abl, 3, first, std::min(512u, kFrames - first));
+		ASSERT_EQ(kCADSPChainError_OK, chain.Process(slice.List(), std::min(512u, kFrames - first)));
+	}
+	for (int ch = 0; ch < 3; ++ch)
+		EXPECT_LE(Peak(abl, ch, 0, kFrames), 0.5f * (1.0f + 1e-6f)) << "channel " << ch;
+	EXPECT_GT(Peak(abl, 0, 0, kFrames / 4), 0.49f);
+	// one gain for every channel: the spikes on channel 2 duck channel 0 too
+	EXPECT_NEAR(beside * 0.125f, abl.Channel(0)[100], 1e-6f);
+	// and after ten release times, it's all back
+	for (UInt32 i = 0; i < quiet.size(); ++i)
+		ASSERT_NEAR(quiet[i], abl.Channel(0)[kFrames / 2 + i], 1e-6f) << "frame " << kFrames / 2 + i;
+}
+
+TEST(CADSPChainTest, DelayTapsAndFeedsBack)
+{
+	const UInt32 kFrames = 4096;
+	const UInt32 kDelayFrames = 480;
+	CADSPChain chain;
+	CADSPDelay *delay = new CADSPDelay(0.05, kDelayFrames / kSampleRate);
+	delay->SetFeedback(0.5f);
+	chain.Add(delay);
+	chain.Prepare(2, kSampleRate);
+	EXPECT_GE(delay->GetMaxDelayFrames(), UInt32(0.05 * kSampleRate));
+
+	TestABL abl(2, kFrames);
+	for (int ch = 0; ch < 2; ++ch) {
+		std::fill(abl.Channel(ch), abl.Channel(ch) + kFrames, 0.0f);
+		abl.Channel(ch)[ch] = 1.0f;
+	}
+	// in blocks shorter than the delay, and longer
+	for (UInt32 first = 0, n = 100; first < kFrames; first += n, n = 1700 - n) {
+		n = std::min(n, kFrames - first);
+		Slice slice(abl, 2, first, n);
+		ASSERT_EQ(kCADSPChainError_OK, chain.Process(slice.List(), n));
+	}
+	for (int ch = 0; ch < 2; ++ch)
+		for (UInt32 i = 0; i < kFrames; ++i) {
+			Float32 expected = 0.0f;
+			if (i >= kDelayFrames + ch && (i - ch) % kDelayFrames == 0)
+				expected = ldexpf(1.0f, -int((i - ch) / kDelayFrames - 1));
+			ASSERT_EQ(expected, abl.Sample(ch, i)) << "channel " << ch << " frame " << i;
+		}
+
+	// no delay passes the input straight through, and one past the end is held to it
+	delay->SetDelay(0.0);
+	delay->SetFeedback(0.0f);
+	abl.Fill(0);
+	ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+	EXPECT_EQ(SampleValue(1, 17), abl.Sample(1, 17));
+	delay->SetDelay(10.0);
+	abl.Fill(0);
+	ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+	EXPECT_EQ(SampleValue(1, kFrames - 1 - delay->GetMaxDelayFrames()), abl.Sample(1, kFrames - 1));
+}
+
+// The lines are long enough for the maximum at any rate up to kMaxSampleRate: a move to a higher
+// rate keeps the delay the same length in seconds, not in frames.
+TEST(CADSPChainTest, DelayKeepsItsLengthAcrossRateChanges)
+{
+	const UInt32 kFrames = 150000;
+	CADSPChain chain;
+	CADSPDelay *delay = new CADSPDelay(1.0, 0.75);
+	chain.Add(delay);
+	chain.Prepare(2, kSampleRate);
+	EXPECT_EQ(UInt32(kSampleRate), delay->GetMaxDelayFrames());
+
+	for (Float64 rate : { 96000.0, 192000.0, 44100.0 }) {
+		SCOPED_TRACE(testing::Message() << rate << " Hz");
+		chain.SetSampleRate(rate);
+		chain.Reset();
+		EXPECT_EQ(UInt32(rate), delay->GetMaxDelayFrames());
+		EXPECT_EQ(0.75, delay->GetDelay());
+
+		TestABL abl(2, kFrames);
+		for (int ch = 0; ch < 2; ++ch) {
+			std::fill(abl.Channel(ch), abl.Channel(ch) + kFrames, 0.0f);
+			abl.Channel(ch)[0] = 1.0f;
+		}
+		for (UInt32 first = 0; first < kFrames; first += 4096) {
+			Slice slice(abl, 2, first, std::min(4096u, kFrames - first));
+			ASSERT_EQ(kCADSPChainError_OK, chain.Process(slice.List(), std::min(4096u, kFrames - first)));
+		}
+		const UInt32 expected = UInt32(0.75 * rate);
+		for (int ch = 0; ch < 2; ++ch)
+			for (UInt32 i = 0; i < std::min(kFrames, 2 * expected); ++i)
+				ASSERT_EQ(i == expected ? 1.0f : 0.0f, abl.Sample(ch, i)) << "channel " << ch << " frame " << i;
+	}
+}
+
+// Reset runs on the IO thread as the output starts, so it can't clear lines long enough for a second
+// at kMaxSampleRate: on 64 channels it takes microseconds, not the milliseconds a clear would, and
+// what the lines held before it still never comes out, whatever delay is set after.
+TEST(CADSPChainTest, DelayResetsWithoutClearingTheLines)
+{
+	const int kChannels = 64;
+	const UInt32 kFrames = 4096;
+	CADSPChain chain;
+	CADSPDelay *delay = new CADSPDelay(1.0, 0.01);
+	delay->SetFeedback(0.5f);
+	chain.Add(delay);
+	chain.Prepare(kChannels, kSampleRate);
+
+	std::mt19937 random(25);
+	TestABL abl(kChannels, kFrames);
+	for (int i = 0; i < 16; ++i) {
+		FillRandom(abl, kChannels, kFrames, random);
+		ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+	}
+
+	// the best of a few, against clearing 64 lines of 262144 floats
+	Float64 resetSeconds = 1.0;
+	for (int i = 0; i < 5; ++i) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		chain.Reset();
+		resetSeconds = std::min(resetSeconds, std::chrono::duration<Float64>(std::chrono::steady_clock::now() - start).count());
+	}
+	EXPECT_LT(resetSeconds, 50e-6);
+
+	// a longer delay than has been written since reads silence too, up to the impulse
+	delay->SetFeedback(0.0f);
+	for (int ch = 0; ch < kChannels; ++ch) {
+		std::fill(abl.Channel(ch), abl.Channel(ch) + kFrames, 0.0f);
+		abl.Channel(ch)[0] = 1.0f;
+	}
+	ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), 1000));
+	delay->SetDelay(0.05);
+	Slice rest(abl, kChannels, 1000, kFrames - 1000);
+	ASSERT_EQ(kCADSPChainError_OK, chain.Process(rest.List(), kFrames - 1000));
+	for (int ch = 0; ch < kChannels; ++ch)
+		for (UInt32 i = 0; i < kFrames; ++i) {
+			Float32 expected = (i == 480 || i == 2400) ? 1.0f : 0.0f;
+			ASSERT_EQ(expected, abl.Sample(ch, i)) << "channel " << ch << " frame " << i;
+		}
+}
+
+// A pending rate waits for the IO thread to take it up, and so do the designs posted after it: the
+// blocks until then are delayed at the old rate's length in frames.
+TEST(CADSPChainTest, PendingRateWaitsToBeTakenUp)
+{
+	const UInt32 kFrames = 4096;
+	CADSPChain chain;
+	CADSPDelay *delay = new CADSPDelay(0.1, 0.01);
+	chain.Add(delay);
+	chain.Prepare(1, kSampleRate);
+
+	// where an impulse at the start of a block comes out
+	auto delayed = [&]() {
+		TestABL abl(1, kFrames);
+		std::fill(abl.Channel(0), abl.Channel(0) + kFrames, 0.0f);
+		abl.Channel(0)[0] = 1.0f;
+		chain.Reset();
+		EXPECT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+		for (UInt32 i = 0; i < kFrames; ++i)
+			if (abl.Channel(0)[i] != 0.0f)
+				return i;
+		return kFrames;
+	};
+
+	EXPECT_EQ(480u, delayed());
+	chain.SetPendingSampleRate(96000);
+	EXPECT_EQ(480u, delayed());
+	delay->SetDelay(0.02);
+	EXPECT_EQ(480u, delayed());
+	chain.TakeUpSampleRate(96000);
+	EXPECT_EQ(1920u, delayed());
+
+	// and SetSampleRate, for the next block
+	chain.SetSampleRate(kSampleRate);
+	EXPECT_EQ(960u, delayed());
+}
+
+// The same signal through two chains, one in a single block and one in blocks of every size:
+// every processor carries its state from one block to the next exactly.
+TEST(CADSPChainTest, ProcessesAlikeInAnyBlockSize)
+{
+	const UInt32 kFrames = 8192;
+	CADSPChain whole, pieces;
+	AddEverything(whole);
+	AddEverything(pieces);
+	std::mt19937 random(5);
+	TestABL a(5, kFrames), b(5, kFrames);
+	FillRandom(a, 5, kFrames, random);
+	for (int ch = 0; ch < 5; ++ch)
+		std::copy(a.Channel(ch), a.Channel(ch) + kFrames, b.Channel(ch));
+
+	ASSERT_EQ(kCADSPChainError_OK, whole.Process(a.List(), kFrames));
+	std::uniform_int_distribution<UInt32> size(1, 700);
+	for (UInt32 first = 0; first < kFrames; ) {
+		UInt32 n = std::min(size(random), kFrames - first);
+		Slice slice(b, 5, first, n);
+		ASSERT_EQ(kCADSPChainError_OK, pieces.Process(slice.List(), n));
+		first += n;
+	}
+	for (int ch = 0; ch < 5; ++ch)
+		for (UInt32 i = 0; i < kFrames; ++i)
+			ASSERT_EQ(a.Sample(ch, i), b.Sample(ch, i)) << "channel " << ch << " frame " << i;
+}
+
+TEST(CADSPChainTest, OrderChangesAtTheNextBlock)
+{
+	const UInt32 kFrames = 64;
+	CADSPChain chain;
+	ASSERT_EQ(kCADSPChainError_OK, chain.Add(new CADSPGain(2.0f)));
+	ASSERT_EQ(kCADSPChainError_OK, chain.Add(new CADSPLimiter(1.0f, 0.0)));	// back up at once
+	chain.Prepare(2, kSampleRate);
+	EXPECT_EQ(2u, chain.GetNumberProcessors());
+	EXPECT_STREQ("Limiter", chain.GetProcessor(1)->GetName());
+	EXPECT_EQ(NULL, chain.GetProcessor(2));
+
+	TestABL abl(2, kFrames);
+	auto run = [&]() {
+		for (int ch = 0; ch < 2; ++ch)
+			std::fill(abl.Channel(ch), abl.Channel(ch) + kFrames, 0.75f);
+		EXPECT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+		return abl.Sample(1, kFrames - 1);
+	};
+	EXPECT_EQ(1.0f, run());
+	const UInt32 reversed[] = { 1, 0 };
+	ASSERT_EQ(kCADSPChainError_OK, chain.SetOrder(reversed, 2));
+	EXPECT_EQ(1.5f, run());
+	ASSERT_EQ(kCADSPChainError_OK, chain.SetOrder(NULL, 0));
+	EXPECT_EQ(0.75f, run());
+	ASSERT_EQ(kCADSPChainError_OK, chain.SetOrder(reversed + 1, 1));
+	EXPECT_EQ(1.5f, run());
+
+	const UInt32 missing[] = { 0, 2 };
+	EXPECT_EQ(kCADSPChainError_NoSuchProcessor, chain.SetOrder(missing, 2));
+	EXPECT_EQ(1.5f, run());
+	TestABL mono(1, kFrames);
+	EXPECT_EQ(kCADSPChainError_Channels, chain.Process(mono.List(), kFrames));
+
+	while (chain.GetNumberProcessors() < CADSPChain::kMaxProcessors)
+		ASSERT_EQ(kCADSPChainError_OK, chain.Add(new CADSPGain));
+	CADSPGain extra;
+	EXPECT_EQ(kCADSPChainError_Full, chain.Add(&extra));
+	CADSPEqualizerBand bands[CADSPEqualizer::kMaxBands + 1] = { };
+	CADSPEqualizer eq;
+	EXPECT_EQ(kCADSPChainError_Full, eq.SetBands(bands, CADSPEqualizer::kMaxBands + 1));
+	EXPECT_EQ(kCADSPChainError_OK, eq.SetBands(bands, CADSPEqualizer::kMaxBands));
+
+	// nothing to run: ioData isn't even looked at
+	chain.RemoveAll();
+	EXPECT_EQ(kCADSPChainError_OK, chain.Process(mono.List(), kFrames));
+}
+
+// A control thread changes the gain, the bands and the order as fast as it can while blocks run,
+// and a second, as the engine's Reconfigure would from a device notification, sets the rate over
+// and over: each block sees one whole set of coefficients or another, never a mixture.
+TEST(CADSPChainTest, ControlThreadUpdatesWithoutLocks)
+{
+	const UInt32 kFrames = 128;
+	CADSPChain chain;
+	CADSPGain *gain = new CADSPGain(0.5f);
+	CADSPEqualizer *eq = new CADSPEqualizer;
+	chain.Add(gain);
+	chain.Add(eq);
+	chain.Prepare(4, kSampleRate);
+
+	std::atomic<bool> done(false);
+	std::thread control([&]() {
+		const CADSPEqualizerBand flat[] = { Band(kCADSPFilter_Peaking, 1000, 1.0, 0.0), Band(kCADSPFilter_LowShelf, 100, 0.7, 0.0) };
+		const CADSPEqualizerBand steep[] = { Band(kCADSPFilter_HighPass, 20, 0.7, 0.0), Band(kCADSPFilter_Peaking, 5000, 4.0, 0.0),
+											 Band(kCADSPFilter_LowPass, 20000, 0.7, 0.0) };
+		const UInt32 both[] = { 0, 1 }, first[] = { 0 };
+		for (UInt32 n = 0; !done.load(); ++n) {
+			gain->SetGain(n & 1 ? 0.25f : 0.5f);
+			if (n % 3 == 0)
+				eq->SetBands(n & 1 ? flat : steep, n & 1 ? 2 : 3);
+			if (n % 7 == 0)
+				chain.SetOrder(n & 8 ? first : both, n & 8 ? 1 : 2);
+		}
+	});
+	std::thread device([&]() {
+		while (!done.load())
+			chain.SetSampleRate(kSampleRate);
+	});
+
+	TestABL abl(4, kFrames);
+	for (int block = 0; block < 20000; ++block) {
+		for (int ch = 0; ch < 4; ++ch)
+			std::fill(abl.Channel(ch), abl.Channel(ch) + kFrames, 1.0f);
+		ASSERT_EQ(kCADSPChainError_OK, chain.Process(abl.List(), kFrames));
+		for (int ch = 0; ch < 4; ++ch)
+			for (UInt32 i = 0; i < kFrames; ++i)
+				ASSERT_TRUE(std::isfinite(abl.Sample(ch, i)) && std::fabs(abl.Sample(ch, i)) < 4.0f)
+					<< "block " << block << " channel " << ch << " frame " << i << ": " << abl.Sample(ch, i);
+	}
+	done = true;
+	control.join();
+	device.join();
+}
+
+// A tenth of a second's delay on the output adds that to the latency the simulated output hears,
+// through the varispeed and through the engine's resampler, and is otherwise transparent.
+TEST(CADSPChainTest, DelaysThePlayThrough)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mNominalSampleRate = 44100;
+	input.mDriftPPM = 100;
+	output.mChannels = 3;
+
+	for (int varispeed = 1; varispeed >= 0; --varispeed) {
+		SCOPED_TRACE(varispeed ? "varispeed" : "resampled");
+		Float64 latency[2];
+		for (int delayed = 0; delayed < 2; ++delayed) {
+			CASimulatedBackend backend(input, output, 1);
+			backend.SetVarispeed(varispeed);
+			CAPlayThroughEngine engine(backend);
+			if (delayed) {
+				engine.GetDSPChain().Add(new CADSPGain);
+				engine.GetDSPChain().Add(new CADSPDelay(0.2, 0.1));
+			}
+			engine.Allocate(input.mChannels, output.mChannels);
+			EXPECT_EQ(3u, engine.GetDSPChain().GetNumberChannels());
+			engine.ComputeThruOffset();
+			backend.SetClient(&engine);
+			backend.Run(60);
+
+			CASimulatedBackendStats stats;
+			backend.GetStats(stats);
+			EXPECT_EQ(0u, stats.mDropouts);
+			EXPECT_EQ(0u, stats.mDiscontinuities);
+			latency[delayed] = stats.mLatencyP50;
+		}
+		EXPECT_NEAR(0.1, latency[1] - latency[0], 0.0005);
+	}
+}
+
+// A block the chain refuses, here for a chain prepared for the wrong number of channels, is played
+// as silence rather than unprocessed, and counted.
+TEST(CADSPChainTest, RefusedBlocksPlayAsSilence)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+
+	for (int varispeed = 1; varispeed >= 0; --varispeed) {
+		SCOPED_TRACE(varispeed ? "varispeed" : "resampled");
+		CASimulatedBackend backend(input, output, 1);
+		backend.SetVarispeed(varispeed);
+		CAPlayThroughEngine engine(backend);
+		engine.GetDSPChain().Add(new CADSPGain(0.5f));
+		engine.Allocate(input.mChannels, output.mChannels);
+		engine.ComputeThruOffset();
+		backend.SetClient(&engine);
+		backend.Run(5);
+
+		CASimulatedBackendStats before, after;
+		backend.GetStats(before);
+		CAPlayThroughMetrics::Snapshot snapshot;
+		engine.GetMetrics().GetSnapshot(snapshot);
+		EXPECT_EQ(0u, snapshot.mDSPErrors);
+		EXPECT_EQ(0u, snapshot.mOutput.mErrors);
+
+		engine.GetDSPChain().Prepare(output.mChannels + 1, input.mNominalSampleRate);
+		backend.Run(5);
+		backend.GetStats(after);
+		engine.GetMetrics().GetSnapshot(snapshot);
+		EXPECT_GT(snapshot.mDSPErrors, 0u);
+		EXPECT_EQ(snapshot.mDSPErrors, snapshot.mOutput.mErrors);
+		EXPECT_EQ(after.mFramesPlayed - before.mFramesPlayed, after.mSilentFrames - before.mSilentFrames);
+	}
+}
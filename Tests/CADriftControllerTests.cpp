@@ -0,0 +1,119 @@
+/*=============================================================================
+	CADriftControllerTests.cpp
+
+	CADriftController against a model of two drifting clocks: the latency
+	grows by the input's rate less the rate the varispeed consumes at.
+=============================================================================*/
+
+#include "CADriftController.h"
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+
+namespace {
+
+struct Loop {
+	explicit Loop(Float64 clockRatio, Float64 startRate = 1.0) : mClockRatio(clockRatio), mLatencyError(0), mTime(0)
+	{
+		mController.Reset(startRate);
+	}
+
+	// one output callback of 512 frames at 48 kHz, the error measured with some noise
+	void Step(Float64 noise = 0.0)
+	{
+		const Float64 dt = 512 / 48000.0;
+		Float64 rate = mController.Update(mLatencyError + noise, dt);
+		mLatencyError += (mClockRatio - rate) * dt;
+		mTime += dt;
+	}
+
+	// runs for that long; returns when |error| last exceeded the tolerance
+	Float64 Run(Float64 seconds, Float64 tolerance)
+	{
+		Float64 settled = mTime;
+		for (Float64 end = mTime + seconds; mTime < end; ) {
+			Step();
+			if (std::fabs(mLatencyError) > tolerance)
+				settled = mTime;
+		}
+		return settled;
+	}
+
+	CADriftController	mController;
+	Float64				mClockRatio;
+	Float64				mLatencyError;		// seconds
+	Float64				mTime;
+};
+
+} // namespace
+
+TEST(CADriftControllerTest, LearnsTheClockRatio)
+{
+	// the clocks 400 ppm apart and the controller starting from 1
+	Loop loop(1.0004);
+	Float64 settled = loop.Run(120, 10e-6);
+
+	// critically damped: one overshoot-free hump of about 0.0004 / (e w) seconds, then settled
+	EXPECT_LT(settled, 30.0);
+	EXPECT_LT(std::fabs(loop.mLatencyError), 1e-7);
+	EXPECT_NEAR(1.0004, loop.mController.GetRate(), 1e-8);
+}
+
+TEST(CADriftControllerTest, RemovesAStepInLatency)
+{
+	Loop loop(1.0);
+	loop.mLatencyError = 0.005;
+	Float64 settled = loop.Run(120, 10e-6);
+
+	EXPECT_LT(settled, 40.0);
+	EXPECT_LT(std::fabs(loop.mLatencyError), 1e-7);
+	EXPECT_NEAR(1.0, loop.mController.GetRate(), 1e-8);
+}
+
+TEST(CADriftControllerTest, WiderBandwidthSettlesFaster)
+{
+	Float64 settled[2];
+	Float64 bandwidths[2] = { 0.05, 0.2 };
+	for (int i = 0; i < 2; ++i) {
+		Loop loop(0.9998);
+		loop.mController.SetBandwidth(bandwidths[i]);
+		settled[i] = loop.Run(120, 10e-6);
+	}
+	EXPECT_LT(settled[1] * 3, settled[0]);
+}
+
+TEST(CADriftControllerTest, StaysWithinTheRateLimit)
+{
+	Loop loop(1.0);
+	loop.mController.SetMaxRateDeviation(0.001);
+	loop.mLatencyError = 0.1;
+
+	Float64 maxRate = 1.0;
+	for (int i = 0; i < 50000; ++i) {
+		loop.Step();
+		maxRate = std::max(maxRate, loop.mController.GetRate());
+	}
+	EXPECT_DOUBLE_EQ(1.001, maxRate);
+	// no wind-up while pinned: a small overshoot at most
+	EXPECT_LT(std::fabs(loop.mLatencyError), 1e-6);
+}
+
+TEST(CADriftControllerTest, RidesOutMeasurementJitter)
+{
+	// each measurement up to 2 ms off, as when the callback that takes it is late
+	Loop loop(1.0002);
+	std::mt19937 random(3);
+	std::uniform_real_distribution<Float64> jitter(-0.001, 0.001);
+	loop.Run(60, 1);
+
+	Float64 sumSquares = 0, maxDeviation = 0;
+	const int kSteps = 20000;
+	for (int i = 0; i < kSteps; ++i) {
+		loop.Step(jitter(random));
+		sumSquares += loop.mLatencyError * loop.mLatencyError;
+		maxDeviation = std::max(maxDeviation, std::fabs(loop.mController.GetRate() - 1.0002));
+	}
+	EXPECT_LT(std::sqrt(sumSquares / kSteps), 200e-6);		// steady-state error, RMS
+	EXPECT_LT(maxDeviation, 0.001);						// under 2 cents of pitch
+}
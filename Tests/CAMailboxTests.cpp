@@ -0,0 +1,87 @@
+/*=============================================================================
+	CAMailboxTests.cpp
+
+	CAMailbox on one thread, and with a writer posting as fast as it can
+	while a reader takes: every value taken is whole, and newer than the
+	last.
+=============================================================================*/
+
+#include "CAMailbox.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+
+namespace {
+
+struct Value {
+	UInt64		mSequence;
+	UInt64		mCheck[7];		// each the sequence times its index, so that a torn value shows
+};
+
+} // namespace
+
+TEST(CAMailboxTest, TakesTheLatest)
+{
+	CAMailbox<int> mailbox;
+	int value = -1;
+	EXPECT_FALSE(mailbox.Take(value));
+
+	mailbox.Post(1);
+	EXPECT_TRUE(mailbox.Take(value));
+	EXPECT_EQ(1, value);
+	EXPECT_FALSE(mailbox.Take(value));
+	EXPECT_EQ(1, value);
+
+	for (int i = 2; i <= 10; ++i)
+		mailbox.Post(i);
+	EXPECT_TRUE(mailbox.Take(value));
+	EXPECT_EQ(10, value);
+	EXPECT_FALSE(mailbox.Take(value));
+
+	mailbox.Post(11);
+	mailbox.Clear();
+	EXPECT_FALSE(mailbox.Take(value));
+	mailbox.Post(12);
+	EXPECT_TRUE(mailbox.Take(value));
+	EXPECT_EQ(12, value);
+}
+
+TEST(CAMailboxTest, ConcurrentPostAndTakeNeverTear)
+{
+	const UInt64 kValues = 2000000;
+	CAMailbox<Value> mailbox;
+	std::atomic<bool> done(false);
+
+	std::thread writer([&]() {
+		Value value;
+		for (UInt64 n = 1; n <= kValues; ++n) {
+			value.mSequence = n;
+			for (int i = 0; i < 7; ++i)
+				value.mCheck[i] = n * (i + 1);
+			mailbox.Post(value);
+		}
+		done = true;
+	});
+
+	UInt64 last = 0, taken = 0, torn = 0, backwards = 0;
+	Value value;
+	for (;;) {
+		bool finished = done.load();
+		while (mailbox.Take(value)) {
+			for (int i = 0; i < 7; ++i)
+				torn += (value.mCheck[i] != value.mSequence * (i + 1));
+			backwards += (value.mSequence <= last);
+			last = value.mSequence;
+			++taken;
+		}
+		if (finished)
+			break;
+	}
+	writer.join();
+
+	EXPECT_EQ(0u, torn);
+	EXPECT_EQ(0u, backwards);
+	EXPECT_EQ(kValues, last);
+	EXPECT_GT(taken, 1u);
+}
@@ -0,0 +1,194 @@
+/*=============================================================================
+	CAPlayThroughMetricsTests.cpp
+
+	CAPlayThroughMetrics on its own, fed made-up times, and as the engine
+	keeps it while the simulated backend runs offline and in real time.
+=============================================================================*/
+
+#include "CAPlayThroughEngine.h"
+#include "CASimulatedBackend.h"
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+struct SimulatedPlayThrough {
+	SimulatedPlayThrough(const CASimulatedDeviceConfig &input, const CASimulatedDeviceConfig &output, bool varispeed = true) :
+		mBackend(input, output, 1), mEngine(mBackend)
+	{
+		mBackend.SetVarispeed(varispeed);
+		mEngine.Allocate(input.mChannels, output.mChannels);
+		mEngine.ComputeThruOffset();
+		mBackend.SetClient(&mEngine);
+	}
+
+	CASimulatedBackend	mBackend;
+	CAPlayThroughEngine	mEngine;
+};
+
+UInt64 FetchCount(const CAPlayThroughMetrics::Snapshot &snapshot, CARingBufferError err)
+{
+	return snapshot.mFetchResults[CAPlayThroughMetrics::FetchResultIndex(err)];
+}
+
+} // namespace
+
+TEST(CAPlayThroughMetricsTest, HistogramsBucketByPowersOfTwo)
+{
+	CAPlayThroughMetrics metrics;
+	// callbacks 1 ms apart lasting 100 us, and one lasting 3 ms
+	UInt64 now = 1000000000;
+	for (int i = 0; i < 100; ++i, now += 1000000) {
+		metrics.CallbackBegan(CAPlayThroughMetrics::kOutput, now);
+		metrics.CallbackEnded(CAPlayThroughMetrics::kOutput, now + (i == 50 ? 3000000 : 100000), i == 50 ? -1 : noErr);
+	}
+
+	CAPlayThroughMetrics::Snapshot snapshot;
+	metrics.GetSnapshot(snapshot);
+	EXPECT_EQ(0u, snapshot.mInput.mCallbacks);
+	EXPECT_EQ(100u, snapshot.mOutput.mCallbacks);
+	EXPECT_EQ(1u, snapshot.mOutput.mErrors);
+
+	const CAPlayThroughMetrics::Histogram &duration = snapshot.mOutput.mDuration;
+	EXPECT_EQ(100u, duration.mCount);
+	EXPECT_EQ(3000000u, duration.mMaxNanos);
+	EXPECT_DOUBLE_EQ((99 * 100000.0 + 3000000) / 100, duration.MeanNanos());
+	EXPECT_EQ(99u, duration.mBuckets[16]);		// 100 us is in [65536, 131072) ns
+	EXPECT_EQ(1u, duration.mBuckets[21]);		// 3 ms is in [2097152, 4194304) ns
+	EXPECT_EQ(131072u, duration.PercentileNanos(50));
+	EXPECT_EQ(131072u, duration.PercentileNanos(99));
+	EXPECT_EQ(3000000u, duration.PercentileNanos(100));	// no further than the max
+
+	// no interval before the first callback
+	const CAPlayThroughMetrics::Histogram &interval = snapshot.mOutput.mInterval;
+	EXPECT_EQ(99u, interval.mCount);
+	EXPECT_EQ(99u, interval.mBuckets[19]);		// 1 ms is in [524288, 1048576) ns
+}
+
+TEST(CAPlayThroughMetricsTest, CountsWhatTheEngineCounts)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+
+	// the output stalls for longer than the ring holds, so the engine has to move its read position
+	SimulatedPlayThrough sim(input, output);
+	sim.mBackend.Run(5);
+	sim.mBackend.Stall(CAPlayThroughBackend::kOutput, 2.0);
+	sim.mBackend.Run(10);
+
+	CASimulatedBackendStats backendStats;
+	CAPlayThroughEngineStats engineStats;
+	CAPlayThroughMetrics::Snapshot snapshot;
+	sim.mBackend.GetStats(backendStats);
+	sim.mEngine.GetStats(engineStats);
+	sim.mEngine.GetMetrics().GetSnapshot(snapshot);
+
+	EXPECT_EQ(backendStats.mInputCallbacks, snapshot.mInput.mCallbacks);
+	EXPECT_EQ(backendStats.mOutputCallbacks, snapshot.mOutput.mCallbacks);
+	EXPECT_EQ(0u, snapshot.mInput.mErrors);
+
+	UInt64 fetches = 0;
+	for (int i = 0; i < CAPlayThroughMetrics::kFetchResultCount; ++i)
+		fetches += snapshot.mFetchResults[i];
+	// one a callback, but for the silent ones before the input has started
+	EXPECT_LE(fetches, snapshot.mOutput.mCallbacks);
+	EXPECT_GE(fetches + 4, snapshot.mOutput.mCallbacks);
+	EXPECT_GT(FetchCount(snapshot, kCARingBufferError_OK), fetches * 9 / 10);
+	EXPECT_EQ(engineStats.mUnderruns, FetchCount(snapshot, kCARingBufferError_SlightlyAhead) +
+									  FetchCount(snapshot, kCARingBufferError_WayAhead));
+	EXPECT_GE(snapshot.mOffsetAdjustments, engineStats.mUnderruns + engineStats.mOverruns);
+	EXPECT_GE(engineStats.mOverruns, 1u);
+
+	EXPECT_EQ(engineStats.mRate, snapshot.mRate);
+	EXPECT_EQ(engineStats.mTargetLatency, snapshot.mTargetLatency);
+	EXPECT_GT(snapshot.mRingFill, 0);
+	EXPECT_LT(snapshot.mRingFill, engineStats.mTargetLatency + 2 * input.mBufferSizeFrames);
+}
+
+// the silent ones as well: before the input starts, and while the new ring fills after a Reconfigure
+TEST(CAPlayThroughMetricsTest, CountsTheSilentCallbacks)
+{
+	for (bool varispeed : { true, false }) {
+		SCOPED_TRACE(testing::Message() << "varispeed " << varispeed);
+		SimulatedPlayThrough sim(CASimulatedBackend::DefaultDeviceConfig(), CASimulatedBackend::DefaultDeviceConfig(), varispeed);
+		sim.mBackend.Run(2);
+		sim.mBackend.SetSampleRate(CAPlayThroughBackend::kInput, 48000);
+		ASSERT_EQ(noErr, sim.mEngine.Reconfigure());
+		sim.mBackend.Run(2);
+
+		CASimulatedBackendStats backendStats;
+		CAPlayThroughMetrics::Snapshot snapshot;
+		sim.mBackend.GetStats(backendStats);
+		sim.mEngine.GetMetrics().GetSnapshot(snapshot);
+		EXPECT_GT(backendStats.mSilentFrames, 0u);
+		EXPECT_EQ(backendStats.mOutputCallbacks, snapshot.mOutput.mCallbacks);
+		EXPECT_EQ(backendStats.mOutputCallbacks, snapshot.mOutput.mDuration.mCount);
+		EXPECT_EQ(0u, snapshot.mOutput.mErrors);
+	}
+}
+
+TEST(CAPlayThroughMetricsTest, ReadWhileRunningInRealTime)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mBufferSizeFrames = 256;
+	output.mBufferSizeFrames = 256;
+
+	SimulatedPlayThrough sim(input, output);
+	ASSERT_EQ(noErr, sim.mBackend.Start());
+	CAPlayThroughMetrics::Snapshot snapshot;
+	UInt64 lastCallbacks = 0;
+	for (int i = 0; i < 10; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		sim.mEngine.GetMetrics().GetSnapshot(snapshot);
+		EXPECT_GE(snapshot.mOutput.mCallbacks, lastCallbacks);
+		lastCallbacks = snapshot.mOutput.mCallbacks;
+	}
+	ASSERT_EQ(noErr, sim.mBackend.Stop());
+	sim.mEngine.GetMetrics().GetSnapshot(snapshot);
+
+	EXPECT_GT(snapshot.mInput.mCallbacks, 40u);
+	EXPECT_GT(snapshot.mOutput.mCallbacks, 40u);
+	EXPECT_GT(FetchCount(snapshot, kCARingBufferError_OK), 0u);
+
+	// callbacks every 256 / 48000 s, give or take the scheduler
+	const Float64 kPeriod = 256 / 48000.0 * 1e9;
+	EXPECT_NEAR(kPeriod, snapshot.mOutput.mInterval.MeanNanos(), kPeriod * 0.2);
+	EXPECT_NEAR(kPeriod, snapshot.mInput.mInterval.MeanNanos(), kPeriod * 0.2);
+	EXPECT_LT(snapshot.mOutput.mDuration.MeanNanos(), kPeriod);
+}
+
+TEST(CAPlayThroughMetricsTest, FormatsReports)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	SimulatedPlayThrough sim(input, output);
+	sim.mBackend.Run(1);
+
+	CAPlayThroughMetrics::Snapshot snapshot;
+	sim.mEngine.GetMetrics().GetSnapshot(snapshot);
+
+	std::string text = CAPlayThroughMetrics::FormatText(snapshot);
+	EXPECT_NE(std::string::npos, text.find("output: "));
+	EXPECT_NE(std::string::npos, text.find("interval"));
+	EXPECT_NE(std::string::npos, text.find("fetch: wayBehind"));
+	EXPECT_NE(std::string::npos, text.find("DSP errors: 0"));
+	EXPECT_NE(std::string::npos, text.find("ring fill"));
+
+	std::string json = CAPlayThroughMetrics::FormatJSON(snapshot);
+	EXPECT_EQ('{', json.front());
+	EXPECT_EQ('}', json.back());
+	EXPECT_EQ(std::string::npos, json.find('\n'));
+	for (const char *key : { "\"input\":{", "\"output\":{", "\"duration\":{", "\"buckets\":[", "\"fetch\":{", "\"ok\":",
+							 "\"offsetAdjustments\":", "\"dspErrors\":", "\"ringFill\":", "\"rate\":", "\"latencyError\":", "\"targetLatency\":" })
+		EXPECT_NE(std::string::npos, json.find(key)) << key;
+
+	int depth = 0;
+	for (char c : json) {
+		depth += (c == '{' || c == '[') - (c == '}' || c == ']');
+		ASSERT_GE(depth, 0);
+	}
+	EXPECT_EQ(0, depth);
+}
@@ -0,0 +1,481 @@
+/*=============================================================================
+	CAPlayThroughRegressionTests.cpp
+
+	Long play-through runs on simulated clocks, offline and so many times
+	faster than real time: mismatched sample rates, drifting clocks, bursty
+	scheduling, buffer size changes, sample rate changes and a downmix, through the
+	engine's ring buffer and offset correction, and through its own
+	resampler where the backend has no varispeed. Each scenario prints the underruns, overruns, silence
+	and latency distribution it saw and checks them against its limits.
+=============================================================================*/
+
+#include "CAPlayThroughEngine.h"
+#include "CASimulatedBackend.h"
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+
+namespace {
+
+struct SimulatedPlayThrough {
+	SimulatedPlayThrough(const CASimulatedDeviceConfig &input, const CASimulatedDeviceConfig &output, UInt32 seed = 1,
+						 bool varispeed = true) :
+		mBackend(input, output, seed), mEngine(mBackend)
+	{
+		mBackend.SetVarispeed(varispeed);
+		mEngine.Allocate(input.mChannels, output.mChannels);
+		mEngine.ComputeThruOffset();
+		mBackend.SetClient(&mEngine);
+	}
+
+	void Report(const char *name)
+	{
+		mBackend.GetStats(mStats);
+		mEngine.GetStats(mEngineStats);
+		printf("[ report   ] %s: %llu/%llu overloads, %llu underruns, %llu overruns, %llu frames silenced, %llu dropouts, %llu discontinuities, "
+			   "latency ms min %.2f p1 %.1f p50 %.1f p99 %.1f max %.2f\n", name,
+			   (unsigned long long)mStats.mInputOverloads, (unsigned long long)mStats.mOutputOverloads,
+			   (unsigned long long)mEngineStats.mUnderruns, (unsigned long long)mEngineStats.mOverruns,
+			   (unsigned long long)mEngineStats.mSilentFramesInserted, (unsigned long long)mStats.mDropouts,
+			   (unsigned long long)mStats.mDiscontinuities, mStats.mLatencyMin * 1e3, mStats.mLatencyP1 * 1e3,
+			   mStats.mLatencyP50 * 1e3, mStats.mLatencyP99 * 1e3, mStats.mLatencyMax * 1e3);
+	}
+
+	CASimulatedBackend			mBackend;
+	CAPlayThroughEngine			mEngine;
+	CASimulatedBackendStats		mStats;
+	CAPlayThroughEngineStats	mEngineStats;
+};
+
+struct Scenario {
+	const char *	mName;
+	Float64			mInputRate, mOutputRate;
+	Float64			mInputPPM, mOutputPPM;
+	UInt32			mInputBufferFrames, mOutputBufferFrames;
+	Float64			mJitterSeconds;
+	Float64			mSeconds;
+	bool			mVarispeed;			// or the engine resamples
+
+	// limits
+	UInt64			mMaxUnderruns;
+	Float64			mMaxLatencySpread;		// p99 - p1, seconds
+};
+
+void PrintTo(const Scenario &scenario, std::ostream *os) { *os << scenario.mName; }
+
+const Scenario kSteadyScenarios[] = {
+	// name						in rate		out rate	in ppm	out ppm	in buf	out buf	jitter	seconds	varispeed	underruns	spread
+	{ "Matched48k",				48000,		48000,		0,		0,		512,	512,	0,		3600,	true,		0,			0.0005 },
+	{ "44k1To48k",				44100,		48000,		200,	-200,	512,	512,	0,		3600,	true,		0,			0.0005 },
+	{ "48kTo44k1",				48000,		44100,		-200,	200,	256,	1024,	0,		3600,	true,		0,			0.0005 },
+	{ "44k1To48kJitter",		44100,		48000,		-200,	200,	512,	512,	0.002,	1800,	true,		0,			0.006 },
+	{ "SmallBuffers",			48000,		48000,		200,	-200,	64,		64,		0.0005,	600,	true,		0,			0.002 },
+	{ "Resampled44k1To48k",		44100,		48000,		200,	-200,	512,	512,	0,		600,	false,		0,			0.0005 },
+	{ "Resampled48kTo44k1",		48000,		44100,		-200,	200,	256,	1024,	0.002,	600,	false,		0,			0.006 },
+};
+
+class CAPlayThroughSteadyTest : public ::testing::TestWithParam<Scenario> { };
+
+} // namespace
+
+TEST_P(CAPlayThroughSteadyTest, PlaysThroughWithinLimits)
+{
+	const Scenario &scenario = GetParam();
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mNominalSampleRate = scenario.mInputRate;
+	input.mDriftPPM = scenario.mInputPPM;
+	input.mBufferSizeFrames = scenario.mInputBufferFrames;
+	input.mJitterSeconds = scenario.mJitterSeconds;
+	input.mSafetyOffset = 24;
+	output.mNominalSampleRate = scenario.mOutputRate;
+	output.mDriftPPM = scenario.mOutputPPM;
+	output.mBufferSizeFrames = scenario.mOutputBufferFrames;
+	output.mJitterSeconds = scenario.mJitterSeconds;
+	output.mSafetyOffset = 32;
+	output.mStartSampleTime = 1e6;
+
+	SimulatedPlayThrough sim(input, output, 1, scenario.mVarispeed);
+	sim.mBackend.Run(scenario.mSeconds);
+	sim.Report(scenario.mName);
+	EXPECT_EQ(!scenario.mVarispeed, sim.mEngine.IsResampling());
+
+	EXPECT_LE(sim.mEngineStats.mUnderruns, scenario.mMaxUnderruns);
+	EXPECT_EQ(0u, sim.mEngineStats.mOverruns);
+	EXPECT_EQ(0u, sim.mStats.mDiscontinuities);
+	EXPECT_EQ(0u, sim.mStats.mDropouts);
+	EXPECT_LE(sim.mStats.mLatencyP99 - sim.mStats.mLatencyP1, scenario.mMaxLatencySpread);
+	// through the varispeed, or out of the engine's resampler
+	Float64 frameRate = scenario.mVarispeed ? scenario.mInputRate : scenario.mOutputRate;
+	EXPECT_NEAR(sim.mStats.mFramesPlayed / (scenario.mSeconds * frameRate), 1.0, 0.001);
+}
+
+INSTANTIATE_TEST_SUITE_P(Scenarios, CAPlayThroughSteadyTest, ::testing::ValuesIn(kSteadyScenarios),
+	[](const ::testing::TestParamInfo<Scenario> &info) { return std::string(info.param.mName); });
+
+// Both devices are now and then kept off the CPU for 15 ms and skip the cycles they
+// missed. The input loses frames and the output may run dry or fall behind, but every
+// gap is accounted for and the play-through never loses its place in the ring.
+TEST(CAPlayThroughRegressionTest, BurstySchedulingRecovers)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mNominalSampleRate = 44100;
+	input.mDriftPPM = 150;
+	output.mDriftPPM = -150;
+	input.mBufferSizeFrames = output.mBufferSizeFrames = 256;
+	input.mJitterSeconds = output.mJitterSeconds = 0.001;
+	input.mStallProbability = output.mStallProbability = 0.001;
+	input.mStallSeconds = output.mStallSeconds = 0.015;
+
+	for (int varispeed = 1; varispeed >= 0; --varispeed) {
+		SimulatedPlayThrough sim(input, output, 7, varispeed);
+		sim.mBackend.Run(varispeed ? 1800 : 600);
+		sim.Report(varispeed ? "BurstyScheduling" : "BurstySchedulingResampled");
+
+		EXPECT_GT(sim.mStats.mInputOverloads, 0u);
+		EXPECT_GT(sim.mStats.mOutputOverloads, 0u);
+		EXPECT_LE(sim.mStats.mDropouts, sim.mStats.mInputOverloads + sim.mEngineStats.mUnderruns + sim.mEngineStats.mOverruns);
+		EXPECT_LE(sim.mStats.mDiscontinuities, sim.mStats.mInputOverloads + sim.mEngineStats.mUnderruns + sim.mEngineStats.mOverruns);
+		EXPECT_LT(sim.mStats.mSilentFrames, sim.mStats.mFramesPlayed / 100);
+		EXPECT_LT(sim.mStats.mLatencyMax, sim.mEngine.GetRingBuffer().GetCapacityFrames() / input.mNominalSampleRate + 0.02);
+	}
+}
+
+// The devices change buffer size mid-run, as they do when another client asks for a
+// different IO size; each change must not leave the play-through silent.
+TEST(CAPlayThroughRegressionTest, BufferSizeChanges)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mDriftPPM = -100;
+	output.mDriftPPM = 100;
+
+	static const UInt32 kSizes[][2] = { { 512, 512 }, { 256, 512 }, { 256, 1024 }, { 1024, 128 }, { 64, 64 }, { 512, 512 } };
+	SimulatedPlayThrough sim(input, output);
+	for (const UInt32 *sizes : kSizes) {
+		CASimulatedBackendStats before;
+		sim.mBackend.GetStats(before);
+		sim.mBackend.SetBufferSize(CAPlayThroughBackend::kInput, sizes[0]);
+		sim.mBackend.SetBufferSize(CAPlayThroughBackend::kOutput, sizes[1]);
+		sim.mBackend.Run(300);
+
+		sim.Report("BufferSizeChanges");
+		EXPECT_EQ(0u, sim.mEngineStats.mOverruns);
+		EXPECT_GT(sim.mStats.mFramesPlayed - sim.mStats.mSilentFrames, before.mFramesPlayed - before.mSilentFrames) << sizes[0] << "/" << sizes[1];
+	}
+	EXPECT_LT(sim.mStats.mSilentFrames, 48000u);
+}
+
+// The output device stalls for longer than the ring holds. The frames it wanted have
+// been overwritten by the time it comes back; it has to pick up from the newest input
+// rather than keep asking for ones that are gone.
+TEST(CAPlayThroughRegressionTest, OutputStallLongerThanTheRing)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+
+	SimulatedPlayThrough sim(input, output);
+	sim.mBackend.Run(10);
+	sim.mBackend.Stall(CAPlayThroughBackend::kOutput, 2.0);
+	sim.mBackend.Run(10);
+	sim.Report("OutputStall");
+	CASimulatedBackendStats stalled = sim.mStats;
+	CAPlayThroughEngineStats stalledEngine = sim.mEngineStats;
+	EXPECT_GE(stalledEngine.mOverruns, 1u);
+
+	sim.mBackend.Run(60);
+	sim.Report("OutputStall");
+	EXPECT_EQ(stalledEngine.mOverruns, sim.mEngineStats.mOverruns);
+	EXPECT_EQ(stalled.mSilentFrames, sim.mStats.mSilentFrames);
+	EXPECT_EQ(stalled.mDiscontinuities, sim.mStats.mDiscontinuities);
+}
+
+// The input device stalls for longer than the initial latency. The output runs dry and
+// has to wait for the input rather than fall further behind it.
+TEST(CAPlayThroughRegressionTest, InputStallRecovers)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+
+	SimulatedPlayThrough sim(input, output);
+	sim.mBackend.Run(10);
+	sim.mBackend.Stall(CAPlayThroughBackend::kInput, 0.1);
+	sim.mBackend.Run(10);
+	sim.Report("InputStall");
+	CASimulatedBackendStats stalled = sim.mStats;
+	EXPECT_GE(sim.mEngineStats.mUnderruns, 1u);
+	EXPECT_EQ(0u, sim.mEngineStats.mOverruns);
+
+	sim.mBackend.Run(60);
+	sim.Report("InputStall");
+	EXPECT_EQ(stalled.mSilentFrames, sim.mStats.mSilentFrames);
+	EXPECT_EQ(stalled.mDiscontinuities, sim.mStats.mDiscontinuities);
+}
+
+// Lowering the target latency while running slews the read position onto it through the
+// varispeed: no jump in the signal, no underruns, and then it stays there.
+TEST(CAPlayThroughRegressionTest, SettlesOnANewTargetLatency)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mDriftPPM = 200;
+	output.mDriftPPM = -200;
+	input.mBufferSizeFrames = output.mBufferSizeFrames = 256;
+	input.mJitterSeconds = output.mJitterSeconds = 0.0005;
+
+	SimulatedPlayThrough sim(input, output);
+	sim.mEngine.SetTargetLatency(sim.mEngine.DefaultTargetLatency() + 480);
+	sim.mBackend.Run(30);
+	sim.mEngine.SetTargetLatency(sim.mEngine.DefaultTargetLatency() - 64);	// 11 ms less, with half the default's spare
+
+	const Float64 kStep = 0.05;
+	Float64 settled = 0, sumSquares = 0;
+	int nSteady = 0;
+	for (Float64 t = 0; t < 120; t += kStep) {
+		sim.mBackend.Run(kStep);
+		sim.mEngine.GetStats(sim.mEngineStats);
+		Float64 error = sim.mEngineStats.mLatencyError;
+		if (std::fabs(error) > 48)		// 1 ms
+			settled = t + kStep;
+		if (t >= 60) {
+			sumSquares += error * error;
+			++nSteady;
+		}
+	}
+	Float64 rmsError = std::sqrt(sumSquares / nSteady);
+	sim.Report("NewTargetLatency");
+	printf("[ report   ] NewTargetLatency: settled to within 1 ms in %.1f s, steady-state error %.1f frames RMS\n", settled, rmsError);
+
+	EXPECT_LT(settled, 30.0);
+	EXPECT_LT(rmsError, 24.0);
+	EXPECT_EQ(0u, sim.mEngineStats.mUnderruns);
+	EXPECT_EQ(0u, sim.mStats.mDropouts);
+	EXPECT_EQ(0u, sim.mStats.mDiscontinuities);
+}
+
+// Adaptive latency against the default target, on the same devices: it should learn to run
+// with less latency without glitching once it has settled.
+TEST(CAPlayThroughRegressionTest, AdaptiveLatencyShavesTheSpare)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mNominalSampleRate = 44100;
+	input.mDriftPPM = 200;
+	output.mDriftPPM = -200;
+	input.mBufferSizeFrames = output.mBufferSizeFrames = 256;
+	input.mSafetyOffset = 24;
+	output.mSafetyOffset = 32;
+	input.mJitterSeconds = output.mJitterSeconds = 0.0005;
+
+	SimulatedPlayThrough fixed(input, output);
+	fixed.mBackend.Run(600);
+	fixed.Report("FixedLatency");
+
+	SimulatedPlayThrough adaptive(input, output);
+	adaptive.mEngine.SetAdaptiveLatency(true);
+	adaptive.mBackend.Run(300);
+	adaptive.Report("AdaptiveLatency");
+	CAPlayThroughEngineStats settling = adaptive.mEngineStats;
+	CASimulatedBackendStats settlingBackend = adaptive.mStats;
+	adaptive.mBackend.Run(300);
+	adaptive.Report("AdaptiveLatency");
+	const CAAdaptiveLatency &learned = adaptive.mEngine.GetAdaptiveLatency();
+	printf("[ report   ] AdaptiveLatency: target %.2f ms from %.2f ms, jitter %.2f ms, headroom %.2f ms, %llu backoffs\n",
+		   learned.GetTarget() * 1e3, adaptive.mEngine.DefaultTargetLatency() / input.mNominalSampleRate * 1e3,
+		   learned.GetJitter() * 1e3, learned.GetMinHeadroom() * 1e3, (unsigned long long)learned.GetBackoffs());
+
+	EXPECT_EQ(0u, fixed.mEngineStats.mUnderruns);
+	EXPECT_LT(adaptive.mStats.mLatencyP50, fixed.mStats.mLatencyP50 - 0.002);
+	// once settled, nothing
+	EXPECT_EQ(settling.mUnderruns, adaptive.mEngineStats.mUnderruns);
+	EXPECT_EQ(settlingBackend.mDropouts, adaptive.mStats.mDropouts);
+	EXPECT_EQ(0u, adaptive.mStats.mDiscontinuities);
+
+	// an input stall it has no room for: it backs off
+	Float64 before = learned.GetTarget();
+	adaptive.mBackend.Stall(CAPlayThroughBackend::kInput, 0.01);
+	adaptive.mBackend.Run(1);
+	EXPECT_GE(learned.GetBackoffs(), 1u);
+	EXPECT_GT(learned.GetTarget(), before + CAAdaptiveLatency::kDefaultBackoff);
+}
+
+// Small buffers with the rate decided on a control thread every 10 ms rather than on every
+// callback: it plays through as well as the per-callback engine does, and sets the varispeed
+// far less often.
+TEST(CAPlayThroughRegressionTest, ControlPlaneAtSmallBuffers)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mNominalSampleRate = 44100;
+	input.mDriftPPM = 200;
+	output.mDriftPPM = -200;
+	input.mBufferSizeFrames = output.mBufferSizeFrames = 64;
+	input.mSafetyOffset = 24;
+	output.mSafetyOffset = 32;
+	input.mJitterSeconds = output.mJitterSeconds = 0.0005;
+
+	for (int varispeed = 1; varispeed >= 0; --varispeed) {
+		SimulatedPlayThrough perCallback(input, output, 1, varispeed);
+		perCallback.mBackend.Run(600);
+		perCallback.Report(varispeed ? "PerCallback" : "PerCallbackResampled");
+
+		SimulatedPlayThrough controlled(input, output, 1, varispeed);
+		CAPlayThroughEngine &engine = controlled.mEngine;
+		engine.SetControlInterval(0.01);
+		controlled.mBackend.SetControlProc([&engine]() { engine.ControlTick(); }, 0.01);
+		controlled.mBackend.Run(600);
+		controlled.Report(varispeed ? "ControlPlane" : "ControlPlaneResampled");
+		if (varispeed)
+			printf("[ report   ] ControlPlane: %llu rate updates, %llu per callback, of %llu callbacks\n",
+				   (unsigned long long)controlled.mEngineStats.mRateUpdates,
+				   (unsigned long long)perCallback.mEngineStats.mRateUpdates,
+				   (unsigned long long)controlled.mStats.mOutputCallbacks);
+
+		EXPECT_EQ(0u, controlled.mEngineStats.mUnderruns);
+		EXPECT_EQ(0u, controlled.mEngineStats.mOverruns);
+		EXPECT_EQ(0u, controlled.mStats.mDropouts);
+		EXPECT_EQ(0u, controlled.mStats.mDiscontinuities);
+		EXPECT_LE(controlled.mStats.mLatencyP99 - controlled.mStats.mLatencyP1, 0.002);
+		EXPECT_NEAR(controlled.mStats.mLatencyP50, perCallback.mStats.mLatencyP50, 0.0005);
+		if (varispeed)
+			EXPECT_LT(controlled.mEngineStats.mRateUpdates, controlled.mStats.mOutputCallbacks / 5);
+	}
+}
+
+// The devices change sample rate again and again under a running play-through, and the engine
+// reconfigures for each change in place. Each change costs one short gap, a little over the
+// target latency while the new ring fills, and with a crossfade no more than the two edges of it.
+TEST(CAPlayThroughRegressionTest, HotReconfiguration)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mDriftPPM = 100;
+	output.mDriftPPM = -100;
+	input.mBufferSizeFrames = output.mBufferSizeFrames = 256;
+	input.mSafetyOffset = 24;
+	output.mSafetyOffset = 32;
+	input.mJitterSeconds = output.mJitterSeconds = 0.0005;
+
+	static const Float64 kRates[][2] = { { 44100, 48000 }, { 96000, 96000 }, { 48000, 44100 }, { 44100, 44100 }, { 48000, 96000 } };
+	const UInt64 kChanges = sizeof(kRates) / sizeof(kRates[0]);
+	for (int varispeed = 1; varispeed >= 0; --varispeed) {
+		for (UInt32 crossfade : { 0u, CAPlayThroughEngine::kDefaultCrossfadeFrames }) {
+			char name[64];
+			snprintf(name, sizeof(name), "HotReconfiguration%s%s", varispeed ? "" : "Resampled", crossfade ? "Crossfaded" : "");
+			SimulatedPlayThrough sim(input, output, 1, varispeed);
+			sim.mEngine.SetCrossfadeFrames(crossfade);
+			sim.mBackend.Run(5);
+
+			Float64 reconfigureSeconds = 0, maxGap = 0, maxAllowed = 0;
+			for (const Float64 *rates : kRates) {
+				CASimulatedBackendStats before;
+				sim.mBackend.GetStats(before);
+				sim.mBackend.SetSampleRate(CAPlayThroughBackend::kInput, rates[0]);
+				sim.mBackend.SetSampleRate(CAPlayThroughBackend::kOutput, rates[1]);
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				EXPECT_EQ(noErr, sim.mEngine.Reconfigure());
+				reconfigureSeconds = std::max(reconfigureSeconds, std::chrono::duration<Float64>(std::chrono::steady_clock::now() - start).count());
+				sim.mBackend.Run(5);
+				EXPECT_FALSE(sim.mEngine.IsReconfiguring());
+
+				// the gap in the output's time: the target latency, as the new ring fills, and a
+				// few buffers either side as the IO threads take the change up
+				sim.mBackend.GetStats(sim.mStats);
+				Float64 outputRate = varispeed ? rates[0] : rates[1];
+				Float64 gap = (sim.mStats.mSilentFrames - before.mSilentFrames) / outputRate;
+				Float64 allowed = sim.mEngine.DefaultTargetLatency() / rates[0] + 4 * 256 / std::min(rates[0], rates[1]);
+				maxGap = std::max(maxGap, gap);
+				maxAllowed = std::max(maxAllowed, allowed);
+				EXPECT_LE(gap, allowed) << rates[0] << " -> " << rates[1];
+			}
+			sim.Report(name);
+			printf("[ report   ] %s: %llu changes, Reconfigure took up to %.3f ms, gaps up to %.2f ms of %.2f ms allowed\n", name,
+				   (unsigned long long)sim.mEngineStats.mReconfigurations, reconfigureSeconds * 1e3, maxGap * 1e3, maxAllowed * 1e3);
+
+			EXPECT_EQ(kChanges, sim.mEngineStats.mReconfigurations);
+			EXPECT_EQ(0u, sim.mEngineStats.mUnderruns);
+			EXPECT_EQ(0u, sim.mEngineStats.mOverruns);
+			EXPECT_EQ(kChanges, sim.mStats.mDropouts);
+			if (crossfade)
+				EXPECT_LE(sim.mStats.mDiscontinuities, 2 * kChanges);
+			else
+				EXPECT_EQ(0u, sim.mStats.mDiscontinuities);
+			EXPECT_EQ(!varispeed, sim.mEngine.IsResampling());
+		}
+	}
+}
+
+// Stopped, a route takes up every change that comes before it runs again, even with the last one
+// still pending from when it ran: the IO threads never got to it, and won't now.
+TEST(CAPlayThroughRegressionTest, ReconfigurationWhileStopped)
+{
+	for (bool varispeed : { true, false }) {
+		SCOPED_TRACE(testing::Message() << "varispeed " << varispeed);
+		SimulatedPlayThrough sim(CASimulatedBackend::DefaultDeviceConfig(), CASimulatedBackend::DefaultDeviceConfig(), 1, varispeed);
+		sim.mBackend.Run(2);
+		sim.mBackend.SetSampleRate(CAPlayThroughBackend::kInput, 44100);
+		EXPECT_EQ(noErr, sim.mEngine.Reconfigure());
+		EXPECT_TRUE(sim.mEngine.IsReconfiguring());
+		sim.mBackend.SetSampleRate(CAPlayThroughBackend::kInput, 96000);
+		EXPECT_EQ(kCAPlayThroughEngineError_Reconfiguring, sim.mEngine.Reconfigure());
+
+		EXPECT_EQ(noErr, sim.mEngine.Reconfigure(false));
+		EXPECT_FALSE(sim.mEngine.IsReconfiguring());
+		sim.mBackend.SetSampleRate(CAPlayThroughBackend::kOutput, 44100);
+		EXPECT_EQ(noErr, sim.mEngine.Reconfigure(false));
+		EXPECT_FALSE(sim.mEngine.IsReconfiguring());
+
+		CASimulatedBackendStats before;
+		sim.mBackend.GetStats(before);
+		sim.mBackend.Run(5);
+		sim.Report(varispeed ? "ReconfigurationWhileStopped" : "ReconfigurationWhileStoppedResampled");
+		EXPECT_EQ(2u, sim.mEngineStats.mReconfigurations);
+		EXPECT_EQ(0u, sim.mEngineStats.mUnderruns);
+		EXPECT_EQ(0u, sim.mEngineStats.mOverruns);
+		EXPECT_EQ(1u, sim.mStats.mDropouts);	// the one start, as if from a stop
+		EXPECT_NEAR(sim.mEngine.DefaultTargetLatency(), sim.mEngineStats.mTargetLatency, 1.0);
+		// silent only until the new ring has the target latency's frames
+		Float64 outputRate = varispeed ? 96000 : 44100;
+		Float64 gap = (sim.mStats.mSilentFrames - before.mSilentFrames) / outputRate;
+		EXPECT_LE(gap, sim.mEngine.DefaultTargetLatency() / 96000 + 4 * 512 / 44100.0);
+	}
+}
+
+// Eight input channels down to two through the channel matrix, ahead of the varispeed and ahead
+// of the engine's resampler. Every input channel carries the same counter, so the four at a
+// quarter each sum back to it exactly and the output's first channel checks as it would unmixed.
+TEST(CAPlayThroughRegressionTest, ChannelMatrixDownmix)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mNominalSampleRate = 44100;
+	input.mDriftPPM = 200;
+	output.mDriftPPM = -200;
+	input.mChannels = 8;
+	output.mChannels = 2;
+	input.mBufferSizeFrames = output.mBufferSizeFrames = 256;
+
+	for (int varispeed = 1; varispeed >= 0; --varispeed) {
+		SimulatedPlayThrough sim(input, output, 1, varispeed);
+		CAChannelMatrix &matrix = sim.mEngine.GetChannelMatrix();
+		EXPECT_EQ(8u, matrix.GetNumberInputs());
+		EXPECT_EQ(2u, matrix.GetNumberOutputs());
+		matrix.Clear();
+		for (UInt32 n = 4; n < 8; ++n)
+			matrix.SetGain(0, n, 0.25f);
+		matrix.SetGain(1, 0, 1.0f);
+
+		sim.mBackend.Run(600);
+		sim.Report(varispeed ? "ChannelMatrixDownmix" : "ChannelMatrixDownmixResampled");
+
+		EXPECT_EQ(0u, sim.mEngineStats.mUnderruns);
+		EXPECT_EQ(0u, sim.mEngineStats.mOverruns);
+		EXPECT_EQ(0u, sim.mStats.mDropouts);
+		EXPECT_EQ(0u, sim.mStats.mDiscontinuities);
+		Float64 frameRate = varispeed ? input.mNominalSampleRate : output.mNominalSampleRate;
+		EXPECT_NEAR(sim.mStats.mFramesPlayed / (600 * frameRate), 1.0, 0.001);
+	}
+}
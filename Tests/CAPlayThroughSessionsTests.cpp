@@ -0,0 +1,259 @@
+/*=============================================================================
+	CAPlayThroughSessionsTests.cpp
+
+	CAPlayThroughSessionManager over simulated devices: routes keyed by
+	their devices, device handles shared between routes and closed with
+	the last of them, sessions that run independently, and device changes
+	passed on to every session on the device.
+=============================================================================*/
+
+#include "CASimulatedSessions.h"
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+CAPlayThroughRoute Route(CAPlayThroughDeviceID input, CAPlayThroughDeviceID output)
+{
+	CAPlayThroughRoute route = { input, output };
+	return route;
+}
+
+CASimulatedSessionFactory::Session &SessionFor(CAPlayThroughSessionManager &manager, const CAPlayThroughRoute &route)
+{
+	CASimulatedSessionFactory::Session *found = NULL;
+	manager.ForEachSession([&](const CAPlayThroughRoute &r, CAPlayThroughSessionManager::Session &session) {
+		if (r == route)
+			found = static_cast<CASimulatedSessionFactory::Session *>(&session);
+	});
+	return *found;
+}
+
+// devices 1 to n, 48 kHz and 256 frames, drifting a little apart
+void AddDevices(CASimulatedSessionFactory &factory, UInt32 n)
+{
+	for (UInt32 id = 1; id <= n; ++id) {
+		CASimulatedDeviceConfig config = CASimulatedBackend::DefaultDeviceConfig();
+		config.mBufferSizeFrames = 256;
+		config.mDriftPPM = (id % 2) ? 100 : -100;
+		factory.AddDevice(id, config);
+	}
+}
+
+} // namespace
+
+TEST(CAPlayThroughSessionsTest, SharesDevicesBetweenRoutes)
+{
+	CASimulatedSessionFactory factory;
+	AddDevices(factory, 3);
+	CAPlayThroughSessionManager manager(factory);
+
+	ASSERT_EQ(noErr, manager.AddRoute(Route(1, 2)));
+	ASSERT_EQ(noErr, manager.AddRoute(Route(1, 3)));
+	ASSERT_EQ(noErr, manager.AddRoute(Route(3, 2)));
+	ASSERT_EQ(noErr, manager.AddRoute(Route(2, 2)));
+	EXPECT_EQ(4u, manager.GetNumberRoutes());
+	EXPECT_EQ(3u, manager.GetNumberOpenDevices());
+	EXPECT_EQ(3u, factory.GetOpenDevices());
+	EXPECT_EQ(2u, manager.GetDeviceUseCount(1));
+	EXPECT_EQ(3u, manager.GetDeviceUseCount(2));
+	EXPECT_EQ(2u, manager.GetDeviceUseCount(3));
+
+	EXPECT_EQ(kCAPlayThroughSessionError_RouteExists, manager.AddRoute(Route(1, 2)));
+	EXPECT_EQ(kCAPlayThroughSessionError_DeviceUnavailable, manager.AddRoute(Route(1, 9)));
+	EXPECT_EQ(kCAPlayThroughSessionError_DeviceUnavailable, manager.AddRoute(Route(9, 1)));
+	EXPECT_EQ(2u, manager.GetDeviceUseCount(1));
+	EXPECT_EQ(0u, manager.GetDeviceUseCount(9));
+	EXPECT_EQ(kCAPlayThroughSessionError_NoSuchRoute, manager.RemoveRoute(Route(2, 1)));
+
+	// each device closes with the last route on it
+	ASSERT_EQ(noErr, manager.RemoveRoute(Route(1, 3)));
+	EXPECT_EQ(3u, factory.GetOpenDevices());
+	ASSERT_EQ(noErr, manager.RemoveRoute(Route(3, 2)));
+	EXPECT_EQ(2u, factory.GetOpenDevices());
+	EXPECT_EQ(0u, manager.GetDeviceUseCount(3));
+	ASSERT_EQ(noErr, manager.RemoveRoute(Route(1, 2)));
+	EXPECT_EQ(1u, factory.GetOpenDevices());
+	manager.RemoveAllRoutes();
+	EXPECT_EQ(0u, factory.GetOpenDevices());
+	EXPECT_FALSE(manager.HasRoute(Route(2, 2)));
+}
+
+// Routes sharing devices play through as cleanly as they would alone, and go on doing so when one
+// of them is removed.
+TEST(CAPlayThroughSessionsTest, SessionsPlayThroughIndependently)
+{
+	CASimulatedSessionFactory factory;
+	AddDevices(factory, 4);
+	CAPlayThroughSessionManager manager(factory);
+	const CAPlayThroughRoute kRoutes[] = { Route(1, 2), Route(1, 3), Route(2, 4), Route(3, 4) };
+	for (const CAPlayThroughRoute &route : kRoutes)
+		ASSERT_EQ(noErr, manager.AddRoute(route));
+
+	for (int pass = 0; pass < 2; ++pass) {
+		manager.ForEachSession([](const CAPlayThroughRoute &, CAPlayThroughSessionManager::Session &session) {
+			static_cast<CASimulatedSessionFactory::Session &>(session).Run(60);
+		});
+		manager.ForEachSession([](const CAPlayThroughRoute &route, CAPlayThroughSessionManager::Session &session) {
+			CASimulatedBackendStats stats;
+			static_cast<CASimulatedSessionFactory::Session &>(session).GetBackend().GetStats(stats);
+			EXPECT_EQ(0u, stats.mDropouts) << route.mInput << " -> " << route.mOutput;
+			EXPECT_EQ(0u, stats.mDiscontinuities) << route.mInput << " -> " << route.mOutput;
+			EXPECT_GT(stats.mFramesPlayed - stats.mSilentFrames, 0u);
+		});
+		if (pass == 0)
+			ASSERT_EQ(noErr, manager.RemoveRoute(Route(1, 3)));
+	}
+	EXPECT_EQ(3u, manager.GetNumberRoutes());
+}
+
+// A rate change reaches every session on the device, in place; a channel count change makes their
+// sessions again. The routes on other devices are left alone.
+TEST(CAPlayThroughSessionsTest, DeviceChangesReachEverySessionOnTheDevice)
+{
+	CASimulatedSessionFactory factory;
+	AddDevices(factory, 4);
+	CAPlayThroughSessionManager manager(factory);
+	ASSERT_EQ(noErr, manager.AddRoute(Route(1, 2)));
+	ASSERT_EQ(noErr, manager.AddRoute(Route(3, 1)));
+	ASSERT_EQ(noErr, manager.AddRoute(Route(3, 4)));
+	manager.ForEachSession([](const CAPlayThroughRoute &, CAPlayThroughSessionManager::Session &session) {
+		static_cast<CASimulatedSessionFactory::Session &>(session).Run(2);
+	});
+
+	factory.SetSampleRate(1, 44100);
+	EXPECT_EQ(noErr, manager.DeviceChanged(1));
+	manager.ForEachSession([](const CAPlayThroughRoute &route, CAPlayThroughSessionManager::Session &session) {
+		CASimulatedSessionFactory::Session &simulated = static_cast<CASimulatedSessionFactory::Session &>(session);
+		simulated.Run(2);
+		CAPlayThroughEngineStats stats;
+		simulated.GetEngine().GetStats(stats);
+		bool onDevice = (route.mInput == 1 || route.mOutput == 1);
+		EXPECT_EQ(onDevice ? 1u : 0u, stats.mReconfigurations) << route.mInput << " -> " << route.mOutput;
+		EXPECT_EQ(onDevice ? 44100.0 : 48000.0,
+				  simulated.GetBackend().GetDeviceInfo(route.mInput == 1 ? CAPlayThroughBackend::kInput : CAPlayThroughBackend::kOutput).mNominalSampleRate);
+	});
+
+	CASimulatedDeviceConfig config = CASimulatedBackend::DefaultDeviceConfig();
+	config.mChannels = 6;
+	factory.AddDevice(3, config);
+	EXPECT_EQ(noErr, manager.DeviceChanged(3));
+	EXPECT_EQ(3u, manager.GetNumberRoutes());
+	CASimulatedSessionFactory::Session &after = SessionFor(manager, Route(3, 4));
+	// made again rather than reconfigured: the old one had run, and the new one may sit where it was
+	CAPlayThroughMetrics::Snapshot snapshot;
+	after.GetEngine().GetMetrics().GetSnapshot(snapshot);
+	EXPECT_EQ(0u, snapshot.mOutput.mCallbacks);
+	EXPECT_EQ(6u, after.GetEngine().GetChannelMatrix().GetNumberInputs());
+	EXPECT_EQ(2u, after.GetEngine().GetChannelMatrix().GetNumberOutputs());
+}
+
+// Changes that come faster than the session runs each go through: here a second rate before the
+// IO threads have called back since the first.
+TEST(CAPlayThroughSessionsTest, BackToBackDeviceChangesLand)
+{
+	CASimulatedSessionFactory factory;
+	AddDevices(factory, 2);
+	CAPlayThroughSessionManager manager(factory);
+	ASSERT_EQ(noErr, manager.AddRoute(Route(1, 2)));
+	CASimulatedSessionFactory::Session &session = SessionFor(manager, Route(1, 2));
+	session.Run(2);
+
+	factory.SetSampleRate(1, 44100);
+	EXPECT_EQ(noErr, manager.DeviceChanged(1));
+	factory.SetSampleRate(1, 96000);
+	EXPECT_EQ(noErr, manager.DeviceChanged(1));
+	EXPECT_EQ(96000.0, session.GetBackend().GetDeviceInfo(CAPlayThroughBackend::kInput).mNominalSampleRate);
+	EXPECT_FALSE(session.GetEngine().IsReconfiguring());
+	session.Run(2);
+
+	CAPlayThroughEngineStats stats;
+	session.GetEngine().GetStats(stats);
+	EXPECT_EQ(2u, stats.mReconfigurations);
+	EXPECT_EQ(0u, stats.mUnderruns);
+	CASimulatedBackendStats backendStats;
+	session.GetBackend().GetStats(backendStats);
+	EXPECT_GT(backendStats.mFramesPlayed - backendStats.mSilentFrames, 0u);
+}
+
+// A session that fails to take a change up for any reason but the format is kept, as it was, and
+// the error is passed on; the change isn't lost, but tried again until it goes through.
+TEST(CAPlayThroughSessionsTest, RefusedDeviceChangesAreRetried)
+{
+	CASimulatedSessionFactory factory;
+	AddDevices(factory, 3);
+	CAPlayThroughSessionManager manager(factory);
+	ASSERT_EQ(noErr, manager.AddRoute(Route(1, 2)));
+	ASSERT_EQ(noErr, manager.AddRoute(Route(3, 2)));
+	const OSStatus kRefused = -50;
+
+	auto inputRate = [&](const CAPlayThroughRoute &route) {
+		return SessionFor(manager, route).GetBackend().GetDeviceInfo(CAPlayThroughBackend::kInput).mNominalSampleRate;
+	};
+
+	// at the next notification, from any device
+	factory.SetReconfigureError(kRefused);
+	factory.SetSampleRate(1, 44100);
+	EXPECT_EQ(kRefused, manager.DeviceChanged(1));
+	EXPECT_EQ(2u, manager.GetNumberRoutes());
+	EXPECT_TRUE(manager.HasPendingChange(Route(1, 2)));
+	EXPECT_FALSE(manager.HasPendingChange(Route(3, 2)));
+	EXPECT_EQ(48000.0, inputRate(Route(1, 2)));
+	EXPECT_EQ(kRefused, manager.RetryDeviceChanges());
+	EXPECT_TRUE(manager.HasPendingChange(Route(1, 2)));
+	factory.SetReconfigureError(noErr);
+	EXPECT_EQ(noErr, manager.DeviceChanged(3));
+	EXPECT_FALSE(manager.HasPendingChange(Route(1, 2)));
+	EXPECT_EQ(44100.0, inputRate(Route(1, 2)));
+
+	// when asked
+	factory.SetReconfigureError(kRefused);
+	factory.SetSampleRate(3, 96000);
+	EXPECT_EQ(kRefused, manager.DeviceChanged(3));
+	factory.SetReconfigureError(noErr);
+	EXPECT_EQ(noErr, manager.RetryDeviceChanges());
+	EXPECT_FALSE(manager.HasPendingChange(Route(3, 2)));
+	EXPECT_EQ(96000.0, inputRate(Route(3, 2)));
+
+	// and before the route starts
+	factory.SetReconfigureError(kRefused);
+	factory.SetSampleRate(1, 48000);
+	EXPECT_EQ(kRefused, manager.DeviceChanged(1));
+	EXPECT_EQ(kRefused, manager.Start(Route(1, 2)));
+	EXPECT_FALSE(manager.IsRunning(Route(1, 2)));
+	factory.SetReconfigureError(noErr);
+	EXPECT_EQ(noErr, manager.Start(Route(1, 2)));
+	EXPECT_TRUE(manager.IsRunning(Route(1, 2)));
+	EXPECT_FALSE(manager.HasPendingChange(Route(1, 2)));
+	EXPECT_EQ(48000.0, inputRate(Route(1, 2)));
+	manager.StopAll();
+}
+
+TEST(CAPlayThroughSessionsTest, StartsAndResetsRoutesInRealTime)
+{
+	CASimulatedSessionFactory factory;
+	AddDevices(factory, 3);
+	CAPlayThroughSessionManager manager(factory);
+	ASSERT_EQ(noErr, manager.AddRoute(Route(1, 2)));
+	ASSERT_EQ(noErr, manager.AddRoute(Route(1, 3)));
+	EXPECT_EQ(kCAPlayThroughSessionError_NoSuchRoute, manager.Start(Route(2, 3)));
+
+	ASSERT_EQ(noErr, manager.Start(Route(1, 2)));
+	EXPECT_TRUE(manager.IsRunning(Route(1, 2)));
+	EXPECT_FALSE(manager.IsRunning(Route(1, 3)));
+	ASSERT_EQ(noErr, manager.ResetRoute(Route(1, 2)));
+	EXPECT_TRUE(manager.IsRunning(Route(1, 2)));
+
+	ASSERT_EQ(noErr, manager.StartAll());
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	EXPECT_TRUE(manager.IsRunning(Route(1, 3)));
+	ASSERT_EQ(noErr, manager.StopAll());
+	EXPECT_FALSE(manager.IsRunning(Route(1, 2)));
+	EXPECT_FALSE(manager.IsRunning(Route(1, 3)));
+
+	CASimulatedBackendStats stats;
+	SessionFor(manager, Route(1, 3)).GetBackend().GetStats(stats);
+	EXPECT_GT(stats.mOutputCallbacks, 10u);
+}
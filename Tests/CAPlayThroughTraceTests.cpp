@@ -0,0 +1,231 @@
+/*=============================================================================
+	CAPlayThroughTraceTests.cpp
+
+	CAPlayThroughTrace's rings, read while they're written, and the trace
+	the engine leaves of a glitch. Offline runs take milliseconds of real
+	time, which the events are stamped with, so a trace of the last second
+	covers all of one.
+=============================================================================*/
+
+#include "CAPlayThroughEngine.h"
+#include "CASimulatedBackend.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+std::string TempPath(const char *name)
+{
+	const char *dir = getenv("TMPDIR");
+	return std::string(dir ? dir : "/tmp") + "/" + name + "-" + std::to_string(getpid());
+}
+
+std::string ReadFile(const std::string &path)
+{
+	std::ifstream file(path);
+	std::stringstream text;
+	text << file.rdbuf();
+	return text.str();
+}
+
+// balanced, and a single object
+bool LooksLikeJSON(const std::string &text)
+{
+	int depth = 0;
+	bool inString = false;
+	for (size_t i = 0; i < text.size(); ++i) {
+		char c = text[i];
+		if (inString) {
+			if (c == '\\')
+				++i;
+			else if (c == '"')
+				inString = false;
+			continue;
+		}
+		if (c == '"')
+			inString = true;
+		else if (c == '{' || c == '[')
+			++depth;
+		else if (c == '}' || c == ']')
+			if (--depth < 0)
+				return false;
+	}
+	return depth == 0 && !inString && text.find('{') == 0;
+}
+
+size_t Count(const std::string &text, const std::string &what)
+{
+	size_t n = 0;
+	for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1))
+		++n;
+	return n;
+}
+
+} // namespace
+
+TEST(CAPlayThroughTraceTest, RecordsNothingUntilAllocated)
+{
+	CAPlayThroughTrace trace;
+	trace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kFetch, 0, 1, 2, 3);
+	trace.Glitch(kCARingBufferError_SlightlyAhead, 512);
+
+	std::vector<CAPlayThroughTrace::Event> events;
+	trace.CopyEvents(events, 10);
+	EXPECT_FALSE(trace.IsEnabled());
+	EXPECT_TRUE(events.empty());
+	EXPECT_EQ(0u, trace.GetGlitches());
+}
+
+TEST(CAPlayThroughTraceTest, KeepsTheNewestInTimeOrder)
+{
+	CAPlayThroughTrace trace;
+	trace.Allocate(100);
+	ASSERT_EQ(128u, trace.GetCapacity());
+
+	// 300 events from each thread, interleaved
+	for (int i = 0; i < 300; ++i) {
+		trace.Record(CAPlayThroughTrace::kInput, CAPlayThroughTrace::kCallbackBegan, i, i);
+		trace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kCallbackBegan, i, i);
+	}
+
+	std::vector<CAPlayThroughTrace::Event> events;
+	trace.CopyEvents(events, 10);
+	// all but the oldest slot of each ring, which a writer might be overwriting
+	ASSERT_EQ(254u, events.size());
+	int next[2] = { 300 - 127, 300 - 127 };
+	for (size_t i = 0; i < events.size(); ++i) {
+		const CAPlayThroughTrace::Event &event = events[i];
+		ASSERT_LT(event.mThread, 2);
+		EXPECT_EQ(next[event.mThread]++, event.mValue);
+		EXPECT_EQ(event.mValue, event.mA);
+		if (i > 0)
+			EXPECT_LE(events[i - 1].mNanos, event.mNanos);
+	}
+	EXPECT_EQ(300, next[0]);
+	EXPECT_EQ(300, next[1]);
+}
+
+TEST(CAPlayThroughTraceTest, ReadsWhileWritten)
+{
+	CAPlayThroughTrace trace;
+	trace.Allocate(64);
+
+	// every event's fields agree with each other, so a torn one shows
+	std::atomic<bool> done(false);
+	std::thread writer([&] {
+		for (int i = 0; i < 2000000; ++i)
+			trace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kFetch, i, i, -i, i * 0.5);
+		done = true;
+	});
+
+	std::vector<CAPlayThroughTrace::Event> events;
+	UInt64 copies = 0, copied = 0;
+	while (!done) {
+		trace.CopyEvents(events, 10);
+		for (size_t i = 0; i < events.size(); ++i) {
+			const CAPlayThroughTrace::Event &event = events[i];
+			ASSERT_EQ(CAPlayThroughTrace::kFetch, event.mType);
+			ASSERT_EQ(Float64(event.mValue), event.mA);
+			ASSERT_EQ(-event.mA, event.mB);
+			ASSERT_EQ(event.mA * 0.5, event.mC);
+			if (i > 0)
+				ASSERT_EQ(events[i - 1].mValue + 1, event.mValue);
+		}
+		++copies;
+		copied += events.size();
+	}
+	writer.join();
+	EXPECT_GT(copies, 0u);
+	printf("[ report   ] %llu copies, %.1f events each\n", (unsigned long long)copies, copies ? Float64(copied) / copies : 0.0);
+}
+
+TEST(CAPlayThroughTraceTest, TracesAGlitch)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedBackend backend(input, output, 1);
+	CAPlayThroughEngine engine(backend);
+	engine.GetTrace().Allocate(1 << 14);
+	engine.Allocate(input.mChannels);
+	engine.ComputeThruOffset();
+	backend.SetClient(&engine);
+
+	backend.Run(5);
+	EXPECT_EQ(0u, engine.GetTrace().GetGlitches());
+
+	// the output stalls for longer than the ring holds
+	backend.Stall(CAPlayThroughBackend::kOutput, 2.0);
+	backend.Run(5);
+	CAPlayThroughEngineStats stats;
+	engine.GetStats(stats);
+	EXPECT_EQ(stats.mUnderruns + stats.mOverruns, engine.GetTrace().GetGlitches());
+	ASSERT_GE(engine.GetTrace().GetGlitches(), 1u);
+
+	std::vector<CAPlayThroughTrace::Event> events;
+	engine.GetTrace().CopyEvents(events, 1);
+	int began[2] = { 0, 0 }, ended[2] = { 0, 0 }, glitches = 0, behind = 0;
+	for (const CAPlayThroughTrace::Event &event : events) {
+		if (event.mType == CAPlayThroughTrace::kCallbackBegan)
+			++began[event.mThread];
+		else if (event.mType == CAPlayThroughTrace::kCallbackEnded)
+			++ended[event.mThread];
+		else if (event.mType == CAPlayThroughTrace::kGlitch)
+			++glitches;
+		else if (event.mType == CAPlayThroughTrace::kOffsetAdjusted && event.mValue == CAPlayThroughTrace::kOffsetBehind)
+			++behind;
+	}
+	EXPECT_GT(began[CAPlayThroughTrace::kInput], 0);
+	EXPECT_GT(began[CAPlayThroughTrace::kOutput], 0);
+	EXPECT_NEAR(began[CAPlayThroughTrace::kOutput], ended[CAPlayThroughTrace::kOutput], 1);
+	EXPECT_EQ(SInt64(engine.GetTrace().GetGlitches()), glitches);
+	EXPECT_EQ(SInt64(stats.mOverruns), behind);
+
+	std::string path = TempPath("CAPlayThroughTraceTest") + ".json";
+	ASSERT_TRUE(engine.GetTrace().WriteChromeTrace(path.c_str(), 1));
+	std::string json = ReadFile(path);
+	remove(path.c_str());
+	EXPECT_TRUE(LooksLikeJSON(json));
+	EXPECT_NE(std::string::npos, json.find("\"traceEvents\":["));
+	EXPECT_NE(std::string::npos, json.find("\"reason\":\"behind\""));
+	EXPECT_EQ(size_t(glitches), Count(json, "\"name\":\"glitch\""));
+	EXPECT_EQ(Count(json, "\"ph\":\"B\""), size_t(began[0] + began[1]));
+}
+
+TEST(CAPlayThroughTraceTest, DumperWritesATraceAfterAGlitch)
+{
+	CAPlayThroughTrace trace;
+	trace.Allocate(1024);
+	std::string prefix = TempPath("CAPlayThroughTraceDump") + "-";
+
+	CAPlayThroughTraceDumper dumper(trace);
+	dumper.Start(prefix, 1.0, 2, 0.01);
+	for (int i = 0; i < 10; ++i)
+		trace.Record(CAPlayThroughTrace::kOutput, CAPlayThroughTrace::kCallbackBegan, 0, i * 512, 512);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_EQ(0u, dumper.GetDumps());
+
+	// three glitches far enough apart, and only two files
+	for (int i = 0; i < 3; ++i) {
+		trace.Glitch(kCARingBufferError_SlightlyAhead, 512);
+		for (int wait = 0; wait < 200 && dumper.GetDumps() < std::min(i + 1, 2); ++wait)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	dumper.Stop();
+	EXPECT_EQ(2u, dumper.GetDumps());
+	EXPECT_EQ(prefix + "2.json", dumper.GetLastPath());
+
+	std::string json = ReadFile(prefix + "2.json");
+	EXPECT_TRUE(LooksLikeJSON(json));
+	EXPECT_EQ(2u, Count(json, "\"name\":\"glitch\""));
+	EXPECT_EQ(10u, Count(json, "\"ph\":\"B\""));
+	EXPECT_EQ(std::string(), ReadFile(prefix + "3.json"));
+	remove((prefix + "1.json").c_str());
+	remove((prefix + "2.json").c_str());
+}
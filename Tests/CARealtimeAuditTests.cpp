@@ -0,0 +1,286 @@
+/*=============================================================================
+	CARealtimeAuditTests.cpp
+
+	CARealtimeAudit catching each kind of violation, and the engine's IO
+	procs run under it against the simulated backend, offline and in real
+	time, through every path they have: varispeed and resampling, adaptive
+	latency, the trace, the control thread, stalls, buffer size changes and
+	reconfiguration, with their channels shared out to a worker pool, and
+	through a DSP chain.
+=============================================================================*/
+
+#include "CADSPProcessors.h"
+#include "CAPlayThroughEngine.h"
+#include "CARealtimeAudit.h"
+#include "CASimulatedBackend.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// counts the violations from here on, in kLog mode, so that a test sees them all rather than dies
+// of the first
+struct Violations {
+	Violations() : mMode(CARealtimeAudit::GetMode())
+	{
+		CARealtimeAudit::SetMode(CARealtimeAudit::kLog);
+		for (int i = 0; i < CARealtimeAudit::kViolationCount; ++i)
+			mStart[i] = CARealtimeAudit::GetViolations(CARealtimeAudit::Violation(i));
+	}
+	~Violations() { CARealtimeAudit::SetMode(mMode); }
+
+	UInt64 operator[](CARealtimeAudit::Violation kind) const { return CARealtimeAudit::GetViolations(kind) - mStart[kind]; }
+	UInt64 Total() const
+	{
+		UInt64 total = 0;
+		for (int i = 0; i < CARealtimeAudit::kViolationCount; ++i)
+			total += (*this)[CARealtimeAudit::Violation(i)];
+		return total;
+	}
+
+	CARealtimeAudit::Mode	mMode;
+	UInt64					mStart[CARealtimeAudit::kViolationCount];
+};
+
+struct SimulatedPlayThrough {
+	SimulatedPlayThrough(const CASimulatedDeviceConfig &input, const CASimulatedDeviceConfig &output, bool varispeed = true) :
+		mBackend(input, output, 3), mEngine(mBackend)
+	{
+		mBackend.SetVarispeed(varispeed);
+		mEngine.GetTrace().Allocate(4096);
+		mEngine.Allocate(input.mChannels, output.mChannels);
+		mEngine.ComputeThruOffset();
+		mBackend.SetClient(&mEngine);
+	}
+
+	CASimulatedBackend	mBackend;
+	CAPlayThroughEngine	mEngine;
+};
+
+} // namespace
+
+TEST(CARealtimeAuditTest, IsAuditing)
+{
+	EXPECT_TRUE(CARealtimeAudit::IsAuditing());
+	EXPECT_FALSE(CARealtimeAudit::IsRealtimeThread());
+	{
+		CARealtimeAudit::Scope realtime;
+		EXPECT_TRUE(CARealtimeAudit::IsRealtimeThread());
+		{
+			CARealtimeAudit::Scope nested;
+			EXPECT_TRUE(CARealtimeAudit::IsRealtimeThread());
+		}
+		EXPECT_TRUE(CARealtimeAudit::IsRealtimeThread());
+	}
+	EXPECT_FALSE(CARealtimeAudit::IsRealtimeThread());
+}
+
+TEST(CARealtimeAuditTest, CatchesEachKind)
+{
+	FILE *devNull = fopen("/dev/null", "w");
+	ASSERT_TRUE(devNull);
+	fputs("x", devNull);	// so that it has its buffer already
+	std::mutex mutex;
+	Violations violations;
+	UInt64 counts[CARealtimeAudit::kViolationCount];
+	{
+		// nothing that could fail in here: a failure allocates
+		CARealtimeAudit::Scope realtime;
+
+		int *volatile p = new int(1);
+		delete p;
+		void *volatile q = malloc(16);
+		q = realloc(q, 32);
+		free(q);
+
+		mutex.lock();
+		mutex.unlock();
+
+		std::this_thread::sleep_for(std::chrono::microseconds(1));
+		usleep(1);
+
+		fprintf(devNull, "%d\n", 1);
+		fputs("x", devNull);
+		fwrite("x", 1, 1, devNull);
+		fflush(devNull);
+
+		for (int i = 0; i < CARealtimeAudit::kViolationCount; ++i)
+			counts[i] = violations[CARealtimeAudit::Violation(i)];
+	}
+	EXPECT_EQ(5u, counts[CARealtimeAudit::kAllocation]);
+	EXPECT_EQ(1u, counts[CARealtimeAudit::kLock]);
+	EXPECT_EQ(2u, counts[CARealtimeAudit::kBlocking]);
+	EXPECT_EQ(4u, counts[CARealtimeAudit::kStdio]);
+
+	// the same, from a thread that isn't real-time
+	UInt64 total = violations.Total();
+	int *volatile p = new int(1);
+	delete p;
+	mutex.lock();
+	mutex.unlock();
+	fprintf(devNull, "x");
+	fclose(devNull);
+	EXPECT_EQ(total, violations.Total());
+}
+
+TEST(CARealtimeAuditDeathTest, AbortsByDefault)
+{
+	EXPECT_DEATH({
+		CARealtimeAudit::SetMode(CARealtimeAudit::kAbort);
+		CARealtimeAudit::Scope realtime;
+		void *volatile p = malloc(16);
+		free(p);
+	}, "CARealtimeAudit: malloc \\(allocation\\) on a real-time thread");
+}
+
+// the engine marks its IO procs real-time, and what it calls the backend for with them
+TEST(CARealtimeAuditTest, EngineCallbacksAreRealtime)
+{
+	struct WatchedBackend : CASimulatedBackend {
+		using CASimulatedBackend::CASimulatedBackend;
+		OSStatus RenderInput(const AudioTimeStamp &timeStamp, UInt32 nFrames, AudioBufferList *ioData) override
+		{
+			(CARealtimeAudit::IsRealtimeThread() ? mRealtime : mNot)++;
+			return CASimulatedBackend::RenderInput(timeStamp, nFrames, ioData);
+		}
+		OSStatus SetPlaybackRate(Float64 rate) override
+		{
+			(CARealtimeAudit::IsRealtimeThread() ? mRealtime : mNot)++;
+			return CASimulatedBackend::SetPlaybackRate(rate);
+		}
+		int mRealtime = 0, mNot = 0;
+	};
+
+	CASimulatedDeviceConfig config = CASimulatedBackend::DefaultDeviceConfig();
+	WatchedBackend backend(config, config, 1);
+	CAPlayThroughEngine engine(backend);
+	engine.Allocate(config.mChannels);
+	engine.ComputeThruOffset();
+	backend.SetClient(&engine);
+	backend.Run(2);
+	EXPECT_GT(backend.mRealtime, 100);
+	EXPECT_EQ(0, backend.mNot);
+	EXPECT_FALSE(CARealtimeAudit::IsRealtimeThread());
+}
+
+TEST(CARealtimeAuditTest, EngineIsCleanOffline)
+{
+	for (bool varispeed : { true, false }) {
+		for (bool adaptive : { false, true }) {
+			SCOPED_TRACE(testing::Message() << "varispeed " << varispeed << " adaptive " << adaptive);
+			CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+			CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+			input.mNominalSampleRate = 44100;
+			input.mDriftPPM = 150;
+			output.mJitterSeconds = 0.001;
+
+			SimulatedPlayThrough sim(input, output, varispeed);
+			sim.mEngine.SetAdaptiveLatency(adaptive);
+			Violations violations;
+			sim.mBackend.Run(30);
+			sim.mBackend.Stall(CAPlayThroughBackend::kOutput, 2.0);
+			sim.mBackend.Run(10);
+			sim.mBackend.Stall(CAPlayThroughBackend::kInput, 0.05);
+			sim.mBackend.Run(10);
+			// the IO procs changing over to a new pipeline
+			sim.mBackend.SetSampleRate(CAPlayThroughBackend::kInput, 48000);
+			EXPECT_EQ(noErr, sim.mEngine.Reconfigure());
+			sim.mBackend.Run(10);
+			CAPlayThroughEngineStats stats;
+			sim.mEngine.GetStats(stats);
+			EXPECT_EQ(1u, stats.mReconfigurations);
+			EXPECT_EQ(0u, violations.Total());
+			EXPECT_GT(sim.mEngine.GetTrace().GetGlitches(), 0u);
+		}
+	}
+}
+
+TEST(CARealtimeAuditTest, EngineIsCleanInRealTime)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mBufferSizeFrames = 128;
+	output.mBufferSizeFrames = 128;
+
+	// and with the rate decided on a control thread
+	for (bool controlled : { false, true }) {
+		SCOPED_TRACE(testing::Message() << "controlled " << controlled);
+		SimulatedPlayThrough sim(input, output, false);
+		sim.mEngine.SetControlInterval(controlled ? 0.005 : 0.0);
+		Violations violations;
+		ASSERT_EQ(noErr, sim.mBackend.Start());
+		sim.mEngine.StartControlThread();
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		sim.mEngine.StopControlThread();
+		ASSERT_EQ(noErr, sim.mBackend.Stop());
+
+		CAPlayThroughMetrics::Snapshot snapshot;
+		sim.mEngine.GetMetrics().GetSnapshot(snapshot);
+		EXPECT_GT(snapshot.mOutput.mCallbacks, 50u);
+		EXPECT_EQ(0u, violations.Total());
+	}
+}
+
+// The pool's workers run their tasks under the audit as the IO thread does.
+TEST(CARealtimeAuditTest, EngineIsCleanOnAWorkerPool)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mChannels = 8;
+	input.mDriftPPM = 100;
+	output.mChannels = 8;
+	output.mNominalSampleRate = 44100;
+
+	CARealtimeWorkerPool pool;
+	pool.Initialize(2);
+	SimulatedPlayThrough sim(input, output, false);
+	sim.mEngine.GetChannelMatrix().SetGain(0, 7, 0.5f);
+	sim.mEngine.SetWorkerPool(&pool);
+	Violations violations;
+	sim.mBackend.Run(10);
+
+	CARealtimeWorkerPoolStats stats;
+	pool.GetStats(stats);
+	EXPECT_GT(stats.mBlocks, 1000u);
+	EXPECT_EQ(0u, violations.Total());
+}
+
+// The chain's processors taking up new parameters and a new order on the IO thread, as well as
+// running.
+TEST(CARealtimeAuditTest, EngineIsCleanWithADSPChain)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	output.mNominalSampleRate = 44100;
+
+	for (bool varispeed : { true, false }) {
+		SCOPED_TRACE(testing::Message() << "varispeed " << varispeed);
+		SimulatedPlayThrough sim(input, output, varispeed);
+		CADSPChain &chain = sim.mEngine.GetDSPChain();
+		CADSPEqualizer *eq = new CADSPEqualizer;
+		CADSPEqualizerBand band = { kCADSPFilter_Peaking, 1000, 1, 6 };
+		eq->SetBands(&band, 1);
+		CADSPGain *gain = new CADSPGain(0.5f);
+		CADSPDelay *delay = new CADSPDelay(0.1, 0.01);
+		chain.Add(eq);
+		chain.Add(gain);
+		chain.Add(new CADSPLimiter(0.5f));
+		chain.Add(delay);
+		Violations violations;
+		sim.mBackend.Run(5);
+		band.mGainDB = -6;
+		eq->SetBands(&band, 1);
+		gain->SetGain(2.0f);
+		delay->SetDelay(0.05);
+		const UInt32 order[] = { 3, 2, 1, 0 };
+		EXPECT_EQ(kCADSPChainError_OK, chain.SetOrder(order, 4));
+		sim.mBackend.Run(5);
+		EXPECT_EQ(0u, violations.Total());
+	}
+}
@@ -0,0 +1,236 @@
+/*=============================================================================
+	CARealtimeWorkerPoolTests.cpp
+
+	CARealtimeWorkerPool running every task once, block after block, with
+	the workers asleep, awake or missing; stealing from a slow participant;
+	the block reports and deadline misses; and the channel matrix and the
+	resampler giving the same output on a pool as without one.
+=============================================================================*/
+
+#include "CAChannelMatrix.h"
+#include "CARealtimeWorkerPool.h"
+#include "CAResampler.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Counts {
+	std::vector<std::atomic<UInt32>>	mRuns;
+
+	explicit Counts(UInt32 n) : mRuns(n) { }
+
+	static void Task(void *context, UInt32 task)
+	{
+		((Counts *)context)->mRuns[task].fetch_add(1, std::memory_order_relaxed);
+	}
+};
+
+void Spin(std::chrono::microseconds duration)
+{
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + duration;
+	while (std::chrono::steady_clock::now() < end) { }
+}
+
+void FillRandom(TestABL &abl, int nChannels, UInt32 nFrames, std::mt19937 &random)
+{
+	std::uniform_real_distribution<Float32> sample(-1.0f, 1.0f);
+	for (int ch = 0; ch < nChannels; ++ch)
+		for (UInt32 i = 0; i < nFrames; ++i)
+			abl.Channel(ch)[i] = sample(random);
+}
+
+} // namespace
+
+TEST(CARealtimeWorkerPoolTest, RunsEveryTaskOnce)
+{
+	for (UInt32 nWorkers : { 0u, 1u, 3u }) {
+		SCOPED_TRACE(testing::Message() << nWorkers << " workers");
+		CARealtimeWorkerPool pool;
+		pool.Initialize(nWorkers);
+		EXPECT_EQ(nWorkers + 1, pool.GetConcurrency());
+
+		for (UInt32 nTasks : { 1u, 2u, 7u, 64u, 1000u }) {
+			Counts counts(nTasks);
+			for (int block = 0; block < 200; ++block)
+				pool.Run(nTasks, Counts::Task, &counts);
+			for (UInt32 task = 0; task < nTasks; ++task)
+				ASSERT_EQ(200u, counts.mRuns[task].load()) << "task " << task << " of " << nTasks;
+		}
+
+		// and after the workers have gone to sleep
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		Counts counts(16);
+		pool.Run(16, Counts::Task, &counts);
+		for (UInt32 task = 0; task < 16; ++task)
+			EXPECT_EQ(1u, counts.mRuns[task].load());
+
+		CARealtimeWorkerPoolStats stats;
+		pool.GetStats(stats);
+		EXPECT_EQ(1001u, stats.mBlocks);
+		EXPECT_EQ(0u, stats.mDeadlineMisses);
+	}
+}
+
+TEST(CARealtimeWorkerPoolTest, RunsInlineUninitialized)
+{
+	CARealtimeWorkerPool pool;
+	EXPECT_EQ(1u, pool.GetConcurrency());
+	EXPECT_EQ(1u, pool.GetTasks(64));
+
+	std::thread::id caller = std::this_thread::get_id();
+	struct Check {
+		std::thread::id	mCaller;
+		UInt32			mElsewhere;
+		static void Task(void *context, UInt32)
+		{
+			Check &check = *(Check *)context;
+			if (std::this_thread::get_id() != check.mCaller)
+				++check.mElsewhere;
+		}
+	} check = { caller, 0 };
+	pool.Run(32, Check::Task, &check);
+	EXPECT_EQ(0u, check.mElsewhere);
+
+	CARealtimeWorkerPoolBlock block;
+	ASSERT_TRUE(pool.GetLastBlock(block));
+	EXPECT_EQ(32u, block.mTasks);
+	EXPECT_EQ(0u, block.mStolen);
+	EXPECT_FALSE(pool.GetLastBlock(block));
+}
+
+// The first participant's tasks are slow: the others take them once their own are done, and the
+// block takes not much longer than its share of the work.
+TEST(CARealtimeWorkerPoolTest, StealsFromASlowParticipant)
+{
+	CARealtimeWorkerPool pool;
+	pool.Initialize(3);
+	Spin(std::chrono::microseconds(1000));
+
+	struct Skewed {
+		static void Task(void *, UInt32 task)
+		{
+			Spin(std::chrono::microseconds(task < 8 ? 200 : 5));
+		}
+	};
+	UInt64 stolen = 0;
+	for (int block = 0; block < 20; ++block) {
+		pool.Run(32, Skewed::Task, NULL);
+		CARealtimeWorkerPoolBlock report;
+		ASSERT_TRUE(pool.GetLastBlock(report));
+		stolen += report.mStolen;
+		EXPECT_LE(report.mCriticalPathNanos, report.mWallNanos);
+		EXPECT_GE(report.mWorkNanos, report.mCriticalPathNanos);
+		EXPECT_GE(report.mWorkNanos, 8 * 200000u);
+	}
+	EXPECT_GT(stolen, 0u);
+
+	CARealtimeWorkerPoolStats stats;
+	pool.GetStats(stats);
+	EXPECT_EQ(stolen, stats.mStolen);
+	EXPECT_GE(stats.mMaxWallNanos, 200000u);
+}
+
+TEST(CARealtimeWorkerPoolTest, CountsDeadlineMisses)
+{
+	CARealtimeWorkerPool pool;
+	pool.Initialize(1, 0.0001);
+
+	struct Slow {
+		static void Task(void *, UInt32) { Spin(std::chrono::microseconds(300)); }
+	};
+	pool.Run(2, Slow::Task, NULL);
+	CARealtimeWorkerPoolBlock block;
+	ASSERT_TRUE(pool.GetLastBlock(block));
+	EXPECT_NEAR(100000.0, Float64(block.mPeriodNanos), 1.0);
+	EXPECT_GT(block.mWallNanos, block.mPeriodNanos);
+
+	pool.SetPeriod(1.0);
+	pool.Run(2, Slow::Task, NULL);
+
+	CARealtimeWorkerPoolStats stats;
+	pool.GetStats(stats);
+	EXPECT_EQ(2u, stats.mBlocks);
+	EXPECT_EQ(1u, stats.mDeadlineMisses);
+}
+
+TEST(CARealtimeWorkerPoolTest, ReinitializesAndTearsDown)
+{
+	CARealtimeWorkerPool pool;
+	Counts counts(8);
+	for (UInt32 nWorkers : { 2u, 5u, 0u, 1u }) {
+		pool.Initialize(nWorkers);
+		pool.Run(8, Counts::Task, &counts);
+	}
+	pool.Teardown();
+	EXPECT_EQ(1u, pool.GetConcurrency());
+	pool.Run(8, Counts::Task, &counts);
+	for (UInt32 task = 0; task < 8; ++task)
+		EXPECT_EQ(5u, counts.mRuns[task].load());
+}
+
+TEST(CARealtimeWorkerPoolTest, MatrixIsTheSameOnAPool)
+{
+	const int kInputs = 16, kOutputs = 12;
+	const UInt32 kFrames = 256;
+	std::mt19937 random(7);
+	std::uniform_real_distribution<Float32> gain(-1.0f, 1.0f);
+	CAChannelMatrix matrix;
+	matrix.Initialize(kInputs, kOutputs);
+	for (int m = 0; m < kOutputs; ++m)
+		for (int n = 0; n < kInputs; ++n)
+			if ((m + n) % 3)
+				matrix.SetGain(m, n, gain(random));
+
+	TestABL in(kInputs, kFrames), alone(kOutputs, kFrames), pooled(kOutputs, kFrames);
+	FillRandom(in, kInputs, kFrames, random);
+	ASSERT_EQ(kCAChannelMatrixError_OK, matrix.Process(in.List(), alone.List(), kFrames));
+
+	CARealtimeWorkerPool pool;
+	pool.Initialize(3);
+	EXPECT_EQ(6u, pool.GetTasks(kOutputs));
+	for (int block = 0; block < 10; ++block) {
+		pooled.Scribble();
+		ASSERT_EQ(kCAChannelMatrixError_OK, matrix.Process(in.List(), pooled.List(), kFrames, false, &pool));
+		for (int ch = 0; ch < kOutputs; ++ch)
+			for (UInt32 i = 0; i < kFrames; ++i)
+				ASSERT_EQ(alone.Sample(ch, i), pooled.Sample(ch, i)) << "channel " << ch << " frame " << i;
+	}
+	CARealtimeWorkerPoolStats stats;
+	pool.GetStats(stats);
+	EXPECT_EQ(10u, stats.mBlocks);
+}
+
+TEST(CARealtimeWorkerPoolTest, ResamplerIsTheSameOnAPool)
+{
+	const int kChannels = 10;
+	const UInt32 kFrames = 256;
+	CAResampler alone, pooled;
+	alone.Initialize(kChannels, kFrames, 1.1);
+	pooled.Initialize(kChannels, kFrames, 1.1);
+	CARealtimeWorkerPool pool;
+	pool.Initialize(2);
+
+	std::mt19937 random(11);
+	TestABL in(kChannels, alone.GetMaxInputFrames());
+	TestABL outAlone(kChannels, kFrames), outPooled(kChannels, kFrames);
+	Float64 ratio = 0.99;
+	for (int block = 0; block < 20; ++block, ratio += 0.005) {
+		UInt32 nInput = alone.InputFramesNeeded(kFrames, ratio);
+		ASSERT_EQ(nInput, pooled.InputFramesNeeded(kFrames, ratio));
+		FillRandom(in, kChannels, nInput, random);
+		for (int ch = 0; ch < kChannels; ++ch)
+			in.List()->mBuffers[ch].mDataByteSize = nInput * sizeof(Float32);
+		ASSERT_EQ(kCAResamplerError_OK, alone.Process(in.List(), nInput, outAlone.List(), kFrames, ratio));
+		ASSERT_EQ(kCAResamplerError_OK, pooled.Process(in.List(), nInput, outPooled.List(), kFrames, ratio, &pool));
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < kFrames; ++i)
+				ASSERT_EQ(outAlone.Sample(ch, i), outPooled.Sample(ch, i)) << "block " << block << " channel " << ch;
+	}
+}
@@ -0,0 +1,232 @@
+/*=============================================================================
+	CAResamplerTests.cpp
+
+	CAResampler's kernels, its accuracy per quality, its group delay and its
+	bookkeeping of input frames.
+=============================================================================*/
+
+#include "CAResampler.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace {
+
+const UInt32 kBlockFrames = 512;
+
+std::vector<const CAResamplerKernels *> AvailableKernels()
+{
+	std::vector<const CAResamplerKernels *> kernels;
+	for (int isa = 0; isa < kCASampleConversionISA_Count; ++isa)
+		if (const CAResamplerKernels *k = CAGetResamplerKernels(CASampleConversionISA(isa)))
+			kernels.push_back(k);
+	return kernels;
+}
+
+// Resamples a sine of frequency cycles per input frame in blocks, the ratio of each block given by
+// ratioOf, and returns the signal to error ratio in dB against the ideal sine at the positions the
+// resampler promises: its ratio ramps across each block and its output lags by GetLatency.
+Float64 SineSNR(CAResamplerQuality quality, Float64 frequency, Float64 maxRatio, std::function<Float64 (int)> ratioOf,
+				int nBlocks = 200, const CAResamplerKernels *kernels = NULL)
+{
+	CAResampler resampler;
+	resampler.Initialize(1, kBlockFrames, maxRatio, quality, kernels);
+	TestABL in(1, resampler.GetMaxInputFrames()), out(1, kBlockFrames);
+
+	UInt64 inputTime = 0;
+	Float64 position = -Float64(resampler.GetLatency());
+	Float64 lastRatio = std::min(1.0, maxRatio);
+	Float64 signal = 0, error = 0;
+	for (int block = 0; block < nBlocks; ++block) {
+		Float64 ratio = ratioOf(block);
+		UInt32 nIn = resampler.InputFramesNeeded(kBlockFrames, ratio);
+		for (UInt32 i = 0; i < nIn; ++i)
+			in.Channel(0)[i] = Float32(sin(2 * M_PI * frequency * (inputTime + i)));
+		inputTime += nIn;
+		EXPECT_EQ(kCAResamplerError_OK, resampler.Process(in.List(), nIn, out.List(), kBlockFrames, ratio));
+
+		for (UInt32 k = 0; k < kBlockFrames; ++k) {
+			// skip the first blocks, where the filter still holds the silence before the input
+			if (block >= 2) {
+				Float64 ideal = sin(2 * M_PI * frequency * position);
+				signal += ideal * ideal;
+				error += (out.Channel(0)[k] - ideal) * (out.Channel(0)[k] - ideal);
+			}
+			position += lastRatio + (ratio - lastRatio) * (k + 1) / kBlockFrames;
+		}
+		lastRatio = ratio;
+	}
+	return 10 * log10(signal / error);
+}
+
+// Resamples a sine and returns the output's power in dB relative to the input's.
+Float64 SineGain(CAResamplerQuality quality, Float64 frequency, Float64 ratio)
+{
+	CAResampler resampler;
+	resampler.Initialize(1, kBlockFrames, ratio, quality);
+	TestABL in(1, resampler.GetMaxInputFrames()), out(1, kBlockFrames);
+
+	UInt64 inputTime = 0;
+	Float64 power = 0;
+	const int kBlocks = 100;
+	for (int block = 0; block < kBlocks; ++block) {
+		UInt32 nIn = resampler.InputFramesNeeded(kBlockFrames, ratio);
+		for (UInt32 i = 0; i < nIn; ++i)
+			in.Channel(0)[i] = Float32(sin(2 * M_PI * frequency * (inputTime + i)));
+		inputTime += nIn;
+		resampler.Process(in.List(), nIn, out.List(), kBlockFrames, ratio);
+		if (block >= 2)
+			for (UInt32 k = 0; k < kBlockFrames; ++k)
+				power += out.Channel(0)[k] * out.Channel(0)[k];
+	}
+	return 10 * log10(power / ((kBlocks - 2) * kBlockFrames * 0.5));
+}
+
+const char *QualityName(CAResamplerQuality quality)
+{
+	static const char *names[] = { "Cubic", "Low", "Medium", "High" };
+	return names[quality];
+}
+
+} // namespace
+
+TEST(CAResamplerTest, EveryKernelMatchesScalar)
+{
+	const CAResamplerKernels *scalar = CAGetResamplerKernels(kCASampleConversionISA_Scalar);
+	ASSERT_TRUE(scalar != NULL);
+
+	for (const CAResamplerKernels *kernels : AvailableKernels()) {
+		for (int q = 0; q < kCAResamplerQuality_Count; ++q) {
+			SCOPED_TRACE(std::string(kernels->mName) + " " + QualityName(CAResamplerQuality(q)));
+			CAResampler a, b;
+			a.Initialize(2, kBlockFrames, 1.1, CAResamplerQuality(q), scalar);
+			b.Initialize(2, kBlockFrames, 1.1, CAResamplerQuality(q), kernels);
+			TestABL in(2, a.GetMaxInputFrames()), outA(2, kBlockFrames), outB(2, kBlockFrames);
+
+			std::mt19937 random(7);
+			std::uniform_real_distribution<Float32> sample(-1.0f, 1.0f);
+			std::uniform_real_distribution<Float64> ratio(0.9, 1.1);
+			for (int block = 0; block < 20; ++block) {
+				// odd block sizes so that every kernel also runs its scalar tail
+				UInt32 nOut = kBlockFrames - 13 * (block % 3);
+				Float64 r = ratio(random);
+				UInt32 nIn = a.InputFramesNeeded(nOut, r);
+				ASSERT_EQ(nIn, b.InputFramesNeeded(nOut, r));
+				for (int ch = 0; ch < 2; ++ch)
+					for (UInt32 i = 0; i < nIn; ++i)
+						in.Channel(ch)[i] = sample(random);
+				ASSERT_EQ(kCAResamplerError_OK, a.Process(in.List(), nIn, outA.List(), nOut, r));
+				ASSERT_EQ(kCAResamplerError_OK, b.Process(in.List(), nIn, outB.List(), nOut, r));
+				for (int ch = 0; ch < 2; ++ch)
+					for (UInt32 k = 0; k < nOut; ++k)
+						ASSERT_NEAR(outA.Channel(ch)[k], outB.Channel(ch)[k], 1e-5f) << "block " << block << " frame " << k;
+			}
+		}
+	}
+}
+
+TEST(CAResamplerTest, SineAccuracyPerQuality)
+{
+	// 1 kHz and 10 kHz, 44.1 to 48 kHz and back: the error in dB below the signal
+	const Float64 kMinSNR[kCAResamplerQuality_Count][2] = {
+		{ 85, 20 },		// cubic
+		{ 60, 60 },
+		{ 85, 80 },
+		{ 105, 105 },
+	};
+	const Float64 kUp = 44100.0 / 48000.0, kDown = 48000.0 / 44100.0;
+	for (int q = 0; q < kCAResamplerQuality_Count; ++q) {
+		for (int f = 0; f < 2; ++f) {
+			Float64 hz = f ? 10000 : 1000;
+			Float64 up = SineSNR(CAResamplerQuality(q), hz / 44100, kUp, [=](int) { return kUp; });
+			Float64 down = SineSNR(CAResamplerQuality(q), hz / 48000, kDown, [=](int) { return kDown; });
+			printf("[ report   ] %-6s %5.0f Hz  44.1->48 %5.1f dB  48->44.1 %5.1f dB\n", QualityName(CAResamplerQuality(q)), hz, up, down);
+			EXPECT_GT(up, kMinSNR[q][f]) << QualityName(CAResamplerQuality(q)) << " " << hz;
+			EXPECT_GT(down, kMinSNR[q][f]) << QualityName(CAResamplerQuality(q)) << " " << hz;
+		}
+	}
+}
+
+TEST(CAResamplerTest, SincQualitiesRejectAliases)
+{
+	// 48 to 44.1 kHz: 23 kHz has no place in the output, and would fold to 21.1 kHz
+	const Float64 kDown = 48000.0 / 44100.0;
+	Float64 low = SineGain(kCAResamplerQuality_Low, 23000.0 / 48000, kDown);
+	Float64 medium = SineGain(kCAResamplerQuality_Medium, 23000.0 / 48000, kDown);
+	Float64 high = SineGain(kCAResamplerQuality_High, 23000.0 / 48000, kDown);
+	printf("[ report   ] 23 kHz at 48->44.1: Low %.1f dB  Medium %.1f dB  High %.1f dB\n", low, medium, high);
+	EXPECT_LT(low, -40.0);
+	EXPECT_LT(medium, -40.0);
+	EXPECT_LT(high, -55.0);
+
+	// while the passband is left alone
+	for (int q = kCAResamplerQuality_Low; q < kCAResamplerQuality_Count; ++q)
+		EXPECT_NEAR(0.0, SineGain(CAResamplerQuality(q), 5000.0 / 48000, kDown), 0.05) << QualityName(CAResamplerQuality(q));
+}
+
+TEST(CAResamplerTest, GroupDelayIsTheLatency)
+{
+	for (int q = 0; q < kCAResamplerQuality_Count; ++q) {
+		CAResampler resampler;
+		resampler.Initialize(1, kBlockFrames, 1.0, CAResamplerQuality(q));
+		TestABL in(1, resampler.GetMaxInputFrames()), out(1, kBlockFrames);
+
+		UInt32 nIn = resampler.InputFramesNeeded(kBlockFrames, 1.0);
+		EXPECT_EQ(kBlockFrames, nIn);
+		std::fill(in.Channel(0), in.Channel(0) + nIn, 0.0f);
+		in.Channel(0)[100] = 1.0f;
+		ASSERT_EQ(kCAResamplerError_OK, resampler.Process(in.List(), nIn, out.List(), kBlockFrames, 1.0));
+
+		Float32 *y = out.Channel(0);
+		UInt32 peak = UInt32(std::max_element(y, y + kBlockFrames, [](Float32 a, Float32 b) { return fabsf(a) < fabsf(b); }) - y);
+		EXPECT_EQ(100 + resampler.GetLatency(), peak) << QualityName(CAResamplerQuality(q));
+	}
+}
+
+TEST(CAResamplerTest, ConsumesTheInputAtTheRatio)
+{
+	CAResampler resampler;
+	resampler.Initialize(1, kBlockFrames, 1.01);
+	TestABL in(1, resampler.GetMaxInputFrames()), out(1, kBlockFrames);
+
+	std::mt19937 random(11);
+	std::uniform_real_distribution<Float64> ratio(0.99, 1.01);
+	UInt64 consumed = 0;
+	Float64 expected = 0, lastRatio = 1.0;
+	for (int block = 0; block < 1000; ++block) {
+		Float64 r = ratio(random);
+		UInt32 nIn = resampler.InputFramesNeeded(kBlockFrames, r);
+		ASSERT_LE(nIn, resampler.GetMaxInputFrames());
+		ASSERT_EQ(kCAResamplerError_OK, resampler.Process(in.List(), nIn, out.List(), kBlockFrames, r));
+		consumed += nIn;
+		expected += kBlockFrames * (lastRatio + r) / 2 + (r - lastRatio) / 2;
+		lastRatio = r;
+		// never more than a filter's worth ahead of the positions output so far
+		ASSERT_NEAR(expected, Float64(consumed), resampler.GetLatency() + 1.0) << "block " << block;
+	}
+}
+
+TEST(CAResamplerTest, RatioChangesAreSmooth)
+{
+	// the ratio jumping a whole 1% either way from block to block, as it never will
+	Float64 snr = SineSNR(kCAResamplerQuality_Medium, 1000.0 / 48000, 1.01, [](int block) { return (block & 1) ? 1.01 : 0.99; });
+	EXPECT_GT(snr, 85.0);
+}
+
+TEST(CAResamplerTest, RejectsBadArguments)
+{
+	CAResampler resampler;
+	resampler.Initialize(1, kBlockFrames, 1.1);
+	TestABL in(1, resampler.GetMaxInputFrames()), out(1, kBlockFrames + 1);
+
+	UInt32 nIn = resampler.InputFramesNeeded(kBlockFrames, 1.0);
+	EXPECT_EQ(kCAResamplerError_TooManyFrames, resampler.Process(in.List(), nIn, out.List(), kBlockFrames + 1, 1.0));
+	EXPECT_EQ(kCAResamplerError_BadRatio, resampler.Process(in.List(), nIn, out.List(), kBlockFrames, 1.2));
+	EXPECT_EQ(kCAResamplerError_BadRatio, resampler.Process(in.List(), nIn, out.List(), kBlockFrames, 0.0));
+	EXPECT_EQ(kCAResamplerError_InputFrames, resampler.Process(in.List(), nIn - 1, out.List(), kBlockFrames, 1.0));
+	EXPECT_EQ(kCAResamplerError_OK, resampler.Process(in.List(), nIn, out.List(), kBlockFrames, 1.0));
+}
@@ -0,0 +1,186 @@
+/*=============================================================================
+	CARingBufferReaderTests.cpp
+
+	The fan-out test runs one writer and eight readers for CARB_STRESS_SECONDS
+	seconds (default 2).
+=============================================================================*/
+
+#include "CARingBufferReader.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kChannels = 2;
+const UInt32 kCapacity = 256;
+
+class CARingBufferReaderTest : public ::testing::Test {
+protected:
+	void SetUp() override
+	{
+		mRing.Allocate(kChannels, sizeof(Float32), kCapacity);
+	}
+
+	void StoreAt(CARingBuffer::SampleTime t, UInt32 nFrames)
+	{
+		TestABL src(kChannels, nFrames);
+		src.Fill(t);
+		ASSERT_EQ(kCARingBufferError_OK, mRing.Store(src.List(), nFrames, t));
+	}
+
+	CARingBuffer mRing;
+};
+
+double StressSeconds()
+{
+	const char *env = getenv("CARB_STRESS_SECONDS");
+	return env ? atof(env) : 2.0;
+}
+
+} // namespace
+
+TEST_F(CARingBufferReaderTest, FetchesAtItsOffsetAndAdvances)
+{
+	StoreAt(0, 128);
+	CARingBufferReader reader(mRing, 1000);
+
+	TestABL dest(kChannels, 32);
+	ASSERT_EQ(kCARingBufferError_OK, reader.Fetch(dest.List(), 32, 1016));
+	EXPECT_EQ(SampleValue(0, 16), dest.Channel(0)[0]);
+	EXPECT_EQ(48, reader.GetPosition());
+
+	ASSERT_EQ(kCARingBufferError_OK, reader.FetchNext(dest.List(), 32));
+	EXPECT_EQ(SampleValue(1, 48), dest.Channel(1)[0]);
+	EXPECT_EQ(80, reader.GetPosition());
+
+	CARingBufferReaderStats stats;
+	reader.GetStats(stats);
+	EXPECT_EQ(2u, stats.mFetches);
+	EXPECT_EQ(64u, stats.mFramesFetched);
+	EXPECT_EQ(0u, stats.mUnderruns + stats.mOverruns + stats.mDiscontinuities);
+}
+
+TEST_F(CARingBufferReaderTest, CountsUnderrunsOverrunsAndDiscontinuities)
+{
+	for (CARingBuffer::SampleTime t = 0; t < 320; t += 64)
+		StoreAt(t, 64);		// leaves [64, 320)
+	CARingBufferReader reader(mRing);
+	TestABL dest(kChannels, 32);
+
+	EXPECT_EQ(kCARingBufferError_WayBehind, reader.Fetch(dest.List(), 32, 0));
+	EXPECT_EQ(kCARingBufferError_SlightlyBehind, reader.Fetch(dest.List(), 32, 48));
+	reader.Seek(296);
+	EXPECT_EQ(kCARingBufferError_SlightlyAhead, reader.FetchNext(dest.List(), 32));
+	EXPECT_EQ(kCARingBufferError_WayAhead, reader.Fetch(dest.List(), 32, 400));
+
+	CARingBufferReaderStats stats;
+	reader.GetStats(stats);
+	EXPECT_EQ(4u, stats.mFetches);
+	EXPECT_EQ(0u, stats.mFramesFetched);
+	EXPECT_EQ(2u, stats.mOverruns);
+	EXPECT_EQ(2u, stats.mUnderruns);
+	EXPECT_EQ(2u, stats.mDiscontinuities);	// 0 -> 48 and 328 -> 400; the Seek isn't one
+
+	reader.ResetStats();
+	reader.GetStats(stats);
+	EXPECT_EQ(0u, stats.mFetches + stats.mFramesFetched + stats.mOverruns + stats.mUnderruns + stats.mDiscontinuities);
+}
+
+TEST_F(CARingBufferReaderTest, ReadersAreIndependent)
+{
+	StoreAt(0, 128);
+	CARingBufferReader early(mRing, 0), late(mRing, -64);
+	TestABL a(kChannels, 64), b(kChannels, 64);
+
+	ASSERT_EQ(kCARingBufferError_OK, early.Fetch(a.List(), 64, 0));
+	ASSERT_EQ(kCARingBufferError_OK, late.Fetch(b.List(), 64, 0));
+	EXPECT_EQ(SampleValue(0, 0), a.Channel(0)[0]);
+	EXPECT_EQ(SampleValue(0, 64), b.Channel(0)[0]);
+	EXPECT_EQ(64, early.GetPosition());
+	EXPECT_EQ(128, late.GetPosition());
+}
+
+TEST(CARingBufferReaderStressTest, OneWriterEightReaders)
+{
+	const int kReaders = 8;
+	const UInt32 kCapacity = 4096;
+	const UInt32 kWriteFrames = 128;
+
+	CARingBuffer ring;
+	ring.Allocate(kChannels, sizeof(Float32), kCapacity);
+
+	std::vector<std::unique_ptr<CARingBufferReader>> readers;
+	for (int i = 0; i < kReaders; ++i)
+		readers.emplace_back(new CARingBufferReader(ring));
+
+	std::atomic<bool> done(false);
+	std::atomic<UInt64> badSamples(0), okFetches(0), failedFetches(0);
+
+	std::thread writer([&] {
+		TestABL src(kChannels, kWriteFrames);
+		CARingBuffer::SampleTime t = 0;
+		while (!done.load(std::memory_order_relaxed)) {
+			src.Fill(t);
+			ring.Store(src.List(), kWriteFrames, t);
+			t += kWriteFrames;
+			std::this_thread::yield();
+		}
+	});
+
+	std::vector<std::thread> readerThreads;
+	for (int i = 0; i < kReaders; ++i) {
+		readerThreads.emplace_back([&, i] {
+			CARingBufferReader &reader = *readers[i];
+			const UInt32 nFrames = 32 + 29 * i;		// every reader at its own block size...
+			const UInt32 lag = 256 * i;				// ...and its own latency behind the writer
+			TestABL dest(kChannels, nFrames);
+			while (!done.load(std::memory_order_relaxed)) {
+				CARingBuffer::SampleTime start, end;
+				ring.GetTimeBounds(start, end);
+				CARingBuffer::SampleTime readTime = reader.GetPosition();
+				if (readTime + nFrames + lag > end) {
+					std::this_thread::yield();
+					continue;
+				}
+				dest.Scribble();
+				if (reader.FetchNext(dest.List(), nFrames) != kCARingBufferError_OK) {
+					++failedFetches;
+					reader.Seek(end - nFrames - lag);	// lapped by the writer; catch up
+					continue;
+				}
+				for (int ch = 0; ch < kChannels; ++ch)
+					for (UInt32 f = 0; f < nFrames; ++f)
+						if (dest.Channel(ch)[f] != SampleValue(ch, readTime + f))
+							++badSamples;
+				++okFetches;
+			}
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(StressSeconds()));
+	done = true;
+	writer.join();
+	for (std::thread &t : readerThreads)
+		t.join();
+
+	EXPECT_EQ(0u, badSamples.load());
+	EXPECT_GT(okFetches.load(), 0u);
+
+	UInt64 totalFetches = 0, totalFailures = 0;
+	for (int i = 0; i < kReaders; ++i) {
+		CARingBufferReaderStats stats;
+		readers[i]->GetStats(stats);
+		EXPECT_GT(stats.mFramesFetched, 0u) << "reader " << i;
+		totalFetches += stats.mFetches;
+		totalFailures += stats.mUnderruns + stats.mOverruns;
+	}
+	EXPECT_EQ(okFetches.load() + failedFetches.load(), totalFetches);
+	EXPECT_EQ(failedFetches.load(), totalFailures);
+}
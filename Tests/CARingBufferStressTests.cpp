@@ -0,0 +1,91 @@
+/*=============================================================================
+	CARingBufferStressTests.cpp
+
+	One producer thread storing and one consumer thread reading the time
+	bounds and fetching, concurrently. Runs for CARB_STRESS_SECONDS seconds
+	(default 2); set it to a few hundred for a soak test.
+=============================================================================*/
+
+#include "CARingBuffer.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <thread>
+
+namespace {
+
+double StressSeconds()
+{
+	const char *env = getenv("CARB_STRESS_SECONDS");
+	return env ? atof(env) : 2.0;
+}
+
+} // namespace
+
+TEST(CARingBufferStressTest, ConcurrentStoreAndFetchNeverSeeTornBounds)
+{
+	const int kChannels = 2;
+	const UInt32 kCapacity = 1024;
+	const UInt32 kMaxBlock = 200;
+	const UInt32 kReadFrames = 64;
+
+	CARingBuffer ring;
+	ring.Allocate(kChannels, sizeof(Float32), kCapacity);
+
+	std::atomic<bool> done(false);
+	std::atomic<UInt64> tornBounds(0), badSamples(0), verifiedFetches(0), boundsReads(0);
+
+	std::thread producer([&] {
+		TestABL src(kChannels, kMaxBlock);
+		CARingBuffer::SampleTime t = 0;
+		UInt32 seed = 12345;
+		while (!done.load(std::memory_order_relaxed)) {
+			seed = seed * 1664525 + 1013904223;
+			UInt32 nFrames = 1 + (seed >> 8) % kMaxBlock;	// varying sizes make a torn (start, end) pair unlikely to look valid
+			src.Fill(t);
+			ring.Store(src.List(), nFrames, t);
+			t += nFrames;
+		}
+	});
+
+	std::thread consumer([&] {
+		TestABL dest(kChannels, kReadFrames);
+		CARingBuffer::SampleTime lastStart = 0, lastEnd = 0;
+		while (!done.load(std::memory_order_relaxed)) {
+			CARingBuffer::SampleTime start, end;
+			if (ring.GetTimeBounds(start, end) != kCARingBufferError_OK)
+				++tornBounds;
+			++boundsReads;
+			
+			// the producer only moves forward, and never holds more than the capacity
+			if (start < lastStart || end < lastEnd || end < start || end - start > kCapacity)
+				++tornBounds;
+			lastStart = start;
+			lastEnd = end;
+
+			if (end - start < kReadFrames)
+				continue;
+			dest.Scribble();
+			if (ring.Fetch(dest.List(), kReadFrames, end - kReadFrames) != kCARingBufferError_OK)
+				continue;
+			for (int ch = 0; ch < kChannels; ++ch)
+				for (UInt32 i = 0; i < kReadFrames; ++i)
+					if (dest.Channel(ch)[i] != SampleValue(ch, end - kReadFrames + i))
+						++badSamples;
+			++verifiedFetches;
+		}
+	});
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(StressSeconds()));
+	done = true;
+	producer.join();
+	consumer.join();
+
+	EXPECT_EQ(0u, tornBounds.load());
+	EXPECT_EQ(0u, badSamples.load());
+	EXPECT_GT(boundsReads.load(), 0u);
+	EXPECT_GT(verifiedFetches.load(), 0u);
+}
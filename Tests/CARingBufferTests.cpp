@@ -0,0 +1,627 @@
+/*=============================================================================
+	CARingBufferTests.cpp
+
+=============================================================================*/
+
+#include "CARingBuffer.h"
+#include "CARingBufferMemory.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const int kChannels = 2;
+const UInt32 kCapacity = 256;
+
+class CARingBufferTest : public ::testing::Test {
+protected:
+	CARingBufferTest(CARingBuffer::Layout layout = CARingBuffer::kDeinterleaved) : mLayout(layout) { }
+
+	void SetUp() override
+	{
+		mRing.Allocate(kChannels, sizeof(Float32), kCapacity, mLayout);
+	}
+
+	CARingBufferError StoreAt(CARingBuffer::SampleTime t, UInt32 nFrames)
+	{
+		TestABL src(kChannels, nFrames, mLayout);
+		src.Fill(t);
+		return mRing.Store(src.List(), nFrames, t);
+	}
+
+	// leaves valid data in [64, 320)
+	void FillPastCapacity()
+	{
+		for (CARingBuffer::SampleTime t = 0; t < 320; t += 64)
+			ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, 64));
+		ExpectBounds(64, 320);
+	}
+
+	void ExpectBounds(CARingBuffer::SampleTime start, CARingBuffer::SampleTime end)
+	{
+		CARingBuffer::SampleTime s, e;
+		ASSERT_EQ(kCARingBufferError_OK, mRing.GetTimeBounds(s, e));
+		EXPECT_EQ(start, s);
+		EXPECT_EQ(end, e);
+	}
+
+	void ExpectSamples(TestABL &abl, UInt32 destOffset, UInt32 nFrames, CARingBuffer::SampleTime t)
+	{
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < nFrames; ++i)
+				ASSERT_EQ(SampleValue(ch, t + i), abl.Sample(ch, destOffset + i)) << "channel " << ch << " frame " << destOffset + i;
+	}
+
+	// base + gains[ch] times the SampleValues, as FetchScaled and FetchMix leave them
+	void ExpectScaled(TestABL &abl, UInt32 destOffset, UInt32 nFrames, CARingBuffer::SampleTime t, const Float32 *gains, Float32 base = 0.0f)
+	{
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < nFrames; ++i)
+				ASSERT_EQ(base + SampleValue(ch, t + i) * gains[ch], abl.Sample(ch, destOffset + i)) << "channel " << ch << " frame " << destOffset + i;
+	}
+
+	void ExpectConstant(TestABL &abl, UInt32 destOffset, UInt32 nFrames, Float32 value)
+	{
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < nFrames; ++i)
+				ASSERT_EQ(value, abl.Sample(ch, destOffset + i)) << "channel " << ch << " frame " << destOffset + i;
+	}
+
+	void Set(TestABL &abl, UInt32 nFrames, Float32 value)
+	{
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < nFrames; ++i)
+				abl.Sample(ch, i) = value;
+	}
+
+	void ExpectSilence(TestABL &abl, UInt32 destOffset, UInt32 nFrames)
+	{
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < nFrames; ++i)
+				ASSERT_EQ(0.0f, abl.Sample(ch, destOffset + i)) << "channel " << ch << " frame " << destOffset + i;
+	}
+
+	// writes SampleValues for [t, t + nFrames) straight into the ring
+	CARingBufferError StoreInPlace(CARingBuffer::SampleTime t, UInt32 nFrames)
+	{
+		SpanABL head(kChannels), tail(kChannels);
+		UInt32 headFrames;
+		CARingBufferError err = mRing.BeginStore(nFrames, t, head.List(), tail.List(), headFrames);
+		if (err) return err;
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < nFrames; ++i)
+				(i < headFrames ? head.Sample(ch, i) : tail.Sample(ch, i - headFrames)) = SampleValue(ch, t + i);
+		mRing.EndStore(nFrames, t);
+		return kCARingBufferError_OK;
+	}
+
+	// reads [t, t + nFrames) straight out of the ring and checks it
+	void ExpectSamplesInPlace(CARingBuffer::SampleTime t, UInt32 nFrames)
+	{
+		SpanABL head(kChannels), tail(kChannels);
+		UInt32 headFrames;
+		ASSERT_EQ(kCARingBufferError_OK, mRing.BeginFetch(nFrames, t, head.List(), tail.List(), headFrames));
+		ASSERT_LE(headFrames, nFrames);
+		for (int ch = 0; ch < kChannels; ++ch)
+			for (UInt32 i = 0; i < nFrames; ++i)
+				ASSERT_EQ(SampleValue(ch, t + i), i < headFrames ? head.Sample(ch, i) : tail.Sample(ch, i - headFrames)) << "channel " << ch << " frame " << i;
+		EXPECT_EQ(kCARingBufferError_OK, mRing.EndFetch(nFrames, t));
+	}
+
+	CARingBuffer::Layout mLayout;
+	CARingBuffer mRing;
+};
+
+class CARingBufferInterleavedTest : public CARingBufferTest {
+protected:
+	CARingBufferInterleavedTest() : CARingBufferTest(CARingBuffer::kInterleaved) { }
+};
+
+// Mirrored rings round their capacity up to whole pages, so these tests size
+// everything from GetCapacityFrames() rather than kCapacity.
+class CARingBufferMirroredTest : public CARingBufferTest, public ::testing::WithParamInterface<CARingBuffer::Layout> {
+protected:
+	CARingBufferMirroredTest() : CARingBufferTest(GetParam()) { }
+
+	void SetUp() override
+	{
+		mRing.Allocate(kChannels, sizeof(Float32), kCapacity, mLayout, CARingBuffer::kAllocateMirrored);
+		if (!mRing.IsMirrored())
+			GTEST_SKIP() << "mirrored allocation is not available here";
+		mCapacityFrames = mRing.GetCapacityFrames();
+	}
+
+	UInt32 mCapacityFrames;
+};
+
+} // namespace
+
+TEST_F(CARingBufferTest, EmptyBufferHasEmptyBounds)
+{
+	ExpectBounds(0, 0);
+}
+
+TEST_F(CARingBufferTest, StoreThenFetchRoundTrips)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, 64));
+	ExpectBounds(0, 64);
+
+	TestABL dest(kChannels, 64);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 64, 0));
+	ExpectSamples(dest, 0, 64, 0);
+	EXPECT_EQ(64 * sizeof(Float32), dest.List()->mBuffers[0].mDataByteSize);
+}
+
+TEST_F(CARingBufferTest, CapacityIsRoundedUpToPowerOfTwo)
+{
+	CARingBuffer ring;
+	ring.Allocate(1, sizeof(Float32), 100);
+
+	TestABL src(1, 129);
+	EXPECT_EQ(kCARingBufferError_OK, ring.Store(src.List(), 128, 0));
+	EXPECT_EQ(kCARingBufferError_TooMuch, ring.Store(src.List(), 129, 128));
+}
+
+TEST_F(CARingBufferTest, StoreLargerThanCapacityFails)
+{
+	EXPECT_EQ(kCARingBufferError_TooMuch, StoreAt(0, kCapacity + 1));
+	ExpectBounds(0, 0);
+}
+
+TEST_F(CARingBufferTest, SequentialStoresAdvanceStartTimeOnceFull)
+{
+	for (CARingBuffer::SampleTime t = 0; t < CARingBuffer::SampleTime(kCapacity); t += 64)
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, 64));
+	ExpectBounds(0, kCapacity);
+
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(kCapacity, 64));
+	ExpectBounds(64, kCapacity + 64);
+}
+
+TEST_F(CARingBufferTest, StoreAndFetchAcrossTheWrapPoint)
+{
+	// misaligned block size so that both the store and the fetch split at the end of the buffer
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 10; ++i, t += kBlock)
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+	ExpectBounds(t - kCapacity, t);
+
+	TestABL dest(kChannels, 200);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 200, t - 200));
+	ExpectSamples(dest, 0, 200, t - 200);
+}
+
+TEST_F(CARingBufferTest, ZeroFrameFetchWritesNothing)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, 200));
+
+	const Float32 kGains[kChannels] = { 2.0f, -0.5f };
+	TestABL dest(kChannels, 32);
+	for (CARingBuffer::SampleTime t : { 0, 100, 200 }) {
+		EXPECT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 0, t));
+		EXPECT_EQ(kCARingBufferError_OK, mRing.FetchMix(dest.List(), 0, t, kGains));
+		ExpectConstant(dest, 0, 32, kGarbage);
+	}
+}
+
+TEST_F(CARingBufferTest, WraparoundOverManyPasses)
+{
+	const UInt32 kWrite = 96, kRead = 96;
+	TestABL dest(kChannels, kRead);
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 1000; ++i, t += kWrite) {
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kWrite));
+		dest.Scribble();
+		ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), kRead, t + kWrite - kRead));
+		ExpectSamples(dest, 0, kRead, t + kWrite - kRead);
+	}
+}
+
+TEST_F(CARingBufferTest, GapIsFilledWithSilence)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, 32));
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(64, 32));
+	ExpectBounds(0, 96);
+
+	TestABL dest(kChannels, 96);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 96, 0));
+	ExpectSamples(dest, 0, 32, 0);
+	ExpectSilence(dest, 32, 32);
+	ExpectSamples(dest, 64, 32, 64);
+}
+
+TEST_F(CARingBufferTest, GapAcrossTheWrapPointIsFilledWithSilence)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, 200));
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(300, 32));
+	ExpectBounds(332 - kCapacity, 332);
+
+	TestABL dest(kChannels, 132);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 132, 200));
+	ExpectSilence(dest, 0, 100);
+	ExpectSamples(dest, 100, 32, 300);
+}
+
+TEST_F(CARingBufferTest, StoringBackwardsDiscardsEverything)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(1000, 64));
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(500, 64));
+	ExpectBounds(500, 564);
+}
+
+TEST_F(CARingBufferTest, FetchWayBehind)
+{
+	FillPastCapacity();
+
+	TestABL dest(kChannels, 32);
+	EXPECT_EQ(kCARingBufferError_WayBehind, mRing.Fetch(dest.List(), 32, 0));
+}
+
+TEST_F(CARingBufferTest, FetchSlightlyBehindZeroesTheLeadingFrames)
+{
+	FillPastCapacity();
+
+	TestABL dest(kChannels, 32);
+	EXPECT_EQ(kCARingBufferError_SlightlyBehind, mRing.Fetch(dest.List(), 32, 54));
+	ExpectSilence(dest, 0, 10);
+	ExpectSamples(dest, 10, 22, 64);
+}
+
+TEST_F(CARingBufferTest, FetchSlightlyAheadZeroesTheTrailingFrames)
+{
+	FillPastCapacity();
+
+	TestABL dest(kChannels, 32);
+	EXPECT_EQ(kCARingBufferError_SlightlyAhead, mRing.Fetch(dest.List(), 32, 296));
+	ExpectSamples(dest, 0, 24, 296);
+	ExpectSilence(dest, 24, 8);
+}
+
+TEST_F(CARingBufferTest, FetchWayAhead)
+{
+	FillPastCapacity();
+
+	TestABL dest(kChannels, 32);
+	EXPECT_EQ(kCARingBufferError_WayAhead, mRing.Fetch(dest.List(), 32, 400));
+}
+
+TEST_F(CARingBufferTest, FetchTooMuchZeroesBothEnds)
+{
+	FillPastCapacity();
+
+	TestABL dest(kChannels, kCapacity + 64);
+	EXPECT_EQ(kCARingBufferError_TooMuch, mRing.Fetch(dest.List(), kCapacity + 64, 32));
+	ExpectSilence(dest, 0, 32);
+	ExpectSamples(dest, 32, kCapacity, 64);
+	ExpectSilence(dest, 32 + kCapacity, 32);
+}
+
+TEST_F(CARingBufferTest, FetchScaledAcrossTheWrapPoint)
+{
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 10; ++i, t += kBlock)
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+
+	const Float32 kGains[][kChannels] = { { 0.5f, -2.0f }, { 1.0f, 0.0f } };
+	for (const Float32 *gains : kGains) {
+		TestABL dest(kChannels, 200);
+		ASSERT_EQ(kCARingBufferError_OK, mRing.FetchScaled(dest.List(), 200, t - 200, gains));
+		ExpectScaled(dest, 0, 200, t - 200, gains);
+		EXPECT_EQ(200 * sizeof(Float32), dest.List()->mBuffers[1].mDataByteSize);
+	}
+}
+
+TEST_F(CARingBufferTest, FetchMixAddsToWhatIsThere)
+{
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 10; ++i, t += kBlock)
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+
+	// two sources into one bus, the second a channel muted
+	const Float32 kFirst[kChannels] = { 0.5f, 0.25f }, kSecond[kChannels] = { 1.0f, 0.0f };
+	TestABL bus(kChannels, 200);
+	Set(bus, 200, 3.0f);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.FetchMix(bus.List(), 200, t - 200, kFirst));
+	ExpectScaled(bus, 0, 200, t - 200, kFirst, 3.0f);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.FetchMix(bus.List(), 200, t - 200, kSecond));
+	for (UInt32 i = 0; i < 200; ++i) {
+		ASSERT_EQ(3.0f + SampleValue(0, t - 200 + i) * 1.5f, bus.Sample(0, i)) << "frame " << i;
+		ASSERT_EQ(3.0f + SampleValue(1, t - 200 + i) * 0.25f, bus.Sample(1, i)) << "frame " << i;
+	}
+}
+
+TEST_F(CARingBufferTest, FetchScaledTooMuchZeroesBothEnds)
+{
+	FillPastCapacity();
+
+	const Float32 kGains[kChannels] = { 2.0f, -0.5f };
+	TestABL dest(kChannels, kCapacity + 64);
+	EXPECT_EQ(kCARingBufferError_TooMuch, mRing.FetchScaled(dest.List(), kCapacity + 64, 32, kGains));
+	ExpectSilence(dest, 0, 32);
+	ExpectScaled(dest, 32, kCapacity, 64, kGains);
+	ExpectSilence(dest, 32 + kCapacity, 32);
+}
+
+// what isn't in the ring is silence, and silence mixed in changes nothing
+TEST_F(CARingBufferTest, FetchMixTooMuchLeavesBothEnds)
+{
+	FillPastCapacity();
+
+	const Float32 kGains[kChannels] = { 2.0f, -0.5f };
+	TestABL dest(kChannels, kCapacity + 64);
+	Set(dest, kCapacity + 64, 7.0f);
+	EXPECT_EQ(kCARingBufferError_TooMuch, mRing.FetchMix(dest.List(), kCapacity + 64, 32, kGains));
+	ExpectConstant(dest, 0, 32, 7.0f);
+	ExpectScaled(dest, 32, kCapacity, 64, kGains, 7.0f);
+	ExpectConstant(dest, 32 + kCapacity, 32, 7.0f);
+
+	Set(dest, 64, 7.0f);
+	EXPECT_EQ(kCARingBufferError_WayAhead, mRing.FetchMix(dest.List(), 64, 1000, kGains));
+	ExpectConstant(dest, 0, 64, 7.0f);
+}
+
+TEST_F(CARingBufferTest, InPlaceStoreAndFetchAcrossTheWrapPoint)
+{
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 10; ++i, t += kBlock) {
+		ASSERT_EQ(kCARingBufferError_OK, StoreInPlace(t, kBlock));
+		ExpectSamplesInPlace(t, kBlock);
+	}
+	ExpectBounds(t - kCapacity, t);
+
+	TestABL dest(kChannels, kCapacity);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), kCapacity, t - kCapacity));
+	ExpectSamples(dest, 0, kCapacity, t - kCapacity);
+}
+
+TEST_F(CARingBufferTest, InPlaceStoreZeroesTheGap)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreInPlace(0, 200));
+	ASSERT_EQ(kCARingBufferError_OK, StoreInPlace(300, 32));
+	ExpectBounds(332 - kCapacity, 332);
+
+	TestABL dest(kChannels, 132);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 132, 200));
+	ExpectSilence(dest, 0, 100);
+	ExpectSamples(dest, 100, 32, 300);
+}
+
+TEST_F(CARingBufferTest, AbandonedStoreIsNotPublished)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, 64));
+
+	SpanABL head(kChannels), tail(kChannels);
+	UInt32 headFrames;
+	ASSERT_EQ(kCARingBufferError_OK, mRing.BeginStore(32, 64, head.List(), tail.List(), headFrames));
+	EXPECT_EQ(32u, headFrames);
+	EXPECT_EQ(0u, tail.List()->mBuffers[0].mDataByteSize);
+	ExpectBounds(0, 64);
+
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(64, 32));
+	ExpectSamplesInPlace(0, 96);
+}
+
+TEST_F(CARingBufferTest, InPlaceStoreLargerThanCapacityFails)
+{
+	SpanABL head(kChannels), tail(kChannels);
+	UInt32 headFrames = 1;
+	EXPECT_EQ(kCARingBufferError_TooMuch, mRing.BeginStore(kCapacity + 1, 0, head.List(), tail.List(), headFrames));
+	EXPECT_EQ(0u, headFrames);
+}
+
+TEST_F(CARingBufferTest, InPlaceFetchRequiresTheWholeRange)
+{
+	FillPastCapacity();
+
+	SpanABL head(kChannels), tail(kChannels);
+	UInt32 headFrames = 1;
+	EXPECT_EQ(kCARingBufferError_SlightlyBehind, mRing.BeginFetch(32, 54, head.List(), tail.List(), headFrames));
+	EXPECT_EQ(0u, headFrames);
+	EXPECT_EQ(kCARingBufferError_SlightlyAhead, mRing.BeginFetch(32, 296, head.List(), tail.List(), headFrames));
+	EXPECT_EQ(0u, headFrames);
+}
+
+TEST_F(CARingBufferTest, EndFetchDetectsOverwrite)
+{
+	FillPastCapacity();
+
+	SpanABL head(kChannels), tail(kChannels);
+	UInt32 headFrames;
+	ASSERT_EQ(kCARingBufferError_OK, mRing.BeginFetch(32, 64, head.List(), tail.List(), headFrames));
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(320, 32));
+	EXPECT_NE(kCARingBufferError_OK, mRing.EndFetch(32, 64));
+}
+
+TEST_F(CARingBufferInterleavedTest, InPlaceStoreAndFetchAcrossTheWrapPoint)
+{
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 10; ++i, t += kBlock) {
+		ASSERT_EQ(kCARingBufferError_OK, StoreInPlace(t, kBlock));
+		ExpectSamplesInPlace(t, kBlock);
+	}
+
+	TestABL dest(kChannels, kCapacity, mLayout);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), kCapacity, t - kCapacity));
+	ExpectSamples(dest, 0, kCapacity, t - kCapacity);
+}
+
+TEST_F(CARingBufferTest, PlacementOptionsKeepTheRingWorking)
+{
+	const UInt32 kOptions[] = {
+		CARingBuffer::kAllocateHugePages,
+		CARingBuffer::kAllocateLocked,
+		CARingBuffer::kAllocateHugePages | CARingBuffer::kAllocateLocked,
+		CARingBuffer::kAllocateMirrored | CARingBuffer::kAllocateHugePages | CARingBuffer::kAllocateLocked
+	};
+	for (UInt32 options : kOptions) {
+		SCOPED_TRACE(options);
+		mRing.Allocate(kChannels, sizeof(Float32), kCapacity, mLayout, options, 0);
+		EXPECT_EQ(0u, mRing.GetAllocationOptions() & ~options);
+		EXPECT_TRUE(mRing.GetNUMANode() == 0 || mRing.GetNUMANode() == -1);
+
+		const UInt32 capacity = mRing.GetCapacityFrames();
+		const UInt32 kBlock = capacity / 3 + 1;
+		TestABL dest(kChannels, kBlock);
+		for (CARingBuffer::SampleTime t = 0; t < 4 * capacity; t += kBlock) {
+			ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+			dest.Scribble();
+			ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), kBlock, t));
+			ExpectSamples(dest, 0, kBlock, t);
+		}
+	}
+}
+
+TEST_F(CARingBufferTest, PlainAllocationReportsNoOptions)
+{
+	EXPECT_EQ(0u, mRing.GetAllocationOptions());
+	EXPECT_EQ(-1, mRing.GetNUMANode());
+}
+
+TEST_F(CARingBufferInterleavedTest, StoreAndFetchAcrossTheWrapPoint)
+{
+	ASSERT_TRUE(mRing.IsInterleaved());
+
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 10; ++i, t += kBlock)
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+	ExpectBounds(t - kCapacity, t);
+
+	TestABL dest(kChannels, 200, mLayout);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 200, t - 200));
+	ExpectSamples(dest, 0, 200, t - 200);
+	EXPECT_EQ(200 * kChannels * sizeof(Float32), dest.List()->mBuffers[0].mDataByteSize);
+}
+
+// channels with gains of their own, and with one gain for them all
+TEST_F(CARingBufferInterleavedTest, FetchScaledAndMixAcrossTheWrapPoint)
+{
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 10; ++i, t += kBlock)
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+
+	const Float32 kGains[][kChannels] = { { 0.5f, -2.0f }, { 0.25f, 0.25f }, { 1.0f, 1.0f } };
+	for (const Float32 *gains : kGains) {
+		TestABL dest(kChannels, 200, mLayout);
+		ASSERT_EQ(kCARingBufferError_OK, mRing.FetchScaled(dest.List(), 200, t - 200, gains));
+		ExpectScaled(dest, 0, 200, t - 200, gains);
+		EXPECT_EQ(200 * kChannels * sizeof(Float32), dest.List()->mBuffers[0].mDataByteSize);
+
+		Set(dest, 200, 1.0f);
+		ASSERT_EQ(kCARingBufferError_OK, mRing.FetchMix(dest.List(), 200, t - 200, gains));
+		ExpectScaled(dest, 0, 200, t - 200, gains, 1.0f);
+	}
+}
+
+TEST_F(CARingBufferInterleavedTest, GapIsFilledWithSilence)
+{
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, 200));
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(300, 32));
+
+	TestABL dest(kChannels, 132, mLayout);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 132, 200));
+	ExpectSilence(dest, 0, 100);
+	ExpectSamples(dest, 100, 32, 300);
+}
+
+TEST_F(CARingBufferInterleavedTest, FetchTooMuchZeroesBothEnds)
+{
+	FillPastCapacity();
+
+	TestABL dest(kChannels, kCapacity + 64, mLayout);
+	EXPECT_EQ(kCARingBufferError_TooMuch, mRing.Fetch(dest.List(), kCapacity + 64, 32));
+	ExpectSilence(dest, 0, 32);
+	ExpectSamples(dest, 32, kCapacity, 64);
+	ExpectSilence(dest, 32 + kCapacity, 32);
+}
+
+TEST_P(CARingBufferMirroredTest, CapacityIsWholePages)
+{
+	const UInt32 bytesPerFrame = sizeof(Float32) * (mRing.IsInterleaved() ? kChannels : 1);
+	EXPECT_GE(mCapacityFrames, kCapacity);
+	EXPECT_EQ(0u, mCapacityFrames & (mCapacityFrames - 1));
+	EXPECT_EQ(0u, mCapacityFrames * bytesPerFrame % CARingBufferPageSize());
+}
+
+TEST_P(CARingBufferMirroredTest, StoreAndFetchAcrossTheWrapPoint)
+{
+	// misaligned block size so that stores and fetches keep landing across the end of the buffer
+	const UInt32 kBlock = mCapacityFrames / 3 + 1;
+	TestABL dest(kChannels, kBlock, mLayout);
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 20; ++i, t += kBlock) {
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+		dest.Scribble();
+		ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), kBlock, t));
+		ExpectSamples(dest, 0, kBlock, t);
+	}
+	ExpectBounds(t - mCapacityFrames, t);
+
+	TestABL all(kChannels, mCapacityFrames, mLayout);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(all.List(), mCapacityFrames, t - mCapacityFrames));
+	ExpectSamples(all, 0, mCapacityFrames, t - mCapacityFrames);
+}
+
+TEST_P(CARingBufferMirroredTest, FetchMixAcrossTheWrapPoint)
+{
+	const UInt32 kBlock = mCapacityFrames / 3 + 1;
+	const Float32 kGains[kChannels] = { 0.5f, -1.0f };
+	TestABL dest(kChannels, kBlock, mLayout);
+	CARingBuffer::SampleTime t = 0;
+	for (int i = 0; i < 20; ++i, t += kBlock) {
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, kBlock));
+		Set(dest, kBlock, 2.0f);
+		ASSERT_EQ(kCARingBufferError_OK, mRing.FetchMix(dest.List(), kBlock, t, kGains));
+		ExpectScaled(dest, 0, kBlock, t, kGains, 2.0f);
+	}
+}
+
+TEST_P(CARingBufferMirroredTest, GapAcrossTheWrapPointIsFilledWithSilence)
+{
+	const UInt32 kFirst = mCapacityFrames - 56;
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, kFirst));
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(kFirst + 100, 32));
+
+	TestABL dest(kChannels, 132, mLayout);
+	ASSERT_EQ(kCARingBufferError_OK, mRing.Fetch(dest.List(), 132, kFirst));
+	ExpectSilence(dest, 0, 100);
+	ExpectSamples(dest, 100, 32, kFirst + 100);
+}
+
+TEST_P(CARingBufferMirroredTest, FetchTooMuchZeroesBothEnds)
+{
+	for (CARingBuffer::SampleTime t = 0; t < CARingBuffer::SampleTime(mCapacityFrames) + 64; t += 64)
+		ASSERT_EQ(kCARingBufferError_OK, StoreAt(t, 64));
+	ExpectBounds(64, mCapacityFrames + 64);
+
+	TestABL dest(kChannels, mCapacityFrames + 64, mLayout);
+	EXPECT_EQ(kCARingBufferError_TooMuch, mRing.Fetch(dest.List(), mCapacityFrames + 64, 32));
+	ExpectSilence(dest, 0, 32);
+	ExpectSamples(dest, 32, mCapacityFrames, 64);
+	ExpectSilence(dest, 32 + mCapacityFrames, 32);
+}
+
+TEST_P(CARingBufferMirroredTest, InPlaceSpansNeverWrap)
+{
+	const UInt32 kBlock = 100;
+	CARingBuffer::SampleTime t = mCapacityFrames - kBlock / 2;
+	ASSERT_EQ(kCARingBufferError_OK, StoreAt(0, 1));	// start the ring somewhere before t
+	ASSERT_EQ(kCARingBufferError_OK, StoreInPlace(t, kBlock));
+
+	SpanABL head(kChannels), tail(kChannels);
+	UInt32 headFrames;
+	ASSERT_EQ(kCARingBufferError_OK, mRing.BeginFetch(kBlock, t, head.List(), tail.List(), headFrames));
+	EXPECT_EQ(kBlock, headFrames);
+	EXPECT_EQ(0u, tail.List()->mBuffers[0].mDataByteSize);
+	ExpectSamplesInPlace(t, kBlock);
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, CARingBufferMirroredTest, ::testing::Values(CARingBuffer::kDeinterleaved, CARingBuffer::kInterleaved),
+	[](const ::testing::TestParamInfo<CARingBuffer::Layout> &info) { return info.param == CARingBuffer::kInterleaved ? "Interleaved" : "Deinterleaved"; });
@@ -0,0 +1,213 @@
+/*=============================================================================
+	CASampleConversionTests.cpp
+
+=============================================================================*/
+
+#include "CASampleConversion.h"
+#include "CARingBuffer.h"
+#include "TestAudioBufferList.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+// odd length so that every kernel also runs its scalar tail
+const UInt32 kSamples = 1027;
+
+std::vector<Float32> TestSignal()
+{
+	std::vector<Float32> x(kSamples);
+	srand(1);
+	for (UInt32 i = 0; i < kSamples; ++i)
+		x[i] = (Float32(rand()) / RAND_MAX) * 2.4f - 1.2f;	// includes values that must clip
+	x[0] = 1.0f;
+	x[1] = -1.0f;
+	x[2] = 0.0f;
+	x[3] = 0.5f / 32768.0f;		// exactly half an Int16 step: rounds to even
+	x[4] = 1.5f / 32768.0f;
+	return x;
+}
+
+std::vector<CASampleConversionISA> AvailableISAs()
+{
+	std::vector<CASampleConversionISA> isas;
+	for (int isa = 0; isa < kCASampleConversionISA_Count; ++isa)
+		if (CAGetSampleConverter(CASampleConversionISA(isa)))
+			isas.push_back(CASampleConversionISA(isa));
+	return isas;
+}
+
+} // namespace
+
+TEST(CASampleConversionTest, ScalarKnownValues)
+{
+	const CASampleConverter *scalar = CAGetSampleConverter(kCASampleConversionISA_Scalar);
+	ASSERT_TRUE(scalar != NULL);
+
+	std::vector<Float32> x = TestSignal();
+	SInt16 i16[8];
+	scalar->mFromFloat32[kCASampleFormat_Int16](&x[0], i16, 5);
+	EXPECT_EQ(32767, i16[0]);
+	EXPECT_EQ(-32768, i16[1]);
+	EXPECT_EQ(0, i16[2]);
+	EXPECT_EQ(0, i16[3]);
+	EXPECT_EQ(2, i16[4]);
+
+	Byte i24[3];
+	Float32 minusOne = -1.0f;
+	scalar->mFromFloat32[kCASampleFormat_Int24](&minusOne, i24, 1);
+	EXPECT_EQ(0x00, i24[0]);
+	EXPECT_EQ(0x00, i24[1]);
+	EXPECT_EQ(0x80, i24[2]);
+
+	Float32 back;
+	scalar->mToFloat32[kCASampleFormat_Int24](i24, &back, 1);
+	EXPECT_EQ(-1.0f, back);
+
+	SInt32 i32;
+	Float32 plusOne = 1.0f;
+	scalar->mFromFloat32[kCASampleFormat_Int32](&plusOne, &i32, 1);
+	EXPECT_EQ(2147483520, i32);
+}
+
+TEST(CASampleConversionTest, EveryKernelMatchesScalar)
+{
+	const CASampleConverter *scalar = CAGetSampleConverter(kCASampleConversionISA_Scalar);
+	std::vector<Float32> x = TestSignal();
+
+	for (CASampleConversionISA isa : AvailableISAs()) {
+		const CASampleConverter *converter = CAGetSampleConverter(isa);
+		for (int format = 0; format < kCASampleFormat_Count; ++format) {
+			SCOPED_TRACE(std::string(converter->mName) + " format " + std::to_string(format));
+			UInt32 bytes = CASampleFormatBytes(CASampleFormat(format));
+			std::vector<Byte> expected(kSamples * bytes), actual(kSamples * bytes, 0xAA);
+			scalar->mFromFloat32[format](&x[0], &expected[0], kSamples);
+			converter->mFromFloat32[format](&x[0], &actual[0], kSamples);
+			EXPECT_EQ(0, memcmp(&expected[0], &actual[0], expected.size()));
+
+			std::vector<Float32> expectedBack(kSamples), actualBack(kSamples, kGarbage);
+			scalar->mToFloat32[format](&expected[0], &expectedBack[0], kSamples);
+			converter->mToFloat32[format](&expected[0], &actualBack[0], kSamples);
+			EXPECT_EQ(0, memcmp(&expectedBack[0], &actualBack[0], kSamples * sizeof(Float32)));
+		}
+	}
+}
+
+TEST(CASampleConversionTest, KernelsDoNotWritePastTheEnd)
+{
+	std::vector<Float32> x = TestSignal();
+	for (CASampleConversionISA isa : AvailableISAs()) {
+		const CASampleConverter *converter = CAGetSampleConverter(isa);
+		for (UInt32 n = 0; n < 40; ++n) {
+			for (int format = 0; format < kCASampleFormat_Count; ++format) {
+				UInt32 bytes = CASampleFormatBytes(CASampleFormat(format));
+				std::vector<Byte> out((n + 8) * bytes, 0xAA);
+				converter->mFromFloat32[format](&x[0], &out[0], n);
+				for (size_t i = n * bytes; i < out.size(); ++i)
+					ASSERT_EQ(0xAA, out[i]) << converter->mName << " format " << format << " n " << n;
+
+				std::vector<Float32> back(n + 8, kGarbage);
+				converter->mToFloat32[format](&out[0], &back[0], n);
+				for (size_t i = n; i < back.size(); ++i)
+					ASSERT_EQ(kGarbage, back[i]) << converter->mName << " format " << format << " n " << n;
+			}
+		}
+	}
+}
+
+TEST(CASampleConversionTest, GainKernelsMatchScalar)
+{
+	const CASampleConverter *scalar = CAGetSampleConverter(kCASampleConversionISA_Scalar);
+	std::vector<Float32> x = TestSignal();
+	std::vector<Float32> bus(kSamples);
+	for (UInt32 i = 0; i < kSamples; ++i)
+		bus[i] = x[kSamples - 1 - i];
+
+	for (CASampleConversionISA isa : AvailableISAs()) {
+		const CASampleConverter *converter = CAGetSampleConverter(isa);
+		SCOPED_TRACE(converter->mName);
+		std::vector<Float32> expected(kSamples), actual(kSamples, kGarbage);
+		scalar->mScale(&x[0], &expected[0], 0.7f, kSamples);
+		converter->mScale(&x[0], &actual[0], 0.7f, kSamples);
+		EXPECT_EQ(0, memcmp(&expected[0], &actual[0], kSamples * sizeof(Float32)));
+
+		expected = bus;
+		actual = bus;
+		scalar->mMix(&x[0], &expected[0], -0.3f, kSamples);
+		converter->mMix(&x[0], &actual[0], -0.3f, kSamples);
+		for (UInt32 i = 0; i < kSamples; ++i)
+			ASSERT_FLOAT_EQ(expected[i], actual[i]) << "sample " << i;
+
+		// and neither writes past the end
+		for (UInt32 n = 0; n < 40; ++n) {
+			std::vector<Float32> out(n + 8, kGarbage);
+			converter->mScale(&x[0], &out[0], 2.0f, n);
+			converter->mMix(&x[0], &out[0], 2.0f, n);
+			for (size_t i = n; i < out.size(); ++i)
+				ASSERT_EQ(kGarbage, out[i]) << "n " << n;
+		}
+	}
+}
+
+TEST(CASampleConversionTest, RingStoresInInt16AndFetchesFloat32)
+{
+	for (CARingBuffer::Layout layout : { CARingBuffer::kDeinterleaved, CARingBuffer::kInterleaved }) {
+		CARingBuffer ring;
+		ring.Allocate(2, kCASampleFormat_Int16, 256, layout);
+
+		// values on the Int16 grid survive the round trip exactly
+		TestABL src(2, 200, layout), dest(2, 264, layout);
+		for (int ch = 0; ch < 2; ++ch)
+			for (UInt32 i = 0; i < 200; ++i)
+				src.Sample(ch, i) = Float32(SInt32(i * 100 + ch) - 10000) / 32768.0f;
+
+		// two stores so that the second one wraps
+		ASSERT_EQ(kCARingBufferError_OK, ring.Store(src.List(), 200, 0));
+		ASSERT_EQ(kCARingBufferError_OK, ring.Store(src.List(), 200, 200));
+
+		// reads past the end to exercise the zeroed tail in Float32 units
+		ASSERT_EQ(kCARingBufferError_SlightlyAhead, ring.Fetch(dest.List(), 264, 200));
+		for (int ch = 0; ch < 2; ++ch) {
+			for (UInt32 i = 0; i < 200; ++i)
+				ASSERT_EQ(src.Sample(ch, i), dest.Sample(ch, i));
+			for (UInt32 i = 200; i < 264; ++i)
+				ASSERT_EQ(0.0f, dest.Sample(ch, i));
+		}
+	}
+}
+
+// Through Float32 a chunk at a time: more samples than a chunk, and split at the wrap.
+TEST(CASampleConversionTest, RingFetchesInt16WithGains)
+{
+	const Float32 kGains[2] = { 0.5f, -3.0f };
+	for (CARingBuffer::Layout layout : { CARingBuffer::kDeinterleaved, CARingBuffer::kInterleaved }) {
+		CARingBuffer ring;
+		ring.Allocate(2, kCASampleFormat_Int16, 1024, layout);
+
+		TestABL src(2, 700, layout), dest(2, 760, layout);
+		for (int ch = 0; ch < 2; ++ch)
+			for (UInt32 i = 0; i < 700; ++i)
+				src.Sample(ch, i) = Float32(SInt32(i * 40 + ch) - 14000) / 32768.0f;
+		ASSERT_EQ(kCARingBufferError_OK, ring.Store(src.List(), 700, 0));
+		ASSERT_EQ(kCARingBufferError_OK, ring.Store(src.List(), 700, 700));
+
+		ASSERT_EQ(kCARingBufferError_SlightlyAhead, ring.FetchScaled(dest.List(), 760, 700, kGains));
+		for (int ch = 0; ch < 2; ++ch) {
+			for (UInt32 i = 0; i < 700; ++i)
+				ASSERT_EQ(src.Sample(ch, i) * kGains[ch], dest.Sample(ch, i)) << layout << " channel " << ch << " frame " << i;
+			for (UInt32 i = 700; i < 760; ++i)
+				ASSERT_EQ(0.0f, dest.Sample(ch, i));
+		}
+
+		for (int ch = 0; ch < 2; ++ch)
+			for (UInt32 i = 0; i < 760; ++i)
+				dest.Sample(ch, i) = 0.25f;
+		ASSERT_EQ(kCARingBufferError_OK, ring.FetchMix(dest.List(), 700, 700, kGains));
+		for (int ch = 0; ch < 2; ++ch)
+			for (UInt32 i = 0; i < 700; ++i)
+				ASSERT_EQ(0.25f + src.Sample(ch, i) * kGains[ch], dest.Sample(ch, i)) << layout << " channel " << ch << " frame " << i;
+	}
+}
@@ -0,0 +1,116 @@
+/*=============================================================================
+	CASimulatedBackendTests.cpp
+
+	CAPlayThroughEngine driven by CASimulatedBackend.
+=============================================================================*/
+
+#include "CAPlayThroughEngine.h"
+#include "CASimulatedBackend.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// Engine and backend wired together, as CAPlayThrough wires the engine to the real devices.
+struct SimulatedPlayThrough {
+	SimulatedPlayThrough(const CASimulatedDeviceConfig &input, const CASimulatedDeviceConfig &output, UInt32 seed = 1) :
+		mBackend(input, output, seed), mEngine(mBackend)
+	{
+		mEngine.Allocate(input.mChannels, output.mChannels);
+		mEngine.ComputeThruOffset();
+		mBackend.SetClient(&mEngine);
+	}
+
+	CASimulatedBackendStats Stats()
+	{
+		CASimulatedBackendStats stats;
+		mBackend.GetStats(stats);
+		return stats;
+	}
+
+	CASimulatedBackend	mBackend;
+	CAPlayThroughEngine	mEngine;
+};
+
+} // namespace
+
+TEST(CASimulatedBackendTest, MatchedClocksPlayThroughCleanly)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mSafetyOffset = 32;
+	output.mSafetyOffset = 24;
+	output.mStartSampleTime = 123456;	// the devices' sample times have nothing to do with each other
+
+	SimulatedPlayThrough sim(input, output);
+	sim.mBackend.Run(10.0);
+
+	CASimulatedBackendStats stats = sim.Stats();
+	EXPECT_NEAR(10.0 * 48000 / 512, stats.mInputCallbacks, 2);
+	EXPECT_NEAR(10.0 * 48000 / 512, stats.mOutputCallbacks, 2);
+	EXPECT_EQ(0u, stats.mDropouts);
+	EXPECT_EQ(0u, stats.mDiscontinuities);
+	EXPECT_NEAR(1.0, stats.mLastRate, 1e-5);
+
+	// at least the safety offsets and a buffer on each side, and steady
+	EXPECT_GE(stats.mLatencyMin, (512 + 32 + 512 + 24) / 48000.0);
+	EXPECT_LT(stats.mLatencyMax, 4 * 1024 / 48000.0);
+	EXPECT_NEAR(stats.mLatencyMin, stats.mLatencyMax, 1.5 / 48000);	// to within the varispeed's rounding
+}
+
+TEST(CASimulatedBackendTest, VarispeedFollowsTheClocks)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mDriftPPM = 50;
+	output.mDriftPPM = -50;
+
+	SimulatedPlayThrough sim(input, output);
+	sim.mBackend.Run(30.0);
+
+	// on average the varispeed consumes input exactly as fast as it arrives
+	CASimulatedBackendStats stats = sim.Stats();
+	EXPECT_NEAR(1.00005 / 0.99995, Float64(stats.mFramesPlayed) / (stats.mOutputCallbacks * 512), 2e-6);
+	EXPECT_NEAR(1.00005 / 0.99995, stats.mLastRate, 2e-5);
+}
+
+TEST(CASimulatedBackendTest, OfflineRunsAreRepeatable)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mJitterSeconds = 0.002;
+	output.mJitterSeconds = 0.002;
+	output.mBufferSizeFrames = 256;
+	output.mDriftPPM = 200;
+
+	CASimulatedBackendStats stats[2];
+	for (int i = 0; i < 2; ++i) {
+		SimulatedPlayThrough sim(input, output, 42);
+		sim.mBackend.Run(5.0);
+		stats[i] = sim.Stats();
+	}
+	EXPECT_EQ(stats[0].mOutputCallbacks, stats[1].mOutputCallbacks);
+	EXPECT_EQ(stats[0].mFramesPlayed, stats[1].mFramesPlayed);
+	EXPECT_EQ(stats[0].mSilentFrames, stats[1].mSilentFrames);
+	EXPECT_EQ(stats[0].mDiscontinuities, stats[1].mDiscontinuities);
+	EXPECT_EQ(stats[0].mLatencyMean, stats[1].mLatencyMean);
+}
+
+TEST(CASimulatedBackendTest, RunsInRealTime)
+{
+	CASimulatedDeviceConfig input = CASimulatedBackend::DefaultDeviceConfig();
+	CASimulatedDeviceConfig output = CASimulatedBackend::DefaultDeviceConfig();
+	input.mBufferSizeFrames = 256;
+	output.mBufferSizeFrames = 256;
+
+	SimulatedPlayThrough sim(input, output);
+	ASSERT_EQ(noErr, sim.mBackend.Start());
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	ASSERT_EQ(noErr, sim.mBackend.Stop());
+
+	CASimulatedBackendStats stats = sim.Stats();
+	EXPECT_GT(stats.mInputCallbacks, 40u);
+	EXPECT_GT(stats.mOutputCallbacks, 40u);
+	EXPECT_GT(stats.mFramesPlayed - stats.mSilentFrames, 0u);
+	EXPECT_EQ(0u, stats.mDiscontinuities);
+}
@@ -0,0 +1,92 @@
+/*=============================================================================
+	TestAudioBufferList.h
+
+	Helpers shared by the unit tests.
+=============================================================================*/
+
+#ifndef __TestAudioBufferList_h__
+#define __TestAudioBufferList_h__
+
+#include "CARingBuffer.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+static const Float32 kGarbage = -1.0f;
+
+// sample value stored for a given channel and sample time, exact in a Float32
+inline Float32 SampleValue(int channel, CARingBuffer::SampleTime t)
+{
+	return Float32((t & 0xFFFF) + 1 + channel * 0x10000);
+}
+
+// A Float32 AudioBufferList that owns its memory, either one buffer per channel or
+// a single interleaved buffer.
+class TestABL {
+public:
+	TestABL(int nChannels, UInt32 nFrames, CARingBuffer::Layout layout = CARingBuffer::kDeinterleaved) :
+		mChannels(nChannels), mFrames(nFrames), mInterleaved(layout == CARingBuffer::kInterleaved), mStorage(nChannels * nFrames, kGarbage)
+	{
+		int nBuffers = mInterleaved ? 1 : nChannels;
+		mList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nBuffers);
+		mList->mNumberBuffers = nBuffers;
+		for (int i = 0; i < nBuffers; ++i) {
+			mList->mBuffers[i].mNumberChannels = mInterleaved ? nChannels : 1;
+			mList->mBuffers[i].mDataByteSize = nFrames * sizeof(Float32) * mList->mBuffers[i].mNumberChannels;
+			mList->mBuffers[i].mData = &mStorage[i * nFrames];
+		}
+	}
+	~TestABL() { free(mList); }
+
+	TestABL(const TestABL &) = delete;
+	TestABL &operator=(const TestABL &) = delete;
+
+	AudioBufferList *	List() { return mList; }
+	Float32 *			Channel(int i) { return &mStorage[i * mFrames]; }	// deinterleaved only
+	Float32 &			Sample(int ch, UInt32 frame) { return mInterleaved ? mStorage[frame * mChannels + ch] : mStorage[ch * mFrames + frame]; }
+
+	void Fill(CARingBuffer::SampleTime startTime)
+	{
+		for (int ch = 0; ch < mChannels; ++ch)
+			for (UInt32 i = 0; i < mFrames; ++i)
+				Sample(ch, i) = SampleValue(ch, startTime + i);
+	}
+
+	void Scribble() { std::fill(mStorage.begin(), mStorage.end(), kGarbage); }
+
+private:
+	int						mChannels;
+	UInt32					mFrames;
+	bool					mInterleaved;
+	std::vector<Float32>	mStorage;
+	AudioBufferList *		mList;
+};
+
+// An AudioBufferList without storage of its own, for CARingBuffer's zero-copy spans.
+class SpanABL {
+public:
+	explicit SpanABL(int nBuffers)
+	{
+		mList = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers[0]) + sizeof(AudioBuffer) * nBuffers);
+		mList->mNumberBuffers = nBuffers;
+	}
+	~SpanABL() { free(mList); }
+
+	SpanABL(const SpanABL &) = delete;
+	SpanABL &operator=(const SpanABL &) = delete;
+
+	AudioBufferList *	List() { return mList; }
+	Float32 &			Sample(int ch, UInt32 frame)	// works for both layouts
+	{
+		AudioBuffer &buf = mList->mBuffers[mList->mNumberBuffers == 1 ? 0 : ch];
+		UInt32 channel = (buf.mNumberChannels == 1) ? 0 : ch;
+		return ((Float32 *)buf.mData)[frame * buf.mNumberChannels + channel];
+	}
+
+private:
+	AudioBufferList *	mList;
+};
+
+#endif // __TestAudioBufferList_h__